@@ -22,13 +22,14 @@
 #include "aide.h"
 #include "dict.h"
 #include "dictparser.h"
-#include "parray.h"
+#include "log.h"
 #include <dirent.h>
 #include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+/* Written once by aide_init(), only read afterwards, from any thread */
 static dict_t **_dicts = NULL;
 
 static int _get_dict_path(char **output)
@@ -169,9 +170,7 @@ int _open_dict(dict_t **dict, const char *path)
 	dict_parser_t *parser;
 	int err;
 
-#if MXIM_DEBUG
-	fprintf(stderr, "Opening dict: %s\n", path);
-#endif /* MXIM_DEBUG */
+	log_debug("Opening dict: %s", path);
 
 	if ((err = dict_parser_new(&parser, path)) < 0) {
 		return err;
@@ -197,7 +196,7 @@ int aide_init(void)
 		dict_t *dict;
 
 		if ((err = _open_dict(&dict, dict_paths[i])) < 0) {
-			fprintf(stderr, "Could not open dict `%s': %s\n", dict_paths[i], strerror(-err));
+			log_warn("Could not open dict `%s': %s", dict_paths[i], strerror(-err));
 			continue;
 		}
 
@@ -210,45 +209,182 @@ int aide_init(void)
 	return 0;
 }
 
-static int _cmp_candidate_priority(const dict_candidate_t *a,
-                                   const dict_candidate_t *b)
+/* Initial number of suggestions that aide_suggest() makes room for */
+#define AIDE_SUGGESTIONS_MIN 32
+
+/*
+ * A candidate with the priority it had when it was suggested. Priorities
+ * may be changed by other threads at any time, so they are read only once.
+ */
+struct suggestion {
+	dict_candidate_t *candidate;
+	int priority;
+	int order;
+};
+
+static int _cmp_suggestion(const void *left, const void *right)
+{
+	const struct suggestion *a = left;
+	const struct suggestion *b = right;
+
+	/* equally good candidates stay in the order of the dicts */
+	if (a->priority != b->priority) {
+		return a->priority < b->priority ? 1 : -1;
+	}
+
+	return a->order - b->order;
+}
+
+int aide_iter_init(aide_iter_t *iter, const char_t *key)
+{
+	int err;
+
+	if (!iter || !key) {
+		return -EINVAL;
+	}
+
+	iter->key = key;
+	iter->dict = 0;
+	iter->entries = 0;
+	iter->entry = NULL;
+	iter->candidate = 0;
+
+	if (_dicts && _dicts[0] &&
+	    (err = dict_iter_init(&iter->dict_iter, _dicts[0], key)) < 0) {
+		return err;
+	}
+
+	return 0;
+}
+
+static int _aide_iter_next_entry(aide_iter_t *iter)
+{
+	int err;
+
+	while (_dicts && _dicts[iter->dict]) {
+		if (iter->entries < AIDE_ENTRIES_MAX) {
+			if ((err = dict_iter_next(&iter->dict_iter, &iter->entry)) == 0) {
+				iter->entries++;
+				iter->candidate = 0;
+				return 0;
+			}
+
+			if (err != -ENOENT) {
+				return err;
+			}
+		}
+
+		dict_iter_fini(&iter->dict_iter);
+		iter->entries = 0;
+
+		if (!_dicts[++iter->dict]) {
+			break;
+		}
+
+		if ((err = dict_iter_init(&iter->dict_iter, _dicts[iter->dict], iter->key)) < 0) {
+			return err;
+		}
+	}
+
+	iter->entry = NULL;
+	return -ENOENT;
+}
+
+/* Returns -ENOENT once there are no more candidates */
+int aide_iter_next(aide_iter_t *iter, dict_candidate_t **candidate)
+{
+	int err;
+
+	if (!iter || !candidate) {
+		return -EINVAL;
+	}
+
+	while (!iter->entry || iter->candidate >= iter->entry->num_candidates) {
+		if ((err = _aide_iter_next_entry(iter)) < 0) {
+			return err;
+		}
+	}
+
+	*candidate = iter->entry->candidates[iter->candidate++];
+	return 0;
+}
+
+void aide_iter_fini(aide_iter_t *iter)
 {
-	return b->priority - a->priority;
+	if (iter && _dicts && _dicts[iter->dict]) {
+		dict_iter_fini(&iter->dict_iter);
+	}
 }
 
+/* Returns all candidates for a key, best first, in a NULL-terminated array */
 int aide_suggest(const char_t *key, dict_candidate_t ***suggestions)
 {
-	parray_t *parray;
-	dict_entry_t **entries;
+	struct suggestion *found;
+	dict_candidate_t **result;
+	dict_candidate_t *candidate;
+	aide_iter_t iter;
+	int num_found;
+	int size;
 	int err;
 	int i;
 
-	parray = NULL;
-	entries = NULL;
+	if (!suggestions) {
+		return -EINVAL;
+	}
 
-	if ((err = parray_new(&parray, (int(*)(const void*, const void*))_cmp_candidate_priority)) < 0) {
-		goto cleanup;
+	found = NULL;
+	num_found = 0;
+	size = 0;
+
+	if ((err = aide_iter_init(&iter, key)) < 0) {
+		return err;
 	}
 
-	for (i = 0; _dicts[i]; i++) {
-		int j;
+	/* collected first and sorted once */
+	while ((err = aide_iter_next(&iter, &candidate)) == 0) {
+		if (num_found == size) {
+			struct suggestion *grown;
 
-		if ((err = dict_lookup(_dicts[i], key, &entries)) < 0) {
-			continue;
-		}
+			size = size ? size * 2 : AIDE_SUGGESTIONS_MIN;
 
-		for (j = 0; entries[j] && j < 10; j++) {
-			parray_insert(parray, (const void**)entries[j]->candidates,
-			              entries[j]->num_candidates);
+			if (!(grown = realloc(found, size * sizeof(*found)))) {
+				err = -ENOMEM;
+				break;
+			}
+
+			found = grown;
 		}
+
+		found[num_found].candidate = candidate;
+		found[num_found].priority = __atomic_load_n(&candidate->priority, __ATOMIC_RELAXED);
+		found[num_found].order = num_found;
+		num_found++;
 	}
 
-	err = parray_get_items(parray, (const void***)suggestions);
+	aide_iter_fini(&iter);
 
-cleanup:
-	parray_free(&parray);
-	/* only free the array, not the items that it points to */
-	free(entries);
+	if (err != -ENOENT) {
+		goto cleanup;
+	}
+
+	if (!(result = malloc((num_found + 1) * sizeof(*result)))) {
+		err = -ENOMEM;
+		goto cleanup;
+	}
 
+	if (num_found > 1) {
+		qsort(found, num_found, sizeof(*found), _cmp_suggestion);
+	}
+
+	for (i = 0; i < num_found; i++) {
+		result[i] = found[i].candidate;
+	}
+	result[num_found] = NULL;
+
+	*suggestions = result;
+	err = 0;
+
+cleanup:
+	free(found);
 	return err;
 }
@@ -24,7 +24,26 @@
 #include "char.h"
 #include "dict.h"
 
+/* Number of entries per dict, best first, whose candidates are suggested */
+#define AIDE_ENTRIES_MAX 10
+
+/* Candidates for a key, fetched from the dicts as they are needed */
+typedef struct {
+	const char_t *key;
+	int dict;
+	int entries;
+
+	dict_iter_t dict_iter;
+	dict_entry_t *entry;
+	size_t candidate;
+} aide_iter_t;
+
 int aide_init(void);
+
+int aide_iter_init(aide_iter_t *iter, const char_t *key);
+int aide_iter_next(aide_iter_t *iter, dict_candidate_t **candidate);
+void aide_iter_fini(aide_iter_t *iter);
+
 int aide_suggest(const char_t *key, dict_candidate_t ***suggestions);
 
 #endif /* AIDE_H */
@@ -0,0 +1,199 @@
+/*
+ * arena.c - This file is part of mxim
+ * Copyright (C) 2025 Matthias Kruk
+ *
+ * Mxim is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation; either version 3, or (at your
+ * option) any later version.
+ *
+ * Mxim is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Mxim; see the file COPYING.  If not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include "arena.h"
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ARENA_ALIGN sizeof(max_align_t)
+#define ARENA_ALIGN_UP(n) (((n) + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1))
+
+struct arena_block {
+	struct arena_block *next;
+	size_t size;
+	size_t used;
+	max_align_t data[];
+};
+
+struct arena {
+	/* the block that allocations are served from, followed by full ones */
+	struct arena_block *blocks;
+
+	/* bytes handed out since the last reset */
+	size_t used;
+};
+
+static struct arena_block* _arena_block_new(const size_t size)
+{
+	struct arena_block *block;
+
+	if ((block = malloc(sizeof(*block) + size))) {
+		block->next = NULL;
+		block->size = size;
+		block->used = 0;
+	}
+
+	return block;
+}
+
+static void _arena_blocks_free(struct arena_block *block)
+{
+	while (block) {
+		struct arena_block *next;
+
+		next = block->next;
+		free(block);
+		block = next;
+	}
+}
+
+int arena_new(arena_t **arena, const size_t size)
+{
+	arena_t *a;
+
+	if (!arena || !size) {
+		return -EINVAL;
+	}
+
+	if (!(a = calloc(1, sizeof(*a)))) {
+		return -ENOMEM;
+	}
+
+	if (!(a->blocks = _arena_block_new(ARENA_ALIGN_UP(size)))) {
+		free(a);
+		return -ENOMEM;
+	}
+
+	*arena = a;
+	return 0;
+}
+
+int arena_free(arena_t **arena)
+{
+	if (!arena || !*arena) {
+		return -EINVAL;
+	}
+
+	_arena_blocks_free((*arena)->blocks);
+	free(*arena);
+	*arena = NULL;
+
+	return 0;
+}
+
+void* arena_alloc(arena_t *arena, const size_t size)
+{
+	struct arena_block *block;
+	size_t aligned_size;
+	void *ptr;
+
+	if (!arena) {
+		return NULL;
+	}
+
+	aligned_size = ARENA_ALIGN_UP(size ? size : 1);
+	block = arena->blocks;
+
+	if (block->size - block->used < aligned_size) {
+		size_t block_size;
+
+		/* the newest block is always the largest one */
+		block_size = arena->blocks->size;
+		while (block_size < aligned_size) {
+			block_size *= 2;
+		}
+
+		if (!(block = _arena_block_new(block_size))) {
+			return NULL;
+		}
+
+		block->next = arena->blocks;
+		arena->blocks = block;
+	}
+
+	ptr = (uint8_t*)block->data + block->used;
+	block->used += aligned_size;
+	arena->used += aligned_size;
+
+	return ptr;
+}
+
+void* arena_calloc(arena_t *arena, const size_t nmemb, const size_t size)
+{
+	void *ptr;
+
+	if (size && nmemb > SIZE_MAX / size) {
+		return NULL;
+	}
+
+	if ((ptr = arena_alloc(arena, nmemb * size))) {
+		memset(ptr, 0, nmemb * size);
+	}
+
+	return ptr;
+}
+
+char* arena_strndup(arena_t *arena, const char *str, const size_t len)
+{
+	char *dup;
+
+	if (!str) {
+		return NULL;
+	}
+
+	if ((dup = arena_alloc(arena, len + 1))) {
+		memcpy(dup, str, len);
+		dup[len] = 0;
+	}
+
+	return dup;
+}
+
+int arena_reset(arena_t *arena)
+{
+	struct arena_block *block;
+
+	if (!arena) {
+		return -EINVAL;
+	}
+
+	if (arena->blocks->next) {
+		/*
+		 * The arena overflowed since the last reset. Replace the blocks
+		 * with one that is large enough so that the next time around
+		 * no more blocks need to be allocated.
+		 */
+		if ((block = _arena_block_new(ARENA_ALIGN_UP(arena->used)))) {
+			_arena_blocks_free(arena->blocks);
+			arena->blocks = block;
+		} else {
+			/* keep the largest block, which was allocated last */
+			_arena_blocks_free(arena->blocks->next);
+			arena->blocks->next = NULL;
+		}
+	}
+
+	arena->blocks->used = 0;
+	arena->used = 0;
+
+	return 0;
+}
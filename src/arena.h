@@ -0,0 +1,37 @@
+/*
+ * arena.h - This file is part of mxim
+ * Copyright (C) 2025 Matthias Kruk
+ *
+ * Mxim is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation; either version 3, or (at your
+ * option) any later version.
+ *
+ * Mxim is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Mxim; see the file COPYING.  If not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+typedef struct arena arena_t;
+
+int arena_new(arena_t **arena, const size_t size);
+int arena_free(arena_t **arena);
+
+void* arena_alloc(arena_t *arena, const size_t size);
+void* arena_calloc(arena_t *arena, const size_t nmemb, const size_t size);
+char* arena_strndup(arena_t *arena, const char *str, const size_t len);
+
+int arena_reset(arena_t *arena);
+
+#endif /* ARENA_H */
@@ -0,0 +1,158 @@
+/*
+ * bloom.c - This file is part of mxim
+ * Copyright (C) 2025 Matthias Kruk
+ *
+ * Mxim is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation; either version 3, or (at your
+ * option) any later version.
+ *
+ * Mxim is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Mxim; see the file COPYING.  If not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include "bloom.h"
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * A blocked Bloom filter: all bits of an item are in the same 64-byte
+ * block, so that a test touches only one cache line. With 10 bits per
+ * item and 6 bits set per item, about 1-2% of the tests are false
+ * positives.
+ */
+#define BLOOM_BITS_PER_ITEM 10
+#define BLOOM_BITS_SET      6
+#define BLOOM_BLOCK_WORDS   8
+#define BLOOM_BLOCK_BITS    (BLOOM_BLOCK_WORDS * 64)
+
+struct bloom_block {
+	uint64_t words[BLOOM_BLOCK_WORDS];
+} __attribute__((aligned(64)));
+
+struct bloom {
+	struct bloom_block *blocks;
+	size_t num_blocks;
+	size_t num_items;
+	size_t capacity;
+};
+
+int bloom_new(bloom_t **bloom, const size_t capacity)
+{
+	bloom_t *b;
+	size_t num_blocks;
+
+	if (!bloom || !capacity) {
+		return -EINVAL;
+	}
+
+	if (capacity > SIZE_MAX / BLOOM_BITS_PER_ITEM - BLOOM_BLOCK_BITS) {
+		return -EOVERFLOW;
+	}
+
+	num_blocks = (capacity * BLOOM_BITS_PER_ITEM + BLOOM_BLOCK_BITS - 1) / BLOOM_BLOCK_BITS;
+
+	if (!(b = calloc(1, sizeof(*b)))) {
+		return -ENOMEM;
+	}
+
+	if (!(b->blocks = aligned_alloc(sizeof(*b->blocks), num_blocks * sizeof(*b->blocks)))) {
+		free(b);
+		return -ENOMEM;
+	}
+
+	memset(b->blocks, 0, num_blocks * sizeof(*b->blocks));
+	b->num_blocks = num_blocks;
+	b->capacity = capacity;
+
+	*bloom = b;
+	return 0;
+}
+
+int bloom_free(bloom_t **bloom)
+{
+	if (!bloom || !*bloom) {
+		return -EINVAL;
+	}
+
+	free((*bloom)->blocks);
+	free(*bloom);
+	*bloom = NULL;
+
+	return 0;
+}
+
+static struct bloom_block *_bloom_get_block(const bloom_t *bloom, const uint64_t hash)
+{
+	/* maps the upper half of the hash onto [0, num_blocks) */
+	return &bloom->blocks[((hash >> 32) * bloom->num_blocks) >> 32];
+}
+
+static uint64_t _bloom_get_bits(const uint64_t hash)
+{
+	/* the bit positions are taken from a remixed hash, 9 bits each */
+	return hash * 0x9e3779b97f4a7c15ULL;
+}
+
+/* Returns -ENOSPC when the filter is full and needs to be rebuilt larger */
+int bloom_add(bloom_t *bloom, const uint64_t hash)
+{
+	struct bloom_block *block;
+	uint64_t bits;
+	int bit;
+	int i;
+
+	if (!bloom) {
+		return -EINVAL;
+	}
+
+	if (bloom->num_items >= bloom->capacity) {
+		return -ENOSPC;
+	}
+
+	block = _bloom_get_block(bloom, hash);
+	bits = _bloom_get_bits(hash);
+
+	for (i = 0; i < BLOOM_BITS_SET; i++, bits >>= 9) {
+		bit = bits & (BLOOM_BLOCK_BITS - 1);
+		block->words[bit / 64] |= 1ULL << (bit % 64);
+	}
+
+	bloom->num_items++;
+	return 0;
+}
+
+/* Returns 0 if the item was never added, 1 if it may have been */
+int bloom_test(const bloom_t *bloom, const uint64_t hash)
+{
+	const struct bloom_block *block;
+	uint64_t bits;
+	int bit;
+	int i;
+
+	if (!bloom) {
+		return -EINVAL;
+	}
+
+	block = _bloom_get_block(bloom, hash);
+	bits = _bloom_get_bits(hash);
+
+	for (i = 0; i < BLOOM_BITS_SET; i++, bits >>= 9) {
+		bit = bits & (BLOOM_BLOCK_BITS - 1);
+
+		if (!(block->words[bit / 64] & (1ULL << (bit % 64)))) {
+			return 0;
+		}
+	}
+
+	return 1;
+}
@@ -0,0 +1,35 @@
+/*
+ * bloom.h - This file is part of mxim
+ * Copyright (C) 2025 Matthias Kruk
+ *
+ * Mxim is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation; either version 3, or (at your
+ * option) any later version.
+ *
+ * Mxim is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Mxim; see the file COPYING.  If not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#ifndef BLOOM_H
+#define BLOOM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct bloom bloom_t;
+
+int bloom_new(bloom_t **bloom, const size_t capacity);
+int bloom_free(bloom_t **bloom);
+
+int bloom_add(bloom_t *bloom, const uint64_t hash);
+int bloom_test(const bloom_t *bloom, const uint64_t hash);
+
+#endif /* BLOOM_H */
@@ -431,6 +431,15 @@ static int _lut_init(void)
 	return err;
 }
 
+const char* char_get_utf8(const char_t chr)
+{
+	if (chr >= CHAR_LAST) {
+		return NULL;
+	}
+
+	return _charmap[chr];
+}
+
 int char_to_utf8(const char_t *src, const size_t src_len, char *dst, const size_t dst_size)
 {
 	size_t src_idx;
@@ -269,6 +269,10 @@ typedef enum {
 	LANG_MAX
 } lang_t;
 
+/* Every character is a single code point, at most this long in UTF-8 */
+#define CHAR_UTF8_MAX 4
+
+const char* char_get_utf8(const char_t chr);
 int char_to_utf8(const char_t *src, const size_t src_len, char *dst, const size_t dst_size);
 int char_to_utf8_dyn(const char_t *src, const size_t src_len, char **dst);
 int char_from_utf8(const char *src, const size_t src_len, char_t **dst);
@@ -28,6 +28,7 @@ typedef enum {
 	CMD_CURSOR_MOVE,      /* int      dir  */
 	CMD_CANDIDATE_MOVE,   /* int      dir  */
 	CMD_CANDIDATE_SELECT, /* unsigned idx  */
+	CMD_CANDIDATE_PAGE,   /* int      dir  */
 	CMD_SEGMENT_MOVE,     /* int      dir  */
 	CMD_SEGMENT_RESIZE,   /* int      size */
 	CMD_SEGMENT_NEW,      /* none          */
@@ -18,8 +18,10 @@
  * Boston, MA 02111-1307, USA.
  */
 
+#include "bloom.h"
 #include "char.h"
 #include "dict.h"
+#include "string.h"
 #include "trie.h"
 #include <assert.h>
 #include <errno.h>
@@ -27,8 +29,19 @@
 #include <stdlib.h>
 #include <string.h>
 
+/* Number of key prefixes the filter of a new dict is sized for */
+#define DICT_PREFIXES_MIN 1024
+
+/* FNV-1a, so that the hashes of all prefixes of a key are computed in one pass */
+#define DICT_HASH_BASIS 0xcbf29ce484222325ULL
+#define DICT_HASH_PRIME 0x100000001b3ULL
+
 struct dict {
 	trie_t *trie;
+
+	/* filter over the prefixes of all keys, so that misses don't walk the trie */
+	bloom_t *prefixes;
+	size_t prefixes_capacity;
 };
 
 int dict_candidate_new(dict_candidate_t **candidate)
@@ -49,6 +62,11 @@ int dict_candidate_free(dict_candidate_t **candidate)
 		return -EINVAL;
 	}
 
+	if ((*candidate)->markup != (*candidate)->value) {
+		free((*candidate)->markup);
+	}
+	(*candidate)->markup = NULL;
+
 	free((*candidate)->value);
 	(*candidate)->value = NULL;
 
@@ -58,6 +76,61 @@ int dict_candidate_free(dict_candidate_t **candidate)
 	return 0;
 }
 
+/* Escapes the value once, so that it can be shown any number of times */
+int dict_candidate_escape(dict_candidate_t *candidate)
+{
+	string_t *markup;
+	int err;
+
+	if (!candidate || !candidate->value) {
+		return -EINVAL;
+	}
+
+	if (candidate->markup && candidate->markup != candidate->value) {
+		free(candidate->markup);
+	}
+
+	if (!strpbrk(candidate->value, "&<>")) {
+		candidate->markup = candidate->value;
+		candidate->markup_len = strlen(candidate->value);
+		return 0;
+	}
+
+	if ((err = string_new(&markup)) < 0) {
+		return err;
+	}
+
+	candidate->markup = NULL;
+
+	if ((err = string_append_escaped(markup, candidate->value, strlen(candidate->value))) >= 0 &&
+	    (err = string_get_utf8(markup, &candidate->markup)) >= 0) {
+		candidate->markup_len = err;
+		err = 0;
+	}
+
+	string_free(&markup);
+	return err;
+}
+
+/* Counts a selection of the candidate, which may be shared by several threads */
+int dict_candidate_promote(dict_candidate_t *candidate)
+{
+	dict_entry_t *entry;
+	int priority;
+
+	if (!candidate) {
+		return -EINVAL;
+	}
+
+	priority = __atomic_add_fetch(&candidate->priority, 1, __ATOMIC_RELAXED);
+
+	if ((entry = candidate->entry) && entry->dict) {
+		return trie_raise(entry->dict->trie, entry->key, entry, priority);
+	}
+
+	return 0;
+}
+
 int dict_entry_new(dict_entry_t **entry)
 {
 	dict_entry_t *ent;
@@ -134,7 +207,10 @@ int dict_new(dict_t **dict)
 		return -ENOMEM;
 	}
 
-	err = trie_new(&d->trie);
+	if ((err = trie_new(&d->trie)) == 0 &&
+	    (err = bloom_new(&d->prefixes, DICT_PREFIXES_MIN)) == 0) {
+		d->prefixes_capacity = DICT_PREFIXES_MIN;
+	}
 
 	if (err) {
 		dict_free(&d);
@@ -152,6 +228,7 @@ int dict_free(dict_t **dict)
 	}
 
 	trie_free(&(*dict)->trie);
+	bloom_free(&(*dict)->prefixes);
 
 	free(*dict);
 	*dict = NULL;
@@ -159,9 +236,108 @@ int dict_free(dict_t **dict)
 	return 0;
 }
 
+/* Highest priority of the entry and its candidates */
+static int _dict_entry_rank(const dict_entry_t *entry)
+{
+	int priority;
+	int rank;
+	size_t i;
+
+	rank = entry->priority;
+
+	for (i = 0; i < entry->num_candidates; i++) {
+		priority = __atomic_load_n(&entry->candidates[i]->priority, __ATOMIC_RELAXED);
+
+		if (priority > rank) {
+			rank = priority;
+		}
+	}
+
+	return rank;
+}
+
+static int _dict_add_prefixes(bloom_t *prefixes, const char_t *key)
+{
+	uint64_t hash;
+	int err;
+
+	for (hash = DICT_HASH_BASIS; *key != CHAR_INVALID; key++) {
+		hash = (hash ^ *key) * DICT_HASH_PRIME;
+
+		/* prefixes that are (probably) in the filter don't use up space */
+		if (!bloom_test(prefixes, hash) &&
+		    (err = bloom_add(prefixes, hash)) < 0) {
+			return err;
+		}
+	}
+
+	return 0;
+}
+
+/* Replaces the filter with a larger one, containing the keys of all entries */
+static int _dict_grow_prefixes(dict_t *dict)
+{
+	const char_t all = CHAR_INVALID;
+	bloom_t *prefixes;
+	trie_iter_t iter;
+	dict_entry_t *entry;
+	size_t capacity;
+	int err;
+
+	if (dict->prefixes_capacity > SIZE_MAX / 2) {
+		return -EOVERFLOW;
+	}
+
+	capacity = dict->prefixes_capacity * 2;
+
+	if ((err = bloom_new(&prefixes, capacity)) < 0) {
+		return err;
+	}
+
+	if ((err = trie_iter_init(&iter, dict->trie, &all)) < 0) {
+		bloom_free(&prefixes);
+		return err;
+	}
+
+	while ((err = trie_iter_next(&iter, (void**)&entry, NULL)) == 0) {
+		if ((err = _dict_add_prefixes(prefixes, entry->key)) < 0) {
+			break;
+		}
+	}
+
+	trie_iter_fini(&iter);
+
+	if (err != -ENOENT) {
+		bloom_free(&prefixes);
+		return err;
+	}
+
+	bloom_free(&dict->prefixes);
+	dict->prefixes = prefixes;
+	dict->prefixes_capacity = capacity;
+
+	return 0;
+}
+
+static int _dict_may_contain(const dict_t *dict, const char_t *key)
+{
+	uint64_t hash;
+
+	if (*key == CHAR_INVALID) {
+		return 1;
+	}
+
+	for (hash = DICT_HASH_BASIS; *key != CHAR_INVALID; key++) {
+		hash = (hash ^ *key) * DICT_HASH_PRIME;
+	}
+
+	return bloom_test(dict->prefixes, hash);
+}
+
 int dict_add(dict_t *dict, dict_entry_t **entries, const size_t num_entries)
 {
 	size_t i;
+	size_t j;
 	int err;
 
 	if (!dict || !entries) {
@@ -171,8 +347,20 @@ int dict_add(dict_t *dict, dict_entry_t **entries, const size_t num_entries)
 	err = 0;
 
 	for (i = 0; i < num_entries; i++) {
-		if ((err = trie_insert(dict->trie, entries[i]->key,
-		                       (const void**)&entries[i], 1)) < 0) {
+		for (j = 0; j < entries[i]->num_candidates; j++) {
+			entries[i]->candidates[j]->entry = entries[i];
+		}
+		entries[i]->dict = dict;
+
+		while ((err = _dict_add_prefixes(dict->prefixes, entries[i]->key)) == -ENOSPC) {
+			if ((err = _dict_grow_prefixes(dict)) < 0) {
+				break;
+			}
+		}
+
+		if (err < 0 ||
+		    (err = trie_insert(dict->trie, entries[i]->key, (const void**)&entries[i],
+		                       1, _dict_entry_rank(entries[i]))) < 0) {
 			break;
 		}
 	}
@@ -180,11 +368,35 @@ int dict_add(dict_t *dict, dict_entry_t **entries, const size_t num_entries)
 	return err;
 }
 
-int dict_lookup(const dict_t *dict, const char_t *key, dict_entry_t ***output)
+int dict_iter_init(dict_iter_t *iter, const dict_t *dict, const char_t *key)
+{
+	if (!iter || !dict || !key) {
+		return -EINVAL;
+	}
+
+	if (!(iter->miss = !_dict_may_contain(dict, key))) {
+		return trie_iter_init(&iter->trie_iter, dict->trie, key);
+	}
+
+	return 0;
+}
+
+int dict_iter_next(dict_iter_t *iter, dict_entry_t **entry)
 {
-	if (!dict || !key || !output) {
+	if (!iter || !entry) {
 		return -EINVAL;
 	}
 
-	return trie_get_values(dict->trie, key, (void***)output);
+	if (iter->miss) {
+		return -ENOENT;
+	}
+
+	return trie_iter_next(&iter->trie_iter, (void**)entry, NULL);
+}
+
+void dict_iter_fini(dict_iter_t *iter)
+{
+	if (iter && !iter->miss) {
+		trie_iter_fini(&iter->trie_iter);
+	}
 }
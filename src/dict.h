@@ -22,28 +22,45 @@
 #define DICT_H
 
 #include "char.h"
+#include "trie.h"
+#include <stddef.h>
 
 typedef struct dict_candidate dict_candidate_t;
+typedef struct dict_entry dict_entry_t;
+typedef struct dict dict_t;
 
 struct dict_candidate {
 	char *value;
 	int priority;
-};
+	dict_entry_t *entry;
 
-typedef struct dict_entry dict_entry_t;
+	/* value escaped for Pango markup, the same pointer if there was nothing to escape */
+	char *markup;
+	size_t markup_len;
+};
 
 struct dict_entry {
 	int priority;
+	dict_t *dict;
 	char_t *key;
 	char *key_utf8;
 	dict_candidate_t **candidates;
 	size_t num_candidates;
 };
 
-typedef struct dict dict_t;
+/*
+ * Entries of a dict whose keys start with a given prefix, ordered by the
+ * priority of the entry or of its best candidate, whichever is higher
+ */
+typedef struct {
+	trie_iter_t trie_iter;
+	int miss;
+} dict_iter_t;
 
 int dict_candidate_new(dict_candidate_t **candidate);
 int dict_candidate_free(dict_candidate_t **candidate);
+int dict_candidate_escape(dict_candidate_t *candidate);
+int dict_candidate_promote(dict_candidate_t *candidate);
 
 int dict_entry_new(dict_entry_t **entry);
 int dict_entry_free(dict_entry_t **entry);
@@ -57,6 +74,8 @@ int dict_add(dict_t *dict,
              dict_entry_t **entries,
              const size_t num_entries);
 
-int dict_lookup(const dict_t *dict, const char_t *key, dict_entry_t ***output);
+int dict_iter_init(dict_iter_t *iter, const dict_t *dict, const char_t *key);
+int dict_iter_next(dict_iter_t *iter, dict_entry_t **entry);
+void dict_iter_fini(dict_iter_t *iter);
 
 #endif /* DICT_H */
@@ -810,7 +810,8 @@ static int _get_dict_candidate(struct entry *entry, dict_candidate_t **out)
 		c->priority = 0;
 	}
 
-	if ((err = _get_property(entry->property_list, "value", (void*)&c->value)) < 0) {
+	if ((err = _get_property(entry->property_list, "value", (void*)&c->value)) < 0 ||
+	    (err = dict_candidate_escape(c)) < 0) {
 		dict_candidate_free(&c);
 	} else {
 		*out = c;
@@ -856,9 +857,12 @@ static int _get_dict_candidates(struct array *array, dict_candidate_t ***out)
 	}
 
 	for (entry_list = array->entry_list; entry_list; entry_list = entry_list->entry_list) {
-		_get_dict_candidate(entry_list->entry, &candidates[i++]);
+		if (_get_dict_candidate(entry_list->entry, &candidates[i]) == 0) {
+			i++;
+		}
 	}
 
+	candidates[i] = NULL;
 	*out = candidates;
 
 	return 0;
@@ -0,0 +1,106 @@
+/*
+ * event.c - This file is part of mxim
+ * Copyright (C) 2025 Matthias Kruk
+ *
+ * Mxim is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation; either version 3, or (at your
+ * option) any later version.
+ *
+ * Mxim is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Mxim; see the file COPYING.  If not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include "fd.h"
+#include <errno.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+/*
+ * An eventfd, which other threads write to when an event loop has to
+ * wake up. It may be written from any thread, but only the thread that
+ * watches it reads from it.
+ */
+
+static int     _event_open(fd_t *fd, va_list args);
+static int     _event_close(fd_t *fd);
+static ssize_t _event_read(fd_t *fd, void *dst, const size_t dst_size);
+static ssize_t _event_write(fd_t *fd, const void *src, const size_t src_len);
+
+static struct fd_ops _event_ops = {
+	.open  = _event_open,
+	.close = _event_close,
+	.read  = _event_read,
+	.write = _event_write
+};
+
+struct fd_dom _dom_event = {
+	.dom = FD_DOM_EVENT,
+	.ops = &_event_ops,
+	.priv_size = 0
+};
+
+static int _event_open(fd_t *fd, va_list args)
+{
+	int efd;
+
+	if (!fd) {
+		return -EINVAL;
+	}
+
+	if ((efd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)) < 0) {
+		return -errno;
+	}
+
+	fd->fd = efd;
+	return 0;
+}
+
+static int _event_close(fd_t *fd)
+{
+	if (!fd) {
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+/* Reads and resets the counter */
+static ssize_t _event_read(fd_t *fd, void *dst, const size_t dst_size)
+{
+	ssize_t ret_val;
+
+	if (dst_size < sizeof(uint64_t)) {
+		return -EINVAL;
+	}
+
+	if ((ret_val = read(fd->fd, dst, sizeof(uint64_t))) < 0) {
+		ret_val = -errno;
+	}
+
+	return ret_val;
+}
+
+static ssize_t _event_write(fd_t *fd, const void *src, const size_t src_len)
+{
+	ssize_t ret_val;
+
+	if (src_len != sizeof(uint64_t)) {
+		return -EINVAL;
+	}
+
+	/* the counter can't overflow before the reader gets to it */
+	if ((ret_val = write(fd->fd, src, sizeof(uint64_t))) < 0) {
+		ret_val = -errno;
+	}
+
+	return ret_val;
+}
@@ -19,15 +19,29 @@
  */
 
 #include "fd.h"
-#include "thread.h"
 #include <errno.h>
+#include <fcntl.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 
-extern struct fd_dom _dom_in4;
+/* Freed fds are kept for reuse by the thread that freed them */
+#define FD_POOL_MAX   64
+#define FD_ALLOC_SIZE (sizeof(fd_t) + FD_PRIV_MAX)
+
+static __thread fd_t *_fd_pool;
+static __thread int _fd_pool_len;
 
-static struct fd_dom *_doms[] = {
-	&_dom_in4
+extern struct fd_dom _dom_in4;
+extern struct fd_dom _dom_unix;
+extern struct fd_dom _dom_x11;
+extern struct fd_dom _dom_event;
+
+static struct fd_dom *_doms[FD_DOM_NUM] = {
+	[FD_DOM_IN4]   = &_dom_in4,
+	[FD_DOM_UNIX]  = &_dom_unix,
+	[FD_DOM_X11]   = &_dom_x11,
+	[FD_DOM_EVENT] = &_dom_event
 };
 
 int fd_open(fd_t **dst, fd_dom_t dom, ...)
@@ -40,12 +54,13 @@ int fd_open(fd_t **dst, fd_dom_t dom, ...)
 		return -EINVAL;
 	}
 
-	if (!(fd = calloc(1, sizeof(*fd)))) {
-		return -ENOMEM;
+	if (!_doms[dom]) {
+		return -EPROTONOSUPPORT;
 	}
 
-	assert(mutex_init(&fd->lock) == 0);
-	fd->fd = -1;
+	if ((err = fd_alloc(&fd, _doms[dom]->priv_size)) < 0) {
+		return err;
+	}
 
 	va_start(args, dom);
 	err = _doms[dom]->ops->open(fd, args);
@@ -62,6 +77,40 @@ int fd_open(fd_t **dst, fd_dom_t dom, ...)
 	return err;
 }
 
+int fd_alloc(fd_t **dst, const size_t priv_size)
+{
+	fd_t *fd;
+
+	if (!dst || priv_size > FD_PRIV_MAX) {
+		return -EINVAL;
+	}
+
+	if ((fd = _fd_pool)) {
+		_fd_pool = fd->userdata;
+		_fd_pool_len--;
+		memset(fd, 0, FD_ALLOC_SIZE);
+	} else if (!(fd = calloc(1, FD_ALLOC_SIZE))) {
+		return -ENOMEM;
+	}
+
+	fd->fd = -1;
+	fd->priv = priv_size > 0 ? fd + 1 : NULL;
+
+	*dst = fd;
+	return 0;
+}
+
+static void _fd_release(fd_t *fd)
+{
+	if (_fd_pool_len < FD_POOL_MAX) {
+		fd->userdata = _fd_pool;
+		_fd_pool = fd;
+		_fd_pool_len++;
+	} else {
+		free(fd);
+	}
+}
+
 int fd_free(fd_t **fd)
 {
 	int err;
@@ -71,7 +120,7 @@ int fd_free(fd_t **fd)
 	}
 
 	err = fd_close(*fd);
-	free(*fd);
+	_fd_release(*fd);
 	*fd = NULL;
 
 	return err;
@@ -87,13 +136,14 @@ int fd_close(fd_t *fd)
 
 	err = -EBADFD;
 
-	fd_lock(fd);
 	if (fd->fd >= 0) {
+		/* let the event loop forget about the fd before it is reused */
+		fd_notify(fd, FD_EVENT_CLOSE, NULL);
+
 		err = fd->ops->close(fd);
 		close(fd->fd);
 		fd->fd = -1;
 	}
-	fd_unlock(fd);
 
 	return err;
 }
@@ -128,6 +178,21 @@ ssize_t fd_write(fd_t *fd, const void *src, const size_t src_len)
 	return ret_val;
 }
 
+ssize_t fd_writev(fd_t *fd, const struct iovec *iov, const int iovcnt)
+{
+	ssize_t ret_val;
+
+	if (!fd || !iov || iovcnt < 0) {
+		ret_val = (ssize_t)-EINVAL;
+	} else if(!fd->ops->writev) {
+		ret_val = (ssize_t)-EOPNOTSUPP;
+	} else {
+		ret_val = fd->ops->writev(fd, iov, iovcnt);
+	}
+
+	return ret_val;
+}
+
 int fd_accept(fd_t *src, fd_t **dst)
 {
 	int ret_val;
@@ -143,6 +208,25 @@ int fd_accept(fd_t *src, fd_t **dst)
 	return ret_val;
 }
 
+int fd_set_nonblock(fd_t *fd)
+{
+	int flags;
+	int err;
+
+	if (!fd) {
+		return -EINVAL;
+	}
+
+	err = 0;
+
+	if ((flags = fcntl(fd->fd, F_GETFL)) < 0 ||
+	    fcntl(fd->fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+		err = -errno;
+	}
+
+	return err;
+}
+
 int fd_get_fd(fd_t *fd)
 {
 	int ret_val;
@@ -150,9 +234,7 @@ int fd_get_fd(fd_t *fd)
 	ret_val = -EINVAL;
 
 	if (fd) {
-	        fd_lock(fd);
 		ret_val = fd->fd;
-		fd_unlock(fd);
 	}
 
 	return ret_val;
@@ -164,10 +246,8 @@ int fd_set_callback(fd_t *fd, fd_event_t event, fd_callback_t *handler, void *da
 		return -EINVAL;
 	}
 
-	fd_lock(fd);
 	fd->handlers[event].callback = handler;
 	fd->handlers[event].data = data;
-	fd_unlock(fd);
 
 	return 0;
 }
@@ -181,9 +261,7 @@ int fd_notify(fd_t *fd, fd_event_t ev, void *arg)
 	if (fd && fd_event_is_valid(ev)) {
 		struct fd_event_handler handler;
 
-		fd_lock(fd);
 		handler = fd->handlers[ev];
-		fd_unlock(fd);
 
 		if (handler.callback) {
 			handler.callback(fd, ev, handler.data, arg);
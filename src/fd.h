@@ -21,10 +21,10 @@
 #ifndef FD_H
 #define FD_H
 
-#include "thread.h"
 #include <stdarg.h>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 
 typedef struct fd fd_t;
 
@@ -32,12 +32,18 @@ typedef enum {
 	FD_EVENT_IN = 0,
 	FD_EVENT_ERR,
 	FD_EVENT_HUP,
+	FD_EVENT_OUT,
+	FD_EVENT_CLOSE,
+	FD_EVENT_FLUSH,      /* the event loop is done with a pass */
+	FD_EVENT_WANT_OUT,   /* output is queued, FD_EVENT_OUT is wanted */
 	FD_EVENT_NUM
 } fd_event_t;
 
 typedef enum {
 	FD_DOM_IN4,
+	FD_DOM_UNIX,
 	FD_DOM_X11,
+	FD_DOM_EVENT,
 	FD_DOM_NUM,
 } fd_dom_t;
 
@@ -51,6 +57,7 @@ struct fd_ops {
 	int     (*open)(fd_t*, va_list);
 	ssize_t (*read)(fd_t*, void*, const size_t);
 	ssize_t (*write)(fd_t*, const void*, const size_t);
+	ssize_t (*writev)(fd_t*, const struct iovec*, const int);
 	int     (*accept)(fd_t*, fd_t**);
 	int     (*close)(fd_t*);
 };
@@ -58,6 +65,20 @@ struct fd_ops {
 struct fd_dom {
 	fd_dom_t dom;
 	struct fd_ops *ops;
+	size_t priv_size;
+};
+
+/* Private data of a domain is allocated along with the fd */
+#define FD_PRIV_MAX 128
+
+/*
+ * Data that was received on behalf of the fd, passed along with FD_EVENT_IN
+ * by event loops that read from the fd themselves. A length of 0 means the
+ * peer has closed the connection, a negative length is an error.
+ */
+struct fd_data {
+	const void *data;
+	ssize_t len;
 };
 
 typedef void (fd_callback_t)(fd_t*, fd_event_t, void*, void*);
@@ -68,8 +89,8 @@ struct fd_event_handler {
 };
 
 struct fd {
+	/* an fd belongs to the reactor that watches it and is not locked */
 	int fd;
-	mutex_t lock;
 
 	struct fd_ops *ops;
 	struct sockaddr *addr;
@@ -86,15 +107,15 @@ struct fd {
 #define fd_type_is_valid(type)   ((type)  >= 0 && (type)  < FD_TYPE_NUM)
 #define fd_event_is_valid(event) ((event) >= 0 && (event) < FD_EVENT_NUM)
 
-#define fd_lock(fd)   mutex_lock(&(fd)->lock)
-#define fd_unlock(fd) mutex_unlock(&(fd)->lock)
-
 int     fd_open(fd_t **fd, fd_dom_t dom, ...);
+int     fd_alloc(fd_t **fd, const size_t priv_size);
 int     fd_free(fd_t **fd);
 int     fd_close(fd_t *fd);
 ssize_t fd_read(fd_t *fd, void *dst, const size_t dst_size);
 ssize_t fd_write(fd_t *fd, const void *src, const size_t src_len);
+ssize_t fd_writev(fd_t *fd, const struct iovec *iov, const int iovcnt);
 int     fd_accept(fd_t *server, fd_t **client);
+int     fd_set_nonblock(fd_t *fd);
 int     fd_set_callback(fd_t *fd, fd_event_t event,
                         fd_callback_t *handler, void *data);
 int     fd_notify(fd_t *fd, fd_event_t event, void *arg);
@@ -18,7 +18,9 @@
  * Boston, MA 02111-1307, USA.
  */
 
+#define _GNU_SOURCE
 #include "fd.h"
+#include "log.h"
 #include <errno.h>
 #include <stdio.h>
 #include <stddef.h>
@@ -28,12 +30,13 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 
-#define IN4_DEFAULT_BACKLOG 4
+#define IN4_DEFAULT_BACKLOG SOMAXCONN
 
 static int     _in4_open(fd_t *fd, va_list args);
 static int     _in4_close(fd_t *fd);
 static ssize_t _in4_read(fd_t *fd, void *dst, const size_t dst_size);
 static ssize_t _in4_write(fd_t *fd, const void *src, const size_t src_len);
+static ssize_t _in4_writev(fd_t *fd, const struct iovec *iov, const int iovcnt);
 static int     _in4_accept(fd_t *server, fd_t **client);
 
 static struct fd_ops _in4_ops = {
@@ -41,16 +44,19 @@ static struct fd_ops _in4_ops = {
 	.close  = _in4_close,
 	.read   = _in4_read,
 	.write  = _in4_write,
+	.writev = _in4_writev,
 	.accept = _in4_accept
 };
 
-struct fd_dom _dom_in4 = {
-	.dom = FD_DOM_IN4,
-	.ops = &_in4_ops
-};
-
 struct in4_priv {
 	struct sockaddr_in addr;
+	int backlog;
+};
+
+struct fd_dom _dom_in4 = {
+	.dom = FD_DOM_IN4,
+	.ops = &_in4_ops,
+	.priv_size = sizeof(struct in4_priv)
 };
 
 static int _in4_open_sock(struct in4_priv *priv)
@@ -66,17 +72,17 @@ static int _in4_open_sock(struct in4_priv *priv)
 	if (priv) {
 		if ((sock = socket(PF_INET, SOCK_STREAM, 0)) < 0) {
 			ret_val = -errno;
-			perror("socket");
+			log_error("socket: %s", strerror(-ret_val));
 		} else if (setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes)) < 0) {
 			ret_val = -errno;
-			perror("setsockopt");
+			log_error("setsockopt: %s", strerror(-ret_val));
 		} else if (bind(sock, (struct sockaddr*)&priv->addr,
 		                sizeof(priv->addr)) < 0) {
 			ret_val = -errno;
-			perror("bind");
-		} else if (listen(sock, IN4_DEFAULT_BACKLOG) < 0) {
+			log_error("bind: %s", strerror(-ret_val));
+		} else if (listen(sock, priv->backlog) < 0) {
 			ret_val = -errno;
-			perror("bind");
+			log_error("listen: %s", strerror(-ret_val));
 		} else {
 			ret_val = sock;
 		}
@@ -95,6 +101,7 @@ static int _in4_open(fd_t *fd, va_list args)
 	struct in4_priv *priv;
 	const char *addr;
 	unsigned short port;
+	int backlog;
 	int sock;
 
 	if (!fd) {
@@ -105,11 +112,10 @@ static int _in4_open(fd_t *fd, va_list args)
 	sock = -1;
 	addr = (const char*)va_arg(args, char*);
 	port = (unsigned short)va_arg(args, int);
+	backlog = va_arg(args, int);
 
-	if (!(priv = calloc(1, sizeof(*priv)))) {
-		return -ENOMEM;
-	}
-
+	priv = fd->priv;
+	priv->backlog = backlog > 0 ? backlog : IN4_DEFAULT_BACKLOG;
 	priv->addr.sin_family = AF_INET;
 	priv->addr.sin_port = htons(port);
 
@@ -118,19 +124,13 @@ static int _in4_open(fd_t *fd, va_list args)
 	} else if ((sock = _in4_open_sock(priv)) < 0) {
 		ret_val = sock;
 	} else {
-		fd_lock(fd);
 		fd->fd = sock;
-		fd->priv = priv;
 		fd->addr = (struct sockaddr*)&priv->addr;
 		fd->addrlen = sizeof(priv->addr);
-		fd_unlock(fd);
 	}
 
-	if (ret_val < 0) {
-		if (sock >= 0) {
-			close(sock);
-		}
-		free(priv);
+	if (ret_val < 0 && sock >= 0) {
+		close(sock);
 	}
 
 	return ret_val;
@@ -143,9 +143,9 @@ static ssize_t _in4_read(fd_t *fd, void *dst, const size_t dst_size)
 	ret_val = (ssize_t)-EINVAL;
 
 	if (fd && dst) {
-		fd_lock(fd);
-		ret_val = read(fd->fd, dst, dst_size);
-		fd_unlock(fd);
+		if ((ret_val = read(fd->fd, dst, dst_size)) < 0) {
+			ret_val = -errno;
+		}
 	}
 
 	return ret_val;
@@ -158,9 +158,31 @@ static ssize_t _in4_write(fd_t *fd, const void *src, const size_t src_len)
 	ret_val = (ssize_t)-EINVAL;
 
 	if (fd && src) {
-		fd_lock(fd);
-		ret_val = write(fd->fd, src, src_len);
-		fd_unlock(fd);
+		/* a client that went away must not kill the server with SIGPIPE */
+		if ((ret_val = send(fd->fd, src, src_len, MSG_NOSIGNAL)) < 0) {
+			ret_val = -errno;
+		}
+	}
+
+	return ret_val;
+}
+
+static ssize_t _in4_writev(fd_t *fd, const struct iovec *iov, const int iovcnt)
+{
+	ssize_t ret_val;
+
+	ret_val = (ssize_t)-EINVAL;
+
+	if (fd && iov) {
+		struct msghdr msg;
+
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = (struct iovec*)iov;
+		msg.msg_iovlen = iovcnt;
+
+		if ((ret_val = sendmsg(fd->fd, &msg, MSG_NOSIGNAL)) < 0) {
+			ret_val = -errno;
+		}
 	}
 
 	return ret_val;
@@ -172,41 +194,27 @@ static int _in4_accept(fd_t *server, fd_t **client)
 	struct in4_priv *priv;
 	int ret_val;
 
-	new_fd = NULL;
-	priv = NULL;
-	ret_val = 0;
-
 	if (!server || !client) {
-		ret_val = -EINVAL;
-	} else if (!(new_fd = calloc(1, sizeof(*new_fd))) ||
-	           !(priv = calloc(1, sizeof(*priv)))) {
-		ret_val = -ENOMEM;
-	} else {
-		assert(mutex_init(&new_fd->lock) == 0);
+		return -EINVAL;
+	}
 
-		new_fd->addr = (struct sockaddr*)&priv->addr;
-		new_fd->addrlen = sizeof(priv->addr);
-		new_fd->priv = priv;
+	if ((ret_val = fd_alloc(&new_fd, sizeof(*priv))) < 0) {
+		return ret_val;
+	}
 
-		fd_lock(server);
-		new_fd->dom = server->dom;
-		new_fd->ops = server->ops;
-		memcpy(&new_fd->handlers, &server->handlers, sizeof(new_fd->handlers));
+	priv = new_fd->priv;
+	new_fd->addr = (struct sockaddr*)&priv->addr;
+	new_fd->addrlen = sizeof(priv->addr);
 
-		if ((new_fd->fd = accept(server->fd, new_fd->addr, &new_fd->addrlen)) < 0) {
-			ret_val = -errno;
-		}
-		fd_unlock(server);
-	}
+	new_fd->dom = server->dom;
+	new_fd->ops = server->ops;
+	memcpy(&new_fd->handlers, &server->handlers, sizeof(new_fd->handlers));
 
-	if (ret_val < 0) {
-		if (new_fd) {
-			assert(mutex_destroy(&new_fd->lock) == 0);
-			free(new_fd);
-		}
-		if (priv) {
-			free(priv);
-		}
+	/* accepted sockets are non-blocking from the start */
+	if ((new_fd->fd = accept4(server->fd, new_fd->addr, &new_fd->addrlen,
+	                          SOCK_NONBLOCK | SOCK_CLOEXEC)) < 0) {
+		ret_val = -errno;
+		fd_free(&new_fd);
 	} else {
 		*client = new_fd;
 	}
@@ -220,10 +228,5 @@ static int _in4_close(fd_t *fd)
 		return -EINVAL;
 	}
 
-	if (fd->priv) {
-		free(fd->priv);
-		fd->priv = NULL;
-	}
-
 	return 0;
 }
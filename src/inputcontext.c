@@ -21,6 +21,7 @@
 #include "char.h"
 #include "inputcontext.h"
 #include "inputmethod.h"
+#include "log.h"
 #include "preedit.h"
 #include "ximclient.h"
 #include "ximtypes.h"
@@ -30,25 +31,74 @@
 #include <string.h>
 #include <X11/Xlib.h>
 
+/* Commits with more vectors than this need to allocate an iovec array */
+#define INPUT_CONTEXT_COMMIT_IOV 32
+
+/* Freed input contexts are kept for reuse by the thread that freed them */
+#define INPUT_CONTEXT_POOL_MAX 64
+
 extern x_handler_t *xhandler;
 
 struct input_context {
 	int im;
 	int ic;
 
+	/*
+	 * Values that weren't set by the client point to the defaults of
+	 * the input method. Only values that were set are owned by the IC.
+	 */
 	struct {
 		const attr_t *attr;
 		attr_value_t *value;
+		int owned;
 	} attrs[IM_ICATTR_MAX];
 
-	Window window;
+	x_client_window_t window;
 	xim_client_t *client;
 	preedit_t *preedit;
 	void *priv;
 
+	/*
+	 * ICs with the XIMPreeditCallbacks style draw the preedit in the
+	 * client. Only the part that changed since it was last drawn is sent.
+	 */
+	int callbacks;
+	int preedit_started;
+	preedit_text_t drawn;
+	preedit_text_t text;
+
 	lang_t lang;
+	int active;
+	int focused;
+
+	/* set while the IC is waiting to be drawn, see input_context_redraw() */
+	int dirty;
+	struct input_context *next_dirty;
+
+	/* next free input context, while the input context is in the pool */
+	struct input_context *next;
 };
 
+static __thread input_context_t *_ic_pool;
+static __thread int _ic_pool_len;
+
+/* input contexts of this thread that have changed during this pass */
+static __thread input_context_t *_dirty_ics;
+
+static void _input_context_release_attrs(input_context_t *ic)
+{
+	int i;
+
+	for (i = 0; i < IM_ICATTR_MAX; i++) {
+		if (ic->attrs[i].owned) {
+			attr_value_free(&ic->attrs[i].value);
+		}
+
+		ic->attrs[i].value = NULL;
+		ic->attrs[i].owned = 0;
+	}
+}
+
 int input_context_new(input_context_t **dst, xim_client_t *client, const int im, const int ic)
 {
 	input_method_t *method;
@@ -64,53 +114,93 @@ int input_context_new(input_context_t **dst, xim_client_t *client, const int im,
 		return err;
 	}
 
-	if (!(context = calloc(1, sizeof(*context)))) {
+	if ((context = _ic_pool)) {
+		/* pooled contexts come with an empty preedit */
+		_ic_pool = context->next;
+		_ic_pool_len--;
+		context->next = NULL;
+	} else if (!(context = calloc(1, sizeof(*context)))) {
 		return -ENOMEM;
+	} else if ((err = preedit_new(&context->preedit)) < 0) {
+		free(context);
+		return err;
 	}
 
-	err = preedit_new(&(context->preedit));
+	context->client = client;
+	context->im = im;
+	context->ic = ic;
+	context->active = method->active;
 
-	if (!err) {
-		context->client = client;
-		context->im = im;
-		context->ic = ic;
-
-		for (i = err = 0; i < IM_ICATTR_MAX; i++) {
-			context->attrs[i].attr = method->ic_attrs[i].attr;
-
-			if (method->ic_attrs[i].value) {
-				if ((err = attr_value_clone(&context->attrs[i].value,
-				                            method->ic_attrs[i].value)) < 0) {
-					break;
-				}
-			}
-		}
+	/* the defaults are not copied until the client changes them */
+	for (i = 0; i < IM_ICATTR_MAX; i++) {
+		context->attrs[i].attr = method->ic_attrs[i].attr;
+		context->attrs[i].value = method->ic_attrs[i].value;
 	}
 
-	if (err) {
-		input_context_free(&context);
-	} else {
-		*dst = context;
+	*dst = context;
+	return 0;
+}
+
+static int _input_context_recycle(input_context_t *ic)
+{
+	preedit_t *preedit;
+
+	if (_ic_pool_len >= INPUT_CONTEXT_POOL_MAX) {
+		return -ENOSPC;
 	}
 
-	return err;
+	/* an IC that is freed in the middle of a conversion drops its input */
+	if (preedit_clear(ic->preedit) < 0 || preedit_trim(ic->preedit) < 0) {
+		return -EBUSY;
+	}
+
+	preedit = ic->preedit;
+
+	memset(ic, 0, sizeof(*ic));
+	ic->preedit = preedit;
+	ic->next = _ic_pool;
+
+	_ic_pool = ic;
+	_ic_pool_len++;
+
+	return 0;
 }
 
-int input_context_free(input_context_t **ic)
+static void _input_context_undirty(input_context_t *ic)
 {
-	int i;
+	input_context_t **link;
 
+	for (link = &_dirty_ics; *link; link = &(*link)->next_dirty) {
+		if (*link == ic) {
+			*link = ic->next_dirty;
+			break;
+		}
+	}
+
+	ic->dirty = 0;
+	ic->next_dirty = NULL;
+}
+
+int input_context_free(input_context_t **ic)
+{
 	if (!ic || !*ic) {
 		return -EINVAL;
 	}
 
-	for (i = 0; i < IM_ICATTR_MAX; i++) {
-		attr_value_free(&(*ic)->attrs[i].value);
+	if ((*ic)->dirty) {
+		_input_context_undirty(*ic);
 	}
 
-	preedit_free(&(*ic)->preedit);
+	_input_context_release_attrs(*ic);
+	x_handler_forget_client_window(xhandler, &(*ic)->window);
+	preedit_text_release(&(*ic)->drawn);
+	preedit_text_release(&(*ic)->text);
+
+	if (_input_context_recycle(*ic) < 0) {
+		preedit_free(&(*ic)->preedit);
+		free(*ic);
+	}
 
-	free(*ic);
 	*ic = NULL;
 	return 0;
 }
@@ -135,18 +225,29 @@ int input_context_set_attribute(input_context_t *ic, attr_value_t *val)
 		return err;
 	}
 
-	attr_value_free(&ic->attrs[idx].value);
+	if (ic->attrs[idx].owned) {
+		attr_value_free(&ic->attrs[idx].value);
+	}
 	ic->attrs[idx].value = clone;
+	ic->attrs[idx].owned = 1;
 
-	if (strcmp(ic->attrs[idx].attr->name, XNClientWindow) == 0) {
-		x_handler_get_client_window(xhandler, (Window)*(uint32_t*)clone->data,
-		                            &ic->window);
+	if (strcmp(ic->attrs[idx].attr->name, XNInputStyle) == 0 &&
+	    clone->len >= sizeof(uint32_t)) {
+		ic->callbacks = !!(*(uint32_t*)clone->data & XIMPreeditCallbacks);
+	}
+
+	/* the window is resolved in the background, the IC is drawn once it is known */
+	if (strcmp(ic->attrs[idx].attr->name, XNClientWindow) == 0 &&
+	    x_handler_query_client_window(xhandler, (Window)*(uint32_t*)clone->data,
+	                                  &ic->window) == 0) {
+		input_context_redraw(ic);
 	}
 
 	return 0;
 }
 
-int input_context_get_attribute(input_context_t *ic, int id, attr_value_t **val)
+/* The value must not be modified and is valid until it is set again */
+int input_context_get_attribute(input_context_t *ic, int id, const attr_value_t **val)
 {
 	int idx;
 
@@ -160,7 +261,8 @@ int input_context_get_attribute(input_context_t *ic, int id, attr_value_t **val)
 		return -ENOENT;
 	}
 
-	return attr_value_clone(val, ic->attrs[idx].value);
+	*val = ic->attrs[idx].value;
+	return 0;
 }
 
 int input_context_set_data(input_context_t *ic, void *data)
@@ -203,6 +305,56 @@ int input_context_get_client(input_context_t *ic, xim_client_t **client)
 	return 0;
 }
 
+int input_context_update_event_mask(input_context_t *ic)
+{
+	input_method_t *method;
+	int err;
+
+	if (!ic) {
+		return -EINVAL;
+	}
+
+	if ((err = xim_client_get_im(ic->client, ic->im, &method)) < 0) {
+		return err;
+	}
+
+	/* let the client know which key events it has to forward from now on */
+	return xim_client_set_event_mask(ic->client, ic->im, ic->ic,
+	                                 input_method_get_event_mask(method, ic->active),
+	                                 input_method_get_sync_mask(method, ic->active));
+}
+
+int input_context_set_active(input_context_t *ic, const int active)
+{
+	if (!ic) {
+		return -EINVAL;
+	}
+
+	ic->active = !!active;
+	return input_context_update_event_mask(ic);
+}
+
+int input_context_is_active(const input_context_t *ic)
+{
+	return ic && ic->active;
+}
+
+int input_context_set_focus(input_context_t *ic, const int focused)
+{
+	if (!ic) {
+		return -EINVAL;
+	}
+
+	ic->focused = !!focused;
+
+	/* unfocused ICs may stay around for a long time, keep them small */
+	if (!ic->focused && preedit_is_empty(ic->preedit)) {
+		return preedit_trim(ic->preedit);
+	}
+
+	return 0;
+}
+
 int input_context_update_candidates(input_context_t *ic)
 {
 	return preedit_update_candidates(ic->preedit);
@@ -298,6 +450,15 @@ int input_context_select_candidate(input_context_t *ic, const unsigned int candi
 	return preedit_select_candidate(ic->preedit, candidate);
 }
 
+int input_context_move_candidate_page(input_context_t *ic, const int dir)
+{
+	if (!ic) {
+		return -EINVAL;
+	}
+
+	return preedit_move_candidate_page(ic->preedit, dir);
+}
+
 int input_context_move_segment(input_context_t *ic, const int dir)
 {
 	if (!ic) {
@@ -326,39 +487,246 @@ int input_context_insert_segment(input_context_t *ic)
 	return err;
 }
 
-int input_context_redraw(const input_context_t *ic)
+static int _input_context_text_equal(const preedit_text_t *a, const int a_idx,
+                                     const preedit_text_t *b, const int b_idx)
 {
-	char *hint;
+	uint32_t len;
+
+	len = a->offsets[a_idx + 1] - a->offsets[a_idx];
+
+	return a->feedback[a_idx] == b->feedback[b_idx] &&
+	       len == b->offsets[b_idx + 1] - b->offsets[b_idx] &&
+	       memcmp(a->data + a->offsets[a_idx], b->data + b->offsets[b_idx], len) == 0;
+}
+
+/* Tells the client that the preedit is gone, without waiting for the next draw */
+static int _input_context_preedit_done(input_context_t *ic)
+{
+	int err;
+
+	if (!ic->preedit_started) {
+		return 0;
+	}
+
+	if (ic->drawn.num_chars > 0 &&
+	    (err = xim_client_preedit_draw(ic->client, ic->im, ic->ic, 0, 0, ic->drawn.num_chars,
+	                                   NULL, 0, NULL, 0)) < 0) {
+		return err;
+	}
+
+	ic->drawn.len = 0;
+	ic->drawn.num_chars = 0;
+	ic->drawn.caret = 0;
+	ic->preedit_started = 0;
+
+	return xim_client_preedit_done(ic->client, ic->im, ic->ic);
+}
+
+/*
+ * Sends the difference between what the client shows and the preedit.
+ * Characters that are the same at the start and the end are left alone.
+ */
+static int _input_context_draw_callbacks(input_context_t *ic)
+{
+	preedit_text_t *old;
+	preedit_text_t *new;
+	preedit_text_t swap;
+	int first;
+	int old_end;
+	int new_end;
+	int err;
+
+	if ((err = preedit_get_text(ic->preedit, &ic->text)) < 0) {
+		return err;
+	}
+
+	old = &ic->drawn;
+	new = &ic->text;
+
+	if (new->num_chars == 0) {
+		return _input_context_preedit_done(ic);
+	}
+
+	if (!ic->preedit_started) {
+		if ((err = xim_client_preedit_start(ic->client, ic->im, ic->ic)) < 0) {
+			return err;
+		}
+
+		ic->preedit_started = 1;
+	}
+
+	for (first = 0;
+	     first < old->num_chars && first < new->num_chars &&
+	     _input_context_text_equal(old, first, new, first);
+	     first++);
+
+	for (old_end = old->num_chars, new_end = new->num_chars;
+	     old_end > first && new_end > first &&
+	     _input_context_text_equal(old, old_end - 1, new, new_end - 1);
+	     old_end--, new_end--);
+
+	if (old_end > first || new_end > first) {
+		err = xim_client_preedit_draw(ic->client, ic->im, ic->ic, new->caret,
+		                              first, old_end - first,
+		                              new->data + new->offsets[first],
+		                              new->offsets[new_end] - new->offsets[first],
+		                              new->feedback + first, new_end - first);
+	} else if (old->caret != new->caret) {
+		err = xim_client_preedit_caret(ic->client, ic->im, ic->ic, new->caret);
+	}
+
+	if (err < 0) {
+		return err;
+	}
+
+	/* the new text is what the client shows now, the old one is reused next time */
+	swap = ic->drawn;
+	ic->drawn = ic->text;
+	ic->text = swap;
+
+	return 0;
+}
+
+static int _input_context_draw(input_context_t *ic)
+{
+	const char *hint;
+	Window window;
 	int err;
 
+	if (ic->callbacks) {
+		return _input_context_draw_callbacks(ic);
+	}
+
+	if ((err = x_handler_get_client_window(xhandler, &ic->window, &window)) < 0) {
+		return err == -EAGAIN ? err : 0;
+	}
+
+	if (window == None) {
+		return 0;
+	}
+
+	if ((err = preedit_get_input_decorated(ic->preedit, &hint)) < 0) {
+		return err;
+	}
+
+	return x_handler_set_text_property(xhandler, window, "MWM_HINT", err > 0 ? hint : " ");
+}
+
+/*
+ * Marks the IC to be drawn when the current pass of the event loop ends,
+ * so that an IC that changes many times in one pass is only drawn once.
+ */
+int input_context_redraw(input_context_t *ic)
+{
 	if (!ic) {
 		return -EINVAL;
 	}
 
-	if ((err = preedit_get_input_decorated(ic->preedit, &hint)) < 0) {
+	if (!ic->dirty) {
+		ic->dirty = 1;
+		ic->next_dirty = _dirty_ics;
+		_dirty_ics = ic;
+	}
+
+	return 0;
+}
+
+/*
+ * Draws the ICs of the calling thread that were marked by input_context_redraw().
+ * ICs whose window the X server hasn't told us about yet are tried again in
+ * the next pass.
+ */
+int input_context_draw_pending(void)
+{
+	input_context_t *waiting;
+	input_context_t *ic;
+	int drawn;
+	int err;
+
+	for (waiting = NULL, drawn = 0; (ic = _dirty_ics); drawn++) {
+		_dirty_ics = ic->next_dirty;
+		ic->dirty = 0;
+		ic->next_dirty = NULL;
+
+		if ((err = _input_context_draw(ic)) == -EAGAIN) {
+			ic->dirty = 1;
+			ic->next_dirty = waiting;
+			waiting = ic;
+		} else if (err < 0) {
+			log_warn("Could not draw IC %d: %s", ic->ic, strerror(-err));
+		}
+	}
+
+	_dirty_ics = waiting;
+
+	/* the requests are sent without waiting for the X server */
+	return drawn > 0 ? x_handler_flush(xhandler) : 0;
+}
+
+int input_context_commit(input_context_t *ic)
+{
+	struct iovec stack_iov[INPUT_CONTEXT_COMMIT_IOV];
+	struct iovec *iov;
+	int num_iov;
+	int err;
+
+	/* the output is sent straight from the segments and candidates */
+	if ((num_iov = preedit_get_output(ic->preedit, NULL, 0)) < 0) {
+		return num_iov;
+	}
+
+	/* the client must remove the preedit before it inserts the committed string */
+	if (ic->callbacks && (err = _input_context_preedit_done(ic)) < 0) {
 		return err;
 	}
 
-	err = x_handler_set_text_property(xhandler, ic->window, "MWM_HINT",
-	                                  strlen(hint) ? hint : " ");
-	free(hint);
+	iov = stack_iov;
+
+	if (num_iov > INPUT_CONTEXT_COMMIT_IOV &&
+	    !(iov = calloc(num_iov, sizeof(*iov)))) {
+		return -ENOMEM;
+	}
+
+	if ((num_iov = preedit_get_output(ic->preedit, iov, num_iov)) >= 0 &&
+	    (err = xim_client_commit(ic->client, ic->im, ic->ic, iov, num_iov)) >= 0) {
+		err = preedit_clear(ic->preedit);
+	} else if (num_iov < 0) {
+		err = num_iov;
+	}
+
+	if (iov != stack_iov) {
+		free(iov);
+	}
 
 	return err;
 }
 
-int input_context_commit(input_context_t *ic)
+/*
+ * Empties the preedit when the client resets the IC. The client throws
+ * away what it has drawn, so the text that was being edited is returned
+ * through text and len, which remain valid until the IC is drawn again.
+ */
+int input_context_reset(input_context_t *ic, const char **text, size_t *len)
 {
-	char utf8[2048];
-	int utf8_len;
 	int err;
 
-	if ((utf8_len = preedit_get_output(ic->preedit, utf8, sizeof(utf8))) < 0) {
-		return utf8_len;
+	if (!ic || !text || !len) {
+		return -EINVAL;
 	}
 
-	if ((err = xim_client_commit(ic->client, ic->im, ic->ic, utf8, utf8_len)) < 0) {
+	if ((err = preedit_get_text(ic->preedit, &ic->text)) < 0 ||
+	    (err = preedit_clear(ic->preedit)) < 0) {
 		return err;
 	}
 
-	return preedit_clear(ic->preedit);
+	/* the client's preedit ends with the reset, without XIM_PREEDIT_DONE */
+	ic->drawn.len = 0;
+	ic->drawn.num_chars = 0;
+	ic->drawn.caret = 0;
+	ic->preedit_started = 0;
+
+	*text = ic->text.data;
+	*len = ic->text.len;
+
+	return input_context_redraw(ic);
 }
@@ -32,7 +32,7 @@ typedef struct input_method input_method_t;
 int input_context_new(input_context_t **dst, xim_client_t *client, const int im, const int ic);
 int input_context_free(input_context_t **ic);
 int input_context_set_attribute(input_context_t *ic, attr_value_t *val);
-int input_context_get_attribute(input_context_t *ic, int id, attr_value_t **val);
+int input_context_get_attribute(input_context_t *ic, int id, const attr_value_t **val);
 
 int input_context_set_data(input_context_t *ic, void *priv);
 int input_context_get_data(input_context_t *ic, void **priv);
@@ -40,6 +40,11 @@ int input_context_get_im(input_context_t *ic);
 int input_context_get_ic(input_context_t *ic);
 int input_context_get_client(input_context_t *ic, xim_client_t **client);
 
+int input_context_set_active(input_context_t *ic, const int active);
+int input_context_is_active(const input_context_t *ic);
+int input_context_set_focus(input_context_t *ic, const int focused);
+int input_context_update_event_mask(input_context_t *ic);
+
 int input_context_insert(input_context_t *ic, const char_t chr);
 int input_context_erase(input_context_t *ic, int dir);
 
@@ -50,11 +55,14 @@ int input_context_cursor_move(input_context_t *ic, const short segment, const sh
 
 int input_context_move_candidate(input_context_t *ic, const int dir);
 int input_context_select_candidate(input_context_t *ic, const unsigned int candidate);
+int input_context_move_candidate_page(input_context_t *ic, const int dir);
 
 int input_context_move_segment(input_context_t *ic, const int dir);
 int input_context_insert_segment(input_context_t *ic);
 
-int input_context_redraw(const input_context_t *ic);
+int input_context_redraw(input_context_t *ic);
+int input_context_draw_pending(void);
 int input_context_commit(input_context_t *ic);
+int input_context_reset(input_context_t *ic, const char **text, size_t *len);
 
 #endif /* INPUTCONTEXT_H */
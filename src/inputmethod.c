@@ -29,6 +29,9 @@
 #include <stdlib.h>
 #include <string.h>
 
+/* Largest message that a client will accept from us in one piece */
+#define IM_REPLY_MAX 1024
+
 static input_method_t _null_im = {
 	.locale = "invalid"
 };
@@ -40,6 +43,129 @@ static input_method_t *_input_methods[] = {
 	&_jkim
 };
 
+static int _encode_reply(input_method_t *im, const im_reply_t reply, xim_msg_t *msg)
+{
+	uint8_t buffer[IM_REPLY_MAX];
+	uint8_t *data;
+	int len;
+
+	if ((len = xim_msg_encode(msg, buffer, sizeof(buffer))) < 0) {
+		return len;
+	}
+
+	if (!(data = malloc(len))) {
+		return -ENOMEM;
+	}
+
+	memcpy(data, buffer, len);
+	im->replies[reply].data = data;
+	im->replies[reply].len = len;
+
+	return 0;
+}
+
+static int _encode_open_reply(input_method_t *im)
+{
+	xim_msg_open_reply_t msg;
+	int err;
+
+	msg.hdr.type = XIM_OPEN_REPLY;
+	msg.hdr.subtype = 0;
+	msg.id = 0;
+	msg.im_attrs = NULL;
+	msg.ic_attrs = NULL;
+
+	if ((err = input_method_get_im_attrs(im, &msg.im_attrs)) < 0 ||
+	    (err = input_method_get_ic_attrs(im, &msg.ic_attrs)) < 0) {
+		goto cleanup;
+	}
+
+	err = _encode_reply(im, IM_REPLY_OPEN, (xim_msg_t*)&msg);
+
+cleanup:
+	attrs_free(&msg.im_attrs);
+	attrs_free(&msg.ic_attrs);
+
+	return err;
+}
+
+static int _encode_register_triggerkeys(input_method_t *im)
+{
+	xim_msg_register_triggerkeys_t msg;
+	trigger_key_t keys[IM_TRIGGERKEY_MAX];
+	int num_keys;
+
+	/* IMs without trigger keys don't send this message at all */
+	if ((num_keys = input_method_get_trigger_keys(im, keys, IM_TRIGGERKEY_MAX)) <= 0) {
+		return num_keys;
+	}
+
+	msg.hdr.type = XIM_REGISTER_TRIGGERKEYS;
+	msg.hdr.subtype = 0;
+	msg.im = 0;
+
+	/* the same keys turn conversion on and off */
+	msg.num_on_keys = num_keys;
+	msg.on_keys = keys;
+	msg.num_off_keys = num_keys;
+	msg.off_keys = keys;
+
+	return _encode_reply(im, IM_REPLY_REGISTER_TRIGGERKEYS, (xim_msg_t*)&msg);
+}
+
+static int _encode_query_extension_reply(input_method_t *im)
+{
+	xim_msg_query_extension_reply_t msg;
+
+	msg.hdr.type = XIM_QUERY_EXTENSION_REPLY;
+	msg.hdr.subtype = 0;
+	msg.im = 0;
+	msg.exts = im->exts;
+
+	return _encode_reply(im, IM_REPLY_QUERY_EXTENSION, (xim_msg_t*)&msg);
+}
+
+int input_method_init(void)
+{
+	int err;
+	int i;
+
+	for (i = 0; i < (sizeof(_input_methods) / sizeof(_input_methods[0])); i++) {
+		input_method_t *im;
+
+		im = _input_methods[i];
+
+		if ((err = _encode_open_reply(im)) < 0 ||
+		    (err = _encode_register_triggerkeys(im)) < 0 ||
+		    (err = _encode_query_extension_reply(im)) < 0) {
+			input_method_fini();
+			return err;
+		}
+	}
+
+	return 0;
+}
+
+void input_method_fini(void)
+{
+	int i;
+	int j;
+
+	for (i = 0; i < (sizeof(_input_methods) / sizeof(_input_methods[0])); i++) {
+		input_method_t *im;
+
+		im = _input_methods[i];
+
+		for (j = 0; j < IM_REPLY_LAST; j++) {
+			free(im->replies[j].data);
+			im->replies[j].data = NULL;
+			im->replies[j].len = 0;
+		}
+	}
+
+	return;
+}
+
 input_method_t* input_method_for_locale(const char *locale)
 {
 	int i;
@@ -171,6 +297,83 @@ int input_method_get_ic_attrs(input_method_t *im, attr_t ***dst)
 	return 0;
 }
 
+int input_method_get_trigger_keys(input_method_t *im, trigger_key_t *keys, const int max_keys)
+{
+	int num_keys;
+	int key;
+	int mod;
+
+	if (!im || !keys) {
+		return -EINVAL;
+	}
+
+	/* an IM that can't be switched on and off doesn't have trigger keys */
+	if (!im->cmds[CMD_ONOFF]) {
+		return 0;
+	}
+
+	num_keys = 0;
+
+	for (key = 0; key < (sizeof(config_keybindings) / sizeof(config_keybindings[0])); key++) {
+		for (mod = 0; mod < (sizeof(config_keybindings[0]) / sizeof(config_keybindings[0][0])); mod++) {
+			keysym_t ks;
+
+			if (config_keybindings[key][mod].cmd != CMD_ONOFF) {
+				continue;
+			}
+
+			if (num_keys >= max_keys) {
+				return -EOVERFLOW;
+			}
+
+			ks.key = (keycode_t)key;
+			ks.mod = (modmask_t)mod;
+
+			if (keysym_to_trigger_key(&ks, &keys[num_keys]) == 0) {
+				num_keys++;
+			}
+		}
+	}
+
+	return num_keys;
+}
+
+int input_method_get_reply(input_method_t *im, const im_reply_t reply,
+                           const uint8_t **data, size_t *len)
+{
+	if (!im || reply < 0 || reply >= IM_REPLY_LAST || !data || !len) {
+		return -EINVAL;
+	}
+
+	*data = im->replies[reply].data;
+	*len = im->replies[reply].len;
+
+	return 0;
+}
+
+uint32_t input_method_get_event_mask(input_method_t *im, const int active)
+{
+	trigger_key_t keys[IM_TRIGGERKEY_MAX];
+
+	/*
+	 * Inactive contexts only need to forward the trigger keys, and those
+	 * are handled by XIM_TRIGGER_NOTIFY. Without trigger keys, however,
+	 * the client has to forward everything or we would never see the
+	 * key that turns the context back on.
+	 */
+	if (active || input_method_get_trigger_keys(im, keys, IM_TRIGGERKEY_MAX) <= 0) {
+		return KeyPressMask;
+	}
+
+	return 0;
+}
+
+uint32_t input_method_get_sync_mask(input_method_t *im, const int active)
+{
+	/* events of asynchronous IMs are forwarded without XIM_SYNC_REPLY */
+	return im->synchronous ? input_method_get_event_mask(im, active) : 0;
+}
+
 int input_method_handle_key(input_method_t *im, input_context_t *ic, keysym_t *ks)
 {
 	cmd_def_t *binding;
@@ -182,7 +385,7 @@ int input_method_handle_key(input_method_t *im, input_context_t *ic, keysym_t *k
 
 	if (im->cmds[binding->cmd]) {
 		err = im->cmds[binding->cmd](im, ic, &binding->arg);
-	} else if (im->active) {
+	} else if (input_context_is_active(ic)) {
 		assert(input_context_get_language(ic, &ic_lang) == 0);
 
 		if (config_keysym_to_char(&chr, ks, ic_lang) < 0) {
@@ -195,7 +398,7 @@ int input_method_handle_key(input_method_t *im, input_context_t *ic, keysym_t *k
 			err = input_context_insert(ic, chr);
 		}
 	} else {
-		/* IM is not active -> return event to sender */
+		/* IC is not active -> return event to sender */
 		err = -1;
 	}
 
@@ -31,9 +31,17 @@
 
 #define IM_IMATTR_MAX 8
 #define IM_ICATTR_MAX 8
+#define IM_TRIGGERKEY_MAX 8
 
 typedef struct input_method input_method_t;
 
+typedef enum {
+	IM_REPLY_OPEN = 0,
+	IM_REPLY_REGISTER_TRIGGERKEYS,
+	IM_REPLY_QUERY_EXTENSION,
+	IM_REPLY_LAST
+} im_reply_t;
+
 struct input_method {
 	/* The input style that is implemented by the input method */
 	XIMStyle input_style;
@@ -60,18 +68,42 @@ struct input_method {
 	const char **encodings;
 
 	cmd_func_t *cmds[CMD_LAST];
+
+	/* Whether new input contexts start out with conversion turned on */
 	unsigned active;
 
+	/*
+	 * Whether clients must wait for each forwarded event to be processed.
+	 * Asynchronous IMs let clients pipeline key events.
+	 */
+	unsigned synchronous;
+
 	/* Event handler called after an Input Context has been created */
 	int (*ic_created)(input_method_t*, input_context_t*);
 
 	/* Event handler called for each XIM_FORWARD_EVENT message */
 	int (*event)(input_method_t*, input_context_t*, keysym_t*);
+
+	/*
+	 * Replies that are the same for every client, encoded once by
+	 * input_method_init(). The IM id is left zero.
+	 */
+	struct {
+		uint8_t *data;
+		size_t len;
+	} replies[IM_REPLY_LAST];
 };
 
+int input_method_init(void);
+void input_method_fini(void);
 input_method_t* input_method_for_locale(const char *locale);
 int input_method_get_im_attrs(input_method_t *im, attr_t ***attrs);
 int input_method_get_ic_attrs(input_method_t *im, attr_t ***attrs);
+int input_method_get_trigger_keys(input_method_t *im, trigger_key_t *keys, const int max_keys);
+int input_method_get_reply(input_method_t *im, const im_reply_t reply,
+                           const uint8_t **data, size_t *len);
+uint32_t input_method_get_event_mask(input_method_t *im, const int active);
+uint32_t input_method_get_sync_mask(input_method_t *im, const int active);
 int input_method_handle_key(input_method_t *im, input_context_t *ic, keysym_t *ks);
 
 #endif /* INPUTMETHOD_H */
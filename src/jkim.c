@@ -19,6 +19,7 @@
  */
 
 #include "keysym.h"
+#include "log.h"
 #include "ximtypes.h"
 #include "inputmethod.h"
 #include <errno.h>
@@ -30,7 +31,8 @@
 struct XIMSTYLES {
 	uint16_t num_styles;
 	uint16_t unused;
-	XIMStyle style[2];
+	/* CARD32 on the wire, XIMStyle is wider on LP64 */
+	uint32_t style[3];
 } __attribute__((packed));
 
 static int _jkim_commit(input_method_t *im, input_context_t *ic, cmd_arg_t *arg);
@@ -39,6 +41,7 @@ static int _jkim_lang_switch(input_method_t *im, input_context_t *ic, cmd_arg_t
 static int _jkim_cursor_move(input_method_t *im, input_context_t *ic, cmd_arg_t *arg);
 static int _jkim_candidate_move(input_method_t *im, input_context_t *ic, cmd_arg_t *arg);
 static int _jkim_candidate_select(input_method_t *im, input_context_t *ic, cmd_arg_t *arg);
+static int _jkim_candidate_page(input_method_t *im, input_context_t *ic, cmd_arg_t *arg);
 static int _jkim_segment_move(input_method_t *im, input_context_t *ic, cmd_arg_t *arg);
 static int _jkim_segment_resize(input_method_t *im, input_context_t *ic, cmd_arg_t *arg);
 static int _jkim_segment_new(input_method_t *im, input_context_t *ic, cmd_arg_t *arg);
@@ -51,10 +54,12 @@ static const attr_t _im_attr_inputstyle = {
 };
 
 static struct XIMSTYLES _im_attrvalue_inputstyle_data = {
-	.num_styles = 2,
+	.num_styles = 3,
 	.style      = {
 		XIMPreeditNothing | XIMStatusNothing,
-		XIMPreeditNothing | XIMStatusNone
+		XIMPreeditNothing | XIMStatusNone,
+		/* on-the-spot, the client draws the preedit */
+		XIMPreeditCallbacks | XIMStatusNothing
 	}
 };
 
@@ -90,7 +95,8 @@ static const attr_t _ic_attr_nlseparator = {
 	.name = XNSeparatorofNestedList
 };
 
-static const uint32_t _ic_attrvalue_filterevents_data = 0;
+/* clients pass key presses through XFilterEvent() and forward them to us */
+static const uint32_t _ic_attrvalue_filterevents_data = KeyPressMask;
 static attr_value_t _ic_attrvalue_filterevents = {
 	.id = 4,
 	.len = sizeof(_ic_attrvalue_filterevents_data),
@@ -144,12 +150,14 @@ input_method_t _jkim = {
 		[CMD_CURSOR_MOVE]      = (cmd_func_t*)_jkim_cursor_move,
 		[CMD_CANDIDATE_MOVE]   = (cmd_func_t*)_jkim_candidate_move,
 		[CMD_CANDIDATE_SELECT] = (cmd_func_t*)_jkim_candidate_select,
+		[CMD_CANDIDATE_PAGE]   = (cmd_func_t*)_jkim_candidate_page,
 		[CMD_SEGMENT_MOVE]     = (cmd_func_t*)_jkim_segment_move,
 		[CMD_SEGMENT_RESIZE]   = (cmd_func_t*)_jkim_segment_resize,
 		[CMD_SEGMENT_NEW]      = (cmd_func_t*)_jkim_segment_new,
 		[CMD_ONOFF]            = (cmd_func_t*)_jkim_toggle_onoff,
 	},
 	.active = 1,
+	.synchronous = 0,
 
 	/* no extensions */
 	.exts = NULL,
@@ -165,18 +173,18 @@ static int _jkim_lang_switch(input_method_t *im, input_context_t *ic, cmd_arg_t
 		[LANG_KR] = "LANG_KR",
 	};
 
-	if (!im->active) {
+	if (!input_context_is_active(ic)) {
 		return -EAGAIN;
 	}
 
 	lang = (lang_t)arg->u;
-	fprintf(stderr, "Switching context %p to %s\n", (void*)ic, _langs[lang]);
+	log_debug("Switching context %p to %s", (void*)ic, _langs[lang]);
 	return input_context_set_language(ic, lang);
 }
 
 static int _jkim_cursor_move(input_method_t *im, input_context_t *ic, cmd_arg_t *arg)
 {
-	if (!im->active) {
+	if (!input_context_is_active(ic)) {
 		return -EAGAIN;
 	}
 
@@ -185,7 +193,7 @@ static int _jkim_cursor_move(input_method_t *im, input_context_t *ic, cmd_arg_t
 
 static int _jkim_delete(input_method_t *im, input_context_t *ic, cmd_arg_t *arg)
 {
-	if (!im->active) {
+	if (!input_context_is_active(ic)) {
 		return -EAGAIN;
 	}
 
@@ -194,7 +202,7 @@ static int _jkim_delete(input_method_t *im, input_context_t *ic, cmd_arg_t *arg)
 
 static int _jkim_commit(input_method_t *im, input_context_t *ic, cmd_arg_t *arg)
 {
-	if (!im->active) {
+	if (!input_context_is_active(ic)) {
 		return -EAGAIN;
 	}
 
@@ -203,7 +211,7 @@ static int _jkim_commit(input_method_t *im, input_context_t *ic, cmd_arg_t *arg)
 
 static int _jkim_candidate_move(input_method_t *im, input_context_t *ic, cmd_arg_t *arg)
 {
-	if (!im->active) {
+	if (!input_context_is_active(ic)) {
 		return -EAGAIN;
 	}
 
@@ -212,16 +220,25 @@ static int _jkim_candidate_move(input_method_t *im, input_context_t *ic, cmd_arg
 
 static int _jkim_candidate_select(input_method_t *im, input_context_t *ic, cmd_arg_t *arg)
 {
-	if (!im->active) {
+	if (!input_context_is_active(ic)) {
 		return -EAGAIN;
 	}
 
 	return input_context_select_candidate(ic, arg->u);
 }
 
+static int _jkim_candidate_page(input_method_t *im, input_context_t *ic, cmd_arg_t *arg)
+{
+	if (!input_context_is_active(ic)) {
+		return -EAGAIN;
+	}
+
+	return input_context_move_candidate_page(ic, arg->i);
+}
+
 static int _jkim_segment_move(input_method_t *im, input_context_t *ic, cmd_arg_t *arg)
 {
-	if (!im->active) {
+	if (!input_context_is_active(ic)) {
 		return -EAGAIN;
 	}
 
@@ -230,7 +247,7 @@ static int _jkim_segment_move(input_method_t *im, input_context_t *ic, cmd_arg_t
 
 static int _jkim_segment_resize(input_method_t *im, input_context_t *ic, cmd_arg_t *arg)
 {
-	if (!im->active) {
+	if (!input_context_is_active(ic)) {
 		return -EAGAIN;
 	}
 
@@ -239,7 +256,7 @@ static int _jkim_segment_resize(input_method_t *im, input_context_t *ic, cmd_arg
 
 static int _jkim_segment_new(input_method_t *im, input_context_t *ic, cmd_arg_t *arg)
 {
-	if (!im->active) {
+	if (!input_context_is_active(ic)) {
 		return -EAGAIN;
 	}
 
@@ -248,6 +265,5 @@ static int _jkim_segment_new(input_method_t *im, input_context_t *ic, cmd_arg_t
 
 static int _jkim_toggle_onoff(input_method_t *im, input_context_t *ic, cmd_arg_t *arg)
 {
-	im->active = !im->active;
-	return 0;
+	return input_context_set_active(ic, !input_context_is_active(ic));
 }
@@ -21,6 +21,7 @@
 #include "keysym.h"
 #include <errno.h>
 #include <X11/X.h>
+#include <X11/keysym.h>
 
 static const keycode_t _keymap[] = {
 	[0]   = KEY_INVALID,
@@ -159,6 +160,36 @@ static const keycode_t _keymap[] = {
 	[255] = KEY_INVALID
 };
 
+/* X KeySyms of the keys that are sensible as trigger keys */
+static const KeySym _xkeysyms[] = {
+	[KEY_ESC]       = XK_Escape,
+	[KEY_F1]        = XK_F1,
+	[KEY_F2]        = XK_F2,
+	[KEY_F3]        = XK_F3,
+	[KEY_F4]        = XK_F4,
+	[KEY_F5]        = XK_F5,
+	[KEY_F6]        = XK_F6,
+	[KEY_F7]        = XK_F7,
+	[KEY_F8]        = XK_F8,
+	[KEY_F9]        = XK_F9,
+	[KEY_F10]       = XK_F10,
+	[KEY_F11]       = XK_F11,
+	[KEY_F12]       = XK_F12,
+	[KEY_CAPSLOCK]  = XK_Caps_Lock,
+	[KEY_TAB]       = XK_Tab,
+	[KEY_ZENKAKU]   = XK_Zenkaku_Hankaku,
+	[KEY_KANA]      = XK_Hiragana_Katakana,
+	[KEY_HENKAN]    = XK_Henkan,
+	[KEY_MUHENKAN]  = XK_Muhenkan,
+	[KEY_INSERT]    = XK_Insert,
+	[KEY_RETURN]    = XK_Return,
+	[KEY_SPACE]     = XK_space,
+	[KEY_SCRLK]     = XK_Scroll_Lock,
+	[KEY_PAUSE]     = XK_Pause,
+	[KEY_MENU]      = XK_Menu,
+	[KEY_LOCK]      = NoSymbol
+};
+
 static keycode_t keycode_from_detail(const int detail)
 {
 	int idx;
@@ -194,6 +225,28 @@ static modmask_t modmask_from_state(const int state)
 	return mask;
 }
 
+static uint32_t state_from_modmask(const modmask_t mask)
+{
+	uint32_t state;
+
+	state = 0;
+
+	if (mask & MOD_SHIFT) {
+		state |= ShiftMask;
+	}
+	if (mask & MOD_CTRL) {
+		state |= ControlMask;
+	}
+	if (mask & MOD_ALT) {
+		state |= Mod1Mask;
+	}
+	if (mask & MOD_SUPER) {
+		state |= Mod4Mask;
+	}
+
+	return state;
+}
+
 int keysym_from_event(keysym_t *keysym, struct XCoreKeyEvent *event)
 {
 	keycode_t key;
@@ -207,3 +260,22 @@ int keysym_from_event(keysym_t *keysym, struct XCoreKeyEvent *event)
 
 	return 0;
 }
+
+int keysym_to_trigger_key(const keysym_t *keysym, trigger_key_t *key)
+{
+	if (!keysym || !key) {
+		return -EINVAL;
+	}
+
+	if (keysym->key >= (sizeof(_xkeysyms) / sizeof(_xkeysyms[0])) ||
+	    _xkeysyms[keysym->key] == NoSymbol) {
+		return -ENOENT;
+	}
+
+	key->keysym = _xkeysyms[keysym->key];
+	key->modifier = state_from_modmask(keysym->mod);
+	/* lock modifiers must not keep the trigger from matching */
+	key->modifier_mask = state_from_modmask(MOD_SHIFT | MOD_CTRL | MOD_ALT | MOD_SUPER);
+
+	return 0;
+}
@@ -150,5 +150,6 @@ typedef struct {
 } keysym_t;
 
 int keysym_from_event(keysym_t *keysym, struct XCoreKeyEvent *event);
+int keysym_to_trigger_key(const keysym_t *keysym, trigger_key_t *key);
 
 #endif /* KEYSYM_H */
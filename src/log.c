@@ -0,0 +1,254 @@
+/*
+ * log.c - This file is part of mxim
+ * Copyright (C) 2025 Matthias Kruk
+ *
+ * Mxim is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation; either version 3, or (at your
+ * option) any later version.
+ *
+ * Mxim is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Mxim; see the file COPYING.  If not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include "log.h"
+#include "thread.h"
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+/* Number of messages that can be pending, must be a power of two */
+#define LOG_RING_SIZE 256
+
+/* Longer messages are truncated */
+#define LOG_TEXT_MAX  256
+
+/*
+ * A slot in the ring. The sequence number tells the producers and the
+ * consumer whose turn it is: a slot at position pos is free if its seq is
+ * pos, and holds a message if its seq is pos + 1.
+ */
+struct log_entry {
+	unsigned int seq;
+
+	log_level_t level;
+	const char *func;
+	struct timespec time;
+	char text[LOG_TEXT_MAX];
+};
+
+static struct {
+	struct log_entry entries[LOG_RING_SIZE];
+
+	unsigned int head;     /* next slot to write, shared by all producers */
+	unsigned int tail;     /* next slot to read, only used by the consumer */
+	unsigned int dropped;  /* messages lost because the ring was full */
+
+	int running;
+	semaphore_t pending;
+	thread_t *thread;
+} _log;
+
+log_level_t log_level = LOG_LEVEL_INFO;
+
+static const char *_level_names[LOG_LEVEL_NUM] = {
+	[LOG_LEVEL_ERROR]   = "error",
+	[LOG_LEVEL_WARNING] = "warning",
+	[LOG_LEVEL_INFO]    = "info",
+	[LOG_LEVEL_DEBUG]   = "debug"
+};
+
+static void _log_print(const log_level_t level, const char *func,
+                       const struct timespec *time, const char *text)
+{
+	struct tm tm;
+
+	localtime_r(&time->tv_sec, &tm);
+
+	fprintf(stderr, "%02d:%02d:%02d.%03ld %-7s %s: %s\n",
+	        tm.tm_hour, tm.tm_min, tm.tm_sec, time->tv_nsec / 1000000,
+	        _level_names[level], func, text);
+}
+
+static void _log_drain(void)
+{
+	struct log_entry *entry;
+	unsigned int dropped;
+
+	for (;;) {
+		entry = &_log.entries[_log.tail & (LOG_RING_SIZE - 1)];
+
+		if (__atomic_load_n(&entry->seq, __ATOMIC_ACQUIRE) != _log.tail + 1) {
+			break;
+		}
+
+		_log_print(entry->level, entry->func, &entry->time, entry->text);
+
+		/* hand the slot back to the producers, one lap later */
+		__atomic_store_n(&entry->seq, _log.tail + LOG_RING_SIZE, __ATOMIC_RELEASE);
+		_log.tail++;
+	}
+
+	if ((dropped = __atomic_exchange_n(&_log.dropped, 0, __ATOMIC_RELAXED)) > 0) {
+		fprintf(stderr, "Log overflow, %u messages dropped\n", dropped);
+	}
+
+	fflush(stderr);
+}
+
+static void* _log_run(void *arg)
+{
+	while (!thread_is_stopping(_log.thread)) {
+		if (sem_wait(&_log.pending) < 0 && errno != EINTR) {
+			break;
+		}
+
+		_log_drain();
+	}
+
+	return NULL;
+}
+
+int log_init(const log_level_t level)
+{
+	unsigned int i;
+	int err;
+
+	if (!log_level_is_valid(level)) {
+		return -EINVAL;
+	}
+
+	if (_log.thread) {
+		return -EALREADY;
+	}
+
+	log_level = level;
+
+	for (i = 0; i < LOG_RING_SIZE; i++) {
+		_log.entries[i].seq = i;
+	}
+	_log.head = 0;
+	_log.tail = 0;
+
+	if (sem_init(&_log.pending, 0, 0) < 0) {
+		return -errno;
+	}
+
+	if ((err = thread_new(&_log.thread)) < 0) {
+		goto cleanup;
+	}
+
+	__atomic_store_n(&_log.running, 1, __ATOMIC_RELEASE);
+
+	if ((err = thread_start(_log.thread, _log_run, NULL)) < 0) {
+		__atomic_store_n(&_log.running, 0, __ATOMIC_RELEASE);
+		thread_free(&_log.thread);
+	}
+
+cleanup:
+	if (err < 0) {
+		sem_destroy(&_log.pending);
+	}
+
+	return err;
+}
+
+int log_fini(void)
+{
+	if (!_log.thread) {
+		return -EALREADY;
+	}
+
+	__atomic_store_n(&_log.running, 0, __ATOMIC_RELEASE);
+
+	thread_stop(_log.thread);
+	sem_post(&_log.pending);
+	thread_join(_log.thread, NULL);
+	thread_free(&_log.thread);
+
+	/* write whatever came in while the thread was shutting down */
+	_log_drain();
+	sem_destroy(&_log.pending);
+
+	return 0;
+}
+
+int log_parse_level(const char *name, log_level_t *level)
+{
+	int i;
+
+	if (!name || !level) {
+		return -EINVAL;
+	}
+
+	for (i = 0; i < LOG_LEVEL_NUM; i++) {
+		if (strcmp(name, _level_names[i]) == 0) {
+			*level = (log_level_t)i;
+			return 0;
+		}
+	}
+
+	return -ENOENT;
+}
+
+void log_write(const log_level_t level, const char *func, const char *fmt, ...)
+{
+	struct log_entry *entry;
+	struct timespec now;
+	unsigned int pos;
+	va_list args;
+	int diff;
+
+	clock_gettime(CLOCK_REALTIME, &now);
+
+	if (!__atomic_load_n(&_log.running, __ATOMIC_ACQUIRE)) {
+		char text[LOG_TEXT_MAX];
+
+		va_start(args, fmt);
+		vsnprintf(text, sizeof(text), fmt, args);
+		va_end(args);
+
+		_log_print(level, func, &now, text);
+		return;
+	}
+
+	pos = __atomic_load_n(&_log.head, __ATOMIC_RELAXED);
+
+	/* claim a slot without taking a lock, or drop the message if there is none */
+	for (;;) {
+		entry = &_log.entries[pos & (LOG_RING_SIZE - 1)];
+		diff = (int)(__atomic_load_n(&entry->seq, __ATOMIC_ACQUIRE) - pos);
+
+		if (diff == 0) {
+			if (__atomic_compare_exchange_n(&_log.head, &pos, pos + 1, 1,
+			                                __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+				break;
+			}
+		} else if (diff < 0) {
+			__atomic_add_fetch(&_log.dropped, 1, __ATOMIC_RELAXED);
+			return;
+		} else {
+			pos = __atomic_load_n(&_log.head, __ATOMIC_RELAXED);
+		}
+	}
+
+	entry->level = level;
+	entry->func = func;
+	entry->time = now;
+
+	va_start(args, fmt);
+	vsnprintf(entry->text, sizeof(entry->text), fmt, args);
+	va_end(args);
+
+	__atomic_store_n(&entry->seq, pos + 1, __ATOMIC_RELEASE);
+	sem_post(&_log.pending);
+}
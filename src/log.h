@@ -0,0 +1,77 @@
+/*
+ * log.h - This file is part of mxim
+ * Copyright (C) 2025 Matthias Kruk
+ *
+ * Mxim is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation; either version 3, or (at your
+ * option) any later version.
+ *
+ * Mxim is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Mxim; see the file COPYING.  If not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#ifndef LOG_H
+#define LOG_H
+
+typedef enum {
+	LOG_LEVEL_ERROR = 0,
+	LOG_LEVEL_WARNING,
+	LOG_LEVEL_INFO,
+	LOG_LEVEL_DEBUG,
+	LOG_LEVEL_NUM
+} log_level_t;
+
+/*
+ * Messages above this level are removed at compile time. Debug messages
+ * may contain what the user typed, so they are only built into debug
+ * builds by default.
+ */
+#ifndef LOG_LEVEL_MAX
+#if MXIM_DEBUG
+#define LOG_LEVEL_MAX LOG_LEVEL_DEBUG
+#else /* !MXIM_DEBUG */
+#define LOG_LEVEL_MAX LOG_LEVEL_INFO
+#endif /* !MXIM_DEBUG */
+#endif /* !LOG_LEVEL_MAX */
+
+#define log_level_is_valid(level) ((level) >= 0 && (level) < LOG_LEVEL_NUM)
+
+/* Messages above this level are dropped at run time */
+extern log_level_t log_level;
+
+#define log_enabled(level) ((level) <= LOG_LEVEL_MAX && (level) <= log_level)
+
+/* The arguments are not evaluated unless the level is enabled */
+#define log_at(level, ...)                                      \
+	do {                                                    \
+		if (log_enabled(level)) {                       \
+			log_write((level), __func__, __VA_ARGS__); \
+		}                                               \
+	} while (0)
+
+#define log_error(...) log_at(LOG_LEVEL_ERROR, __VA_ARGS__)
+#define log_warn(...)  log_at(LOG_LEVEL_WARNING, __VA_ARGS__)
+#define log_info(...)  log_at(LOG_LEVEL_INFO, __VA_ARGS__)
+#define log_debug(...) log_at(LOG_LEVEL_DEBUG, __VA_ARGS__)
+
+/*
+ * Starts the thread that writes messages to stderr. Until then, and after
+ * log_fini(), messages are written by the thread that logs them.
+ */
+int log_init(const log_level_t level);
+int log_fini(void);
+
+int log_parse_level(const char *name, log_level_t *level);
+
+void log_write(const log_level_t level, const char *func, const char *fmt, ...)
+	__attribute__((format(printf, 3, 4)));
+
+#endif /* LOG_H */
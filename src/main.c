@@ -19,19 +19,28 @@
  */
 
 #include "aide.h"
+#include "inputmethod.h"
+#include "log.h"
 #include "xhandler.h"
 #include "ximserver.h"
 #include <errno.h>
 #include <getopt.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <limits.h>
 
 #define MXIM_ADDR "127.0.0.1"
 #define MXIM_PORT 1234
-static const char *_cmd_flags = "h";
+#define MXIM_SOCKET "mxim.sock"
+static const char *_cmd_flags = "b:hl:t:";
 
 static struct option _cmd_opts[] = {
-	{ "help", no_argument, 0, 'h' },
+	{ "backlog",   required_argument, 0, 'b' },
+	{ "help",      no_argument,       0, 'h' },
+	{ "log-level", required_argument, 0, 'l' },
+	{ "threads",   required_argument, 0, 't' },
 	{ 0, 0, 0, 0 }
 };
 
@@ -40,25 +49,113 @@ static void _print_usage(const char *name)
 	fprintf(stderr,
 	        "Usage: %s options\n"
 	        "\n"
-	        " -h  --help    Display this text\n",
+	        " -b  --backlog NUM  Queue up to NUM pending connections (default: system limit)\n"
+	        " -h  --help         Display this text\n"
+	        " -l  --log-level LEVEL\n"
+	        "                    Log messages up to LEVEL, one of error, warning,\n"
+	        "                    info, or debug (default: info)\n"
+	        " -t  --threads NUM  Handle clients in NUM threads (default: 1)\n",
 	        name);
 }
 
 x_handler_t *xhandler;
 
+static void _get_socket_path(char *dst, const size_t dst_size)
+{
+	const char *runtime_dir;
+
+	/* the runtime dir is private to the user, so it's the preferred location */
+	if ((runtime_dir = getenv("XDG_RUNTIME_DIR")) && *runtime_dir) {
+		snprintf(dst, dst_size, "%s/" MXIM_SOCKET, runtime_dir);
+	} else {
+		snprintf(dst, dst_size, "/tmp/mxim-%u.sock", (unsigned)getuid());
+	}
+}
+
+static int _listen(xim_server_t *server, const int backlog,
+                   char *transport, const size_t transport_size)
+{
+	char hostname[HOST_NAME_MAX + 1];
+	char path[PATH_MAX];
+	int transport_len;
+	int err;
+
+	transport_len = 0;
+	transport[0] = 0;
+
+	_get_socket_path(path, sizeof(path));
+
+	if (gethostname(hostname, sizeof(hostname)) < 0) {
+		strcpy(hostname, "localhost");
+	}
+	hostname[sizeof(hostname) - 1] = 0;
+
+	/* local clients should prefer the unix socket, so it's advertised first */
+	if ((err = xim_server_listen_local(server, path, backlog)) < 0) {
+		log_warn("Could not listen on %s: %s", path, strerror(-err));
+	} else {
+		transport_len += snprintf(transport + transport_len, transport_size - transport_len,
+		                          "local/%s:%s", hostname, path);
+	}
+
+	if ((err = xim_server_listen_tcp(server, MXIM_ADDR, MXIM_PORT, backlog)) < 0) {
+		log_warn("Could not listen on %s:%d: %s", MXIM_ADDR, MXIM_PORT, strerror(-err));
+	} else if (transport_len < transport_size) {
+		transport_len += snprintf(transport + transport_len, transport_size - transport_len,
+		                          "%stcp/%s:%d", transport_len ? "," : "",
+		                          MXIM_ADDR, MXIM_PORT);
+	}
+
+	if (transport_len == 0) {
+		return -ENOTCONN;
+	}
+
+	return transport_len < transport_size ? 0 : -ENAMETOOLONG;
+}
+
 int main(int argc, char *argv[])
 {
 	xim_server_t *server;
+	char transport[PATH_MAX + HOST_NAME_MAX + 64];
+	int num_threads;
+	int backlog;
 	int ret;
 
+	num_threads = 1;
+	backlog = 0;
+
 	do {
 		ret = getopt_long(argc, argv, _cmd_flags, _cmd_opts, NULL);
 
 		switch (ret) {
+		case 'b':
+			if ((backlog = atoi(optarg)) < 1) {
+				fprintf(stderr, "Backlog must be a positive number\n");
+				return 1;
+			}
+			break;
+
 		case 'h':
 			_print_usage(argv[0]);
 			return 1;
 
+		case 'l':
+			if (log_parse_level(optarg, &log_level) < 0) {
+				fprintf(stderr, "Invalid log level '%s'\n", optarg);
+				return 1;
+			}
+			break;
+
+		case 't':
+			num_threads = atoi(optarg);
+
+			if (num_threads < 1 || num_threads > XIM_SERVER_REACTOR_MAX) {
+				fprintf(stderr, "Number of threads must be between 1 and %d\n",
+				        XIM_SERVER_REACTOR_MAX);
+				return 1;
+			}
+			break;
+
 		case '?':
 			fprintf(stderr, "Unrecognized command line option '%s'\n", optarg);
 			return 1;
@@ -71,36 +168,68 @@ int main(int argc, char *argv[])
 
 	ret = aide_init();
 	if (ret < 0) {
-		fprintf(stderr, "Could not initialize aide: %s\n", strerror(-ret));
+		log_error("Could not initialize aide: %s", strerror(-ret));
+		return 5;
+	}
+	log_debug("Aide initialized");
+
+	ret = input_method_init();
+	if (ret < 0) {
+		log_error("Could not initialize input methods: %s", strerror(-ret));
 		return 5;
 	}
-#if MXIM_DEBUG
-	fprintf(stderr, "Aide initialized\n");
-#endif /* MXIM_DEBUG */
 
 	ret = x_handler_init(&xhandler);
 	if (ret < 0) {
-		fprintf(stderr, "Could not initialize IM handler: %s\n", strerror(-ret));
+		log_error("Could not initialize IM handler: %s", strerror(-ret));
 		return 2;
 	}
 
-	ret = xim_server_init(&server, MXIM_ADDR, MXIM_PORT);
+	ret = xim_server_init(&server, num_threads);
+	if (ret < 0) {
+		log_error("Could not initialize XIM server: %s", strerror(-ret));
+		return 3;
+	}
+
+	ret = _listen(server, backlog, transport, sizeof(transport));
 	if (ret < 0) {
-		fprintf(stderr, "Could not initialize XIM server: %s\n", strerror(-ret));
+		log_error("Could not open any XIM transport: %s", strerror(-ret));
 		return 3;
 	}
 
-	ret = xim_server_start(server);
+	ret = x_handler_set_transport(xhandler, transport);
+	if (ret < 0) {
+		log_error("Could not set XIM transport: %s", strerror(-ret));
+		return 3;
+	}
+
+	/* X events are handled by the first event loop, with the XIM messages */
+	ret = x_handler_attach(xhandler, server);
+	if (ret < 0) {
+		log_error("Could not watch X connection: %s", strerror(-ret));
+		return 2;
+	}
+
+	/* from here on, messages are written by the log thread */
+	ret = log_init(log_level);
+	if (ret < 0) {
+		log_warn("Could not start log thread: %s", strerror(-ret));
+	}
+
+	/* the first event loop runs in this thread */
+	ret = xim_server_run(server);
 	if (ret < 0) {
-		fprintf(stderr, "Could not start XIM server: %s\n", strerror(-ret));
+		log_error("Could not start XIM server: %s", strerror(-ret));
+		log_fini();
 		return 4;
 	}
 
-	x_handler_run(xhandler);
 	ret = xim_server_stop(server);
 
 	x_handler_free(&xhandler);
 	xim_server_free(&server);
+	input_method_fini();
+	log_fini();
 
 	return ret;
 }
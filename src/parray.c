@@ -51,6 +51,7 @@ int parray_free(parray_t **parray)
 		return -EINVAL;
 	}
 
+	free((*parray)->items);
 	free(*parray);
 	*parray = NULL;
 
@@ -22,12 +22,19 @@
 #include "segment.h"
 #include <errno.h>
 #include <stdlib.h>
+#include <string.h>
+#include <X11/Xlib.h>
+
+#define PREEDIT_TEXT_GROW 32
 
 struct preedit {
         segment_t **segments;
 	short num_segments;
 
 	preedit_cursor_t cursor;
+
+	/* the markup of all segments, see preedit_get_input_decorated() */
+	string_t *markup;
 };
 
 int preedit_new(preedit_t **preedit)
@@ -66,6 +73,7 @@ int preedit_free(preedit_t **preedit)
 	}
 	free((*preedit)->segments);
 	(*preedit)->segments = NULL;
+	string_free(&(*preedit)->markup);
 
 	free(*preedit);
 	*preedit = NULL;
@@ -211,6 +219,37 @@ int preedit_clear(preedit_t *preedit)
 	return segment_clear(preedit->segments[0]);
 }
 
+/*
+ * Releases the memory that an empty preedit doesn't need, leaving it in
+ * the state that preedit_new() returns it in.
+ */
+int preedit_trim(preedit_t *preedit)
+{
+	segment_t **segments;
+	int err;
+
+	if (!preedit) {
+		return -EINVAL;
+	}
+
+	if (!preedit_is_empty(preedit)) {
+		return -EBUSY;
+	}
+
+	if ((err = preedit_clear(preedit)) < 0) {
+		return err;
+	}
+
+	/* the segments array is reallocated for every segment, keep the first */
+	if ((segments = realloc(preedit->segments, sizeof(*segments)))) {
+		preedit->segments = segments;
+	}
+
+	string_free(&preedit->markup);
+
+	return segment_trim(preedit->segments[0]);
+}
+
 int preedit_get_input(preedit_t *preedit, char *dst, const size_t dst_size)
 {
 	size_t offset;
@@ -234,9 +273,16 @@ int preedit_get_input(preedit_t *preedit, char *dst, const size_t dst_size)
 	return (int)offset;
 }
 
-int preedit_get_input_decorated(const preedit_t *preedit, char **dst)
+/*
+ * Returns the markup of all segments. Segments are only rendered again if
+ * they changed, the rest is copied from their cache. The markup is owned by
+ * the preedit and valid until the preedit changes.
+ */
+int preedit_get_input_decorated(preedit_t *preedit, const char **dst)
 {
-	string_t *input;
+	const char *segment;
+	int cursor;
+	int len;
 	int err;
 	short i;
 
@@ -244,67 +290,182 @@ int preedit_get_input_decorated(const preedit_t *preedit, char **dst)
 		return -EINVAL;
 	}
 
-	if ((err = string_new(&input)) < 0) {
-		return -ENOMEM;
+	if (!preedit->markup && (err = string_new(&preedit->markup)) < 0) {
+		return err;
 	}
 
+	string_clear(preedit->markup);
+
 	for (i = 0; i < preedit->num_segments; i++) {
-		char *segment;
-		int selected;
-		int cursor;
-		int len;
+		cursor = preedit->cursor.segment == i ? preedit->cursor.offset : -1;
 
-		segment = NULL;
+		if ((len = segment_get_input_decorated(preedit->segments[i],
+		                                       preedit->cursor.segment == i,
+		                                       cursor, &segment)) < 0) {
+			return len;
+		}
 
-		if (preedit->cursor.segment == i) {
-			cursor = preedit->cursor.offset;
-			selected = 1;
-		} else {
-			cursor = -1;
-			selected = 0;
+		if (len > 0 && (err = string_append_utf8(preedit->markup, segment, len)) < 0) {
+			return err;
 		}
+	}
 
-		if ((len = segment_get_input_decorated(preedit->segments[i], selected,
-		                                       cursor, &segment)) < 0) {
-			err = len;
-			goto cleanup;
+	return string_peek_utf8(preedit->markup, dst);
+}
+
+int preedit_get_output(const preedit_t *preedit, struct iovec *iov, const int max_iov)
+{
+	int num_iov;
+	int i;
+
+	for (num_iov = i = 0; i < preedit->num_segments; i++) {
+		int n;
+
+		if ((n = segment_get_output(preedit->segments[i],
+		                            num_iov < max_iov ? iov + num_iov : NULL,
+		                            num_iov < max_iov ? max_iov - num_iov : 0)) < 0) {
+			return n;
 		}
 
-		err = string_append_utf8(input, segment, len);
-		free(segment);
+		num_iov += n;
+	}
 
-		if (err < 0) {
-			goto cleanup;
+	return num_iov;
+}
+
+static int _preedit_text_reserve(preedit_text_t *text, const size_t len)
+{
+	uint32_t *offsets;
+	uint32_t *feedback;
+	size_t size;
+	char *data;
+	int max;
+
+	/* UTF-8 needs at least one byte per character */
+	if (text->len + len > text->size) {
+		size = text->len + len + PREEDIT_TEXT_GROW;
+
+		if (!(data = realloc(text->data, size))) {
+			return -ENOMEM;
 		}
+
+		text->data = data;
+		text->size = size;
 	}
 
-cleanup:
-	if (err >= 0) {
-		err = string_get_utf8(input, dst);
+	if (text->num_chars + (int)len >= text->max_chars) {
+		max = text->num_chars + (int)len + PREEDIT_TEXT_GROW;
+
+		if (!(offsets = realloc(text->offsets, max * sizeof(*offsets)))) {
+			return -ENOMEM;
+		}
+		text->offsets = offsets;
+
+		if (!(feedback = realloc(text->feedback, max * sizeof(*feedback)))) {
+			return -ENOMEM;
+		}
+		text->feedback = feedback;
+		text->max_chars = max;
 	}
-	string_free(&input);
 
-	return err;
+	return 0;
 }
 
-int preedit_get_output(const preedit_t *preedit, char *dst, const size_t dst_size)
+static int _preedit_text_append(preedit_text_t *text, const char *utf8, const size_t len,
+                                const uint32_t feedback)
 {
-	int offset;
+	size_t i;
+	int err;
+
+	if ((err = _preedit_text_reserve(text, len)) < 0) {
+		return err;
+	}
+
+	for (i = 0; i < len; i++) {
+		/* a character starts at every byte that isn't a continuation byte */
+		if ((utf8[i] & 0xc0) != 0x80) {
+			text->offsets[text->num_chars] = text->len + i;
+			text->feedback[text->num_chars] = feedback;
+			text->num_chars++;
+		}
+	}
+
+	memcpy(text->data + text->len, utf8, len);
+	text->len += len;
+	text->offsets[text->num_chars] = text->len;
+
+	return 0;
+}
+
+int preedit_get_text(const preedit_t *preedit, preedit_text_t *dst)
+{
+	const segment_t *segment;
+	uint32_t feedback;
+	int err;
 	int i;
+	int j;
 
-	for (offset = i = 0; i < preedit->num_segments; i++) {
-		int len;
+	if (!preedit || !dst) {
+		return -EINVAL;
+	}
+
+	dst->len = 0;
+	dst->num_chars = 0;
+	dst->caret = 0;
 
-		if ((len = segment_get_output(preedit->segments[i],
-		                              dst + offset,
-		                              dst_size - offset)) < 0) {
-			break;
+	if ((err = _preedit_text_reserve(dst, 0)) < 0) {
+		return err;
+	}
+	dst->offsets[0] = 0;
+
+	for (i = 0; i < preedit->num_segments; i++) {
+		segment = preedit->segments[i];
+		feedback = i == preedit->cursor.segment ? XIMReverse : XIMUnderline;
+
+		if (segment->selection >= 0 && segment->selection < segment->num_candidates) {
+			const char *value;
+
+			/* the caret goes behind a converted segment */
+			value = segment->candidates[segment->selection]->value;
+			err = _preedit_text_append(dst, value, strlen(value), feedback);
+
+			if (i == preedit->cursor.segment) {
+				dst->caret = dst->num_chars;
+			}
+		} else {
+			for (err = 0, j = 0; j < segment->len && err == 0; j++) {
+				const char *utf8;
+
+				if (i == preedit->cursor.segment && j == preedit->cursor.offset) {
+					dst->caret = dst->num_chars;
+				}
+
+				if ((utf8 = char_get_utf8(segment->input[j]))) {
+					err = _preedit_text_append(dst, utf8, strlen(utf8), feedback);
+				}
+			}
+
+			if (i == preedit->cursor.segment && preedit->cursor.offset >= segment->len) {
+				dst->caret = dst->num_chars;
+			}
 		}
 
-		offset += len;
+		if (err < 0) {
+			return err;
+		}
 	}
 
-	return offset;
+	return dst->num_chars;
+}
+
+void preedit_text_release(preedit_text_t *text)
+{
+	if (text) {
+		free(text->data);
+		free(text->offsets);
+		free(text->feedback);
+		memset(text, 0, sizeof(*text));
+	}
 }
 
 int preedit_move_candidate(preedit_t *preedit, const int dir)
@@ -344,7 +505,32 @@ int preedit_select_candidate(preedit_t *preedit, const unsigned int candidate)
 		return -ENOENT;
 	}
 
-	return segment_select_candidate(segment, (int)candidate);
+	if (candidate >= SEGMENT_CANDIDATE_PAGE_SIZE) {
+		return -EBADSLT;
+	}
+
+	return segment_select_candidate(segment, segment->page * SEGMENT_CANDIDATE_PAGE_SIZE +
+	                                (int)candidate);
+}
+
+int preedit_move_candidate_page(preedit_t *preedit, const int dir)
+{
+	segment_t *segment;
+
+	if (!preedit) {
+		return -EINVAL;
+	}
+
+	if (preedit->cursor.segment < 0 ||
+	    preedit->cursor.segment >= preedit->num_segments) {
+		return -EBADFD;
+	}
+
+	if (!(segment = preedit->segments[preedit->cursor.segment])) {
+		return -ENOENT;
+	}
+
+	return segment_move_candidate_page(segment, dir);
 }
 
 int preedit_move_segment(preedit_t *preedit, const int dir)
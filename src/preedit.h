@@ -24,6 +24,8 @@
 #include "segment.h"
 #include "string.h"
 #include <limits.h>
+#include <stddef.h>
+#include <stdint.h>
 
 #define PREEDIT_SEGMENT_FIRST SHRT_MIN
 #define PREEDIT_SEGMENT_LAST  SHRT_MAX
@@ -40,6 +42,23 @@ typedef struct preedit_iter preedit_dir_t;
 
 typedef struct preedit preedit_t;
 
+/* The preedit as it is shown by the client, see preedit_get_text() */
+typedef struct {
+	/* UTF-8, not terminated */
+	char *data;
+	size_t len;
+	size_t size;
+
+	/* byte offset of each character and one past the last, and its XIMFeedback */
+	uint32_t *offsets;
+	uint32_t *feedback;
+	int num_chars;
+	int max_chars;
+
+	/* character that the caret is in front of */
+	int caret;
+} preedit_text_t;
+
 int preedit_new(preedit_t **preedit);
 int preedit_free(preedit_t **preedit);
 
@@ -47,13 +66,23 @@ int preedit_move(preedit_t *preedit, preedit_dir_t cursor_dir);
 int preedit_erase(preedit_t *preedit, preedit_dir_t cursor_dir);
 int preedit_insert(preedit_t *preedit, char_t chr, preedit_dir_t cursor_dir);
 int preedit_clear(preedit_t *preedit);
+int preedit_trim(preedit_t *preedit);
 
 int preedit_get_input(preedit_t *preedit, char *dst, const size_t dst_size);
-int preedit_get_input_decorated(const preedit_t *preedit, char **dst);
-int preedit_get_output(const preedit_t *preedit, char *dst, const size_t dst_size);
+int preedit_get_input_decorated(preedit_t *preedit, const char **dst);
+/*
+ * Fills iov with the output of all segments and returns the number of
+ * vectors needed. The vectors point to memory owned by the preedit.
+ */
+int preedit_get_output(const preedit_t *preedit, struct iovec *iov, const int max_iov);
+/* Replaces the contents of dst, reusing its memory */
+int preedit_get_text(const preedit_t *preedit, preedit_text_t *dst);
+void preedit_text_release(preedit_text_t *text);
 
 int preedit_move_candidate(preedit_t *preedit, const int dir);
+/* Selects a candidate on the current page of candidates */
 int preedit_select_candidate(preedit_t *preedit, const unsigned int candidate);
+int preedit_move_candidate_page(preedit_t *preedit, const int dir);
 int preedit_move_segment(preedit_t *preedit, const int dir);
 int preedit_insert_segment(preedit_t *preedit);
 int preedit_update_candidates(preedit_t *preedit);
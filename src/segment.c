@@ -56,7 +56,9 @@ int segment_free(segment_t **segment)
 	}
 
 	free((*segment)->input);
+	free((*segment)->output);
 	free((*segment)->candidates);
+	string_free(&(*segment)->markup);
 	free(*segment);
 	*segment = 0;
 	return 0;
@@ -81,6 +83,7 @@ int segment_erase(segment_t *segment, const short pos)
 
 	segment->len--;
 	segment->input[segment->len] = CHAR_INVALID;
+	segment->markup_valid = 0;
 
 	return 0;
 }
@@ -138,6 +141,7 @@ int segment_insert(segment_t *segment, const char_t chr,
 
 		if (combined != CHAR_INVALID) {
 			segment->input[insert_pos - 1] = combined;
+			segment->markup_valid = 0;
 			return 0;
 		}
 	}
@@ -147,6 +151,7 @@ int segment_insert(segment_t *segment, const char_t chr,
 	        segment->input + insert_pos, tail_len);
 	segment->input[insert_pos] = chr;
 	segment->len++;
+	segment->markup_valid = 0;
 
 	return 1;
 }
@@ -159,11 +164,47 @@ int segment_clear(segment_t *segment)
 
 	memset(segment->input, 0, segment->size * sizeof(*segment->input));
 	segment->len = 0;
+	segment->markup_valid = 0;
 
 	free(segment->candidates);
 	segment->candidates = NULL;
 	segment->num_candidates = 0;
 	segment->selection = -1;
+	segment->page = 0;
+
+	return 0;
+}
+
+/* Gives back memory of an empty segment that grew while it was in use */
+int segment_trim(segment_t *segment)
+{
+	char_t *input;
+
+	if (!segment) {
+		return -EINVAL;
+	}
+
+	if (segment->len > 0) {
+		return -EBUSY;
+	}
+
+	free(segment->candidates);
+	segment->candidates = NULL;
+	segment->num_candidates = 0;
+	segment->selection = -1;
+	segment->page = 0;
+	segment->markup_valid = 0;
+	string_free(&segment->markup);
+
+	free(segment->output);
+	segment->output = NULL;
+	segment->output_size = 0;
+
+	if (segment->size > INITIAL_SEGMENT_SIZE &&
+	    (input = realloc(segment->input, INITIAL_SEGMENT_SIZE * sizeof(*input)))) {
+		segment->input = input;
+		segment->size = INITIAL_SEGMENT_SIZE;
+	}
 
 	return 0;
 }
@@ -177,124 +218,189 @@ int segment_get_input(segment_t *segment, char *dst, const size_t dst_size)
 	return char_to_utf8(segment->input, segment->len, dst, dst_size);
 }
 
-int segment_get_input_decorated(segment_t *segment, const int selected, const int cursor_pos, char **dst)
+static int _segment_append_input(segment_t *segment, const int from, const int to)
 {
-	static const char cursor[] = "<span foreground=\"grey\">⇱</span>";
-	string_t *input;
-	string_t *escape;
+	const char *utf8;
 	int err;
 	int i;
 
-	escape = NULL;
-
-	if ((err = string_new(&input)) < 0) {
-		return err;
+	for (i = from; i < to; i++) {
+		if ((utf8 = char_get_utf8(segment->input[i])) &&
+		    (err = string_append_escaped(segment->markup, utf8, strlen(utf8))) < 0) {
+			return err;
+		}
 	}
 
+	return 0;
+}
+
+static int _segment_render(segment_t *segment, const int selected, const int cursor_pos)
+{
+	static const char cursor[] = "<span foreground=\"grey\">⇱</span>";
+	static const char selection_header[] = "<span foreground=\"blue\">";
+	static const char selection_trailer[] = "</span>";
+	dict_candidate_t *candidate;
+	int num_pages;
+	int first;
+	int last;
+	int err;
+	int i;
+
+	string_clear(segment->markup);
+
 	if (selected &&
-	    (err = string_append_utf8(input, "[", 1)) < 0) {
-		goto cleanup;
+	    (err = string_append_utf8(segment->markup, "[", 1)) < 0) {
+		return err;
 	}
 
 	if (cursor_pos >= 0 && cursor_pos <= segment->len) {
-		if (string_new(&escape) < 0 ||
-		    (err = string_append_char(escape, segment->input, cursor_pos)) < 0 ||
-		    (err = string_replace(escape, "&", "&amp;")) < 0 ||
-		    (err = string_replace(escape, "<", "&lt;")) < 0 ||
-		    (err = string_replace(escape, ">", "&gt;")) < 0 ||
-		    (err = string_append(input, escape)) < 0 ||
-		    (err = string_free(&escape)) < 0) {
-			goto cleanup;
+		if ((err = _segment_append_input(segment, 0, cursor_pos)) < 0 ||
+		    (err = string_append_utf8(segment->markup, cursor, sizeof(cursor) - 1)) < 0 ||
+		    (err = _segment_append_input(segment, cursor_pos, segment->len)) < 0) {
+			return err;
 		}
+	} else if ((err = _segment_append_input(segment, 0, segment->len)) < 0) {
+		return err;
+	}
 
-		if ((err = string_append_utf8(input, cursor, sizeof(cursor))) < 0) {
-			goto cleanup;
-		}
+	if (!selected) {
+		return 0;
+	}
 
-		if (string_new(&escape) < 0 ||
-		    (err = string_append_char(escape, segment->input + cursor_pos,
-		                              segment->len - cursor_pos)) < 0 ||
-		    (err = string_replace(escape, "&", "&amp;")) < 0 ||
-		    (err = string_replace(escape, "<", "&lt;")) < 0 ||
-		    (err = string_replace(escape, ">", "&gt;")) < 0 ||
-		    (err = string_append(input, escape)) < 0 ||
-		    (err = string_free(&escape)) < 0) {
-			goto cleanup;
-		}
-	} else {
-		if (string_new(&escape) < 0 ||
-		    (err = string_append_char(escape, segment->input, segment->len)) < 0 ||
-		    (err = string_replace(escape, "&", "&amp;")) < 0 ||
-		    (err = string_replace(escape, "<", "&lt;")) < 0 ||
-		    (err = string_replace(escape, ">", "&gt;")) < 0 ||
-		    (err = string_append(input, escape)) < 0 ||
-		    (err = string_free(&escape)) < 0) {
-			goto cleanup;
+	/* only the current page is shown, candidate values were escaped on load */
+	first = segment->page * SEGMENT_CANDIDATE_PAGE_SIZE;
+	last = first + SEGMENT_CANDIDATE_PAGE_SIZE;
+
+	if (last > segment->num_candidates) {
+		last = segment->num_candidates;
+	}
+
+	for (i = first; i < last; i++) {
+		candidate = segment->candidates[i];
+
+		if ((err = string_append_utf8(segment->markup, "|", 1)) < 0 ||
+		    (i == segment->selection &&
+		     (err = string_append_utf8(segment->markup, selection_header,
+		                               sizeof(selection_header) - 1)) < 0) ||
+		    (err = string_append_utf8(segment->markup, candidate->markup,
+		                              candidate->markup_len)) < 0 ||
+		    (i == segment->selection &&
+		     (err = string_append_utf8(segment->markup, selection_trailer,
+		                               sizeof(selection_trailer) - 1)) < 0)) {
+			return err;
 		}
 	}
 
-	if (selected) {
-		for (i = 0; i < segment->num_candidates; i++) {
-			static const char _selection_header[] = "<span foreground=\"blue\">";
-			static const char _selection_trailer[] = "</span>";
+	num_pages = (segment->num_candidates + SEGMENT_CANDIDATE_PAGE_SIZE - 1) /
+	            SEGMENT_CANDIDATE_PAGE_SIZE;
 
-			if ((err = string_append_utf8(input, "|", 1)) < 0) {
-				goto cleanup;
-			}
+	if (num_pages > 1 &&
+	    (err = string_append_fmt(segment->markup, "|<span foreground=\"grey\">%d/%d</span>",
+	                             segment->page + 1, num_pages)) < 0) {
+		return err;
+	}
 
-			if (i == segment->selection &&
-			    (err = string_append_utf8(input, _selection_header,
-			                              sizeof(_selection_header))) < 0) {
-				goto cleanup;
-			}
+	return string_append_utf8(segment->markup, "]", 1);
+}
 
-			if ((err = string_new(&escape)) < 0 ||
-			    (err = string_append_utf8(escape, segment->candidates[i]->value,
-			                              strlen(segment->candidates[i]->value))) < 0 ||
-			    (err = string_replace(escape, "&", "&amp;")) < 0 ||
-			    (err = string_replace(escape, "<", "&lt;")) < 0 ||
-			    (err = string_replace(escape, ">", "&gt;")) < 0 ||
-			    (err = string_append(input, escape)) < 0 ||
-			    string_free(&escape) < 0) {
-				goto cleanup;
-			}
+/*
+ * Returns the segment as Pango markup. The markup is only rendered again
+ * if the segment or the arguments changed since the last call.
+ */
+int segment_get_input_decorated(segment_t *segment, const int selected, const int cursor_pos,
+                                const char **dst)
+{
+	int err;
 
-			if (segment->selection == i &&
-			    (err = string_append_utf8(input, _selection_trailer,
-			                              sizeof(_selection_trailer))) < 0) {
-				goto cleanup;
-			}
-		}
+	if (!segment || !dst) {
+		return -EINVAL;
+	}
 
-		if ((err = string_append_utf8(input, "]", 1)) < 0) {
-			goto cleanup;
+	if (!segment->markup && (err = string_new(&segment->markup)) < 0) {
+		return err;
+	}
+
+	if (!segment->markup_valid ||
+	    segment->markup_selected != selected ||
+	    segment->markup_cursor != cursor_pos) {
+		if ((err = _segment_render(segment, selected, cursor_pos)) < 0) {
+			segment->markup_valid = 0;
+			return err;
 		}
+
+		segment->markup_valid = 1;
+		segment->markup_selected = selected;
+		segment->markup_cursor = cursor_pos;
 	}
 
-cleanup:
-	string_free(&escape);
+	return string_peek_utf8(segment->markup, dst);
+}
+
+/* Converts the input to UTF-8, into a buffer that is kept with the segment */
+static int _segment_render_output(segment_t *segment)
+{
+	char *output;
+	int size;
+
+	size = segment->len * CHAR_UTF8_MAX + 1;
 
-	if (err >= 0) {
-		err = string_get_utf8(input, dst);
+	if (segment->output_size < size) {
+		if (!(output = realloc(segment->output, size))) {
+			return -ENOMEM;
+		}
+
+		segment->output = output;
+		segment->output_size = size;
 	}
 
-	string_free(&input);
-	return err;
+	return char_to_utf8(segment->input, segment->len, segment->output, segment->output_size);
 }
 
-int segment_get_output(segment_t *segment, char *dst, const size_t dst_size)
+/*
+ * Returns the output of the segment in a single vector: the selected
+ * candidate, or the input if no candidate is selected. The vector is
+ * valid until the segment changes.
+ */
+int segment_get_output(segment_t *segment, struct iovec *iov, const int max_iov)
 {
-	if (!segment || !dst) {
+	dict_candidate_t *candidate;
+	int len;
+
+	if (!segment || (!iov && max_iov > 0)) {
 		return -EINVAL;
 	}
 
 	if (segment->selection < 0 ||
 	    segment->selection >= segment->num_candidates) {
-		/* no candidate selected - return input */
-		return segment_get_input(segment, dst, dst_size);
+		if (segment->len == 0) {
+			return 0;
+		}
+
+		if (max_iov < 1) {
+			return 1;
+		}
+
+		if ((len = _segment_render_output(segment)) < 0) {
+			return len;
+		}
+
+		iov[0].iov_base = segment->output;
+		iov[0].iov_len = len;
+
+		return 1;
 	}
-	segment->candidates[segment->selection]->priority++;
-	return snprintf(dst, dst_size, "%s", segment->candidates[segment->selection]->value);
+
+	if (max_iov < 1) {
+		return 1;
+	}
+
+	candidate = segment->candidates[segment->selection];
+	dict_candidate_promote(candidate);
+
+	iov[0].iov_base = (void*)candidate->value;
+	iov[0].iov_len = strlen(candidate->value);
+
+	return 1;
 }
 
 int segment_select_candidate(segment_t *segment, const int selection)
@@ -308,6 +414,8 @@ int segment_select_candidate(segment_t *segment, const int selection)
 	}
 
 	segment->selection = selection;
+	segment->page = selection / SEGMENT_CANDIDATE_PAGE_SIZE;
+	segment->markup_valid = 0;
 	return 0;
 }
 
@@ -341,6 +449,8 @@ int segment_set_candidates(segment_t *segment, dict_candidate_t **candidates)
 	segment->candidates = candidates;
 	segment->num_candidates = num_candidates;
 	segment->selection = new_selection;
+	segment->page = new_selection > 0 ? new_selection / SEGMENT_CANDIDATE_PAGE_SIZE : 0;
+	segment->markup_valid = 0;
 
 	return num_candidates;
 }
@@ -375,6 +485,49 @@ int segment_move_candidate(segment_t *segment, const int dir)
 		segment->selection += segment->num_candidates;
 	}
 
+	segment->page = segment->selection / SEGMENT_CANDIDATE_PAGE_SIZE;
+	segment->markup_valid = 0;
+
+	return 0;
+}
+
+/*
+ * Shows the next or previous page of candidates. A selected candidate
+ * keeps its position on the page, as far as the page is long enough.
+ */
+int segment_move_candidate_page(segment_t *segment, const int dir)
+{
+	int num_pages;
+	int page;
+
+	if (!segment) {
+		return -EINVAL;
+	}
+
+	if (segment->num_candidates == 0) {
+		return -ENOENT;
+	}
+
+	num_pages = (segment->num_candidates + SEGMENT_CANDIDATE_PAGE_SIZE - 1) /
+	            SEGMENT_CANDIDATE_PAGE_SIZE;
+	page = (segment->page + dir) % num_pages;
+
+	while (page < 0) {
+		page += num_pages;
+	}
+
+	if (segment->selection >= 0) {
+		segment->selection = page * SEGMENT_CANDIDATE_PAGE_SIZE +
+		                     segment->selection % SEGMENT_CANDIDATE_PAGE_SIZE;
+
+		if (segment->selection >= segment->num_candidates) {
+			segment->selection = segment->num_candidates - 1;
+		}
+	}
+
+	segment->page = page;
+	segment->markup_valid = 0;
+
 	return 0;
 }
 
@@ -23,7 +23,9 @@
 
 #include "char.h"
 #include "dict.h"
+#include "string.h"
 #include <limits.h>
+#include <sys/uio.h>
 
 struct segment {
 	char_t *input;
@@ -33,10 +35,24 @@ struct segment {
 	dict_candidate_t **candidates;
 	int num_candidates;
 	int selection;
+	int page;
+
+	/* the input in UTF-8, as returned by segment_get_output() */
+	char *output;
+	int output_size;
+
+	/* what segment_get_input_decorated() returned last, and for which arguments */
+	string_t *markup;
+	int markup_valid;
+	int markup_selected;
+	int markup_cursor;
 };
 
 typedef struct segment segment_t;
 
+/* Number of candidates that are shown at a time */
+#define SEGMENT_CANDIDATE_PAGE_SIZE 10
+
 #define SEGMENT_START SHRT_MIN
 #define SEGMENT_END   SHRT_MAX
 
@@ -45,15 +61,19 @@ int segment_free(segment_t **segment);
 int segment_erase(segment_t *segment, const short pos);
 int segment_insert(segment_t *segment, const char_t chr, const short pos);
 int segment_clear(segment_t *segment);
+int segment_trim(segment_t *segment);
 
 int segment_get_input(segment_t *segment, char *dst, const size_t dst_size);
-int segment_get_input_decorated(segment_t *segment, const int selected, const int cursor_pos, char **dst);
-int segment_get_output(segment_t *segment, char *dst, const size_t dst_size);
+/* The markup is owned by the segment and valid until the segment changes */
+int segment_get_input_decorated(segment_t *segment, const int selected, const int cursor_pos,
+                                const char **dst);
+int segment_get_output(segment_t *segment, struct iovec *iov, const int max_iov);
 
 int segment_select_candidate(segment_t *segment, const int selection);
 int segment_set_candidates(segment_t *segment, dict_candidate_t **candidates);
 int segment_get_candidates(segment_t *segment, dict_candidate_t ***candidates);
 int segment_move_candidate(segment_t *segment, const int dir);
+int segment_move_candidate_page(segment_t *segment, const int dir);
 int segment_update_candidates(segment_t *segment);
 
 #endif /* SEGMENT_H */
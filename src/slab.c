@@ -0,0 +1,228 @@
+/*
+ * slab.c - This file is part of mxim
+ * Copyright (C) 2025 Matthias Kruk
+ *
+ * Mxim is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation; either version 3, or (at your
+ * option) any later version.
+ *
+ * Mxim is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Mxim; see the file COPYING.  If not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include "slab.h"
+#include <errno.h>
+#include <stdlib.h>
+
+#define SLAB_INDEX_MASK ((1 << SLAB_INDEX_BITS) - 1)
+#define SLAB_GEN_MASK   (0xffff >> SLAB_INDEX_BITS)
+
+#define SLAB_ID(idx, gen) ((((gen) & SLAB_GEN_MASK) << SLAB_INDEX_BITS) | ((idx) + 1))
+#define SLAB_ID_IDX(id)   (((id) & SLAB_INDEX_MASK) - 1)
+#define SLAB_ID_GEN(id)   (((id) >> SLAB_INDEX_BITS) & SLAB_GEN_MASK)
+
+struct slab_slot {
+	void *item;
+	int busy;
+	int next;            /* next free slot, while the slot is free */
+	unsigned int gen;
+};
+
+struct slab {
+	struct slab_slot *slots;
+	int size;
+
+	/* slots [0..used) have been handed out at least once */
+	int used;
+
+	/* most recently freed slot, or -1 */
+	int free;
+};
+
+int slab_new(slab_t **slab, const int size)
+{
+	slab_t *s;
+
+	if (!slab || size <= 0 || size > SLAB_SIZE_MAX) {
+		return -EINVAL;
+	}
+
+	if (!(s = calloc(1, sizeof(*s)))) {
+		return -ENOMEM;
+	}
+
+	if (!(s->slots = calloc(size, sizeof(*s->slots)))) {
+		free(s);
+		return -ENOMEM;
+	}
+
+	s->size = size;
+	s->free = -1;
+
+	*slab = s;
+	return 0;
+}
+
+int slab_free(slab_t **slab)
+{
+	if (!slab || !*slab) {
+		return -EINVAL;
+	}
+
+	free((*slab)->slots);
+	free(*slab);
+	*slab = NULL;
+
+	return 0;
+}
+
+static int _slab_grow(slab_t *slab)
+{
+	struct slab_slot *slots;
+	int size;
+
+	if (slab->size == SLAB_SIZE_MAX) {
+		return -ENOSPC;
+	}
+
+	size = slab->size * 2 > SLAB_SIZE_MAX ? SLAB_SIZE_MAX : slab->size * 2;
+
+	if (!(slots = realloc(slab->slots, size * sizeof(*slots)))) {
+		return -ENOMEM;
+	}
+
+	slab->slots = slots;
+	slab->size = size;
+
+	return 0;
+}
+
+int slab_insert(slab_t *slab, void *item)
+{
+	struct slab_slot *slot;
+	int idx;
+	int err;
+
+	if (!slab) {
+		return -EINVAL;
+	}
+
+	if (slab->free >= 0) {
+		idx = slab->free;
+		slab->free = slab->slots[idx].next;
+	} else {
+		if (slab->used == slab->size && (err = _slab_grow(slab)) < 0) {
+			return err;
+		}
+
+		idx = slab->used++;
+		slab->slots[idx].gen = 0;
+	}
+
+	slot = &slab->slots[idx];
+	slot->item = item;
+	slot->busy = 1;
+	slot->next = -1;
+
+	return SLAB_ID(idx, slot->gen);
+}
+
+static struct slab_slot* _slab_lookup(const slab_t *slab, const int id)
+{
+	struct slab_slot *slot;
+	int idx;
+
+	if (!slab || id <= 0 || id > 0xffff) {
+		return NULL;
+	}
+
+	if ((idx = SLAB_ID_IDX(id)) < 0 || idx >= slab->used) {
+		return NULL;
+	}
+
+	slot = &slab->slots[idx];
+
+	return slot->busy && slot->gen == SLAB_ID_GEN(id) ? slot : NULL;
+}
+
+void* slab_get(const slab_t *slab, const int id)
+{
+	struct slab_slot *slot;
+
+	return (slot = _slab_lookup(slab, id)) ? slot->item : NULL;
+}
+
+/* Sets the item of an id that was handed out by slab_insert() */
+int slab_set(slab_t *slab, const int id, void *item)
+{
+	struct slab_slot *slot;
+
+	if (!(slot = _slab_lookup(slab, id))) {
+		return -ENOENT;
+	}
+
+	slot->item = item;
+	return 0;
+}
+
+void* slab_remove(slab_t *slab, const int id)
+{
+	struct slab_slot *slot;
+	void *item;
+	int idx;
+
+	if (!(slot = _slab_lookup(slab, id))) {
+		return NULL;
+	}
+
+	idx = SLAB_ID_IDX(id);
+	item = slot->item;
+
+	/* ids that refer to the old item will no longer match */
+	slot->item = NULL;
+	slot->busy = 0;
+	slot->gen = (slot->gen + 1) & SLAB_GEN_MASK;
+	slot->next = slab->free;
+	slab->free = idx;
+
+	return item;
+}
+
+/* Returns the id of the first item after the one with the given id, or 0 */
+int slab_next(const slab_t *slab, const int id)
+{
+	int idx;
+
+	if (!slab) {
+		return 0;
+	}
+
+	for (idx = id > 0 ? SLAB_ID_IDX(id) + 1 : 0; idx < slab->used; idx++) {
+		if (slab->slots[idx].busy) {
+			return SLAB_ID(idx, slab->slots[idx].gen);
+		}
+	}
+
+	return 0;
+}
+
+int slab_reset(slab_t *slab)
+{
+	if (!slab) {
+		return -EINVAL;
+	}
+
+	/* the slots are handed out again in order, keeping their memory */
+	slab->used = 0;
+	slab->free = -1;
+
+	return 0;
+}
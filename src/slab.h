@@ -0,0 +1,50 @@
+/*
+ * slab.h - This file is part of mxim
+ * Copyright (C) 2025 Matthias Kruk
+ *
+ * Mxim is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation; either version 3, or (at your
+ * option) any later version.
+ *
+ * Mxim is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Mxim; see the file COPYING.  If not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#ifndef SLAB_H
+#define SLAB_H
+
+/*
+ * A slab hands out small integer ids for pointers. Ids are made of the
+ * index of a slot plus one and a generation that changes whenever the
+ * slot is reused, so that stale ids are not mistaken for new ones. All
+ * ids fit in a CARD16 and none of them is zero.
+ *
+ * An id may be handed out before its item exists, by inserting NULL and
+ * setting the item later. slab_get() returns NULL until then.
+ */
+
+#define SLAB_INDEX_BITS 12
+#define SLAB_SIZE_MAX   ((1 << SLAB_INDEX_BITS) - 1)
+
+typedef struct slab slab_t;
+
+int slab_new(slab_t **slab, const int size);
+int slab_free(slab_t **slab);
+
+int slab_insert(slab_t *slab, void *item);
+void* slab_get(const slab_t *slab, const int id);
+int slab_set(slab_t *slab, const int id, void *item);
+void* slab_remove(slab_t *slab, const int id);
+int slab_next(const slab_t *slab, const int id);
+
+int slab_reset(slab_t *slab);
+
+#endif /* SLAB_H */
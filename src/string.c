@@ -73,7 +73,10 @@ int string_clear(string_t *str)
 		return -EINVAL;
 	}
 
-	memset(str->str, 0, str->size);
+	/* the memory is kept for the next use */
+	if (str->str) {
+		str->str[0] = 0;
+	}
 	str->len = 0;
 
 	return 0;
@@ -195,6 +198,63 @@ int string_append_utf8(string_t *dst, const char *src, const size_t src_len)
 	return err;
 }
 
+/* Appends src with &, < and > replaced by their markup entities */
+int string_append_escaped(string_t *dst, const char *src, const size_t src_len)
+{
+	const char *entity;
+	size_t need;
+	size_t i;
+	int err;
+
+	if (!dst || !src) {
+		return -EINVAL;
+	}
+
+	for (need = src_len, i = 0; i < src_len; i++) {
+		switch (src[i]) {
+		case '&':
+			need += 4;
+			break;
+		case '<':
+		case '>':
+			need += 3;
+			break;
+		}
+	}
+
+	if (need >= INT_MAX || SIZE_MAX - dst->len <= need) {
+		return -EOVERFLOW;
+	}
+
+	if (dst->size - dst->len < need + 1 &&
+	    (err = _string_grow(dst, need + 1 - (dst->size - dst->len))) < 0) {
+		return err;
+	}
+
+	for (i = 0; i < src_len; i++) {
+		switch (src[i]) {
+		case '&':
+			entity = "&amp;";
+			break;
+		case '<':
+			entity = "&lt;";
+			break;
+		case '>':
+			entity = "&gt;";
+			break;
+		default:
+			dst->str[dst->len++] = src[i];
+			continue;
+		}
+
+		memcpy(dst->str + dst->len, entity, strlen(entity));
+		dst->len += strlen(entity);
+	}
+
+	dst->str[dst->len] = 0;
+	return (int)need;
+}
+
 int string_append_fmt(string_t *dst, const char *fmt, ...)
 {
 	va_list args;
@@ -281,3 +341,14 @@ int string_get_utf8(string_t *str, char **dst)
 	*dst = utf8;
 	return strlen(utf8);
 }
+
+/* Returns the string without copying it. It is valid until the string is changed */
+int string_peek_utf8(const string_t *str, const char **dst)
+{
+	if (!str || !dst) {
+		return -EINVAL;
+	}
+
+	*dst = str->str ? str->str : "";
+	return (int)str->len;
+}
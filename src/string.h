@@ -33,8 +33,10 @@ int string_clear(string_t *str);
 int string_append(string_t *dst, const string_t *src);
 int string_append_char(string_t *dst, const char_t *src, const size_t src_len);
 int string_append_utf8(string_t *dst, const char *src, const size_t src_len);
+int string_append_escaped(string_t *dst, const char *src, const size_t src_len);
 int string_append_fmt(string_t *dst, const char *ftm, ...);
 int string_replace(string_t *str, const char *search, const char *replace);
 int string_get_utf8(string_t *str, char **dst);
+int string_peek_utf8(const string_t *str, const char **dst);
 
 #endif /* STRING_H */
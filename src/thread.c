@@ -183,18 +183,23 @@ int thread_cancel(thread_t *thr, void **ret)
 
 int thread_join(thread_t *thr, void **ret)
 {
+	void *ret_val;
 	int err;
 
 	if (!thr) {
 		return -EINVAL;
 	}
 
-	LOCK(thr);
-	err = -pthread_join(thr->thread, &thr->ret_val);
-	if (!err && ret) {
-		*ret = thr->ret_val;
+	/* the thread takes the lock on its way out, it mustn't be held while waiting */
+	if ((err = -pthread_join(thr->thread, &ret_val)) == 0) {
+		LOCK(thr);
+		thr->ret_val = ret_val;
+		UNLOCK(thr);
+
+		if (ret) {
+			*ret = ret_val;
+		}
 	}
-	UNLOCK(thr);
 
 	return err;
 }
@@ -27,11 +27,21 @@
 #include <stdlib.h>
 #include <string.h>
 
+#define TRIE_NUM_CHILDREN 256
+
+struct trie_value {
+	void *data;
+	int priority;
+};
+
 struct trie {
-	trie_t *children[256];
+	trie_t *children[TRIE_NUM_CHILDREN];
 
-	void **values;
+	struct trie_value *values;
 	int num_values;
+
+	/* highest priority of all values in this subtree */
+	int max_priority;
 };
 
 int trie_new(trie_t **trie)
@@ -42,6 +52,7 @@ int trie_new(trie_t **trie)
 		return -ENOMEM;
 	}
 
+	t->max_priority = INT_MIN;
 	*trie = t;
 	return 0;
 }
@@ -58,7 +69,21 @@ int trie_free(trie_t **trie)
 	return 0;
 }
 
-int trie_insert(trie_t *trie, const char_t *key, const void **values, const size_t num_values)
+/* Raises *dst to priority unless it is already higher */
+static void _trie_raise_priority(int *dst, const int priority)
+{
+	int cur;
+
+	cur = __atomic_load_n(dst, __ATOMIC_RELAXED);
+
+	while (cur < priority &&
+	       !__atomic_compare_exchange_n(dst, &cur, priority, 1,
+	                                    __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+	}
+}
+
+int trie_insert(trie_t *trie, const char_t *key, const void **values,
+                const size_t num_values, const int priority)
 {
 	int err;
 
@@ -72,88 +97,253 @@ int trie_insert(trie_t *trie, const char_t *key, const void **values, const size
 			return err;
 		}
 
-		return trie_insert(trie->children[*key], key + 1, values, num_values);
+		if ((err = trie_insert(trie->children[*key], key + 1, values,
+		                       num_values, priority)) == 0) {
+			_trie_raise_priority(&trie->max_priority, priority);
+		}
+
+		return err;
 	}
 
-	return trie_add_values(trie, values, num_values);
+	return trie_add_values(trie, values, num_values, priority);
 }
 
-int trie_add_values(trie_t *trie, const void **values, const size_t num_values)
+int trie_add_values(trie_t *trie, const void **values, const size_t num_values,
+                    const int priority)
 {
+	struct trie_value *new_values;
 	size_t new_num_values;
-	void **new_values;
+	size_t i;
 
-	if (SIZE_MAX - trie->num_values <= num_values) {
+	if ((size_t)(INT_MAX - trie->num_values) < num_values) {
 		return -EOVERFLOW;
 	}
 
 	new_num_values = trie->num_values + num_values;
-	new_values = realloc(trie->values, (new_num_values + 1) * sizeof(*new_values));
+	new_values = realloc(trie->values, new_num_values * sizeof(*new_values));
 
 	if (!new_values) {
 		return -ENOMEM;
 	}
 
-	memmove(new_values + trie->num_values, values, num_values * sizeof(*values));
+	for (i = 0; i < num_values; i++) {
+		new_values[trie->num_values + i].data = (void*)values[i];
+		new_values[trie->num_values + i].priority = priority;
+	}
+
 	trie->values = new_values;
 	trie->num_values = new_num_values;
+	_trie_raise_priority(&trie->max_priority, priority);
 
 	return 0;
 }
 
-static int _trie_append_to_array(trie_t *trie, void ***array)
+/*
+ * Raises the priority of a value and the annotations of the nodes above
+ * it, so that iterators don't skip over it. May be called while other
+ * threads are iterating over the trie.
+ */
+int trie_raise(trie_t *trie, const char_t *key, const void *value, const int priority)
 {
-	void **new_array;
-	int new_len;
-	int len;
-
-	len = 0;
+	int i;
 
-	if (!trie || !array) {
+	if (!trie || !key) {
 		return -EINVAL;
 	}
 
-	if (*array) {
-		while ((*array)[len]) {
-			len++;
+	if (*key != CHAR_INVALID) {
+		if (!trie->children[*key]) {
+			return -ENOENT;
 		}
+
+		_trie_raise_priority(&trie->max_priority, priority);
+		return trie_raise(trie->children[*key], key + 1, value, priority);
 	}
 
-	if (INT_MAX - len <= trie->num_values) {
-		return -EOVERFLOW;
+	for (i = 0; i < trie->num_values; i++) {
+		if (trie->values[i].data == value) {
+			_trie_raise_priority(&trie->max_priority, priority);
+			_trie_raise_priority(&trie->values[i].priority, priority);
+			return 0;
+		}
 	}
 
-	new_len = len + trie->num_values;
-	new_array = realloc(*array, (new_len + 1) * sizeof(**array));
+	return -ENOENT;
+}
 
-	if (!new_array) {
-		return -ENOMEM;
+static const trie_t *_trie_find(const trie_t *trie, const char_t *key)
+{
+	while (trie && *key != CHAR_INVALID) {
+		trie = trie->children[*key++];
+	}
+
+	return trie;
+}
+
+/*
+ * The iterator keeps a max-heap of nodes, keyed by the highest priority
+ * below them, and of values, keyed by their own priority. A node is only
+ * expanded when it comes out on top, so subtrees that can't beat any of
+ * the values returned so far are never visited.
+ */
+static void _trie_iter_sift_up(trie_iter_t *iter, int pos)
+{
+	struct trie_iter_item item;
+	int parent;
+
+	item = iter->heap[pos];
+
+	while (pos > 0) {
+		parent = (pos - 1) / 2;
+
+		if (iter->heap[parent].priority >= item.priority) {
+			break;
+		}
+
+		iter->heap[pos] = iter->heap[parent];
+		pos = parent;
+	}
+
+	iter->heap[pos] = item;
+}
+
+static void _trie_iter_sift_down(trie_iter_t *iter, int pos)
+{
+	struct trie_iter_item item;
+	int child;
+
+	item = iter->heap[pos];
+
+	while ((child = pos * 2 + 1) < iter->len) {
+		if (child + 1 < iter->len &&
+		    iter->heap[child + 1].priority > iter->heap[child].priority) {
+			child++;
+		}
+
+		if (item.priority >= iter->heap[child].priority) {
+			break;
+		}
+
+		iter->heap[pos] = iter->heap[child];
+		pos = child;
 	}
 
-	memmove(new_array + len, trie->values, sizeof(*trie->values) * trie->num_values);
-	new_array[new_len] = NULL;
-	*array = new_array;
+	iter->heap[pos] = item;
+}
+
+static int _trie_iter_push(trie_iter_t *iter, const trie_t *node, const int value)
+{
+	struct trie_iter_item *heap;
+	int size;
+
+	if (iter->len == iter->size) {
+		if (iter->size > INT_MAX / 2) {
+			return -EOVERFLOW;
+		}
+
+		size = iter->size * 2;
+
+		if (iter->heap == iter->items) {
+			if ((heap = malloc(size * sizeof(*heap)))) {
+				memcpy(heap, iter->items, sizeof(iter->items));
+			}
+		} else {
+			heap = realloc(iter->heap, size * sizeof(*heap));
+		}
+
+		if (!heap) {
+			return -ENOMEM;
+		}
+
+		iter->heap = heap;
+		iter->size = size;
+	}
+
+	iter->heap[iter->len].node = node;
+	iter->heap[iter->len].value = value;
+	iter->heap[iter->len].priority = value < 0 ?
+		__atomic_load_n(&node->max_priority, __ATOMIC_RELAXED) :
+		__atomic_load_n(&node->values[value].priority, __ATOMIC_RELAXED);
+	_trie_iter_sift_up(iter, iter->len++);
 
 	return 0;
 }
 
-int trie_get_values(trie_t *trie, const char_t *key, void ***values)
+int trie_iter_init(trie_iter_t *iter, const trie_t *trie, const char_t *key)
 {
+	if (!iter || !trie || !key) {
+		return -EINVAL;
+	}
+
+	iter->heap = iter->items;
+	iter->size = TRIE_ITER_ITEMS;
+	iter->len = 0;
+
+	if ((trie = _trie_find(trie, key))) {
+		return _trie_iter_push(iter, trie, -1);
+	}
+
+	return 0;
+}
+
+/*
+ * Returns the values below the key in order of decreasing priority, and
+ * -ENOENT once all values were returned.
+ */
+int trie_iter_next(trie_iter_t *iter, void **value, int *priority)
+{
+	struct trie_iter_item top;
+	int err;
 	int i;
 
-	if (!trie || !key || !values) {
+	if (!iter || !value) {
 		return -EINVAL;
 	}
 
-	if (*key != CHAR_INVALID) {
-		return trie_get_values(trie->children[*key], key + 1, values);
-	} else {
-		_trie_append_to_array(trie, values);
+	while (iter->len > 0) {
+		top = iter->heap[0];
+		iter->heap[0] = iter->heap[--iter->len];
+
+		if (iter->len > 0) {
+			_trie_iter_sift_down(iter, 0);
+		}
+
+		if (top.value >= 0) {
+			*value = top.node->values[top.value].data;
+
+			if (priority) {
+				*priority = top.priority;
+			}
 
-		for (i = 0; i < (sizeof(trie->children) / sizeof(trie->children[0])); i++) {
-			trie_get_values(trie->children[i], key, values);
+			return 0;
+		}
+
+		for (i = 0; i < top.node->num_values; i++) {
+			if ((err = _trie_iter_push(iter, top.node, i)) < 0) {
+				return err;
+			}
+		}
+
+		for (i = 0; i < TRIE_NUM_CHILDREN; i++) {
+			if (top.node->children[i] &&
+			    (err = _trie_iter_push(iter, top.node->children[i], -1)) < 0) {
+				return err;
+			}
 		}
 	}
 
-	return 0;
+	return -ENOENT;
+}
+
+void trie_iter_fini(trie_iter_t *iter)
+{
+	if (iter && iter->heap != iter->items) {
+		free(iter->heap);
+		iter->heap = iter->items;
+		iter->size = TRIE_ITER_ITEMS;
+	}
+
+	if (iter) {
+		iter->len = 0;
+	}
 }
@@ -24,13 +24,40 @@
 #include "char.h"
 #include <stddef.h>
 
+/* Number of items an iterator can hold without allocating memory */
+#define TRIE_ITER_ITEMS 32
+
 typedef struct trie trie_t;
 
+struct trie_iter_item {
+	const trie_t *node;
+	int value;
+	int priority;
+};
+
+/*
+ * Visits the values below a key without collecting them first, values
+ * with a higher priority first.
+ */
+typedef struct {
+	struct trie_iter_item *heap;
+	int len;
+	int size;
+
+	struct trie_iter_item items[TRIE_ITER_ITEMS];
+} trie_iter_t;
+
 int trie_new(trie_t **trie);
 int trie_free(trie_t **trie);
 
-int trie_insert(trie_t *trie, const char_t *key, const void **values, const size_t num_values);
-int trie_add_values(trie_t *trie, const void **values, const size_t num_values);
-int trie_get_values(trie_t *trie, const char_t *key, void ***values);
+int trie_insert(trie_t *trie, const char_t *key, const void **values,
+                const size_t num_values, const int priority);
+int trie_add_values(trie_t *trie, const void **values, const size_t num_values,
+                    const int priority);
+int trie_raise(trie_t *trie, const char_t *key, const void *value, const int priority);
+
+int trie_iter_init(trie_iter_t *iter, const trie_t *trie, const char_t *key);
+int trie_iter_next(trie_iter_t *iter, void **value, int *priority);
+void trie_iter_fini(trie_iter_t *iter);
 
 #endif /* TRIE_H */
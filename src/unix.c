@@ -0,0 +1,290 @@
+/*
+ * unix.c - This file is part of mxim
+ * Copyright (C) 2025 Matthias Kruk
+ *
+ * Mxim is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation; either version 3, or (at your
+ * option) any later version.
+ *
+ * Mxim is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Mxim; see the file COPYING.  If not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#define _GNU_SOURCE
+#include "fd.h"
+#include "log.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#define UNIX_DEFAULT_BACKLOG SOMAXCONN
+
+static int     _unix_open(fd_t *fd, va_list args);
+static int     _unix_close(fd_t *fd);
+static ssize_t _unix_read(fd_t *fd, void *dst, const size_t dst_size);
+static ssize_t _unix_write(fd_t *fd, const void *src, const size_t src_len);
+static ssize_t _unix_writev(fd_t *fd, const struct iovec *iov, const int iovcnt);
+static int     _unix_accept(fd_t *server, fd_t **client);
+
+static struct fd_ops _unix_ops = {
+	.open   = _unix_open,
+	.close  = _unix_close,
+	.read   = _unix_read,
+	.write  = _unix_write,
+	.writev = _unix_writev,
+	.accept = _unix_accept
+};
+
+struct unix_priv {
+	struct sockaddr_un addr;
+	int backlog;
+	int listening;
+};
+
+struct fd_dom _dom_unix = {
+	.dom = FD_DOM_UNIX,
+	.ops = &_unix_ops,
+	.priv_size = sizeof(struct unix_priv)
+};
+
+static int _unix_is_stale(const struct sockaddr_un *addr)
+{
+	int stale;
+	int sock;
+
+	stale = 0;
+
+	/* nobody is listening on a stale socket, so a connect attempt gets refused */
+	if ((sock = socket(PF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) >= 0) {
+		if (connect(sock, (const struct sockaddr*)addr, sizeof(*addr)) < 0 &&
+		    errno == ECONNREFUSED) {
+			stale = 1;
+		}
+
+		close(sock);
+	}
+
+	return stale;
+}
+
+/*
+ * Only the owner may talk to the IM server. The socket is created with the
+ * right permissions, so nobody can connect before they could be changed.
+ * Sockets are bound before the reactors run, so changing the umask is safe.
+ */
+static int _unix_bind(int sock, const struct sockaddr_un *addr)
+{
+	mode_t mask;
+	int err;
+
+	mask = umask(S_IRWXG | S_IRWXO);
+
+	if ((err = bind(sock, (const struct sockaddr*)addr, sizeof(*addr))) < 0) {
+		err = -errno;
+	}
+
+	umask(mask);
+	return err;
+}
+
+static int _unix_open_sock(struct unix_priv *priv)
+{
+	int ret_val;
+	int sock;
+	int err;
+
+	ret_val = -EINVAL;
+	sock = -1;
+
+	if (priv) {
+		if ((sock = socket(PF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0) {
+			ret_val = -errno;
+			log_error("socket: %s", strerror(-ret_val));
+		} else {
+			if ((err = _unix_bind(sock, &priv->addr)) == -EADDRINUSE &&
+			    _unix_is_stale(&priv->addr)) {
+				/* left behind by an instance that didn't shut down cleanly */
+				unlink(priv->addr.sun_path);
+				err = _unix_bind(sock, &priv->addr);
+			}
+
+			if (err < 0) {
+				ret_val = err;
+				log_error("bind: %s", strerror(-ret_val));
+			} else if (listen(sock, priv->backlog) < 0) {
+				ret_val = -errno;
+				log_error("listen: %s", strerror(-ret_val));
+				unlink(priv->addr.sun_path);
+			} else {
+				ret_val = sock;
+			}
+		}
+
+		if (ret_val < 0 && sock >= 0) {
+			close(sock);
+		}
+	}
+
+	return ret_val;
+}
+
+static int _unix_open(fd_t *fd, va_list args)
+{
+	int ret_val;
+	struct unix_priv *priv;
+	const char *path;
+	int backlog;
+	int sock;
+
+	if (!fd) {
+		return -EINVAL;
+	}
+
+	ret_val = 0;
+	sock = -1;
+	path = (const char*)va_arg(args, char*);
+	backlog = va_arg(args, int);
+
+	if (!path) {
+		return -EINVAL;
+	}
+
+	priv = fd->priv;
+	priv->backlog = backlog > 0 ? backlog : UNIX_DEFAULT_BACKLOG;
+	priv->addr.sun_family = AF_UNIX;
+
+	if (strlen(path) >= sizeof(priv->addr.sun_path)) {
+		ret_val = -ENAMETOOLONG;
+	} else {
+		strcpy(priv->addr.sun_path, path);
+
+		if ((sock = _unix_open_sock(priv)) < 0) {
+			ret_val = sock;
+		} else {
+			priv->listening = 1;
+
+			fd->fd = sock;
+			fd->addr = (struct sockaddr*)&priv->addr;
+			fd->addrlen = sizeof(priv->addr);
+		}
+	}
+
+	return ret_val;
+}
+
+static ssize_t _unix_read(fd_t *fd, void *dst, const size_t dst_size)
+{
+	ssize_t ret_val;
+
+	ret_val = (ssize_t)-EINVAL;
+
+	if (fd && dst) {
+		if ((ret_val = read(fd->fd, dst, dst_size)) < 0) {
+			ret_val = -errno;
+		}
+	}
+
+	return ret_val;
+}
+
+static ssize_t _unix_write(fd_t *fd, const void *src, const size_t src_len)
+{
+	ssize_t ret_val;
+
+	ret_val = (ssize_t)-EINVAL;
+
+	if (fd && src) {
+		/* a client that went away must not kill the server with SIGPIPE */
+		if ((ret_val = send(fd->fd, src, src_len, MSG_NOSIGNAL)) < 0) {
+			ret_val = -errno;
+		}
+	}
+
+	return ret_val;
+}
+
+static ssize_t _unix_writev(fd_t *fd, const struct iovec *iov, const int iovcnt)
+{
+	ssize_t ret_val;
+
+	ret_val = (ssize_t)-EINVAL;
+
+	if (fd && iov) {
+		struct msghdr msg;
+
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = (struct iovec*)iov;
+		msg.msg_iovlen = iovcnt;
+
+		if ((ret_val = sendmsg(fd->fd, &msg, MSG_NOSIGNAL)) < 0) {
+			ret_val = -errno;
+		}
+	}
+
+	return ret_val;
+}
+
+static int _unix_accept(fd_t *server, fd_t **client)
+{
+	fd_t *new_fd;
+	struct unix_priv *priv;
+	int ret_val;
+
+	if (!server || !client) {
+		return -EINVAL;
+	}
+
+	if ((ret_val = fd_alloc(&new_fd, sizeof(*priv))) < 0) {
+		return ret_val;
+	}
+
+	priv = new_fd->priv;
+	new_fd->addr = (struct sockaddr*)&priv->addr;
+	new_fd->addrlen = sizeof(priv->addr);
+
+	new_fd->dom = server->dom;
+	new_fd->ops = server->ops;
+	memcpy(&new_fd->handlers, &server->handlers, sizeof(new_fd->handlers));
+
+	/* accepted sockets are non-blocking from the start */
+	if ((new_fd->fd = accept4(server->fd, new_fd->addr, &new_fd->addrlen,
+	                          SOCK_NONBLOCK | SOCK_CLOEXEC)) < 0) {
+		ret_val = -errno;
+		fd_free(&new_fd);
+	} else {
+		*client = new_fd;
+	}
+
+	return ret_val;
+}
+
+static int _unix_close(fd_t *fd)
+{
+	struct unix_priv *priv;
+
+	if (!fd) {
+		return -EINVAL;
+	}
+
+	if ((priv = fd->priv)) {
+		/* don't leave the socket behind in the file system */
+		if (priv->listening) {
+			unlink(priv->addr.sun_path);
+		}
+	}
+
+	return 0;
+}
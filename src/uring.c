@@ -0,0 +1,361 @@
+/*
+ * uring.c - This file is part of mxim
+ * Copyright (C) 2025 Matthias Kruk
+ *
+ * Mxim is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation; either version 3, or (at your
+ * option) any later version.
+ *
+ * Mxim is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Mxim; see the file COPYING.  If not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include "uring.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+/*
+ * A minimal io_uring wrapper on top of the raw system calls. A ring must
+ * only be used by one thread at a time.
+ */
+struct uring {
+	int fd;
+
+	void *sq_ptr;
+	size_t sq_size;
+	void *cq_ptr;
+	size_t cq_size;
+	struct io_uring_sqe *sqes;
+	size_t sqes_size;
+
+	unsigned int *sq_head;
+	unsigned int *sq_tail;
+	unsigned int *sq_array;
+	unsigned int sq_mask;
+	unsigned int sq_entries;
+	/* entries up to here have been handed out, up to flushed submitted */
+	unsigned int sq_local_tail;
+	unsigned int sq_flushed;
+
+	unsigned int *cq_head;
+	unsigned int *cq_tail;
+	unsigned int cq_mask;
+	struct io_uring_cqe *cqes;
+
+	struct {
+		struct io_uring_buf_ring *ring;
+		size_t ring_size;
+		uint8_t *data;
+		size_t size;
+		unsigned int num;
+		uint16_t tail;
+	} bufs;
+};
+
+static int _uring_setup(const unsigned int entries, struct io_uring_params *params)
+{
+	int fd;
+
+	if ((fd = syscall(__NR_io_uring_setup, entries, params)) < 0) {
+		return -errno;
+	}
+
+	return fd;
+}
+
+static int _uring_enter(const int fd, const unsigned int to_submit,
+                        const unsigned int wait_nr, const unsigned int flags)
+{
+	int ret;
+
+	if ((ret = syscall(__NR_io_uring_enter, fd, to_submit, wait_nr, flags, NULL, 0)) < 0) {
+		return -errno;
+	}
+
+	return ret;
+}
+
+static int _uring_register(const int fd, const unsigned int opcode, void *arg,
+                           const unsigned int nargs)
+{
+	if (syscall(__NR_io_uring_register, fd, opcode, arg, nargs) < 0) {
+		return -errno;
+	}
+
+	return 0;
+}
+
+int uring_new(uring_t **ring, const unsigned int entries)
+{
+	struct io_uring_params params;
+	uring_t *r;
+	int err;
+
+	if (!ring || entries == 0) {
+		return -EINVAL;
+	}
+
+	if (!(r = calloc(1, sizeof(*r)))) {
+		return -ENOMEM;
+	}
+
+	r->sq_ptr = MAP_FAILED;
+	r->cq_ptr = MAP_FAILED;
+	r->sqes = MAP_FAILED;
+
+	memset(&params, 0, sizeof(params));
+
+	if ((r->fd = _uring_setup(entries, &params)) < 0) {
+		err = r->fd;
+		goto cleanup;
+	}
+
+	r->sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+	r->cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+
+	if (params.features & IORING_FEAT_SINGLE_MMAP) {
+		/* both rings live in the same mapping */
+		if (r->cq_size > r->sq_size) {
+			r->sq_size = r->cq_size;
+		}
+		r->cq_size = r->sq_size;
+	}
+
+	if ((r->sq_ptr = mmap(NULL, r->sq_size, PROT_READ | PROT_WRITE,
+	                      MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING)) == MAP_FAILED) {
+		err = -errno;
+		goto cleanup;
+	}
+
+	if (params.features & IORING_FEAT_SINGLE_MMAP) {
+		r->cq_ptr = r->sq_ptr;
+	} else if ((r->cq_ptr = mmap(NULL, r->cq_size, PROT_READ | PROT_WRITE,
+	                             MAP_SHARED | MAP_POPULATE, r->fd,
+	                             IORING_OFF_CQ_RING)) == MAP_FAILED) {
+		err = -errno;
+		goto cleanup;
+	}
+
+	r->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+
+	if ((r->sqes = mmap(NULL, r->sqes_size, PROT_READ | PROT_WRITE,
+	                    MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES)) == MAP_FAILED) {
+		err = -errno;
+		goto cleanup;
+	}
+
+	r->sq_head = (unsigned int*)((uint8_t*)r->sq_ptr + params.sq_off.head);
+	r->sq_tail = (unsigned int*)((uint8_t*)r->sq_ptr + params.sq_off.tail);
+	r->sq_array = (unsigned int*)((uint8_t*)r->sq_ptr + params.sq_off.array);
+	r->sq_mask = *(unsigned int*)((uint8_t*)r->sq_ptr + params.sq_off.ring_mask);
+	r->sq_entries = params.sq_entries;
+	r->sq_local_tail = *r->sq_tail;
+	r->sq_flushed = r->sq_local_tail;
+
+	r->cq_head = (unsigned int*)((uint8_t*)r->cq_ptr + params.cq_off.head);
+	r->cq_tail = (unsigned int*)((uint8_t*)r->cq_ptr + params.cq_off.tail);
+	r->cq_mask = *(unsigned int*)((uint8_t*)r->cq_ptr + params.cq_off.ring_mask);
+	r->cqes = (struct io_uring_cqe*)((uint8_t*)r->cq_ptr + params.cq_off.cqes);
+
+	r->bufs.ring = MAP_FAILED;
+	err = 0;
+
+cleanup:
+	if (err < 0) {
+		uring_free(&r);
+	} else {
+		*ring = r;
+	}
+
+	return err;
+}
+
+int uring_free(uring_t **ring)
+{
+	uring_t *r;
+
+	if (!ring || !*ring) {
+		return -EINVAL;
+	}
+
+	r = *ring;
+
+	/* closing the ring cancels everything that is still in flight */
+	if (r->fd >= 0) {
+		close(r->fd);
+	}
+
+	if (r->bufs.ring && r->bufs.ring != MAP_FAILED) {
+		munmap(r->bufs.ring, r->bufs.ring_size);
+	}
+	free(r->bufs.data);
+
+	if (r->sqes != MAP_FAILED) {
+		munmap(r->sqes, r->sqes_size);
+	}
+	if (r->cq_ptr != MAP_FAILED && r->cq_ptr != r->sq_ptr) {
+		munmap(r->cq_ptr, r->cq_size);
+	}
+	if (r->sq_ptr != MAP_FAILED) {
+		munmap(r->sq_ptr, r->sq_size);
+	}
+
+	free(r);
+	*ring = NULL;
+
+	return 0;
+}
+
+int uring_provide_buffers(uring_t *ring, const uint16_t group,
+                          const unsigned int num_bufs, const size_t buf_size)
+{
+	struct io_uring_buf_reg reg;
+	unsigned int i;
+	int err;
+
+	if (!ring || num_bufs == 0 || num_bufs > 32768 ||
+	    (num_bufs & (num_bufs - 1)) || buf_size == 0) {
+		return -EINVAL;
+	}
+
+	if (ring->bufs.data) {
+		return -EALREADY;
+	}
+
+	/* the kernel wants the buffer ring to be page-aligned */
+	ring->bufs.ring_size = num_bufs * sizeof(struct io_uring_buf);
+
+	if ((ring->bufs.ring = mmap(NULL, ring->bufs.ring_size, PROT_READ | PROT_WRITE,
+	                            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)) == MAP_FAILED) {
+		return -errno;
+	}
+
+	if (!(ring->bufs.data = malloc(num_bufs * buf_size))) {
+		err = -ENOMEM;
+		goto cleanup;
+	}
+
+	memset(&reg, 0, sizeof(reg));
+	reg.ring_addr = (uint64_t)(uintptr_t)ring->bufs.ring;
+	reg.ring_entries = num_bufs;
+	reg.bgid = group;
+
+	if ((err = _uring_register(ring->fd, IORING_REGISTER_PBUF_RING, &reg, 1)) < 0) {
+		goto cleanup;
+	}
+
+	ring->bufs.size = buf_size;
+	ring->bufs.num = num_bufs;
+	ring->bufs.tail = 0;
+
+	for (i = 0; i < num_bufs; i++) {
+		uring_recycle_buffer(ring, i);
+	}
+
+cleanup:
+	if (err < 0) {
+		free(ring->bufs.data);
+		ring->bufs.data = NULL;
+		munmap(ring->bufs.ring, ring->bufs.ring_size);
+		ring->bufs.ring = MAP_FAILED;
+	}
+
+	return err;
+}
+
+void* uring_get_buffer(uring_t *ring, const uint16_t bid)
+{
+	return ring->bufs.data + (size_t)bid * ring->bufs.size;
+}
+
+void uring_recycle_buffer(uring_t *ring, const uint16_t bid)
+{
+	struct io_uring_buf *buf;
+
+	buf = &ring->bufs.ring->bufs[ring->bufs.tail & (ring->bufs.num - 1)];
+
+	/* the tail overlays the resv field of the first entry, leave it alone */
+	buf->addr = (uint64_t)(uintptr_t)uring_get_buffer(ring, bid);
+	buf->len = ring->bufs.size;
+	buf->bid = bid;
+
+	ring->bufs.tail++;
+	__atomic_store_n(&ring->bufs.ring->tail, ring->bufs.tail, __ATOMIC_RELEASE);
+}
+
+struct io_uring_sqe* uring_get_sqe(uring_t *ring)
+{
+	struct io_uring_sqe *sqe;
+	unsigned int idx;
+
+	if (ring->sq_local_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) >=
+	    ring->sq_entries) {
+		/* make room by submitting what has been queued so far */
+		if (uring_submit(ring, 0) < 0 ||
+		    ring->sq_local_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) >=
+		    ring->sq_entries) {
+			return NULL;
+		}
+	}
+
+	idx = ring->sq_local_tail & ring->sq_mask;
+	ring->sq_array[idx] = idx;
+	ring->sq_local_tail++;
+
+	sqe = &ring->sqes[idx];
+	memset(sqe, 0, sizeof(*sqe));
+
+	return sqe;
+}
+
+int uring_submit(uring_t *ring, const unsigned int wait_nr)
+{
+	unsigned int to_submit;
+	int ret;
+
+	if (!ring) {
+		return -EINVAL;
+	}
+
+	to_submit = ring->sq_local_tail - ring->sq_flushed;
+	__atomic_store_n(ring->sq_tail, ring->sq_local_tail, __ATOMIC_RELEASE);
+
+	/* submitting and waiting for completions takes a single system call */
+	if ((ret = _uring_enter(ring->fd, to_submit, wait_nr,
+	                        wait_nr ? IORING_ENTER_GETEVENTS : 0)) > 0) {
+		ring->sq_flushed += ret;
+	}
+
+	return ret;
+}
+
+int uring_peek_cqe(uring_t *ring, struct io_uring_cqe **cqe)
+{
+	unsigned int head;
+
+	head = *ring->cq_head;
+
+	if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+		return -EAGAIN;
+	}
+
+	*cqe = &ring->cqes[head & ring->cq_mask];
+	return 0;
+}
+
+void uring_cqe_seen(uring_t *ring)
+{
+	__atomic_store_n(ring->cq_head, *ring->cq_head + 1, __ATOMIC_RELEASE);
+}
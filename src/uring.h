@@ -0,0 +1,49 @@
+/*
+ * uring.h - This file is part of mxim
+ * Copyright (C) 2025 Matthias Kruk
+ *
+ * Mxim is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation; either version 3, or (at your
+ * option) any later version.
+ *
+ * Mxim is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Mxim; see the file COPYING.  If not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#ifndef URING_H
+#define URING_H
+
+#include <linux/io_uring.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct uring uring_t;
+
+int uring_new(uring_t **ring, const unsigned int entries);
+int uring_free(uring_t **ring);
+
+/*
+ * Registers a ring of num_bufs buffers of buf_size bytes each, that
+ * requests with IOSQE_BUFFER_SELECT receive into. num_bufs must be a
+ * power of two.
+ */
+int   uring_provide_buffers(uring_t *ring, const uint16_t group,
+                            const unsigned int num_bufs, const size_t buf_size);
+void* uring_get_buffer(uring_t *ring, const uint16_t bid);
+void  uring_recycle_buffer(uring_t *ring, const uint16_t bid);
+
+struct io_uring_sqe* uring_get_sqe(uring_t *ring);
+int uring_submit(uring_t *ring, const unsigned int wait_nr);
+
+int  uring_peek_cqe(uring_t *ring, struct io_uring_cqe **cqe);
+void uring_cqe_seen(uring_t *ring);
+
+#endif /* URING_H */
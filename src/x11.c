@@ -0,0 +1,85 @@
+/*
+ * x11.c - This file is part of mxim
+ * Copyright (C) 2025 Matthias Kruk
+ *
+ * Mxim is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation; either version 3, or (at your
+ * option) any later version.
+ *
+ * Mxim is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Mxim; see the file COPYING.  If not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include "fd.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <xcb/xcb.h>
+
+/*
+ * The connection to the X server, so that event loops can wait for it
+ * like for any other fd. XCB does all reading and writing, the fd only
+ * tells the event loop when there is something to read.
+ */
+
+static int _x11_open(fd_t *fd, va_list args);
+static int _x11_close(fd_t *fd);
+
+static struct fd_ops _x11_ops = {
+	.open  = _x11_open,
+	.close = _x11_close
+};
+
+struct x11_priv {
+	xcb_connection_t *conn;
+};
+
+struct fd_dom _dom_x11 = {
+	.dom = FD_DOM_X11,
+	.ops = &_x11_ops,
+	.priv_size = sizeof(struct x11_priv)
+};
+
+static int _x11_open(fd_t *fd, va_list args)
+{
+	struct x11_priv *priv;
+	xcb_connection_t *conn;
+	int sock;
+
+	if (!fd) {
+		return -EINVAL;
+	}
+
+	if (!(conn = va_arg(args, xcb_connection_t*))) {
+		return -EINVAL;
+	}
+
+	/* the connection keeps its own fd, which is closed by xcb_disconnect() */
+	if ((sock = fcntl(xcb_get_file_descriptor(conn), F_DUPFD_CLOEXEC, 0)) < 0) {
+		return -errno;
+	}
+
+	priv = fd->priv;
+	priv->conn = conn;
+	fd->fd = sock;
+
+	return 0;
+}
+
+static int _x11_close(fd_t *fd)
+{
+	if (!fd) {
+		return -EINVAL;
+	}
+
+	return 0;
+}
@@ -1,6 +1,6 @@
 /*
  * xhandler.c - This file is part of mxim
- * Copyright (C) 2024 Matthias Kruk
+ * Copyright (C) 2024-2025 Matthias Kruk
  *
  * Mxim is free software; you can redistribute it and/or modify
  * it under the terms of the GNU General Public License as published
@@ -18,87 +18,188 @@
  * Boston, MA 02111-1307, USA.
  */
 
+#include "fd.h"
+#include "log.h"
+#include "thread.h"
 #include "xhandler.h"
+#include "ximserver.h"
 #include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <X11/Xlib.h>
-#include <X11/Xatom.h>
-#include <X11/Xutil.h>
+#include <xcb/xcb.h>
+#include <xcb/xcbext.h>
+#include <xcb/xproto.h>
 
 enum _atoms {
 	ATOM_IM = 0,
 	ATOM_XIM_SERVERS,
 	ATOM_LOCALES,
 	ATOM_TRANSPORT,
+	ATOM_MWM_HINT,
+	ATOM_UTF8_STRING,
 	ATOM_MAX
 };
 static const char *_atom_names[] = {
 	"@server=mxim",
 	"XIM_SERVERS",
 	"LOCALES",
-	"TRANSPORT"
+	"TRANSPORT",
+	"MWM_HINT",
+	"UTF8_STRING"
+};
+
+/* must be a power of two */
+#define X_WINDOW_CACHE_SIZE 256
+
+/*
+ * Top-level windows of client windows that were resolved before. An entry
+ * is dropped when the X server tells us that the client window or its
+ * top-level window was destroyed or reparented.
+ */
+struct x_window_cache {
+	mutex_t lock;
+	unsigned int generation;
+
+	struct {
+		xcb_window_t window;
+		xcb_window_t client;
+	} entries[X_WINDOW_CACHE_SIZE];
+};
+
+/*
+ * A lookup of the top-level window of a client window. It is started by
+ * the thread of the IC, but only the reactor that watches the connection
+ * to the X server talks to the X server about it. When the answer is
+ * there, the reactor of the IC is woken up to draw the IC.
+ */
+struct x_window_query {
+	xcb_window_t window;
+	xim_reactor_t *reactor;
+
+	/* only used by the X reactor */
+	xcb_window_t current;
+	unsigned int request;
+	x_window_query_t *next;
+
+	/* the answer, valid once done is set */
+	xcb_window_t client;
+	unsigned int generation;
+	int done;
+
+	/* held by the IC and the X reactor */
+	int refs;
 };
 
 struct x_handler {
-	Display *display;
-	Atom atoms[ATOM_MAX];
+	xcb_connection_t *conn;
+	xcb_window_t root;
+	fd_t *fd;
+	xim_server_t *server;
+	xcb_atom_t atoms[ATOM_MAX];
 	char *properties[ATOM_MAX];
-	Window window;
+	xcb_window_t window;
+	struct x_window_cache cache;
+
+	/* queries that ICs have started, and the X reactor is told about through wakeup */
+	mutex_t lock;
+	x_window_query_t *queued;
+	fd_t *wakeup;
+
+	/* queries that are waiting for the X server, only used by the X reactor */
+	x_window_query_t *pending;
 };
 
+#define CACHE_LOCK(h)   mutex_lock(&(h)->cache.lock)
+#define CACHE_UNLOCK(h) mutex_unlock(&(h)->cache.lock)
+
 static int _x_handler_is_connected(x_handler_t *handler)
 {
-	return handler->display != NULL;
+	return handler->conn != NULL;
 }
 
-static int _x_handler_connect(x_handler_t *handler)
+/* All atoms are requested before the first reply is waited for */
+static int _x_handler_intern_atoms(x_handler_t *handler)
 {
-	Window root_window;
-	XSetWindowAttributes attrs;
-	int screen;
+	xcb_intern_atom_cookie_t cookies[ATOM_MAX];
+	int err;
 	int i;
 
+	for (i = ATOM_IM; i < ATOM_MAX; i++) {
+		cookies[i] = xcb_intern_atom(handler->conn, 0, strlen(_atom_names[i]),
+		                             _atom_names[i]);
+	}
+
+	for (err = 0, i = ATOM_IM; i < ATOM_MAX; i++) {
+		xcb_intern_atom_reply_t *reply;
+
+		if (!(reply = xcb_intern_atom_reply(handler->conn, cookies[i], NULL))) {
+			log_error("Could not lookup atom: %s", _atom_names[i]);
+			err = -EFAULT;
+			continue;
+		}
+
+		handler->atoms[i] = reply->atom;
+		free(reply);
+	}
+
+	return err;
+}
+
+static int _x_handler_connect(x_handler_t *handler)
+{
+	const xcb_setup_t *setup;
+	xcb_screen_iterator_t screens;
+	xcb_screen_t *screen;
+	uint32_t event_mask;
+	int screen_num;
+	int err;
+
 	if (_x_handler_is_connected(handler)) {
 		return -EALREADY;
 	}
 
-	if (!(handler->display = XOpenDisplay(NULL))) {
+	/* XCB connections may be used from several threads without locking */
+	handler->conn = xcb_connect(NULL, &screen_num);
+
+	if (xcb_connection_has_error(handler->conn)) {
+		xcb_disconnect(handler->conn);
+		handler->conn = NULL;
 		return -EIO;
 	}
 
-	for (i = ATOM_IM; i < ATOM_MAX; i++) {
-		if ((handler->atoms[i] = XInternAtom(handler->display,
-		                                    _atom_names[i],
-		                                    False)) == None) {
-			fprintf(stderr, "%s: Could not lookup atom: %s\n",
-			        __func__, _atom_names[i]);
-			return -EFAULT;
-		}
+	setup = xcb_get_setup(handler->conn);
+	screens = xcb_setup_roots_iterator(setup);
+
+	while (screen_num-- > 0) {
+		xcb_screen_next(&screens);
 	}
 
-	screen = DefaultScreen(handler->display);
-	root_window = RootWindow(handler->display, screen);
+	screen = screens.data;
+	handler->root = screen->root;
+
+	if ((err = _x_handler_intern_atoms(handler)) < 0) {
+		return err;
+	}
 
-	memset(&attrs, 0, sizeof(attrs));
-	attrs.event_mask = ExposureMask;
+	event_mask = XCB_EVENT_MASK_EXPOSURE;
+	handler->window = xcb_generate_id(handler->conn);
+	xcb_create_window(handler->conn, XCB_COPY_FROM_PARENT, handler->window, handler->root,
+	                  0, 0, 1, 1, 0, XCB_WINDOW_CLASS_INPUT_OUTPUT, screen->root_visual,
+	                  XCB_CW_EVENT_MASK, &event_mask);
 
-	handler->window = XCreateWindow(handler->display, root_window, 0, 0, 1, 1, 0,
-	                                CopyFromParent, CopyFromParent,
-	                                DefaultVisual(handler->display, screen),
-	                                CWEventMask, &attrs);
-	XSetSelectionOwner(handler->display, handler->atoms[ATOM_IM], handler->window, CurrentTime);
-	XSetSelectionOwner(handler->display, handler->atoms[ATOM_XIM_SERVERS], handler->window, CurrentTime);
+	xcb_set_selection_owner(handler->conn, handler->window,
+	                        handler->atoms[ATOM_IM], XCB_CURRENT_TIME);
+	xcb_set_selection_owner(handler->conn, handler->window,
+	                        handler->atoms[ATOM_XIM_SERVERS], XCB_CURRENT_TIME);
 
 	/* register IM Server by prepending it to the XIM_SERVERS property of the root window */
-	XChangeProperty(handler->display, root_window,
-	                handler->atoms[ATOM_XIM_SERVERS], XA_ATOM, 32, PropModePrepend,
-	                (unsigned char*)&handler->atoms[ATOM_IM], 1);
-	XSync(handler->display, False);
+	xcb_change_property(handler->conn, XCB_PROP_MODE_PREPEND, handler->root,
+	                    handler->atoms[ATOM_XIM_SERVERS], XCB_ATOM_ATOM, 32, 1,
+	                    &handler->atoms[ATOM_IM]);
+	xcb_flush(handler->conn);
 
 	handler->properties[ATOM_LOCALES] = "@locales=en_US";
-	handler->properties[ATOM_TRANSPORT] = "@transport=tcp/127.0.0.1:1234";
 
 	return 0;
 }
@@ -111,6 +212,8 @@ int x_handler_init(x_handler_t **handler)
 	err = -ENOMEM;
 
 	if ((hnd = calloc(1, sizeof(*hnd)))) {
+		assert(mutex_init(&hnd->cache.lock) == 0);
+		assert(mutex_init(&hnd->lock) == 0);
 		err = _x_handler_connect(hnd);
 	}
 
@@ -123,74 +226,221 @@ int x_handler_init(x_handler_t **handler)
 	return err;
 }
 
+static void _x_window_query_put(x_window_query_t *query)
+{
+	if (__atomic_sub_fetch(&query->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+		free(query);
+	}
+}
+
+static void _x_window_query_free_all(x_window_query_t *queries)
+{
+	x_window_query_t *query;
+
+	while ((query = queries)) {
+		queries = query->next;
+		_x_window_query_put(query);
+	}
+}
+
 int x_handler_free(x_handler_t **handler)
 {
 	if (!handler || !*handler) {
 		return -EINVAL;
 	}
 
-	if ((*handler)->display) {
-		XCloseDisplay((*handler)->display);
-		(*handler)->display = NULL;
+	if ((*handler)->fd) {
+		fd_free(&(*handler)->fd);
 	}
 
+	if ((*handler)->wakeup) {
+		fd_free(&(*handler)->wakeup);
+	}
+
+	_x_window_query_free_all((*handler)->queued);
+	_x_window_query_free_all((*handler)->pending);
+
+	if ((*handler)->conn) {
+		xcb_disconnect((*handler)->conn);
+		(*handler)->conn = NULL;
+	}
+
+	free((*handler)->properties[ATOM_TRANSPORT]);
+	assert(mutex_destroy(&(*handler)->cache.lock) == 0);
+	assert(mutex_destroy(&(*handler)->lock) == 0);
+
 	free(*handler);
 	*handler = NULL;
 
 	return 0;
 }
 
-static int _handle_selection_request(x_handler_t *handler, XSelectionRequestEvent *event)
+int x_handler_set_transport(x_handler_t *handler, const char *transport)
+{
+	char *prop;
+	int prop_size;
+
+	if (!handler || !transport) {
+		return -EINVAL;
+	}
+
+	prop_size = snprintf(NULL, 0, "@transport=%s", transport) + 1;
+
+	if (!(prop = malloc(prop_size))) {
+		return -ENOMEM;
+	}
+
+	snprintf(prop, prop_size, "@transport=%s", transport);
+
+	free(handler->properties[ATOM_TRANSPORT]);
+	handler->properties[ATOM_TRANSPORT] = prop;
+
+	return 0;
+}
+
+static int _handle_selection_request(x_handler_t *handler, xcb_selection_request_event_t *event)
 {
-	XEvent response;
+	xcb_selection_notify_event_t response;
+	const char *value;
 
 	if (event->target == handler->atoms[ATOM_LOCALES]) {
-		static const char locale[] = "@locale=en_US";
-
-		XChangeProperty(handler->display, event->requestor,
-		                event->property, event->target,
-		                8, PropModeReplace, (unsigned char*)locale,
-		                strlen(locale));
-	} else if (event->target == handler->atoms[ATOM_TRANSPORT]) {
-		static const char transport[] = "@transport=tcp/127.0.0.1:1234";
-
-		XChangeProperty(handler->display, event->requestor,
-		                event->property, event->target,
-		                8, PropModeReplace, (unsigned char*)transport,
-		                strlen(transport));
+		value = "@locale=en_US";
+	} else if (event->target == handler->atoms[ATOM_TRANSPORT] &&
+	           handler->properties[ATOM_TRANSPORT]) {
+		value = handler->properties[ATOM_TRANSPORT];
 	} else {
-		fprintf(stderr, "XSelectionRequestEvent on unhandled property 0x%lx\n", event->target);
+		log_warn("XSelectionRequestEvent on unhandled property 0x%x", event->target);
 		return -ENOSYS;
 	}
 
+	xcb_change_property(handler->conn, XCB_PROP_MODE_REPLACE, event->requestor,
+	                    event->property, event->target, 8, strlen(value), value);
+
+	/* events are sent as 32 bytes, no matter what type they are */
 	memset(&response, 0, sizeof(response));
-	response.type = SelectionNotify;
-	response.xselection.requestor = event->requestor;
-	response.xselection.selection = event->selection;
-	response.xselection.target = event->target;
-	response.xselection.time = event->time;
-	response.xselection.property = event->property;
-	XSendEvent(handler->display, event->requestor, False, NoEventMask, &response);
+	response.response_type = XCB_SELECTION_NOTIFY;
+	response.requestor = event->requestor;
+	response.selection = event->selection;
+	response.target = event->target;
+	response.time = event->time;
+	response.property = event->property;
+	xcb_send_event(handler->conn, 0, event->requestor, XCB_EVENT_MASK_NO_EVENT,
+	               (const char*)&response);
 
 	return 0;
 }
 
-static int _handle_x_event(x_handler_t *handler)
+static unsigned int _x_window_cache_slot(xcb_window_t window)
 {
-	XEvent event;
+	/* window ids of one client only differ in the low bits */
+	return (window ^ (window >> 16)) & (X_WINDOW_CACHE_SIZE - 1);
+}
+
+static int _x_window_cache_lookup(x_handler_t *handler, xcb_window_t window,
+                                  xcb_window_t *client, unsigned int *generation)
+{
+	unsigned int slot;
 	int err;
 
-	if (XNextEvent(handler->display, &event) != 0) {
-		return -EAGAIN;
+	slot = _x_window_cache_slot(window);
+	err = -ENOENT;
+
+	CACHE_LOCK(handler);
+
+	if (handler->cache.entries[slot].window == window) {
+		*client = handler->cache.entries[slot].client;
+		*generation = handler->cache.generation;
+		err = 0;
+	}
+
+	CACHE_UNLOCK(handler);
+
+	return err;
+}
+
+static void _x_window_cache_insert(x_handler_t *handler, xcb_window_t window,
+                                   xcb_window_t client, unsigned int *generation)
+{
+	static const uint32_t event_mask = XCB_EVENT_MASK_STRUCTURE_NOTIFY;
+	unsigned int slot;
+
+	/* tell us when either of them goes away or moves */
+	xcb_change_window_attributes(handler->conn, window, XCB_CW_EVENT_MASK, &event_mask);
+
+	if (client != XCB_WINDOW_NONE) {
+		xcb_change_window_attributes(handler->conn, client, XCB_CW_EVENT_MASK, &event_mask);
+	}
+
+	slot = _x_window_cache_slot(window);
+
+	CACHE_LOCK(handler);
+	handler->cache.entries[slot].window = window;
+	handler->cache.entries[slot].client = client;
+	*generation = handler->cache.generation;
+	CACHE_UNLOCK(handler);
+}
+
+static void _x_window_cache_invalidate(x_handler_t *handler, xcb_window_t window)
+{
+	int dropped;
+	int i;
+
+	CACHE_LOCK(handler);
+
+	for (dropped = 0, i = 0; i < X_WINDOW_CACHE_SIZE; i++) {
+		if (handler->cache.entries[i].window == window ||
+		    handler->cache.entries[i].client == window) {
+			handler->cache.entries[i].window = XCB_WINDOW_NONE;
+			handler->cache.entries[i].client = XCB_WINDOW_NONE;
+			dropped++;
+		}
 	}
 
-	switch (event.type) {
-	case SelectionRequest:
-		err = _handle_selection_request(handler, (XSelectionRequestEvent*)&event);
+	/* makes ICs resolve their windows again, see x_handler_get_client_window() */
+	if (dropped > 0) {
+		__atomic_add_fetch(&handler->cache.generation, 1, __ATOMIC_RELEASE);
+	}
+
+	CACHE_UNLOCK(handler);
+}
+
+static int _handle_x_event(x_handler_t *handler, xcb_generic_event_t *event)
+{
+	int err;
+
+	switch (event->response_type & ~0x80) {
+	case 0:
+		log_debug("X error %d for request %d",
+		          ((xcb_generic_error_t*)event)->error_code,
+		          ((xcb_generic_error_t*)event)->major_code);
+		err = -EIO;
+		break;
+
+	case XCB_SELECTION_REQUEST:
+		err = _handle_selection_request(handler, (xcb_selection_request_event_t*)event);
+		break;
+
+	case XCB_DESTROY_NOTIFY:
+		_x_window_cache_invalidate(handler, ((xcb_destroy_notify_event_t*)event)->window);
+		err = 0;
+		break;
+
+	case XCB_REPARENT_NOTIFY:
+		_x_window_cache_invalidate(handler, ((xcb_reparent_notify_event_t*)event)->window);
+		err = 0;
+		break;
+
+	case XCB_CONFIGURE_NOTIFY:
+	case XCB_MAP_NOTIFY:
+	case XCB_UNMAP_NOTIFY:
+	case XCB_GRAVITY_NOTIFY:
+	case XCB_CIRCULATE_NOTIFY:
+		/* the rest of StructureNotify is of no interest */
+		err = 0;
 		break;
 
 	default:
-		fprintf(stderr, "Unhandled XEvent with type 0x%x\n", event.type);
+		log_debug("Unhandled XEvent with type 0x%x", event->response_type);
 		err = -ENOSYS;
 		break;
 	}
@@ -198,70 +448,373 @@ static int _handle_x_event(x_handler_t *handler)
 	return err;
 }
 
-int x_handler_run(x_handler_t *handler)
+static void _x_handler_query_tree(x_handler_t *handler, x_window_query_t *query)
 {
-	int err;
+	query->request = xcb_query_tree(handler->conn, query->current).sequence;
+}
+
+/* Hands the answer to the IC and wakes up its reactor, so that the IC gets drawn */
+static void _x_window_query_finish(x_window_query_t *query, xcb_window_t client,
+                                   unsigned int generation)
+{
+	query->client = client;
+	query->generation = generation;
+	__atomic_store_n(&query->done, 1, __ATOMIC_RELEASE);
+
+	if (query->reactor) {
+		xim_server_wake(query->reactor);
+	}
+
+	_x_window_query_put(query);
+}
+
+/* Returns 1 when the query is finished, 0 if it's waiting for the X server */
+static int _x_handler_advance(x_handler_t *handler, x_window_query_t *query)
+{
+	xcb_query_tree_reply_t *reply;
+	xcb_generic_error_t *error;
+	unsigned int generation;
+	xcb_window_t client;
+
+	/* nobody is interested in the answer anymore */
+	if (__atomic_load_n(&query->refs, __ATOMIC_ACQUIRE) == 1) {
+		if (query->request) {
+			xcb_discard_reply(handler->conn, query->request);
+		}
+
+		_x_window_query_put(query);
+		return 1;
+	}
+
+	/* no answer is ever going to come */
+	if (xcb_connection_has_error(handler->conn)) {
+		_x_window_query_finish(query, XCB_WINDOW_NONE,
+		                       __atomic_load_n(&handler->cache.generation, __ATOMIC_ACQUIRE));
+		return 1;
+	}
+
+	if (!query->request) {
+		/* another IC may have resolved the same window in the meantime */
+		if (_x_window_cache_lookup(handler, query->window, &client, &generation) == 0) {
+			_x_window_query_finish(query, client, generation);
+			return 1;
+		}
+
+		query->current = query->window;
+		_x_handler_query_tree(handler, query);
+		return 0;
+	}
 
 	while (1) {
-		_handle_x_event(handler);
+		reply = NULL;
+		error = NULL;
+
+		if (!xcb_poll_for_reply(handler->conn, query->request, (void**)&reply, &error)) {
+			return 0;
+		}
+
+		query->request = 0;
+
+		if (!reply) {
+			/* the window is gone */
+			free(error);
+			_x_window_query_finish(query, XCB_WINDOW_NONE,
+			                       __atomic_load_n(&handler->cache.generation,
+			                                       __ATOMIC_ACQUIRE));
+			return 1;
+		}
+
+		if (reply->parent == reply->root) {
+			/* the window itself doesn't count, only its ancestors */
+			client = query->current == query->window ? XCB_WINDOW_NONE : query->current;
+			free(reply);
+
+			_x_window_cache_insert(handler, query->window, client, &generation);
+			_x_window_query_finish(query, client, generation);
+			return 1;
+		}
+
+		query->current = reply->parent;
+		free(reply);
+		_x_handler_query_tree(handler, query);
+	}
+}
+
+/* Moves the queries of the ICs along, called only by the X reactor */
+static void _x_handler_advance_queries(x_handler_t *handler)
+{
+	x_window_query_t **prev;
+	x_window_query_t *query;
+	x_window_query_t *queued;
+
+	mutex_lock(&handler->lock);
+	queued = handler->queued;
+	handler->queued = NULL;
+	mutex_unlock(&handler->lock);
+
+	while ((query = queued)) {
+		queued = query->next;
+		query->next = handler->pending;
+		handler->pending = query;
 	}
 
-	return err;
+	for (prev = &handler->pending; (query = *prev); ) {
+		if (_x_handler_advance(handler, query)) {
+			*prev = query->next;
+		} else {
+			prev = &query->next;
+		}
+	}
 }
 
-int x_handler_get_client_window(x_handler_t *handler, Window window, Window *client)
+static void _x_handler_handle_events(x_handler_t *handler, const int read)
 {
-	Window current;
-	Window root;
-	Window parent;
+	xcb_generic_event_t *ev;
 
-	root = parent = None;
-	current = window;
+	while ((ev = read ? xcb_poll_for_event(handler->conn) :
+	                    xcb_poll_for_queued_event(handler->conn))) {
+		_handle_x_event(handler, ev);
+		free(ev);
+	}
+}
 
-	while (current != root) {
-		Window current_parent;
-		Window *children;
-		unsigned nchildren;
+/*
+ * Called when the connection is readable and at the end of every pass of
+ * the event loop, since XCB may have read events along with replies.
+ */
+static void _x_handler_in(fd_t *fd, fd_event_t event, x_handler_t *handler, void *data)
+{
+	_x_handler_handle_events(handler, event == FD_EVENT_IN);
+	_x_handler_advance_queries(handler);
+
+	/* polling for replies may have read more events */
+	_x_handler_handle_events(handler, 0);
 
-		children = NULL;
-		XQueryTree(handler->display, current, &root, &current_parent, &children, &nchildren);
+	if (xcb_connection_has_error(handler->conn)) {
+		log_error("Connection to the X server was lost");
+		fd_set_callback(fd, FD_EVENT_IN, NULL, NULL);
+		fd_set_callback(fd, FD_EVENT_FLUSH, NULL, NULL);
 
-		if (children) {
-			XFree(children);
+		/* nobody can find the server without the selection */
+		if (handler->server) {
+			xim_server_stop(handler->server);
 		}
+		return;
+	}
+
+	xcb_flush(handler->conn);
+}
 
-		if (current_parent == root) {
-			break;
+/* Woken up by an IC that started a query */
+static void _x_handler_woken(fd_t *fd, fd_event_t event, x_handler_t *handler, void *data)
+{
+	uint64_t count;
+
+	fd_read(fd, &count, sizeof(count));
+
+	/*
+	 * Requests sent here are flushed with the next FD_EVENT_FLUSH. If the
+	 * connection was lost, the queries are finished right away.
+	 */
+	_x_handler_advance_queries(handler);
+}
+
+int x_handler_attach(x_handler_t *handler, xim_server_t *server)
+{
+	int err;
+
+	if (!handler || !server) {
+		return -EINVAL;
+	}
+
+	if (handler->fd) {
+		return -EALREADY;
+	}
+
+	if ((err = fd_open(&handler->fd, FD_DOM_X11, handler->conn)) < 0) {
+		return err;
+	}
+
+	if ((err = fd_open(&handler->wakeup, FD_DOM_EVENT)) < 0) {
+		fd_free(&handler->fd);
+		return err;
+	}
+
+	fd_set_callback(handler->fd, FD_EVENT_IN, (fd_callback_t*)_x_handler_in, handler);
+	fd_set_callback(handler->fd, FD_EVENT_FLUSH, (fd_callback_t*)_x_handler_in, handler);
+	fd_set_callback(handler->wakeup, FD_EVENT_IN, (fd_callback_t*)_x_handler_woken, handler);
+
+	/* both are watched by the same reactor, the X reactor */
+	if ((err = xim_server_watch(server, handler->fd)) < 0 ||
+	    (err = xim_server_watch(server, handler->wakeup)) < 0) {
+		fd_free(&handler->wakeup);
+		fd_free(&handler->fd);
+	} else {
+		handler->server = server;
+	}
+
+	return err;
+}
+
+static int _x_handler_resolve(x_handler_t *handler, x_client_window_t *window)
+{
+	static const uint64_t one = 1;
+	x_window_query_t *query;
+	xcb_window_t client;
+
+	window->client = None;
+	window->resolved = 0;
+
+	if (window->window == None) {
+		window->resolved = 1;
+		window->generation = __atomic_load_n(&handler->cache.generation, __ATOMIC_ACQUIRE);
+		return 0;
+	}
+
+	if (_x_window_cache_lookup(handler, window->window, &client, &window->generation) == 0) {
+		window->client = client;
+		window->resolved = 1;
+		return 0;
+	}
+
+	if (!(query = calloc(1, sizeof(*query)))) {
+		return -ENOMEM;
+	}
+
+	query->window = window->window;
+	query->reactor = xim_server_get_reactor();
+	query->refs = 2;
+	window->query = query;
+
+	mutex_lock(&handler->lock);
+	query->next = handler->queued;
+	handler->queued = query;
+	mutex_unlock(&handler->lock);
+
+	/* the X reactor sends the request, this thread doesn't touch the connection */
+	if (handler->wakeup) {
+		fd_write(handler->wakeup, &one, sizeof(one));
+	}
+
+	return 0;
+}
+
+/*
+ * Starts looking up the top-level window that contains a client's window.
+ * The answer is collected by x_handler_get_client_window(). Windows that
+ * were looked up before are answered from the cache.
+ */
+int x_handler_query_client_window(x_handler_t *handler, Window window, x_client_window_t *dst)
+{
+	if (!handler || !dst) {
+		return -EINVAL;
+	}
+
+	x_handler_forget_client_window(handler, dst);
+
+	dst->window = window;
+	return _x_handler_resolve(handler, dst);
+}
+
+/*
+ * Returns the top-level window of a client window, or -EAGAIN if the
+ * X server hasn't answered yet. This never waits for the X server. The
+ * reactor of the calling thread is woken up when the answer arrives.
+ */
+int x_handler_get_client_window(x_handler_t *handler, x_client_window_t *window, Window *client)
+{
+	x_window_query_t *query;
+	int err;
+
+	if (!handler || !window || !client) {
+		return -EINVAL;
+	}
+
+	/* the cache was invalidated since the window was resolved */
+	if (window->resolved &&
+	    window->generation != __atomic_load_n(&handler->cache.generation, __ATOMIC_ACQUIRE) &&
+	    (err = _x_handler_resolve(handler, window)) < 0) {
+		return err;
+	}
+
+	if (!window->resolved) {
+		if (!(query = window->query)) {
+			return -ENOENT;
 		}
 
-		if (parent != root) {
-			parent = current_parent;
+		if (!__atomic_load_n(&query->done, __ATOMIC_ACQUIRE)) {
+			return -EAGAIN;
 		}
 
-		current = current_parent;
+		window->client = query->client;
+		window->generation = query->generation;
+		window->resolved = 1;
+		window->query = NULL;
+		_x_window_query_put(query);
 	}
 
-	*client = parent;
+	*client = window->client;
 	return 0;
 }
 
+void x_handler_forget_client_window(x_handler_t *handler, x_client_window_t *window)
+{
+	if (handler && window && window->query) {
+		/* the X reactor drops the query when it sees that it's the last one holding it */
+		_x_window_query_put(window->query);
+		window->query = NULL;
+	}
+}
+
+static xcb_atom_t _x_handler_atom(x_handler_t *handler, const char *name)
+{
+	xcb_intern_atom_reply_t *reply;
+	xcb_atom_t atom;
+	int i;
+
+	/* the atoms that were interned on connect don't need a round trip */
+	for (i = ATOM_IM; i < ATOM_MAX; i++) {
+		if (strcmp(name, _atom_names[i]) == 0) {
+			return handler->atoms[i];
+		}
+	}
+
+	atom = XCB_ATOM_NONE;
+
+	if ((reply = xcb_intern_atom_reply(handler->conn,
+	                                   xcb_intern_atom(handler->conn, 0, strlen(name), name),
+	                                   NULL))) {
+		atom = reply->atom;
+		free(reply);
+	}
+
+	return atom;
+}
+
+/* The property is sent with the next x_handler_flush() */
 int x_handler_set_text_property(x_handler_t *handler, Window window, const char *name, const char *value)
 {
-	XTextProperty prop;
-	Atom atom;
+	xcb_atom_t atom;
 
-	if ((atom = XInternAtom(handler->display, name, False)) == None) {
-		return -EIO;
+	if (!handler || !name || !value) {
+		return -EINVAL;
 	}
 
-	if (Xutf8TextListToTextProperty(handler->display, (char**)&value, 1,
-	                                XUTF8StringStyle, &prop) != Success) {
-		return -ENOMEM;
+	if ((atom = _x_handler_atom(handler, name)) == XCB_ATOM_NONE) {
+		return -EIO;
 	}
 
-	XSetTextProperty(handler->display, window, &prop, atom);
-	XSync(handler->display, False);
-	XFree(prop.value);
+	xcb_change_property(handler->conn, XCB_PROP_MODE_REPLACE, (xcb_window_t)window, atom,
+	                    handler->atoms[ATOM_UTF8_STRING], 8, strlen(value), value);
 
 	return 0;
 }
+
+int x_handler_flush(x_handler_t *handler)
+{
+	if (!handler) {
+		return -EINVAL;
+	}
+
+	return xcb_flush(handler->conn) > 0 ? 0 : -EIO;
+}
@@ -21,15 +21,30 @@
 #ifndef XHANDLER_H
 #define XHANDLER_H
 
+#include "ximserver.h"
 #include <X11/Xlib.h>
 
 typedef struct x_handler x_handler_t;
+typedef struct x_window_query x_window_query_t;
+
+/* The top-level window of a client, see x_handler_query_client_window() */
+typedef struct {
+	Window window;
+	Window client;
+	unsigned int generation;
+	int resolved;
+	x_window_query_t *query;
+} x_client_window_t;
 
 int x_handler_init(x_handler_t **handler);
 int x_handler_free(x_handler_t **handler);
-int x_handler_run(x_handler_t *handler);
+int x_handler_attach(x_handler_t *handler, xim_server_t *server);
+int x_handler_set_transport(x_handler_t *handler, const char *transport);
 
-int x_handler_get_client_window(x_handler_t *handler, Window window, Window *client);
+int x_handler_query_client_window(x_handler_t *handler, Window window, x_client_window_t *dst);
+int x_handler_get_client_window(x_handler_t *handler, x_client_window_t *window, Window *client);
+void x_handler_forget_client_window(x_handler_t *handler, x_client_window_t *window);
 int x_handler_set_text_property(x_handler_t *handler, Window window, const char *name, const char *value);
+int x_handler_flush(x_handler_t *handler);
 
 #endif /* XHANDLER_H */
@@ -18,9 +18,12 @@
  * Boston, MA 02111-1307, USA.
  */
 
+#include "arena.h"
 #include "fd.h"
 #include "inputmethod.h"
 #include "inputcontext.h"
+#include "log.h"
+#include "slab.h"
 #include "ximclient.h"
 #include "ximproto.h"
 #include <errno.h>
@@ -30,34 +33,363 @@
 #include <stdlib.h>
 #include <string.h>
 
-#define CLIENT_IC_MAX 16
-#define CLIENT_IM_MAX 16
+/* Initial number of IM and IC ids, the slabs grow up to SLAB_SIZE_MAX */
+#define CLIENT_IM_SLAB 4
+#define CLIENT_IC_SLAB 16
+
+/* Initial size of the receive buffer */
+#ifndef CLIENT_RXBUF_MIN
+#define CLIENT_RXBUF_MIN 1024
+#endif
+
+/* The receive buffer never grows beyond this, limiting the size of messages */
+#ifndef CLIENT_RXBUF_MAX
+#define CLIENT_RXBUF_MAX XIM_MSG_MAX_SIZE
+#endif
+
+/* Initial size of the transmit buffer, which holds encoded messages */
+#ifndef CLIENT_TXBUF_MIN
+#define CLIENT_TXBUF_MIN 4096
+#endif
+
+/* Clients that let more than this pile up without reading are dropped */
+#ifndef CLIENT_TXBUF_MAX
+#define CLIENT_TXBUF_MAX (256 * 1024)
+#endif
+
+/* Space that is reserved in the transmit buffer for encoding a message */
+#define CLIENT_TX_MSG_MAX 1024
+/* Size of an XIM_PREEDIT_DRAW without the string and feedback, plus the CT header and trailer */
+#define CLIENT_PREEDIT_DRAW_HDR 38
+/* Size of an XIM_RESET_IC_REPLY without the string, plus the CT header and trailer */
+#define CLIENT_RESET_IC_REPLY_HDR 20
+
+/* Number of vectors that are passed to a single fd_writev() call */
+#define CLIENT_TX_IOV 64
+
+/* Commits with more vectors than this need to allocate an iovec array */
+#define CLIENT_COMMIT_IOV 64
+
+/* Initial size of the arena that messages are decoded into */
+#define CLIENT_ARENA_SIZE 4096
+
+/* Freed clients are kept for reuse by the thread that freed them */
+#define CLIENT_POOL_MAX 32
+
+/* A piece of queued output, either in the transmit buffer or elsewhere */
+struct tx_vec {
+	const uint8_t *base;  /* NULL if the data is in the transmit buffer */
+	size_t offset;
+	size_t len;
+};
 
 struct xim_client {
 	fd_t *fd;
-	uint8_t rxbuf[1024];
-	size_t rxbuf_len;
 
-	input_context_t *ics[CLIENT_IC_MAX];
-	input_method_t *ims[CLIENT_IM_MAX];
+	/* set while messages are handled, holding back output until the end */
+	int busy;
+
+	/* received data that hasn't been decoded yet is in data[head..tail) */
+	struct {
+		uint8_t *data;
+		size_t size;
+		size_t head;
+		size_t tail;
+	} rx;
+
+	/*
+	 * Output waiting to be sent, in order. Vectors may point to memory
+	 * that isn't owned by the client (such as a commit string), so the
+	 * queue must be flushed or pinned before the owner gets control back.
+	 */
+	struct {
+		uint8_t *data;
+		size_t size;
+		size_t tail;
+
+		struct tx_vec *vecs;
+		int num_vecs;
+		int max_vecs;
+
+		size_t queued;
+		int err;
+	} tx;
+
+	/* decoded messages, released after they have been handled */
+	arena_t *arena;
+
+	/* open input methods and input contexts, by id */
+	slab_t *ims;
+	slab_t *ics;
+
+	/* next free client, while the client is in the pool */
+	struct xim_client *next;
 };
 
+static __thread xim_client_t *_client_pool;
+static __thread int _client_pool_len;
+
+static int _xim_client_tx_reserve(xim_client_t *client, const size_t len)
+{
+	uint8_t *data;
+	size_t size;
+
+	if (client->tx.size - client->tx.tail >= len) {
+		return 0;
+	}
+
+	for (size = client->tx.size; size - client->tx.tail < len; size *= 2)
+		;
+
+	if (!(data = realloc(client->tx.data, size))) {
+		return -ENOMEM;
+	}
+
+	client->tx.data = data;
+	client->tx.size = size;
+	return 0;
+}
+
+static int _xim_client_tx_push(xim_client_t *client, const void *base,
+                               const size_t offset, const size_t len)
+{
+	struct tx_vec *vec;
+
+	if (len == 0) {
+		return 0;
+	}
+
+	vec = client->tx.num_vecs > 0 ? &client->tx.vecs[client->tx.num_vecs - 1] : NULL;
+
+	if (!base && vec && !vec->base && vec->offset + vec->len == offset) {
+		/* consecutive messages in the transmit buffer share a vector */
+		vec->len += len;
+	} else {
+		if (client->tx.num_vecs == client->tx.max_vecs) {
+			struct tx_vec *vecs;
+			int max_vecs;
+
+			max_vecs = client->tx.max_vecs ? client->tx.max_vecs * 2 : 16;
+
+			if (!(vecs = realloc(client->tx.vecs, max_vecs * sizeof(*vecs)))) {
+				/* a partially queued message would corrupt the stream */
+				client->tx.err = -ENOMEM;
+				return -ENOMEM;
+			}
+
+			client->tx.vecs = vecs;
+			client->tx.max_vecs = max_vecs;
+		}
+
+		vec = &client->tx.vecs[client->tx.num_vecs++];
+		vec->base = base;
+		vec->offset = offset;
+		vec->len = len;
+	}
+
+	client->tx.queued += len;
+	return 0;
+}
+
+static void _xim_client_tx_consume(xim_client_t *client, size_t len)
+{
+	int i;
+
+	client->tx.queued -= len;
+
+	for (i = 0; i < client->tx.num_vecs && len >= client->tx.vecs[i].len; i++) {
+		len -= client->tx.vecs[i].len;
+	}
+
+	if (i < client->tx.num_vecs) {
+		if (client->tx.vecs[i].base) {
+			client->tx.vecs[i].base += len;
+		} else {
+			client->tx.vecs[i].offset += len;
+		}
+		client->tx.vecs[i].len -= len;
+	}
+
+	client->tx.num_vecs -= i;
+	memmove(client->tx.vecs, client->tx.vecs + i, client->tx.num_vecs * sizeof(*client->tx.vecs));
+}
+
+/*
+ * Copies output that couldn't be sent into a buffer owned by the client,
+ * so that it doesn't refer to memory that may go away after this pass.
+ */
+static int _xim_client_tx_pin(xim_client_t *client)
+{
+	struct tx_vec *vec;
+	uint8_t *data;
+	size_t size;
+	size_t offset;
+	int i;
+
+	vec = client->tx.vecs;
+
+	if (client->tx.num_vecs == 1 && !vec->base) {
+		/* already owned, just make room at the end */
+		if (vec->offset > client->tx.size / 2) {
+			memmove(client->tx.data, client->tx.data + vec->offset, vec->len);
+			vec->offset = 0;
+			client->tx.tail = vec->len;
+		}
+
+		return 0;
+	}
+
+	for (size = client->tx.size; size < client->tx.queued; size *= 2)
+		;
+
+	if (!(data = malloc(size))) {
+		client->tx.err = -ENOMEM;
+		return -ENOMEM;
+	}
+
+	for (offset = 0, i = 0; i < client->tx.num_vecs; i++) {
+		memcpy(data + offset, vec[i].base ? vec[i].base : client->tx.data + vec[i].offset,
+		       vec[i].len);
+		offset += vec[i].len;
+	}
+
+	free(client->tx.data);
+	client->tx.data = data;
+	client->tx.size = size;
+	client->tx.tail = offset;
+
+	vec->base = NULL;
+	vec->offset = 0;
+	vec->len = offset;
+	client->tx.num_vecs = 1;
+
+	return 0;
+}
+
+static int _xim_client_tx_flush(xim_client_t *client)
+{
+	uint8_t *data;
+
+	while (!client->tx.err && client->tx.num_vecs > 0) {
+		struct iovec iov[CLIENT_TX_IOV];
+		ssize_t sent;
+		size_t len;
+		int i;
+
+		for (len = 0, i = 0; i < client->tx.num_vecs && i < CLIENT_TX_IOV; i++) {
+			struct tx_vec *vec;
+
+			vec = &client->tx.vecs[i];
+			iov[i].iov_base = (void*)(vec->base ? vec->base : client->tx.data + vec->offset);
+			iov[i].iov_len = vec->len;
+			len += vec->len;
+		}
+
+		if ((sent = fd_writev(client->fd, iov, i)) < 0) {
+			if (sent == -EINTR) {
+				continue;
+			}
+			if (sent != -EAGAIN && sent != -EWOULDBLOCK) {
+				client->tx.err = sent;
+			}
+			break;
+		}
+
+		_xim_client_tx_consume(client, sent);
+
+		if (sent < len) {
+			/* the socket is full, wait for EPOLLOUT */
+			break;
+		}
+	}
+
+	if (client->tx.err) {
+		return client->tx.err;
+	}
+
+	if (client->tx.num_vecs > 0) {
+		fd_notify(client->fd, FD_EVENT_WANT_OUT, NULL);
+		return _xim_client_tx_pin(client);
+	}
+
+	client->tx.tail = 0;
+
+	/* give back memory that was needed for a large backlog */
+	if (client->tx.size > CLIENT_TXBUF_MIN &&
+	    (data = realloc(client->tx.data, CLIENT_TXBUF_MIN))) {
+		client->tx.data = data;
+		client->tx.size = CLIENT_TXBUF_MIN;
+	}
+
+	return 0;
+}
+
+/* Queues a message that is at most max_len bytes long when encoded */
+static int _xim_client_send_max(xim_client_t *client, xim_msg_t *msg, const size_t max_len)
+{
+	int len;
+	int err;
+
+	if ((err = _xim_client_tx_reserve(client, max_len)) < 0) {
+		return err;
+	}
+
+	if ((len = xim_msg_encode(msg, client->tx.data + client->tx.tail, max_len)) < 0) {
+		log_error("xim_msg_encode: %s", strerror(-len));
+		return len;
+	}
+
+	if ((err = _xim_client_tx_push(client, NULL, client->tx.tail, len)) < 0) {
+		return err;
+	}
+
+	client->tx.tail += len;
+
+	/* replies to a message are sent together, after the message was handled */
+	return client->busy ? 0 : _xim_client_tx_flush(client);
+}
+
 static int xim_client_send(xim_client_t *client, xim_msg_t *msg)
 {
-	uint8_t buf[1024];
-	int buf_len;
+	return _xim_client_send_max(client, msg, CLIENT_TX_MSG_MAX);
+}
+
+/*
+ * Queues one of the replies that the input method encoded in advance,
+ * with the IM id that was assigned by this client filled in.
+ */
+static int xim_client_send_reply(xim_client_t *client, input_method_t *im,
+                                 const im_reply_t reply, const int id)
+{
+	const uint8_t *data;
+	uint16_t im_id;
+	size_t len;
 	int err;
 
-	if ((buf_len = xim_msg_encode(msg, buf, sizeof(buf))) < 0) {
-		fprintf(stderr, "xim_msg_encode: %s\n", strerror(-buf_len));
-		return buf_len;
+	if ((err = input_method_get_reply(im, reply, &data, &len)) < 0) {
+		return err;
 	}
 
-	if ((err = fd_write(client->fd, buf, buf_len)) < 0) {
-		fprintf(stderr, "fd_write: %s\n", strerror(-err));
+	if (!data) {
+		return len > 0 ? -ENODATA : 0;
 	}
 
-	return err;
+	if ((err = _xim_client_tx_reserve(client, len)) < 0) {
+		return err;
+	}
+
+	/* all cached replies start with the IM id */
+	im_id = (uint16_t)id;
+	memcpy(client->tx.data + client->tx.tail, data, len);
+	memcpy(client->tx.data + client->tx.tail + XIM_MSG_HDR_SIZE, &im_id, sizeof(im_id));
+
+	if ((err = _xim_client_tx_push(client, NULL, client->tx.tail, len)) < 0) {
+		return err;
+	}
+
+	client->tx.tail += len;
+
+	return client->busy ? 0 : _xim_client_tx_flush(client);
 }
 
 static int make_detail(char **dst, const char *fmt, va_list args)
@@ -126,7 +458,7 @@ static int xim_client_send_error(xim_client_t *client, const int im, const int i
 	msg.detail_type = 4; /* char data */
 
 	if ((err = xim_client_send(client, (xim_msg_t*)&msg)) < 0) {
-		fprintf(stderr, "xim_client_send: %s\n", strerror(-err));
+		log_error("xim_client_send: %s", strerror(-err));
 	}
 
 	free(detail);
@@ -135,29 +467,23 @@ static int xim_client_send_error(xim_client_t *client, const int im, const int i
 
 static void handle_connect_msg(xim_client_t *client, xim_msg_connect_t *msg)
 {
-	xim_msg_connect_reply_t *reply;
+	xim_msg_connect_reply_t reply;
 	int err;
 
-	/* FIXME: There is no need to dynamically allocate the reply */
-	if((err = xim_msg_new((xim_msg_t**)&reply, XIM_CONNECT_REPLY)) < 0) {
-		/* FIXME: handle error */
-		fprintf(stderr, "xim_msg_new: %s\n", strerror(-err));
-		return;
-	}
-
-	reply->server_ver.major = 1;
-	reply->server_ver.minor = 0;
+	reply.hdr.type = XIM_CONNECT_REPLY;
+	reply.hdr.subtype = 0;
+	reply.server_ver.major = 1;
+	reply.server_ver.minor = 0;
 
-	if ((err = xim_client_send(client, (xim_msg_t*)reply)) < 0) {
-		fprintf(stderr, "xim_client_send: %s\n", strerror(-err));
+	if ((err = xim_client_send(client, (xim_msg_t*)&reply)) < 0) {
+		log_error("xim_client_send: %s", strerror(-err));
 	}
 
-	/* FIXME: Free reply */
-
 	return;
 }
 
-static void set_event_mask(xim_client_t *client, const int im, const int ic, const uint32_t mask)
+int xim_client_set_event_mask(xim_client_t *client, const int im, const int ic,
+                              const uint32_t forward_mask, const uint32_t sync_mask)
 {
 	xim_msg_set_event_mask_t msg;
 	int err;
@@ -166,12 +492,14 @@ static void set_event_mask(xim_client_t *client, const int im, const int ic, con
 	msg.hdr.subtype = 0;
 	msg.im = im;
 	msg.ic = ic;
-	msg.masks.forward = mask;
-	msg.masks.sync = mask;
+	msg.masks.forward = forward_mask;
+	msg.masks.sync = sync_mask;
 
 	if ((err = xim_client_send(client, (xim_msg_t*)&msg)) < 0) {
-		fprintf(stderr, "xim_client_send: %s\n", strerror(-err));
+		log_error("xim_client_send: %s", strerror(-err));
 	}
+
+	return err;
 }
 
 static void handle_open_msg(xim_client_t *client, xim_msg_open_t *msg)
@@ -179,64 +507,32 @@ static void handle_open_msg(xim_client_t *client, xim_msg_open_t *msg)
 	input_method_t *im;
 	int err;
 	int id;
-	int i;
-
-	for (i = id = 0; i < (sizeof(client->ims) / sizeof(client->ims[0])); i++) {
-		if (!client->ims[i]) {
-			id = i + 1;
-			break;
-		}
-	}
-
-	if (!id) {
-		xim_client_send_error(client, 0, 0, XIM_ERROR_BAD_ALLOC,
-		                      "Client has reached the maximum number of open input methods");
-		return;
-	}
 
 	if (!(im = input_method_for_locale(msg->locale))) {
 		/* XIM_ERROR */
 
 		if ((err = xim_client_send_error(client, 0, 0, XIM_ERROR_LOCALE_NOT_SUPPORTED, NULL)) < 0) {
-			fprintf(stderr, "xim_client_send_error: %s\n", strerror(-err));
+			log_error("xim_client_send_error: %s", strerror(-err));
 			/* FIXME: handle error */
 		}
+	} else if ((id = slab_insert(client->ims, im)) < 0) {
+		xim_client_send_error(client, 0, 0, XIM_ERROR_BAD_ALLOC,
+		                      "Could not allocate IM id: %s", strerror(-id));
 	} else {
-		/* XIM_OPEN_REPLY */
 
-		xim_msg_open_reply_t reply;
-
-		reply.hdr.type = XIM_OPEN_REPLY;
-		reply.hdr.subtype = 0;
-		reply.id = id;
-		reply.im_attrs = NULL;
-		reply.ic_attrs = NULL;
-
-		if ((err = input_method_get_im_attrs(im, &reply.im_attrs)) < 0) {
-			fprintf(stderr, "Could not get IM attributes from input method: %s\n",
-			        strerror(-err));
-			xim_client_send_error(client, 0, 0, XIM_ERROR_BAD_SOMETHING,
-			                      "Could not get IM attributes from input method: %s\n",
-			                      strerror(-err));
-		} else if ((err = input_method_get_ic_attrs(im, &reply.ic_attrs)) < 0) {
-			fprintf(stderr, "Could not get IC attributes from input method: %s\n",
-			        strerror(-err));
-			xim_client_send_error(client, 0, 0, XIM_ERROR_BAD_SOMETHING,
-			                      "Could not get IC attributes from input method: %s\n",
-			                      strerror(-err));
-		} else {
-			client->ims[id - 1] = im;
-
-			if ((err = xim_client_send(client, (xim_msg_t*)&reply)) < 0) {
-				fprintf(stderr, "xim_client_send: %s\n", strerror(-err));
-				/* FIXME: handle error */
-			}
+		/* trigger keys must be registered before the IM is opened */
+		if ((err = xim_client_send_reply(client, im, IM_REPLY_REGISTER_TRIGGERKEYS, id)) < 0) {
+			log_error("xim_client_send_reply: %s", strerror(-err));
+		}
 
-			set_event_mask(client, id, 0, KeyPressMask);
+		if ((err = xim_client_send_reply(client, im, IM_REPLY_OPEN, id)) < 0) {
+			log_error("xim_client_send_reply: %s", strerror(-err));
+			/* FIXME: handle error */
 		}
 
-		attrs_free(&reply.im_attrs);
-		attrs_free(&reply.ic_attrs);
+		xim_client_set_event_mask(client, id, 0,
+		                          input_method_get_event_mask(im, im->active),
+		                          input_method_get_sync_mask(im, im->active));
 	}
 
 	return;
@@ -244,23 +540,16 @@ static void handle_open_msg(xim_client_t *client, xim_msg_open_t *msg)
 
 static void handle_query_extension_msg(xim_client_t *client, xim_msg_query_extension_t *msg)
 {
-	xim_msg_query_extension_reply_t reply;
 	input_method_t *im;
 	int err;
 
-	if (msg->im <= 0 || msg->im > CLIENT_IM_MAX ||
-	    !(im = client->ims[msg->im - 1])) {
+	if (!(im = slab_get(client->ims, msg->im))) {
 		xim_client_send_error(client, 0, 0, XIM_ERROR_BAD_SOMETHING, "Invalid IM id");
 		return;
 	}
 
-	reply.hdr.type = XIM_QUERY_EXTENSION_REPLY;
-	reply.hdr.subtype = 0;
-	reply.im = msg->im;
-	reply.exts = im->exts;
-
-	if ((err = xim_client_send(client, (xim_msg_t*)&reply)) < 0) {
-		fprintf(stderr, "xim_client_send: %s\n", strerror(-err));
+	if ((err = xim_client_send_reply(client, im, IM_REPLY_QUERY_EXTENSION, msg->im)) < 0) {
+		log_error("xim_client_send_reply: %s", strerror(-err));
 	}
 
 	return;
@@ -278,7 +567,7 @@ static void select_encoding(xim_client_t *client, int im, int encoding)
 	reply.encoding = encoding;
 
 	if ((err = xim_client_send(client, (xim_msg_t*)&reply)) < 0) {
-		fprintf(stderr, "xim_client_send: %s\n", strerror(-err));
+		log_error("xim_client_send: %s", strerror(-err));
 	}
 }
 
@@ -290,8 +579,7 @@ static void handle_encoding_negotiation_msg(xim_client_t *client, xim_msg_encodi
 		return;
 	}
 
-	if (msg->im <= 0 || msg->im > CLIENT_IM_MAX ||
-	    !(im = client->ims[msg->im - 1])) {
+	if (!(im = slab_get(client->ims, msg->im))) {
 		xim_client_send_error(client, msg->im, 0, XIM_ERROR_BAD_SOMETHING, "Invalid IM id");
 		return;
 	}
@@ -311,8 +599,7 @@ static void handle_get_im_values_msg(xim_client_t *client, xim_msg_get_im_values
 		return;
 	}
 
-	if (msg->im <= 0 || msg->im > CLIENT_IM_MAX ||
-	    !(im = client->ims[msg->im - 1])) {
+	if (!(im = slab_get(client->ims, msg->im))) {
 		xim_client_send_error(client, msg->im, 0, XIM_ERROR_BAD_SOMETHING, "Invalid IM id");
 		return;
 	}
@@ -337,7 +624,7 @@ static void handle_get_im_values_msg(xim_client_t *client, xim_msg_get_im_values
 	}
 
 	if ((err = xim_client_send(client, (xim_msg_t*)&reply)) < 0) {
-		fprintf(stderr, "xim_client_send: %s\n", strerror(-err));
+		log_error("xim_client_send: %s", strerror(-err));
 	}
 
 	free(reply.values);
@@ -353,31 +640,23 @@ static void handle_create_ic_msg(xim_client_t *client, xim_msg_create_ic_t *msg)
 	int id;
 	int i;
 
-	if (msg->im <= 0 || msg->im > CLIENT_IM_MAX ||
-	    !(im = client->ims[msg->im - 1])) {
+	if (!(im = slab_get(client->ims, msg->im))) {
 		xim_client_send_error(client, msg->im, 0, XIM_ERROR_BAD_SOMETHING,
 		                      "Invalid IM id");
 		return;
 	}
 
-	for (i = id = 0; i < (sizeof(client->ics) / sizeof(client->ics[0])); i++) {
-		if (!client->ics[i]) {
-			id = i + 1;
-			break;
-		}
-	}
-
-	if (!id) {
+	/* the id is needed to create the IC, the IC is filled in below */
+	if ((id = slab_insert(client->ics, NULL)) < 0) {
 		xim_client_send_error(client, msg->im, 0, XIM_ERROR_BAD_ALLOC,
-		                      "Client has reached the maximum number of open input contexts");
-		/* TODO: Handle error */
+		                      "Could not allocate IC id: %s", strerror(-id));
 		return;
 	}
 
 	if ((err = input_context_new(&ic, client, msg->im, id)) < 0) {
+		slab_remove(client->ics, id);
 		xim_client_send_error(client, msg->im, 0, XIM_ERROR_BAD_ALLOC,
 		                      "Could not allocate input context: %s", strerror(-err));
-		/* TODO: Handle error */
 		return;
 	}
 
@@ -393,7 +672,7 @@ static void handle_create_ic_msg(xim_client_t *client, xim_msg_create_ic_t *msg)
 		/* TODO: Handle error */
 	}
 
-	client->ics[id - 1] = ic;
+	slab_set(client->ics, id, ic);
 
 	reply.hdr.type = XIM_CREATE_IC_REPLY;
 	reply.hdr.subtype = 0;
@@ -401,10 +680,12 @@ static void handle_create_ic_msg(xim_client_t *client, xim_msg_create_ic_t *msg)
 	reply.ic = id;
 
 	if ((err = xim_client_send(client, (xim_msg_t*)&reply)) < 0) {
-		fprintf(stderr, "xim_client_send: %s\n", strerror(-err));
+		log_error("xim_client_send: %s", strerror(-err));
 		/* TODO: Handle error */
 	}
 
+	/* tell the client whether it has to wait for its forwarded events */
+	input_context_update_event_mask(ic);
 	return;
 }
 
@@ -412,7 +693,7 @@ static void handle_get_ic_values_msg(xim_client_t *client, xim_msg_get_ic_values
 {
 	input_method_t *im;
 	input_context_t *ic;
-	attr_value_t **values;
+	const attr_value_t **values;
 	int num_values;
 	int err;
 	int i;
@@ -421,14 +702,12 @@ static void handle_get_ic_values_msg(xim_client_t *client, xim_msg_get_ic_values
 	values = NULL;
 	num_values = 0;
 
-	if (msg->im <= 0 || msg->im > CLIENT_IM_MAX ||
-	    !(im = client->ims[msg->im - 1])) {
+	if (!(im = slab_get(client->ims, msg->im))) {
 		xim_client_send_error(client, msg->im, msg->ic, XIM_ERROR_BAD_SOMETHING, "Invalid IM id");
 		return;
 	}
 
-	if (msg->ic <= 0 || msg->ic > CLIENT_IC_MAX ||
-	    !(ic = client->ics[msg->ic - 1])) {
+	if (!(ic = slab_get(client->ics, msg->ic))) {
 		xim_client_send_error(client, msg->im, msg->ic, XIM_ERROR_BAD_SOMETHING, "Invalid IC id");
 		return;
 	}
@@ -457,17 +736,53 @@ static void handle_get_ic_values_msg(xim_client_t *client, xim_msg_get_ic_values
 		reply.im = msg->im;
 		reply.ic = msg->ic;
 		reply.num_values = num_values;
-		reply.values = values;
+		/* the values are only borrowed from the IC */
+		reply.values = (attr_value_t**)values;
 
 		if ((err = xim_client_send(client, (xim_msg_t*)&reply)) < 0) {
-			fprintf(stderr, "xim_client_send: %s\n", strerror(-err));
+			log_error("xim_client_send: %s", strerror(-err));
 		}
 	}
 
-	attr_values_free(&values);
+	free(values);
 	return;
 }
 
+static void handle_set_ic_values_msg(xim_client_t *client, xim_msg_set_ic_values_t *msg)
+{
+	xim_msg_set_ic_values_reply_t reply;
+	input_context_t *ic;
+	int err;
+	int i;
+
+	if (!slab_get(client->ims, msg->im)) {
+		xim_client_send_error(client, msg->im, msg->ic, XIM_ERROR_BAD_SOMETHING, "Invalid IM id");
+		return;
+	}
+
+	if (!(ic = slab_get(client->ics, msg->ic))) {
+		xim_client_send_error(client, msg->im, msg->ic, XIM_ERROR_BAD_SOMETHING, "Invalid IC id");
+		return;
+	}
+
+	for (i = 0; msg->values && msg->values[i]; i++) {
+		if ((err = input_context_set_attribute(ic, msg->values[i])) < 0) {
+			xim_client_send_error(client, msg->im, msg->ic, XIM_ERROR_BAD_SOMETHING,
+			                      "Could not set IC value: %s", strerror(-err));
+			return;
+		}
+	}
+
+	reply.hdr.type = XIM_SET_IC_VALUES_REPLY;
+	reply.hdr.subtype = 0;
+	reply.im = msg->im;
+	reply.ic = msg->ic;
+
+	if ((err = xim_client_send(client, (xim_msg_t*)&reply)) < 0) {
+		log_error("xim_client_send: %s", strerror(-err));
+	}
+}
+
 static int xim_client_sync(xim_client_t *client, const int im, const int ic, const int send_reply)
 {
 	xim_msg_sync_t sync;
@@ -484,19 +799,20 @@ static void handle_destroy_ic_msg(xim_client_t *client, xim_msg_destroy_ic_t *ms
 {
 	xim_msg_destroy_ic_reply_t reply;
 	input_method_t *im;
+	input_context_t *ic;
 	int err;
 
-	if (msg->im <= 0 || msg->im > CLIENT_IM_MAX || !(im = client->ims[msg->im - 1])) {
+	if (!(im = slab_get(client->ims, msg->im))) {
 		xim_client_send_error(client, msg->im, 0, XIM_ERROR_BAD_SOMETHING, "Invalid IM id");
 		return;
 	}
 
-	if (msg->ic <= 0 || msg->ic > CLIENT_IC_MAX || !client->ics[msg->ic - 1]) {
+	if (!(ic = slab_remove(client->ics, msg->ic))) {
 		xim_client_send_error(client, msg->im, msg->ic, XIM_ERROR_BAD_SOMETHING, "Invalid IC id");
 		return;
 	}
 
-	if ((err = input_context_free(&client->ics[msg->ic - 1])) < 0) {
+	if ((err = input_context_free(&ic)) < 0) {
 		xim_client_send_error(client, msg->im, msg->ic, XIM_ERROR_BAD_SOMETHING,
 		                      "Could not destroy IC: %s", strerror(-err));
 		return;
@@ -510,6 +826,44 @@ static void handle_destroy_ic_msg(xim_client_t *client, xim_msg_destroy_ic_t *ms
 	xim_client_send(client, (xim_msg_t*)&reply);
 }
 
+static void handle_reset_ic_msg(xim_client_t *client, xim_msg_reset_ic_t *msg)
+{
+	xim_msg_reset_ic_reply_t reply;
+	input_context_t *ic;
+	const char *text;
+	size_t len;
+	int err;
+
+	if (!slab_get(client->ims, msg->im)) {
+		xim_client_send_error(client, msg->im, msg->ic, XIM_ERROR_BAD_SOMETHING, "Invalid IM id");
+		return;
+	}
+
+	if (!(ic = slab_get(client->ics, msg->ic))) {
+		xim_client_send_error(client, msg->im, msg->ic, XIM_ERROR_BAD_SOMETHING, "Invalid IC id");
+		return;
+	}
+
+	/* the text that was being edited is handed back to the client */
+	if ((err = input_context_reset(ic, &text, &len)) < 0) {
+		log_error("input_context_reset: %s", strerror(-err));
+		text = NULL;
+		len = 0;
+	}
+
+	reply.hdr.type = XIM_RESET_IC_REPLY;
+	reply.hdr.subtype = 0;
+	reply.im = msg->im;
+	reply.ic = msg->ic;
+	reply.preedit.len = len;
+	reply.preedit.data = text;
+
+	if ((err = _xim_client_send_max(client, (xim_msg_t*)&reply,
+	                                CLIENT_RESET_IC_REPLY_HDR + len)) < 0) {
+		log_error("xim_client_send: %s", strerror(-err));
+	}
+}
+
 static void handle_forward_event_msg(xim_client_t *client, xim_msg_forward_event_t *msg)
 {
 	input_method_t *im;
@@ -518,26 +872,19 @@ static void handle_forward_event_msg(xim_client_t *client, xim_msg_forward_event
 	int need_sync;
 	int return_to_sender;
 
-	if (msg->im <= 0 || msg->im > CLIENT_IM_MAX || !(im = client->ims[msg->im - 1])) {
+	if (!(im = slab_get(client->ims, msg->im))) {
 		xim_client_send_error(client, msg->im, msg->ic, XIM_ERROR_BAD_SOMETHING, "Invalid IM id");
 		return;
 	}
 
-	if (msg->ic <= 0 || msg->ic > CLIENT_IC_MAX || !(ic = client->ics[msg->ic - 1])) {
+	if (!(ic = slab_get(client->ics, msg->ic))) {
 		xim_client_send_error(client, msg->im, msg->ic, XIM_ERROR_BAD_SOMETHING, "Invalid IC id");
 		return;
 	}
 
-	fprintf(stderr,
-	        "XIM_FORWARD_EVENT:\n"
-	        " IM     = %d\n"
-	        " IC     = %d\n"
-	        " flags  = %x\n"
-	        " serial = %d\n"
-	        " event  = %d\n"
-	        " state  = 0x%hx\n",
-	        msg->im, msg->ic, msg->flags,
-	        msg->serial, msg->event.detail, msg->event.state);
+	log_debug("IM %d IC %d flags 0x%x serial %d event %d state 0x%hx",
+	          msg->im, msg->ic, msg->flags,
+	          msg->serial, msg->event.detail, msg->event.state);
 
 	return_to_sender = 0;
 	need_sync = msg->flags & XIM_FORWARD_EVENT_FLAG_SYNC;
@@ -559,121 +906,368 @@ static void handle_forward_event_msg(xim_client_t *client, xim_msg_forward_event
 	}
 }
 
-static void _xim_client_handle_msg(xim_client_t *client, xim_msg_t *msg)
+static void handle_trigger_notify_msg(xim_client_t *client, xim_msg_trigger_notify_t *msg)
+{
+	xim_msg_trigger_notify_reply_t reply;
+	input_method_t *im;
+	input_context_t *ic;
+	int err;
+
+	if (!(im = slab_get(client->ims, msg->im))) {
+		xim_client_send_error(client, msg->im, msg->ic, XIM_ERROR_BAD_SOMETHING, "Invalid IM id");
+		return;
+	}
+
+	if (!(ic = slab_get(client->ics, msg->ic))) {
+		xim_client_send_error(client, msg->im, msg->ic, XIM_ERROR_BAD_SOMETHING, "Invalid IC id");
+		return;
+	}
+
+	/* the new event mask must reach the client before the reply does */
+	if ((err = input_context_set_active(ic, msg->flag == XIM_TRIGGER_NOTIFY_FLAG_ON)) < 0) {
+		xim_client_send_error(client, msg->im, msg->ic, XIM_ERROR_BAD_SOMETHING,
+		                      "Could not switch input context: %s", strerror(-err));
+		return;
+	}
+
+	reply.hdr.type = XIM_TRIGGER_NOTIFY_REPLY;
+	reply.hdr.subtype = 0;
+	reply.im = msg->im;
+	reply.ic = msg->ic;
+
+	if ((err = xim_client_send(client, (xim_msg_t*)&reply)) < 0) {
+		log_error("xim_client_send: %s", strerror(-err));
+	}
+}
+
+static void handle_ic_focus_msg(xim_client_t *client, xim_msg_set_ic_focus_t *msg,
+                                const int focused)
 {
-	fprintf(stderr, "Handling message\n");
+	input_context_t *ic;
 
+	/* focus changes are asynchronous, errors are the only replies */
+	if (!slab_get(client->ims, msg->im)) {
+		xim_client_send_error(client, msg->im, msg->ic, XIM_ERROR_BAD_SOMETHING, "Invalid IM id");
+		return;
+	}
+
+	if (!(ic = slab_get(client->ics, msg->ic))) {
+		xim_client_send_error(client, msg->im, msg->ic, XIM_ERROR_BAD_SOMETHING, "Invalid IC id");
+		return;
+	}
+
+	input_context_set_focus(ic, focused);
+}
+
+static void _xim_client_handle_msg(xim_client_t *client, xim_msg_t *msg)
+{
 	switch (msg->type) {
 	case XIM_CONNECT:
-		fprintf(stderr,
-		        "XIM_CONNECT received\n"
-		        " -> %hu.%hu\n", ((xim_msg_connect_t*)msg)->client_ver.major,
-		        ((xim_msg_connect_t*)msg)->client_ver.minor);
+		log_info("XIM_CONNECT, protocol %hu.%hu",
+		         ((xim_msg_connect_t*)msg)->client_ver.major,
+		         ((xim_msg_connect_t*)msg)->client_ver.minor);
 		handle_connect_msg(client, (xim_msg_connect_t*)msg);
 		break;
 
 	case XIM_OPEN:
-		fprintf(stderr,
-		        "XIM_OPEN received\n"
-		        " -> locale = %s\n",
-		        ((xim_msg_open_t*)msg)->locale);
+		log_info("XIM_OPEN, locale %s", ((xim_msg_open_t*)msg)->locale);
 		handle_open_msg(client, (xim_msg_open_t*)msg);
 		break;
 
 	case XIM_QUERY_EXTENSION:
-		fprintf(stderr, "XIM_QUERY_EXTENSION received\n");
-		if (((xim_msg_query_extension_t*)msg)->exts) {
+		if (log_enabled(LOG_LEVEL_DEBUG) && ((xim_msg_query_extension_t*)msg)->exts) {
 			int i;
 
 			for (i = 0; i < ((xim_msg_query_extension_t*)msg)->num_exts; i++) {
-				fprintf(stderr, " ext[%d] -> %s\n", i,
-				        ((xim_msg_query_extension_t*)msg)->exts[i]);
+				log_debug("XIM_QUERY_EXTENSION, ext[%d] = %s", i,
+				          ((xim_msg_query_extension_t*)msg)->exts[i]);
 			}
 		}
 		handle_query_extension_msg(client, (xim_msg_query_extension_t*)msg);
 		break;
 
 	case XIM_ENCODING_NEGOTIATION:
-		fprintf(stderr, "XIM_ENCODING_NEGOTIATION received\n");
-		if (((xim_msg_encoding_negotiation_t*)msg)->encodings) {
+		if (log_enabled(LOG_LEVEL_DEBUG) && ((xim_msg_encoding_negotiation_t*)msg)->encodings) {
 			int i;
 
 			for (i = 0; ((xim_msg_encoding_negotiation_t*)msg)->encodings[i]; i++) {
-				fprintf(stderr, " enc[%d] -> %s\n", i,
-				        ((xim_msg_encoding_negotiation_t*)msg)->encodings[i]);
+				log_debug("XIM_ENCODING_NEGOTIATION, enc[%d] = %s", i,
+				          ((xim_msg_encoding_negotiation_t*)msg)->encodings[i]);
 			}
 		}
 		handle_encoding_negotiation_msg(client, (xim_msg_encoding_negotiation_t*)msg);
 		break;
 
 	case XIM_GET_IM_VALUES:
-		fprintf(stderr, "XIM_GET_IM_VALUES\n");
+		log_debug("XIM_GET_IM_VALUES");
 		handle_get_im_values_msg(client, (xim_msg_get_im_values_t*)msg);
 		break;
 
 	case XIM_CREATE_IC:
-		fprintf(stderr, "XIM_CREATE_IC\n");
+		log_debug("XIM_CREATE_IC");
 		handle_create_ic_msg(client, (xim_msg_create_ic_t*)msg);
 		break;
 
+	case XIM_SET_IC_VALUES:
+		log_debug("XIM_SET_IC_VALUES");
+		handle_set_ic_values_msg(client, (xim_msg_set_ic_values_t*)msg);
+		break;
 
 	case XIM_GET_IC_VALUES:
-		fprintf(stderr, "XIM_GET_IC_VALUES\n");
+		log_debug("XIM_GET_IC_VALUES");
 		handle_get_ic_values_msg(client, (xim_msg_get_ic_values_t*)msg);
 		break;
 
+	case XIM_SET_IC_FOCUS:
+		log_debug("XIM_SET_IC_FOCUS");
+		handle_ic_focus_msg(client, (xim_msg_set_ic_focus_t*)msg, 1);
+		break;
+
+	case XIM_UNSET_IC_FOCUS:
+		log_debug("XIM_UNSET_IC_FOCUS");
+		/* both messages have the same layout */
+		handle_ic_focus_msg(client, (xim_msg_set_ic_focus_t*)msg, 0);
+		break;
+
 	case XIM_FORWARD_EVENT:
-		fprintf(stderr, "XIM_FORWARD_EVENT\n");
 		handle_forward_event_msg(client, (xim_msg_forward_event_t*)msg);
 		break;
 
+	case XIM_TRIGGER_NOTIFY:
+		log_debug("XIM_TRIGGER_NOTIFY");
+		handle_trigger_notify_msg(client, (xim_msg_trigger_notify_t*)msg);
+		break;
+
 	case XIM_DESTROY_IC:
-		fprintf(stderr, "XIM_DESTROY_IC\n");
+		log_debug("XIM_DESTROY_IC");
 		handle_destroy_ic_msg(client, (xim_msg_destroy_ic_t*)msg);
 		break;
 
+	case XIM_RESET_IC:
+		log_debug("XIM_RESET_IC");
+		handle_reset_ic_msg(client, (xim_msg_reset_ic_t*)msg);
+		break;
+
+	case XIM_PREEDIT_START_REPLY:
+	case XIM_PREEDIT_CARET_REPLY:
+		/* the preedit is drawn without waiting for the client */
+		log_debug("XIM_PREEDIT_%s_REPLY",
+		          msg->type == XIM_PREEDIT_START_REPLY ? "START" : "CARET");
+		break;
+
 	default:
-		fprintf(stderr, "Unhandled message type: %d\n", msg->type);
+		log_warn("Unhandled message type: %d", msg->type);
 		break;
 	}
 }
 
-static void _xim_client_in(fd_t *fd, fd_event_t event, xim_client_t *client, void *data)
+static int _xim_client_rx_reserve(xim_client_t *client)
+{
+	uint8_t *data;
+	size_t size;
+
+	if (client->rx.tail < client->rx.size) {
+		return 0;
+	}
+
+	if (client->rx.head > 0) {
+		/*
+		 * Move the incomplete message to the front. This only happens
+		 * when the end of the buffer has been reached, not after every
+		 * message.
+		 */
+		client->rx.tail -= client->rx.head;
+		memmove(client->rx.data, client->rx.data + client->rx.head, client->rx.tail);
+		client->rx.head = 0;
+		return 0;
+	}
+
+	if (client->rx.size >= CLIENT_RXBUF_MAX) {
+		return -EMSGSIZE;
+	}
+
+	size = client->rx.size * 2;
+	if (size > CLIENT_RXBUF_MAX) {
+		size = CLIENT_RXBUF_MAX;
+	}
+
+	if (!(data = realloc(client->rx.data, size))) {
+		return -ENOMEM;
+	}
+
+	client->rx.data = data;
+	client->rx.size = size;
+	return 0;
+}
+
+static void _xim_client_rx_reset(xim_client_t *client)
+{
+	uint8_t *data;
+
+	client->rx.head = 0;
+	client->rx.tail = 0;
+
+	/* give back memory that was needed for a large message */
+	if (client->rx.size > CLIENT_RXBUF_MIN &&
+	    (data = realloc(client->rx.data, CLIENT_RXBUF_MIN))) {
+		client->rx.data = data;
+		client->rx.size = CLIENT_RXBUF_MIN;
+	}
+}
+
+/* Handles the complete messages in src and returns the number of bytes used */
+static size_t _xim_client_process(xim_client_t *client, const uint8_t *src, const size_t src_len)
 {
 	xim_msg_t *msg;
+	size_t offset;
+	int msg_size;
+
+	offset = 0;
+
+	while ((msg_size = xim_msg_get_size(src + offset, src_len - offset)) > 0 &&
+	       msg_size <= src_len - offset) {
+		if (xim_msg_decode(&msg, src + offset, msg_size, client->arena) > 0) {
+			_xim_client_handle_msg(client, msg);
+		}
+
+		arena_reset(client->arena);
+
+		/* Skip the message, even if it couldn't be decoded */
+		offset += msg_size;
+	}
+
+	return offset;
+}
+
+static void _xim_client_process_rx(xim_client_t *client)
+{
+	client->rx.head += _xim_client_process(client, client->rx.data + client->rx.head,
+	                                       client->rx.tail - client->rx.head);
+
+	if (client->rx.head == client->rx.tail) {
+		_xim_client_rx_reset(client);
+	}
+}
+
+/* Handles data that the event loop has already received for the client */
+static int _xim_client_receive(xim_client_t *client, const struct fd_data *in)
+{
+	const uint8_t *src;
+	size_t len;
+	int err;
+
+	if (in->len <= 0) {
+		/* the client disconnected if the length is zero */
+		return in->len < 0 ? (int)in->len : -ECONNRESET;
+	}
+
+	src = in->data;
+	len = in->len;
+
+	if (client->rx.head == client->rx.tail) {
+		/* nothing is buffered, so complete messages can be handled in place */
+		size_t used;
+
+		used = _xim_client_process(client, src, len);
+		src += used;
+		len -= used;
+	}
+
+	while (len > 0) {
+		size_t chunk;
+
+		if ((err = _xim_client_rx_reserve(client)) < 0) {
+			return err;
+		}
+
+		chunk = client->rx.size - client->rx.tail;
+		if (chunk > len) {
+			chunk = len;
+		}
+
+		memcpy(client->rx.data + client->rx.tail, src, chunk);
+		client->rx.tail += chunk;
+		src += chunk;
+		len -= chunk;
+
+		_xim_client_process_rx(client);
+	}
+
+	return 0;
+}
+
+/* Reads from the client until the socket has been drained */
+static int _xim_client_read(xim_client_t *client)
+{
 	ssize_t received_bytes;
-	ssize_t parsed_bytes;
+	int err;
 
-	received_bytes = fd_read(fd, client->rxbuf + client->rxbuf_len,
-	                         sizeof(client->rxbuf) - client->rxbuf_len);
+	for (;;) {
+		if ((err = _xim_client_rx_reserve(client)) < 0) {
+			return err;
+		}
 
-	fprintf(stderr, "%s(): Received %ld bytes\n", __func__, received_bytes);
+		received_bytes = fd_read(client->fd, client->rx.data + client->rx.tail,
+		                         client->rx.size - client->rx.tail);
 
-	if (received_bytes == 0) {
-		/* client disconnected */
-		xim_client_free(&client);
-		return;
+		log_debug("Received %zd bytes", received_bytes);
+
+		if (received_bytes == 0) {
+			/* client disconnected */
+			return -ECONNRESET;
+		}
+
+		if (received_bytes < 0) {
+			if (received_bytes == -EINTR) {
+				continue;
+			}
+
+			return received_bytes == -EAGAIN || received_bytes == -EWOULDBLOCK ?
+				0 : received_bytes;
+		}
+
+		client->rx.tail += received_bytes;
+		_xim_client_process_rx(client);
 	}
+}
 
-	if (received_bytes < 0) {
-		/* FIXME: handle error */
-		fprintf(stderr, "fd_read: %s\n", strerror(-received_bytes));
-		return;
+static void _xim_client_in(fd_t *fd, fd_event_t event, xim_client_t *client, void *data)
+{
+	int err;
+
+	client->busy = 1;
+
+	/* the event loop may have received the data already */
+	if (data) {
+		err = _xim_client_receive(client, data);
+	} else {
+		err = _xim_client_read(client);
 	}
 
-	client->rxbuf_len += received_bytes;
+	client->busy = 0;
 
-	while ((parsed_bytes = xim_msg_decode(&msg, client->rxbuf, client->rxbuf_len)) > 0) {
-		_xim_client_handle_msg(client, msg);
+	/* send everything that was produced in this pass at once */
+	if (!err && (err = _xim_client_tx_flush(client)) == 0 &&
+	    client->tx.queued > CLIENT_TXBUF_MAX) {
+		/* the client isn't reading, don't let it eat up memory */
+		err = -ENOBUFS;
+	}
 
-		/* Remove parsed message from the buffer */
-		client->rxbuf_len -= parsed_bytes;
-		memmove(client->rxbuf, client->rxbuf + parsed_bytes, client->rxbuf_len);
-		free(msg); /* FIXME: this is not the right function to free parsed messages */
+	if (err < 0) {
+		if (err != -ECONNRESET) {
+			log_warn("Dropping client: %s", strerror(-err));
+		}
+		xim_client_free(&client);
 	}
 }
 
-int xim_client_new(xim_client_t **client, fd_t *fd)
+static void _xim_client_out(fd_t *fd, fd_event_t event, xim_client_t *client, void *data)
+{
+	/* errors are left for the input handler, which may free the client */
+	_xim_client_tx_flush(client);
+}
+
+static int _xim_client_alloc(xim_client_t **client)
 {
 	xim_client_t *xc;
 
@@ -681,10 +1275,92 @@ int xim_client_new(xim_client_t **client, fd_t *fd)
 		return -ENOMEM;
 	}
 
+	if (!(xc->rx.data = malloc(CLIENT_RXBUF_MIN))) {
+		free(xc);
+		return -ENOMEM;
+	}
+	xc->rx.size = CLIENT_RXBUF_MIN;
+
+	if (!(xc->tx.data = malloc(CLIENT_TXBUF_MIN))) {
+		free(xc->rx.data);
+		free(xc);
+		return -ENOMEM;
+	}
+	xc->tx.size = CLIENT_TXBUF_MIN;
+
+	if (arena_new(&xc->arena, CLIENT_ARENA_SIZE) < 0) {
+		free(xc->tx.data);
+		free(xc->rx.data);
+		free(xc);
+		return -ENOMEM;
+	}
+
+	if (slab_new(&xc->ims, CLIENT_IM_SLAB) < 0 ||
+	    slab_new(&xc->ics, CLIENT_IC_SLAB) < 0) {
+		slab_free(&xc->ims);
+		arena_free(&xc->arena);
+		free(xc->tx.data);
+		free(xc->rx.data);
+		free(xc);
+		return -ENOMEM;
+	}
+
+	*client = xc;
+	return 0;
+}
+
+static int _xim_client_recycle(xim_client_t *client)
+{
+	xim_client_t blank;
+
+	/* only clients with buffers of the initial size are worth keeping */
+	if (_client_pool_len >= CLIENT_POOL_MAX ||
+	    client->rx.size != CLIENT_RXBUF_MIN ||
+	    client->tx.size != CLIENT_TXBUF_MIN) {
+		return -ENOSPC;
+	}
+
+	arena_reset(client->arena);
+	slab_reset(client->ims);
+	slab_reset(client->ics);
+
+	memset(&blank, 0, sizeof(blank));
+	blank.rx.data = client->rx.data;
+	blank.rx.size = client->rx.size;
+	blank.tx.data = client->tx.data;
+	blank.tx.size = client->tx.size;
+	blank.tx.vecs = client->tx.vecs;
+	blank.tx.max_vecs = client->tx.max_vecs;
+	blank.arena = client->arena;
+	blank.ims = client->ims;
+	blank.ics = client->ics;
+	blank.next = _client_pool;
+
+	*client = blank;
+	_client_pool = client;
+	_client_pool_len++;
+
+	return 0;
+}
+
+int xim_client_new(xim_client_t **client, fd_t *fd)
+{
+	xim_client_t *xc;
+	int err;
+
+	if ((xc = _client_pool)) {
+		_client_pool = xc->next;
+		_client_pool_len--;
+		xc->next = NULL;
+	} else if ((err = _xim_client_alloc(&xc)) < 0) {
+		return err;
+	}
+
 	xc->fd = fd;
 	fd->userdata = xc;
 
 	fd_set_callback(fd, FD_EVENT_IN, (fd_callback_t*)_xim_client_in, xc);
+	fd_set_callback(fd, FD_EVENT_OUT, (fd_callback_t*)_xim_client_out, xc);
 
 	*client = xc;
 	return 0;
@@ -692,6 +1368,8 @@ int xim_client_new(xim_client_t **client, fd_t *fd)
 
 int xim_client_free(xim_client_t **client)
 {
+	int id;
+
 	if (!client || !*client) {
 		return -EINVAL;
 	}
@@ -700,7 +1378,24 @@ int xim_client_free(xim_client_t **client)
 		fd_free(&(*client)->fd);
 	}
 
-	free(*client);
+	/* input contexts that the client didn't destroy go away with it */
+	for (id = slab_next((*client)->ics, 0); id; id = slab_next((*client)->ics, id)) {
+		input_context_t *ic;
+
+		if ((ic = slab_get((*client)->ics, id))) {
+			input_context_free(&ic);
+		}
+	}
+
+	if (_xim_client_recycle(*client) < 0) {
+		slab_free(&(*client)->ics);
+		slab_free(&(*client)->ims);
+		arena_free(&(*client)->arena);
+		free((*client)->tx.vecs);
+		free((*client)->tx.data);
+		free((*client)->rx.data);
+		free(*client);
+	}
 	*client = NULL;
 
 	return 0;
@@ -708,36 +1403,157 @@ int xim_client_free(xim_client_t **client)
 
 int xim_client_get_im(xim_client_t *client, const int id, input_method_t **im)
 {
-	if (!client || id <= 0 || id > CLIENT_IM_MAX || !im) {
+	if (!client || !im) {
 		return -EINVAL;
 	}
 
-	*im = client->ims[id - 1];
+	/* stale ids are caught by the generation in the id */
+	if (!(*im = slab_get(client->ims, id))) {
+		return -ENOENT;
+	}
+
 	return 0;
 }
 
 int xim_client_get_ic(xim_client_t *client, const int id, input_context_t **ic)
 {
-	if (!client || id <= 0 || id > CLIENT_IC_MAX || !ic) {
+	if (!client || !ic) {
 		return -EINVAL;
 	}
 
-	*ic = client->ics[id - 1];
+	if (!(*ic = slab_get(client->ics, id))) {
+		return -ENOENT;
+	}
+
 	return 0;
 }
 
 int xim_client_commit(xim_client_t *client, const int im, const int ic,
-                      const void *data, const size_t data_len)
+                      const struct iovec *iov, const int iovcnt)
 {
 	xim_msg_commit_t msg;
+	struct iovec stack_iov[CLIENT_COMMIT_IOV];
+	struct iovec *msg_iov;
+	int num_iov;
+	int err;
+	int i;
 
 	msg.hdr.type = XIM_COMMIT;
 	msg.hdr.subtype = 0;
 	msg.im = im;
 	msg.ic = ic;
 	msg.flags = XIM_COMMIT_FLAG_CHARS;
-	msg.string.len = data_len;
-	msg.string.data = (void*)data;
+	msg.string.iov = iov;
+	msg.string.iovcnt = iovcnt;
+
+	msg_iov = stack_iov;
+	num_iov = iovcnt + XIM_MSG_COMMIT_IOV_EXTRA;
+
+	if ((err = _xim_client_tx_reserve(client, XIM_MSG_COMMIT_HDR_SIZE)) < 0) {
+		return err;
+	}
+
+	if (num_iov > CLIENT_COMMIT_IOV &&
+	    !(msg_iov = calloc(num_iov, sizeof(*msg_iov)))) {
+		return -ENOMEM;
+	}
+
+	/* the headers go into the transmit buffer, the string is queued where it is */
+	if ((num_iov = xim_msg_encode_commit(&msg, client->tx.data + client->tx.tail,
+	                                     XIM_MSG_COMMIT_HDR_SIZE, msg_iov, num_iov)) < 0) {
+		err = num_iov;
+		log_error("xim_msg_encode_commit: %s", strerror(-err));
+	} else if ((err = _xim_client_tx_push(client, NULL, client->tx.tail,
+	                                      msg_iov[0].iov_len)) == 0) {
+		client->tx.tail += msg_iov[0].iov_len;
+
+		for (i = 1; i < num_iov && err == 0; i++) {
+			err = _xim_client_tx_push(client, msg_iov[i].iov_base, 0, msg_iov[i].iov_len);
+		}
+
+		/*
+		 * The string belongs to the caller, who may free it as soon as this
+		 * returns (the preedit is cleared right after a commit). Even in the
+		 * middle of a pass, it is sent now, or copied if the socket is full.
+		 */
+		if (err == 0) {
+			err = _xim_client_tx_flush(client);
+		}
+	}
+
+	if (msg_iov != stack_iov) {
+		free(msg_iov);
+	}
+
+	return err;
+}
+
+int xim_client_preedit_start(xim_client_t *client, const int im, const int ic)
+{
+	xim_msg_preedit_start_t msg;
+
+	msg.hdr.type = XIM_PREEDIT_START;
+	msg.hdr.subtype = 0;
+	msg.im = im;
+	msg.ic = ic;
+
+	return xim_client_send(client, &msg.hdr);
+}
+
+/*
+ * Replaces chg_length characters of the client's preedit, starting at
+ * chg_first, with the characters in string. The string is UTF-8 and is
+ * sent as compound text, which the client decodes into the same number
+ * of characters. The string may be empty.
+ */
+int xim_client_preedit_draw(xim_client_t *client, const int im, const int ic,
+                            const int caret, const int chg_first, const int chg_length,
+                            const char *string, const size_t len,
+                            const uint32_t *feedback, const int num_feedback)
+{
+	xim_msg_preedit_draw_t msg;
+
+	msg.hdr.type = XIM_PREEDIT_DRAW;
+	msg.hdr.subtype = 0;
+	msg.im = im;
+	msg.ic = ic;
+	msg.caret = caret;
+	msg.chg_first = chg_first;
+	msg.chg_length = chg_length;
+	msg.status = len > 0 ? 0 : XIM_PREEDIT_DRAW_NO_STRING | XIM_PREEDIT_DRAW_NO_FEEDBACK;
+	msg.string.len = len;
+	msg.string.data = string;
+	msg.feedback.num = num_feedback;
+	msg.feedback.list = feedback;
+
+	return _xim_client_send_max(client, &msg.hdr, CLIENT_PREEDIT_DRAW_HDR + len + 3 +
+	                            num_feedback * sizeof(*feedback));
+}
+
+int xim_client_preedit_caret(xim_client_t *client, const int im, const int ic,
+                             const int position)
+{
+	xim_msg_preedit_caret_t msg;
+
+	msg.hdr.type = XIM_PREEDIT_CARET;
+	msg.hdr.subtype = 0;
+	msg.im = im;
+	msg.ic = ic;
+	msg.position = position;
+	msg.direction = XIMAbsolutePosition;
+	msg.style = XIMIsPrimary;
+
+	return xim_client_send(client, &msg.hdr);
+}
+
+int xim_client_preedit_done(xim_client_t *client, const int im, const int ic)
+{
+	xim_msg_preedit_done_t msg;
+
+	msg.hdr.type = XIM_PREEDIT_DONE;
+	msg.hdr.subtype = 0;
+	msg.im = im;
+	msg.ic = ic;
 
-	return xim_client_send(client, (xim_msg_t*)&msg);
+	return xim_client_send(client, &msg.hdr);
 }
@@ -23,6 +23,8 @@
 
 #include "fd.h"
 #include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
 
 typedef struct xim_client xim_client_t;
 typedef struct input_method input_method_t;
@@ -33,7 +35,18 @@ int xim_client_free(xim_client_t **client);
 int xim_client_get_im(xim_client_t *client, const int id, input_method_t **im);
 int xim_client_get_ic(xim_client_t *client, const int id, input_context_t **ic);
 
+int xim_client_set_event_mask(xim_client_t *client, const int im, const int ic,
+                              const uint32_t forward_mask, const uint32_t sync_mask);
 int xim_client_commit(xim_client_t *client, const int im, const int ic,
-                      const void *data, const size_t data_len);
+                      const struct iovec *iov, const int iovcnt);
+
+int xim_client_preedit_start(xim_client_t *client, const int im, const int ic);
+int xim_client_preedit_draw(xim_client_t *client, const int im, const int ic,
+                            const int caret, const int chg_first, const int chg_length,
+                            const char *string, const size_t len,
+                            const uint32_t *feedback, const int num_feedback);
+int xim_client_preedit_caret(xim_client_t *client, const int im, const int ic,
+                             const int position);
+int xim_client_preedit_done(xim_client_t *client, const int im, const int ic);
 
 #endif /* XIMCLIENT_H */
@@ -18,6 +18,8 @@
  * Boston, MA 02111-1307, USA.
  */
 
+#include "arena.h"
+#include "log.h"
 #include "ximproto.h"
 #include "ximtypes.h"
 #include <errno.h>
@@ -35,194 +37,6 @@ struct XIM_PACKET {
 	uint16_t length;
 } __attribute__((packed));
 
-struct XIM_ERROR {
-	uint16_t im;
-	uint16_t ic;
-	uint16_t flag;
-	uint16_t error_code;
-	uint16_t detail_len;
-	uint16_t detail_type;
-	uint8_t detail[];
-} __attribute__((packed));
-
-struct XIM_CONNECT {
-	uint8_t byte_order;
-	uint8_t unused;
-
-	struct {
-		uint16_t major;
-		uint16_t minor;
-	} client_ver;
-
-	struct {
-		uint16_t num_protos;
-		char protos[];
-	} auth;
-} __attribute__((packed));
-
-struct XIM_CONNECT_REPLY {
-	struct {
-		uint16_t major;
-		uint16_t minor;
-	} server_ver;
-} __attribute__((packed));
-
-struct XIM_OPEN {
-	uint8_t len;
-	char str[];
-} __attribute__((packed));
-
-struct XIM_OPEN_REPLY {
-	uint16_t im_id;
-	/* length of LISTofXIMATTR */
-	/* LISTofXIMATTR */
-	/* length of LISTofXICATTR */
-	/* 2 bytes padding */
-	/* LISTofXICATTR */
-} __attribute__((packed));
-
-struct XIM_CLOSE {
-	uint16_t im;
-	uint16_t unused;
-} __attribute__((packed));
-
-struct XIM_CLOSE_REPLY {
-	uint16_t im;
-	uint16_t unused;
-} __attribute__((packed));
-
-struct XIM_QUERY_EXTENSION {
-	uint16_t im;
-	uint16_t exts_len;
-	char exts[];
-	/* pad */
-} __attribute__((packed));
-
-struct XIM_QUERY_EXTENSION_REPLY {
-	uint16_t im;
-	uint16_t exts_len;
-	uint8_t exts[];
-} __attribute__((packed));
-
-struct XIM_ENCODING_NEGOTIATION {
-	uint16_t im;
-	uint8_t encodings[];
-	/* pad */
-	/* length of encoding details */
-	/* 2 bytes padding */
-	/* list of encoding details */
-} __attribute__((packed));
-
-struct XIM_ENCODING_NEGOTIATION_REPLY {
-	uint16_t im;
-	uint16_t category;
-	int16_t encoding;
-	uint16_t unused;
-} __attribute__((packed));
-
-struct XIM_GET_IM_VALUES {
-	uint16_t im;
-	uint16_t len_attrs;
-	uint16_t attrs[];
-} __attribute__((packed));
-
-struct XIM_GET_IM_VALUES_REPLY {
-	uint16_t im;
-	uint16_t len_values;
-	uint8_t values[];
-} __attribute__((packed));
-
-struct XIM_SET_IM_VALUES {
-	uint16_t im;
-	uint16_t len_values;
-	uint8_t values[];
-} __attribute__((packed));
-
-struct XIM_SET_IM_VALUES_REPLY {
-	uint16_t im;
-	uint16_t unused;
-} __attribute__((packed));
-
-struct XIM_CREATE_IC {
-	uint16_t im;
-	uint16_t len_values;
-	uint8_t values[];
-} __attribute__((packed));
-
-struct XIM_CREATE_IC_REPLY {
-	uint16_t im;
-	uint16_t ic;
-} __attribute__((packed));
-
-struct XIM_GET_IC_VALUES {
-	uint16_t im;
-	uint16_t ic;
-	uint16_t len_attrs;
-	uint16_t attrs[];
-} __attribute__((packed));
-
-struct XIM_GET_IC_VALUES_REPLY {
-	uint16_t im;
-	uint16_t ic;
-	uint16_t len_values;
-	uint8_t values[];
-} __attribute__((packed));
-
-struct XIM_SET_IC_VALUES {
-	uint16_t im;
-	uint16_t ic;
-	uint16_t len_values;
-	uint16_t unused;
-	uint8_t values[];
-} __attribute__((packed));
-
-struct XIM_SET_IC_VALUES_REPLY {
-	uint16_t im;
-	uint16_t ic;
-} __attribute__((packed));
-
-struct XIM_SET_IC_FOCUS {
-	uint16_t im;
-	uint16_t ic;
-} __attribute__((packed));
-
-struct XIM_UNSET_IC_FOCUS {
-	uint16_t im;
-	uint16_t ic;
-} __attribute__((packed));
-
-struct XIM_DESTROY_IC {
-	uint16_t im;
-	uint16_t ic;
-} __attribute__((packed));
-
-struct XIM_DESTROY_IC_REPLY {
-	uint16_t im;
-	uint16_t ic;
-} __attribute__((packed));
-
-struct XIM_SYNC {
-	uint16_t im;
-	uint16_t ic;
-} __attribute__((packed));
-
-struct XIM_SYNC_REPLY {
-	uint16_t im;
-	uint16_t ic;
-} __attribute__((packed));
-
-struct XIM_RESET_IC {
-	uint16_t im;
-	uint16_t ic;
-} __attribute__((packed));
-
-struct XIM_RESET_IC_REPLY {
-	uint16_t im;
-	uint16_t ic;
-	uint16_t len_preedit;
-	uint8_t preedit[];
-} __attribute__((packed));
-
 struct XIM_COMMIT {
 	uint16_t im;
 	uint16_t ic;
@@ -248,1426 +62,884 @@ struct XIM_COMMIT {
 	} data;
 } __attribute__((packed));
 
-struct XIM_FORWARD_EVENT {
-	uint16_t im;
-	uint16_t ic;
-	uint16_t flag;
-	uint16_t serial;
-	struct XCoreKeyEvent event;
-} __attribute__((packed));
-
-struct XIM_SET_EVENT_MASK {
-	uint16_t im;
-	uint16_t ic;
-	struct {
-		uint32_t forward;
-		uint32_t sync;
-	} masks;
-} __attribute__((packed));
+/*
+ * Message layouts
+ *
+ * The payload of a message is described as a list of fields. Each field
+ * is given as FIELD(t, kind, member, aux), with t the message struct and
+ * member the struct member the field is decoded into or encoded from.
+ * Fields that don't have a member use hdr. What aux means depends on the
+ * kind of the field: it is the size of UNUSED fields, and the offset of
+ * the count (an int) or length (a size_t) member of lists, or -1 if a
+ * list doesn't have one.
+ *
+ * Lists are preceded by a LEN field that holds their size in bytes. When
+ * decoding, the LEN field determines the size of the next list; when
+ * encoding, it is filled in after the next list was written.
+ *
+ *   CARD8, CARD16, CARD32  integer member of any size
+ *   UNUSED                 aux bytes that are zero
+ *   ALIGN                  padding up to the next multiple of four
+ *   BYTES                  member that is copied as it is
+ *   LEN16, LEN32           length of the next list
+ *   SKIP                   list that is not decoded
+ *   STR                    char*, a STR
+ *   DATA                   void*, the list itself, not copied
+ *   CTEXT                  void*, UTF-8 that is sent as compound text,
+ *                          decoded like DATA
+ *   STRS                   char**, a list of STR
+ *   STRINGS                char**, a list of STRING, LEN is a count
+ *   CARD16S                int*, a list of CARD16
+ *   CARD32S                uint32_t*, a list of CARD32
+ *   ATTRS                  attr_t**, NULL-terminated list of XIMATTR
+ *   ATTRIBUTES             attr_value_t**, list of XIMATTRIBUTE
+ *   EXTS                   ext_t*, list terminated by an ext_t without name
+ *   TRIGGERKEYS            trigger_key_t*, list of XIMTRIGGERKEY
+ *
+ * The decode_* and encode_* functions of each message are generated from
+ * its layout by the preprocessor, see CODEC() below.
+ */
 
-static const struct {
-	xim_msg_type_t type;
-	char *name;
-	size_t size;
-} _msg_info[] = {
-	[XIM_ERROR] = {
-		.type = XIM_ERROR,
-		.name = "XIM_ERROR",
-		.size = sizeof(xim_msg_error_t)
-	},
-	[XIM_CONNECT] = {
-		.type = XIM_CONNECT,
-		.name = "XIM_CONNECT",
-		.size = sizeof(xim_msg_connect_t)
-	},
-	[XIM_CONNECT_REPLY] = {
-		.type = XIM_CONNECT_REPLY,
-		.name = "XIM_CONNECT_REPLY",
-		.size = sizeof(xim_msg_connect_reply_t)
-	},
-	[XIM_DISCONNECT] = {
-		.type = XIM_DISCONNECT,
-		.name = "XIM_DISCONNECT",
-		.size = sizeof(xim_msg_disconnect_t)
-	},
-	[XIM_DISCONNECT_REPLY] = {
-		.type = XIM_DISCONNECT_REPLY,
-		.name = "XIM_DISCONNECT_REPLY",
-		.size = sizeof(xim_msg_disconnect_reply_t)
-	},
-	[XIM_OPEN] = {
-		.type = XIM_OPEN,
-		.name = "XIM_OPEN",
-		.size = sizeof(xim_msg_open_t)
-	},
-	[XIM_OPEN_REPLY] = {
-		.type = XIM_OPEN_REPLY,
-		.name = "XIM_OPEN_REPLY",
-		.size = sizeof(xim_msg_open_reply_t)
-	},
-	[XIM_CLOSE] = {
-		.type = XIM_CLOSE,
-		.name = "XIM_CLOSE",
-		.size = sizeof(xim_msg_close_t)
-	},
-	[XIM_CLOSE_REPLY] = {
-		.type = XIM_CLOSE_REPLY,
-		.name = "XIM_CLOSE_REPLY",
-		.size = sizeof(xim_msg_close_reply_t)
-	},
-	[XIM_QUERY_EXTENSION] = {
-		.type = XIM_QUERY_EXTENSION,
-		.name = "XIM_QUERY_EXTENSION",
-		.size = sizeof(xim_msg_query_extension_t)
-	},
-	[XIM_QUERY_EXTENSION_REPLY] = {
-		.type = XIM_QUERY_EXTENSION_REPLY,
-		.name = "XIM_QUERY_EXTENSION_REPLY",
-		.size = sizeof(xim_msg_query_extension_reply_t)
-	},
-	[XIM_ENCODING_NEGOTIATION] = {
-		.type = XIM_ENCODING_NEGOTIATION,
-		.name = "XIM_ENCODING_NEGOTIATION",
-		.size = sizeof(xim_msg_encoding_negotiation_t)
-	},
-	[XIM_ENCODING_NEGOTIATION_REPLY] = {
-		.type = XIM_ENCODING_NEGOTIATION_REPLY,
-		.name = "XIM_ENCODING_NEGOTIATION_REPLY",
-		.size = sizeof(xim_msg_encoding_negotiation_reply_t)
-	},
-	[XIM_GET_IM_VALUES] = {
-		.type = XIM_GET_IM_VALUES,
-		.name = "XIM_GET_IM_VALUES",
-		.size = sizeof(xim_msg_get_im_values_t)
-	},
-	[XIM_SET_IM_VALUES] = {
-		.type = XIM_SET_IM_VALUES,
-		.name = "XIM_SET_IM_VALUES",
-		.size = sizeof(xim_msg_set_im_values_t)
-	},
-	[XIM_CREATE_IC] = {
-		.type = XIM_CREATE_IC,
-		.name = "XIM_CREATE_IC",
-		.size = sizeof(xim_msg_create_ic_t)
-	},
-	[XIM_CREATE_IC_REPLY] = {
-		.type = XIM_CREATE_IC_REPLY,
-		.name = "XIM_CREATE_IC_REPLY",
-		.size = sizeof(xim_msg_create_ic_reply_t)
-	},
-	[XIM_GET_IC_VALUES] = {
-		.type = XIM_GET_IC_VALUES,
-		.name = "XIM_GET_IC_VALUES",
-		.size = sizeof(xim_msg_get_ic_values_t)
-	},
-	[XIM_GET_IC_VALUES_REPLY] = {
-		.type = XIM_GET_IC_VALUES_REPLY,
-		.name = "XIM_GET_IC_VALUES_REPLY",
-		.size = sizeof(xim_msg_get_ic_values_reply_t)
-	},
-	[XIM_SET_IC_VALUES] = {
-		.type = XIM_SET_IC_VALUES,
-		.name = "XIM_SET_IC_VALUES",
-		.size = sizeof(xim_msg_set_ic_values_t)
-	},
-	[XIM_SET_IC_VALUES_REPLY] = {
-		.type = XIM_SET_IC_VALUES_REPLY,
-		.name = "XIM_SET_IC_VALUES_REPLY",
-		.size = sizeof(xim_msg_set_ic_values_reply_t)
-	},
-	[XIM_SET_IC_FOCUS] = {
-		.type = XIM_SET_IC_FOCUS,
-		.name = "XIM_SET_IC_FOCUS",
-		.size = sizeof(xim_msg_set_ic_focus_t)
-	},
-	[XIM_UNSET_IC_FOCUS] = {
-		.type = XIM_UNSET_IC_FOCUS,
-		.name = "XIM_UNSET_IC_FOCUS",
-		.size = sizeof(xim_msg_unset_ic_focus_t)
-	},
-	[XIM_DESTROY_IC] = {
-		.type = XIM_DESTROY_IC,
-		.name = "XIM_DESTROY_IC",
-		.size = sizeof(xim_msg_destroy_ic_t)
-	},
-	[XIM_DESTROY_IC_REPLY] = {
-		.type = XIM_DESTROY_IC_REPLY,
-		.name = "XIM_DESTROY_IC_REPLY",
-		.size = sizeof(xim_msg_destroy_ic_reply_t)
-	},
-	[XIM_SYNC] = {
-		.type = XIM_SYNC,
-		.name = "XIM_SYNC",
-		.size = sizeof(xim_msg_sync_t)
-	},
-	[XIM_SYNC_REPLY] = {
-		.type = XIM_SYNC_REPLY,
-		.name = "XIM_SYNC_REPLY",
-		.size = sizeof(xim_msg_sync_reply_t)
-	},
-	[XIM_RESET_IC] = {
-		.type = XIM_RESET_IC,
-		.name = "XIM_RESET_IC",
-		.size = sizeof(xim_msg_reset_ic_t)
-	},
-	[XIM_RESET_IC_REPLY] = {
-		.type = XIM_RESET_IC_REPLY,
-		.name = "XIM_RESET_IC_REPLY",
-		.size = sizeof(xim_msg_reset_ic_reply_t)
-	},
-	[XIM_COMMIT] = {
-		.type = XIM_COMMIT,
-		.name = "XIM_COMMIT",
-		.size = sizeof(xim_msg_commit_t)
-	},
-	[XIM_FORWARD_EVENT] = {
-		.type = XIM_FORWARD_EVENT,
-		.name = "XIM_FORWARD_EVENT",
-		.size = sizeof(xim_msg_forward_event_t)
-	},
-	[XIM_SET_EVENT_MASK] = {
-		.type = XIM_SET_EVENT_MASK,
-		.name = "XIM_SET_EVENT_MASK",
-		.size = sizeof(xim_msg_set_event_mask_t)
-	}
+#define IM_LAYOUT(FIELD, t)           \
+	FIELD(t, CARD16, im, -1)      \
+	FIELD(t, UNUSED, hdr, 2)
+
+#define IM_IC_LAYOUT(FIELD, t)        \
+	FIELD(t, CARD16, im, -1)      \
+	FIELD(t, CARD16, ic, -1)
+
+#define XIM_ERROR_LAYOUT(FIELD, t)                                 \
+	IM_IC_LAYOUT(FIELD, t)                                     \
+	FIELD(t, CARD16, flags, -1)                                \
+	FIELD(t, CARD16, error, -1)                                \
+	FIELD(t, LEN16, hdr, -1)                                   \
+	FIELD(t, CARD16, detail_type, -1)                          \
+	FIELD(t, DATA, detail, offsetof(t, detail_len))            \
+	FIELD(t, ALIGN, hdr, -1)
+
+#define XIM_CONNECT_LAYOUT(FIELD, t)                               \
+	FIELD(t, CARD8, byte_order, -1)                            \
+	FIELD(t, UNUSED, hdr, 1)                                   \
+	FIELD(t, CARD16, client_ver.major, -1)                     \
+	FIELD(t, CARD16, client_ver.minor, -1)                     \
+	FIELD(t, LEN16, hdr, -1)                                   \
+	FIELD(t, STRINGS, auth.protos, offsetof(t, auth.num_protos))
+
+#define XIM_CONNECT_REPLY_LAYOUT(FIELD, t)                         \
+	FIELD(t, CARD16, server_ver.major, -1)                     \
+	FIELD(t, CARD16, server_ver.minor, -1)
+
+#define XIM_OPEN_LAYOUT(FIELD, t)                                  \
+	FIELD(t, STR, locale, -1)                                  \
+	FIELD(t, ALIGN, hdr, -1)
+
+#define XIM_OPEN_REPLY_LAYOUT(FIELD, t)                            \
+	FIELD(t, CARD16, id, -1)                                   \
+	FIELD(t, LEN16, hdr, -1)                                   \
+	FIELD(t, ATTRS, im_attrs, -1)                              \
+	FIELD(t, LEN16, hdr, -1)                                   \
+	FIELD(t, UNUSED, hdr, 2)                                   \
+	FIELD(t, ATTRS, ic_attrs, -1)
+
+#define XIM_CLOSE_LAYOUT IM_LAYOUT
+#define XIM_CLOSE_REPLY_LAYOUT IM_LAYOUT
+
+#define XIM_REGISTER_TRIGGERKEYS_LAYOUT(FIELD, t)                  \
+	FIELD(t, CARD16, im, -1)                                   \
+	FIELD(t, UNUSED, hdr, 2)                                   \
+	FIELD(t, LEN32, hdr, -1)                                   \
+	FIELD(t, TRIGGERKEYS, on_keys, offsetof(t, num_on_keys))   \
+	FIELD(t, LEN32, hdr, -1)                                   \
+	FIELD(t, TRIGGERKEYS, off_keys, offsetof(t, num_off_keys))
+
+#define XIM_TRIGGER_NOTIFY_LAYOUT(FIELD, t)                        \
+	IM_IC_LAYOUT(FIELD, t)                                     \
+	FIELD(t, CARD32, flag, -1)                                 \
+	FIELD(t, CARD32, index, -1)                                \
+	FIELD(t, CARD32, mask, -1)
+
+#define XIM_TRIGGER_NOTIFY_REPLY_LAYOUT IM_IC_LAYOUT
+
+#define XIM_SET_EVENT_MASK_LAYOUT(FIELD, t)                        \
+	IM_IC_LAYOUT(FIELD, t)                                     \
+	FIELD(t, CARD32, masks.forward, -1)                        \
+	FIELD(t, CARD32, masks.sync, -1)
+
+#define XIM_ENCODING_NEGOTIATION_LAYOUT(FIELD, t)                  \
+	FIELD(t, CARD16, im, -1)                                   \
+	FIELD(t, LEN16, hdr, -1)                                   \
+	FIELD(t, STRS, encodings, -1)                              \
+	FIELD(t, ALIGN, hdr, -1)                                   \
+	FIELD(t, LEN16, hdr, -1)                                   \
+	FIELD(t, UNUSED, hdr, 2)                                   \
+	FIELD(t, SKIP, hdr, -1)
+
+#define XIM_ENCODING_NEGOTIATION_REPLY_LAYOUT(FIELD, t)            \
+	FIELD(t, CARD16, im, -1)                                   \
+	FIELD(t, CARD16, category, -1)                             \
+	FIELD(t, CARD16, encoding, -1)                             \
+	FIELD(t, UNUSED, hdr, 2)
+
+#define XIM_QUERY_EXTENSION_LAYOUT(FIELD, t)                       \
+	FIELD(t, CARD16, im, -1)                                   \
+	FIELD(t, LEN16, hdr, -1)                                   \
+	FIELD(t, STRS, exts, offsetof(t, num_exts))                \
+	FIELD(t, ALIGN, hdr, -1)
+
+#define XIM_QUERY_EXTENSION_REPLY_LAYOUT(FIELD, t)                 \
+	FIELD(t, CARD16, im, -1)                                   \
+	FIELD(t, LEN16, hdr, -1)                                   \
+	FIELD(t, EXTS, exts, -1)
+
+#define XIM_SET_IM_VALUES_LAYOUT(FIELD, t)                         \
+	FIELD(t, CARD16, im, -1)                                   \
+	FIELD(t, LEN16, hdr, -1)                                   \
+	FIELD(t, ATTRIBUTES, values, -1)
+
+#define XIM_SET_IM_VALUES_REPLY_LAYOUT IM_LAYOUT
+
+#define XIM_GET_IM_VALUES_LAYOUT(FIELD, t)                         \
+	FIELD(t, CARD16, im, -1)                                   \
+	FIELD(t, LEN16, hdr, -1)                                   \
+	FIELD(t, CARD16S, attrs, offsetof(t, num_attrs))           \
+	FIELD(t, ALIGN, hdr, -1)
+
+#define XIM_GET_IM_VALUES_REPLY_LAYOUT(FIELD, t)                   \
+	FIELD(t, CARD16, im, -1)                                   \
+	FIELD(t, LEN16, hdr, -1)                                   \
+	FIELD(t, ATTRIBUTES, values, offsetof(t, num_values))
+
+#define XIM_CREATE_IC_LAYOUT(FIELD, t)                             \
+	FIELD(t, CARD16, im, -1)                                   \
+	FIELD(t, LEN16, hdr, -1)                                   \
+	FIELD(t, ATTRIBUTES, values, offsetof(t, num_values))
+
+#define XIM_CREATE_IC_REPLY_LAYOUT IM_IC_LAYOUT
+#define XIM_DESTROY_IC_LAYOUT IM_IC_LAYOUT
+#define XIM_DESTROY_IC_REPLY_LAYOUT IM_IC_LAYOUT
+
+#define XIM_SET_IC_VALUES_LAYOUT(FIELD, t)                         \
+	IM_IC_LAYOUT(FIELD, t)                                     \
+	FIELD(t, LEN16, hdr, -1)                                   \
+	FIELD(t, UNUSED, hdr, 2)                                   \
+	FIELD(t, ATTRIBUTES, values, -1)
+
+#define XIM_SET_IC_VALUES_REPLY_LAYOUT IM_IC_LAYOUT
+
+#define XIM_GET_IC_VALUES_LAYOUT(FIELD, t)                         \
+	IM_IC_LAYOUT(FIELD, t)                                     \
+	FIELD(t, LEN16, hdr, -1)                                   \
+	FIELD(t, CARD16S, attrs, offsetof(t, num_attrs))           \
+	FIELD(t, ALIGN, hdr, -1)
+
+#define XIM_GET_IC_VALUES_REPLY_LAYOUT(FIELD, t)                   \
+	IM_IC_LAYOUT(FIELD, t)                                     \
+	FIELD(t, LEN16, hdr, -1)                                   \
+	FIELD(t, UNUSED, hdr, 2)                                   \
+	FIELD(t, ATTRIBUTES, values, offsetof(t, num_values))
+
+#define XIM_SET_IC_FOCUS_LAYOUT IM_IC_LAYOUT
+#define XIM_UNSET_IC_FOCUS_LAYOUT IM_IC_LAYOUT
+
+#define XIM_FORWARD_EVENT_LAYOUT(FIELD, t)                         \
+	IM_IC_LAYOUT(FIELD, t)                                     \
+	FIELD(t, CARD16, flags, -1)                                \
+	FIELD(t, CARD16, serial, -1)                               \
+	FIELD(t, BYTES, event, -1)
+
+#define XIM_SYNC_LAYOUT IM_IC_LAYOUT
+#define XIM_SYNC_REPLY_LAYOUT IM_IC_LAYOUT
+#define XIM_RESET_IC_LAYOUT IM_IC_LAYOUT
+
+#define XIM_RESET_IC_REPLY_LAYOUT(FIELD, t)                        \
+	IM_IC_LAYOUT(FIELD, t)                                     \
+	FIELD(t, LEN16, hdr, -1)                                   \
+	FIELD(t, CTEXT, preedit.data, offsetof(t, preedit.len))    \
+	FIELD(t, ALIGN, hdr, -1)
+
+#define XIM_PREEDIT_START_LAYOUT IM_IC_LAYOUT
+
+#define XIM_PREEDIT_START_REPLY_LAYOUT(FIELD, t)                   \
+	IM_IC_LAYOUT(FIELD, t)                                     \
+	FIELD(t, CARD32, max_len, -1)
+
+#define XIM_PREEDIT_DRAW_LAYOUT(FIELD, t)                          \
+	IM_IC_LAYOUT(FIELD, t)                                     \
+	FIELD(t, CARD32, caret, -1)                                \
+	FIELD(t, CARD32, chg_first, -1)                            \
+	FIELD(t, CARD32, chg_length, -1)                           \
+	FIELD(t, CARD32, status, -1)                               \
+	FIELD(t, LEN16, hdr, -1)                                   \
+	FIELD(t, CTEXT, string.data, offsetof(t, string.len))      \
+	FIELD(t, ALIGN, hdr, -1)                                   \
+	FIELD(t, LEN16, hdr, -1)                                   \
+	FIELD(t, UNUSED, hdr, 2)                                   \
+	FIELD(t, CARD32S, feedback.list, offsetof(t, feedback.num))
+
+#define XIM_PREEDIT_CARET_LAYOUT(FIELD, t)                         \
+	IM_IC_LAYOUT(FIELD, t)                                     \
+	FIELD(t, CARD32, position, -1)                             \
+	FIELD(t, CARD32, direction, -1)                            \
+	FIELD(t, CARD32, style, -1)
+
+#define XIM_PREEDIT_CARET_REPLY_LAYOUT(FIELD, t)                   \
+	IM_IC_LAYOUT(FIELD, t)                                     \
+	FIELD(t, CARD32, position, -1)
+
+#define XIM_PREEDIT_DONE_LAYOUT IM_IC_LAYOUT
+
+typedef enum {
+	FIELD_CARD8,
+	FIELD_CARD16,
+	FIELD_CARD32,
+	FIELD_UNUSED,
+	FIELD_ALIGN,
+	FIELD_BYTES,
+	FIELD_LEN16,
+	FIELD_LEN32,
+	FIELD_SKIP,
+	FIELD_STR,
+	FIELD_DATA,
+	FIELD_CTEXT,
+	FIELD_STRS,
+	FIELD_STRINGS,
+	FIELD_CARD16S,
+	FIELD_CARD32S,
+	FIELD_ATTRS,
+	FIELD_ATTRIBUTES,
+	FIELD_EXTS,
+	FIELD_TRIGGERKEYS
+} field_type_t;
+
+/* A UTF-8 string is transmitted as compound text, between these sequences */
+static const uint8_t _ct_header[]  = { 0x1B, 0x25, 0x47 };
+static const uint8_t _ct_trailer[] = { 0x1B, 0x25, 0x40, 0x00, 0x00, 0x00 };
+
+#define CT_TRAILER_LEN 3
+
+struct codec {
+	uint8_t *data;      /* payload on the wire */
+	size_t size;        /* size of the payload, or of the buffer when encoding */
+	size_t offset;      /* position in the payload */
+	size_t list_len;    /* decoding: value of the last LEN field */
+	size_t len_offset;  /* encoding: position of the LEN field to fill in */
+	int len_size;       /* encoding: size of that LEN field, 0 if there is none */
+	arena_t *arena;
 };
 
-static int need_more_data(struct XIM_PACKET *src, const size_t src_len)
-{
-	return (src_len < sizeof(*src) || /* check if header is there */
-	        src_len < (sizeof(*src) + src->length * 4)); /* check if payload is there */
-}
-
-static int decode_XIM_ERROR(xim_msg_t **dst, const struct XIM_ERROR *src, const size_t src_len)
+static uint32_t _wire_get(const uint8_t *src, const size_t size)
 {
-	xim_msg_error_t *msg;
-	int parsed_len;
-	int padded_len;
+	uint16_t card16;
+	uint32_t card32;
 
-	if (src_len < sizeof(*src)) {
-		return -ENOMSG;
-	}
-
-	if (src_len < (sizeof(*msg) + src->detail_len)) {
-		return -EBADMSG;
-	}
+	switch (size) {
+	case 1:
+		return *src;
 
-	if (!(msg = calloc(1, sizeof(*msg)))) {
-		return -ENOMEM;
-	}
+	case 2:
+		memcpy(&card16, src, sizeof(card16));
+		return card16;
 
-	if (!(msg->detail = malloc(src->detail_len))) {
-		free(msg);
-		return -ENOMEM;
+	default:
+		memcpy(&card32, src, sizeof(card32));
+		return card32;
 	}
-
-	msg->im = src->im;
-	msg->ic = src->ic;
-	msg->flags = src->flag;
-	msg->error = src->error_code;
-	msg->detail_len = src->detail_len;
-	msg->detail_type = src->detail_type;
-	parsed_len = sizeof(*src) + src->detail_len;
-	padded_len = parsed_len + PAD(parsed_len);
-
-	memmove(msg->detail, src->detail, msg->detail_len);
-
-	*dst = (xim_msg_t*)msg;
-	return padded_len;
 }
 
-static int decode_XIM_CONNECT(xim_msg_t **dst, const struct XIM_CONNECT *src, const size_t src_len)
+static void _wire_put(uint8_t *dst, const size_t size, const uint32_t value)
 {
-	xim_msg_connect_t *msg;
-	size_t remaining_len;
-	int n;
-	int skip;
-
-	if (!(msg = calloc(1, sizeof(*msg)))) {
-		return -ENOMEM;
-	}
-
-	msg->byte_order = src->byte_order;
-	msg->client_ver.major = src->client_ver.major;
-	msg->client_ver.minor = src->client_ver.minor;
-
-	if (!(msg->auth.protos = calloc(src->auth.num_protos + 1, sizeof(char*)))) {
-		free(msg);
-		return -ENOMEM;
-	}
+	uint16_t card16;
 
-	msg->auth.num_protos = src->auth.num_protos;
-	remaining_len = src_len - offsetof(struct XIM_CONNECT, auth.num_protos);
-
-	for (skip = n = 0; n < src->auth.num_protos; n++) {
-		int parsed;
+	switch (size) {
+	case 1:
+		*dst = (uint8_t)value;
+		break;
 
-		if ((parsed = decode_STRING(&msg->auth.protos[n],
-		                            (uint8_t*)src->auth.protos + skip,
-		                            remaining_len)) < 0) {
-			break;
-		}
+	case 2:
+		card16 = (uint16_t)value;
+		memcpy(dst, &card16, sizeof(card16));
+		break;
 
-		skip += parsed;
-		remaining_len -= parsed;
+	default:
+		memcpy(dst, &value, sizeof(value));
+		break;
 	}
-
-	*dst = (xim_msg_t*)msg;
-	return skip + sizeof(*src);
 }
 
-static int decode_XIM_OPEN(xim_msg_t **dst, const struct XIM_OPEN *src, const size_t src_len)
+static uint32_t _member_get(const uint8_t *member, const size_t size)
 {
-	xim_msg_open_t *msg;
-	char *locale;
-	int parsed_len;
-	int padding;
-	int padded_len;
-
-	if ((parsed_len = decode_STR(&locale, (const uint8_t*)src, src_len)) < 0) {
-		return parsed_len;
-	}
-
-	if (!(msg = calloc(1, sizeof(*msg)))) {
-		free(locale);
-		return -ENOMEM;
-	}
-
-	msg->locale = locale;
-	padding = PAD(parsed_len);
-	padded_len = parsed_len + padding;
-
-	*dst = (xim_msg_t*)msg;
-	return padded_len;
-}
+	switch (size) {
+	case 1:
+		return *member;
 
-static int decode_XIM_CLOSE(xim_msg_t **dst, const struct XIM_CLOSE *src, const size_t src_len)
-{
-	xim_msg_close_t *msg;
+	case 2:
+		return *(const uint16_t*)member;
 
-	if (src_len < sizeof(*src)) {
-		return -ENOMSG;
-	}
+	case 4:
+		return *(const uint32_t*)member;
 
-	if (!(msg = calloc(1, sizeof(*msg)))) {
-		return -ENOMEM;
+	default:
+		return (uint32_t)*(const uint64_t*)member;
 	}
-
-	msg->im = src->im;
-
-	*dst = (xim_msg_t*)msg;
-	return sizeof(*src);
 }
 
-static int decode_XIM_QUERY_EXTENSION(xim_msg_t **dst, const struct XIM_QUERY_EXTENSION *src,
-                                      const size_t src_len)
+static void _member_set(uint8_t *member, const size_t size, const uint32_t value)
 {
-	xim_msg_query_extension_t *msg;
-	int computed_len;
-	int padding_len;
-	int padded_len;
-	int parsed_len;
-
-	computed_len = sizeof(*src) + src->exts_len;
-	padding_len = PAD(computed_len);
-	padded_len = computed_len + padding_len;
-
-	if (padded_len > src_len) {
-		return -EBADMSG;
-	}
-
-	if (!(msg = calloc(1, sizeof(*msg)))) {
-		return -ENOMEM;
-	}
-
-	msg->im = src->im;
-
-	for (parsed_len = sizeof(*src); parsed_len < computed_len; ) {
-		char **new_exts;
-		char *ext;
-		int ext_len;
-
-		if ((ext_len = decode_STR(&ext, (uint8_t*)src + parsed_len, src_len - parsed_len)) < 0) {
-			free(msg);
-			return -EBADMSG;
-		}
+	switch (size) {
+	case 1:
+		*member = (uint8_t)value;
+		break;
 
-		if (!(new_exts = realloc(msg->exts, sizeof(char*) * (msg->num_exts + 1)))) {
-			free(msg);
-			return -ENOMEM;
-		}
+	case 2:
+		*(uint16_t*)member = (uint16_t)value;
+		break;
 
-		new_exts[msg->num_exts++] = ext;
-		msg->exts = new_exts;
+	case 4:
+		*(uint32_t*)member = value;
+		break;
 
-	        parsed_len += ext_len;
+	default:
+		*(uint64_t*)member = value;
+		break;
 	}
-
-	*dst = (xim_msg_t*)msg;
-	return parsed_len + padding_len;
 }
 
-struct LISTofSTR {
-	uint16_t len;
-	uint8_t strings[];
-} __attribute__((packed));
-
-static int count_strings(const struct LISTofSTR *list, const size_t list_len)
+static int _decode_list(struct codec *c, const field_type_t type, uint8_t *msg,
+                        const size_t offset, const int aux)
 {
-	size_t offset;
+	const uint8_t *src;
+	size_t src_len;
+	void **list;
+	int parsed;
 	int count;
+	int i;
 
-	if (list_len < sizeof(*list)) {
-		return -ENOMSG;
-	}
-
-	if (list_len < (sizeof(*list) + list->len)) {
-		return -EBADMSG;
-	}
-
+	src = c->data + c->offset;
+	src_len = c->size - c->offset;
+	list = (void**)(msg + offset);
+	parsed = 0;
 	count = 0;
-	offset = 0;
 
-	while (offset < list->len) {
-		count++;
-		offset += list->strings[offset] + 1;
+	/* the length of a list of STRING is the number of strings */
+	if (type != FIELD_STRINGS && c->list_len > src_len) {
+		return -EBADMSG;
 	}
 
-	return count;
-}
-
-static int decode_LISTofSTR(char ***dst, const void *src, const size_t src_len)
-{
-	const struct LISTofSTR *raw;
-	int num_strings;
-	char **strings;
-	int parsed_len;
-	int i;
+	switch (type) {
+	case FIELD_SKIP:
+		parsed = c->list_len;
+		break;
 
-	if (src_len < sizeof(*raw)) {
-		return -ENOMSG;
-	}
+	case FIELD_DATA:
+	case FIELD_CTEXT:
+		/* the data is not copied, it points into the received message */
+		*list = (void*)src;
+		*(size_t*)(msg + aux) = c->list_len;
+		parsed = c->list_len;
+		break;
 
-	raw = src;
-	if ((num_strings = count_strings(raw, src_len)) < 0) {
-		return num_strings;
-	}
+	case FIELD_STRS:
+		/* the length is an upper bound for the number of strings */
+		if (!(*list = arena_calloc(c->arena, c->list_len + 1, sizeof(char*)))) {
+			return -ENOMEM;
+		}
 
-	if (!(strings = calloc(num_strings + 1, sizeof(char*)))) {
-		return -ENOMEM;
-	}
+		for (parsed = 0; parsed < c->list_len; count++) {
+			int str_len;
 
-	for (i = 0, parsed_len = 0; i < num_strings; i++) {
-		int str_len;
+			if ((str_len = decode_STR(&((char**)*list)[count], src + parsed,
+			                          c->list_len - parsed, c->arena)) < 0) {
+				return -EBADMSG;
+			}
 
-		if ((str_len = decode_STR(&strings[i], raw->strings + parsed_len,
-		                          src_len - sizeof(*raw) - parsed_len)) < 0) {
-			break;
+			parsed += str_len;
 		}
+		break;
 
-		parsed_len += str_len;
-	}
-
-	if (i != num_strings) {
-		/* did not decode all strings */
-		while (i >= 0) {
-			/* FIXME: i-- */
-			free(strings[i]);
+	case FIELD_STRINGS:
+		if (!(*list = arena_calloc(c->arena, c->list_len + 1, sizeof(char*)))) {
+			return -ENOMEM;
 		}
-		free(strings);
-
-		return -EBADMSG;
-	}
-
-	*dst = strings;
-	return parsed_len + sizeof(*raw);
-}
-
-static int decode_XIM_ENCODING_NEGOTIATION(xim_msg_t **dst, const struct XIM_ENCODING_NEGOTIATION *src,
-                                           const size_t src_len)
-{
-	xim_msg_encoding_negotiation_t *msg;
-	char **encodings;
-	int parsed_len;
-	uint16_t details_len;
-
-	if (src_len < sizeof(*src)) {
-		return -ENOMSG;
-	}
-
-	if (!(msg = calloc(1, sizeof(*msg)))) {
-		return -ENOMEM;
-	}
-
-	if ((parsed_len = decode_LISTofSTR(&encodings, src->encodings,
-	                                   src_len - sizeof(*src))) < 0) {
-		return parsed_len;
-	}
-
-	msg->im = src->im;
-	msg->encodings = encodings;
-	parsed_len += PAD(parsed_len);
-	details_len = *(uint16_t*)(src->encodings + parsed_len);
-	parsed_len += 4; /* skip over details size and its padding */
-	parsed_len += details_len; /* skip over details */
-
-	/* FIXME: Implement parsing of details? */
-
-	*dst = (xim_msg_t*)msg;
-	return parsed_len;
-}
-
-static int decode_XIM_GET_IM_VALUES(xim_msg_t **dst, const struct XIM_GET_IM_VALUES *src,
-                                    const size_t src_len)
-{
-	xim_msg_get_im_values_t *msg;
-	int data_len;
-	int padded_len;
-	int i;
 
-	if (src_len < sizeof(*src)) {
-		return -ENOMSG;
-	}
+		for (parsed = 0; count < c->list_len; count++) {
+			int str_len;
 
-	data_len = sizeof(*src) + src->len_attrs;
-	padded_len = data_len + PAD(data_len);
+			if ((str_len = decode_STRING(&((char**)*list)[count], src + parsed,
+			                             src_len - parsed, c->arena)) < 0) {
+				return -EBADMSG;
+			}
 
-	if (src_len < data_len) {
-		return -EBADMSG;
-	}
+			parsed += str_len;
+		}
+		break;
 
-	if (!(msg = calloc(1, sizeof(*msg)))) {
-		return -ENOMEM;
-	}
+	case FIELD_CARD16S:
+		count = c->list_len / sizeof(uint16_t);
 
-	msg->im = src->im;
-	msg->num_attrs = src->len_attrs / sizeof(uint16_t);
+		if (!(*list = arena_calloc(c->arena, count, sizeof(int)))) {
+			return -ENOMEM;
+		}
 
-	if (!(msg->attrs = calloc(msg->num_attrs, sizeof(int)))) {
-		free(msg);
-		return -ENOMEM;
-	}
+		for (i = 0; i < count; i++) {
+			((int*)*list)[i] = _wire_get(src + i * sizeof(uint16_t), sizeof(uint16_t));
+		}
 
-	for (i = 0; i < msg->num_attrs; i++) {
-		msg->attrs[i] = src->attrs[i];
-	}
+		parsed = c->list_len;
+		break;
 
-	*dst = (xim_msg_t*)msg;
-	return padded_len;
-}
+	case FIELD_CARD32S:
+		count = c->list_len / sizeof(uint32_t);
 
-static int decode_XIM_SET_IM_VALUES(xim_msg_t **dst, const struct XIM_SET_IM_VALUES *src,
-                                    const size_t src_len)
-{
-	xim_msg_set_im_values_t *msg;
-	int parsed_len;
+		if (!(*list = arena_calloc(c->arena, count, sizeof(uint32_t)))) {
+			return -ENOMEM;
+		}
 
-	if (src_len < sizeof(*src)) {
-		return -ENOMSG;
-	}
+		for (i = 0; i < count; i++) {
+			((uint32_t*)*list)[i] = _wire_get(src + i * sizeof(uint32_t), sizeof(uint32_t));
+		}
 
-	if (src_len < (sizeof(*src) + src->len_values)) {
-		return -EBADMSG;
-	}
+		parsed = c->list_len;
+		break;
 
-	if (!(msg = calloc(1, sizeof(*msg)))) {
-		return -ENOMEM;
-	}
-
-	msg->im = src->im;
-
-	if ((parsed_len = decode_LISTofATTRIBUTE(&msg->values, src->values, src->len_values)) < 0) {
-		free(msg);
-		return parsed_len;
-	}
-
-	*dst = (xim_msg_t*)msg;
-	return parsed_len + sizeof(*src);
-}
-
-static int decode_XIM_GET_IC_VALUES(xim_msg_t **dst, const struct XIM_GET_IC_VALUES *src,
-                                    const size_t src_len)
-{
-	xim_msg_get_ic_values_t *msg;
-	int data_len;
-	int padded_len;
-	int i;
-
-	if (src_len < sizeof(*src)) {
-		return -ENOMSG;
-	}
-
-	data_len = sizeof(*src) + src->len_attrs;
-	padded_len = data_len + PAD(data_len);
-
-	if (src_len < data_len) {
-		return -EBADMSG;
-	}
-
-	if (!(msg = calloc(1, sizeof(*msg)))) {
-		return -ENOMEM;
-	}
-
-	msg->im = src->im;
-	msg->ic = src->ic;
-	msg->num_attrs = src->len_attrs / sizeof(uint16_t);
-
-	if (!(msg->attrs = calloc(msg->num_attrs, sizeof(int)))) {
-		free(msg);
-		return -ENOMEM;
-	}
-
-	for (i = 0; i < msg->num_attrs; i++) {
-		msg->attrs[i] = src->attrs[i];
-	}
-
-	*dst = (xim_msg_t*)msg;
-	return padded_len;
-}
-
-static int decode_XIM_SET_IC_VALUES(xim_msg_t **dst, const struct XIM_SET_IC_VALUES *src,
-                                    const size_t src_len)
-{
-	xim_msg_set_ic_values_t *msg;
-	int parsed_len;
-
-	if (!dst || !src) {
-		return -EINVAL;
-	}
-
-	if (src_len < sizeof(*src)) {
-		return -ENOMSG;
-	}
-
-	if (src_len < (sizeof(*src) + src->len_values)) {
-		return -EBADMSG;
-	}
-
-	if (!(msg = calloc(1, sizeof(*msg)))) {
-		return -ENOMEM;
-	}
-
-	msg->im = src->im;
-	msg->ic = src->ic;
-
-	if ((parsed_len = decode_LISTofATTRIBUTE(&msg->values, src->values, src->len_values)) < 0) {
-		free(msg);
-		return parsed_len;
-	}
-
-	*dst = (xim_msg_t*)msg;
-	return parsed_len + sizeof(*src);
-}
-
-static int decode_XIM_CREATE_IC(xim_msg_t **dst, const struct XIM_CREATE_IC *src,
-                                const size_t src_len)
-{
-	xim_msg_create_ic_t *msg;
-	int decoded_len;
-
-	if (src_len < sizeof(*src)) {
-		return -ENOMSG;
-	}
-
-	if (src_len < sizeof(*src) + src->len_values) {
-		return -EBADMSG;
-	}
-
-	if (!(msg = calloc(1, sizeof(*msg)))) {
-		return -ENOMEM;
-	}
-
-	msg->im = src->im;
-
-	if ((decoded_len = decode_LISTofATTRIBUTE(&msg->values, src->values, src->len_values)) < 0) {
-		free(msg);
-		return decoded_len;
-	}
-
-	for (msg->num_values = 0; msg->values[msg->num_values]; msg->num_values++);
-
-	*dst = (xim_msg_t*)msg;
-	return decoded_len + sizeof(*src);
-}
-
-static int decode_XIM_SET_IC_FOCUS(xim_msg_t **dst, const struct XIM_SET_IC_FOCUS *src,
-                                   const size_t src_len)
-{
-	xim_msg_set_ic_focus_t *msg;
-
-	if (src_len < sizeof(*src)) {
-		return -ENOMSG;
-	}
-
-	if (!(msg = calloc(1, sizeof(*msg)))) {
-		return -ENOMEM;
-	}
-
-	msg->im = src->im;
-	msg->ic = src->ic;
-
-	*dst = (xim_msg_t*)msg;
-	return sizeof(*src);
-}
-
-static int decode_XIM_UNSET_IC_FOCUS(xim_msg_t **dst, const struct XIM_UNSET_IC_FOCUS *src,
-                                     const size_t src_len)
-{
-	xim_msg_unset_ic_focus_t *msg;
-
-	if (src_len < sizeof(*src)) {
-		return -ENOMSG;
-	}
-
-	if (!(msg = calloc(1, sizeof(*msg)))) {
-		return -ENOMEM;
-	}
-
-	msg->im = src->im;
-	msg->ic = src->ic;
-
-	*dst = (xim_msg_t*)msg;
-	return sizeof(*src);
-}
-
-static int decode_XIM_DESTROY_IC(xim_msg_t **dst, const struct XIM_DESTROY_IC *src,
-                                 const size_t src_len)
-{
-	xim_msg_destroy_ic_t *msg;
-
-	if (src_len < sizeof(*src)) {
-		return -ENOMSG;
-	}
-
-	if (!(msg = calloc(1, sizeof(*msg)))) {
-		return -ENOMEM;
-	}
-
-	msg->im = src->im;
-	msg->ic = src->ic;
-
-	*dst = (xim_msg_t*)msg;
-	return sizeof(*src);
-}
-
-static int decode_XIM_SYNC(xim_msg_t **dst, const struct XIM_SYNC *src, const size_t src_len)
-{
-	xim_msg_sync_t *msg;
-
-	if (src_len < sizeof(*src)) {
-		return -ENOMSG;
-	}
-
-	if (!(msg = calloc(1, sizeof(*msg)))) {
-		return -ENOMEM;
-	}
-
-	msg->im = src->im;
-	msg->ic = src->ic;
-
-	*dst = (xim_msg_t*)msg;
-	return sizeof(*src);
-}
-
-static int decode_XIM_RESET_IC(xim_msg_t **dst, const struct XIM_RESET_IC *src, const size_t src_len)
-{
-	xim_msg_sync_reply_t *msg;
-
-	if (src_len < sizeof(*src)) {
-		return -ENOMSG;
-	}
-
-	if (!(msg = calloc(1, sizeof(*msg)))) {
-		return -ENOMEM;
-	}
-
-	msg->im = src->im;
-	msg->ic = src->ic;
-
-	*dst = (xim_msg_t*)msg;
-	return sizeof(*src);
-}
-
-static int decode_XIM_FORWARD_EVENT(xim_msg_t **dst, const struct XIM_FORWARD_EVENT *src,
-                                    const size_t src_len)
-{
-	xim_msg_forward_event_t *msg;
-
-	if (src_len < sizeof(*src)) {
-		return -ENOMSG;
-	}
-
-	if (!(msg = calloc(1, sizeof(*msg)))) {
-		return -ENOMEM;
-	}
-
-	msg->im = src->im;
-	msg->ic = src->ic;
-	msg->flags = src->flag;
-	msg->serial = src->serial;
-	memmove(&msg->event, &src->event, sizeof(msg->event));
-
-	*dst = (xim_msg_t*)msg;
-	return sizeof(*src);
-}
-
-int xim_msg_decode(xim_msg_t **dst, const uint8_t *src, const size_t src_len)
-{
-	struct XIM_PACKET *hdr;
-	xim_msg_t *msg;
-	int err;
-
-	hdr = (struct XIM_PACKET*)src;
-	msg = NULL;
-
-	if (need_more_data(hdr, src_len)) {
-		err = -EAGAIN;
-	} else {
-		switch (hdr->opcode_major) {
-		case XIM_ERROR:
-			fprintf(stderr, "Decoding XIM_ERROR\n");
-			err = decode_XIM_ERROR(&msg, (struct XIM_ERROR*)(hdr + 1),
-			                       src_len - sizeof(*hdr));
-			break;
-
-		case XIM_CONNECT:
-			fprintf(stderr, "Decoding XIM_CONNECT\n");
-			err = decode_XIM_CONNECT(&msg, (struct XIM_CONNECT*)(hdr + 1),
-			                         src_len - sizeof(*hdr));
-			break;
-
-		case XIM_DISCONNECT:
-			fprintf(stderr, "Decoding XIM_DISCONNECT\n");
-			/* no payload */
-			err = 0;
-			break;
-
-		case XIM_OPEN:
-			fprintf(stderr, "Decoding XIM_OPEN\n");
-			err = decode_XIM_OPEN(&msg, (struct XIM_OPEN*)(hdr + 1),
-			                      src_len - sizeof(*hdr));
-			break;
-
-		case XIM_CLOSE:
-			fprintf(stderr, "Decoding XIM_CLOSE\n");
-			err = decode_XIM_CLOSE(&msg, (struct XIM_CLOSE*)(hdr + 1),
-			                       src_len - sizeof(*hdr));
-			break;
-
-		case XIM_QUERY_EXTENSION:
-			fprintf(stderr, "Decoding XIM_QUERY_EXTENSION\n");
-			err = decode_XIM_QUERY_EXTENSION(&msg, (struct XIM_QUERY_EXTENSION*)(hdr + 1),
-			                                 src_len - sizeof(*hdr));
-			break;
-
-		case XIM_ENCODING_NEGOTIATION:
-			fprintf(stderr, "Decoding XIM_ENCODING_NEGOTIATION\n");
-			err = decode_XIM_ENCODING_NEGOTIATION(&msg,
-			                                      (struct XIM_ENCODING_NEGOTIATION*)(hdr + 1),
-			                                      src_len - sizeof(*hdr));
-			break;
-
-		case XIM_GET_IM_VALUES:
-			fprintf(stderr, "Decoding XIM_GET_IM_VALUES\n");
-			err = decode_XIM_GET_IM_VALUES(&msg, (struct XIM_GET_IM_VALUES*)(hdr + 1),
-			                               src_len - sizeof(*hdr));
-			break;
-
-		case XIM_SET_IM_VALUES:
-			fprintf(stderr, "Decoding XIM_SET_IM_VALUES\n");
-			err = decode_XIM_SET_IM_VALUES(&msg, (struct XIM_SET_IM_VALUES*)(hdr + 1),
-			                               src_len - sizeof(*hdr));
-			break;
-
-		case XIM_GET_IC_VALUES:
-			fprintf(stderr, "Decoding XIM_GET_IC_VALUES\n");
-			err = decode_XIM_GET_IC_VALUES(&msg, (struct XIM_GET_IC_VALUES*)(hdr + 1),
-			                               src_len - sizeof(*hdr));
-			break;
-
-		case XIM_SET_IC_VALUES:
-			fprintf(stderr, "Decoding XIM_SET_IC_VALUES\n");
-			err = decode_XIM_SET_IC_VALUES(&msg, (struct XIM_SET_IC_VALUES*)(hdr + 1),
-			                               src_len - sizeof(*hdr));
-			break;
-
-		case XIM_CREATE_IC:
-			fprintf(stderr, "Decoding XIM_CREATE_IC\n");
-			err = decode_XIM_CREATE_IC(&msg, (struct XIM_CREATE_IC*)(hdr + 1),
-			                           src_len - sizeof(*hdr));
-			break;
-
-		case XIM_SET_IC_FOCUS:
-			fprintf(stderr, "Decoding XIM_SET_IC_FOCUS\n");
-			err = decode_XIM_SET_IC_FOCUS(&msg, (struct XIM_SET_IC_FOCUS*)(hdr + 1),
-			                              src_len - sizeof(*hdr));
-			break;
-
-		case XIM_UNSET_IC_FOCUS:
-			fprintf(stderr, "Decoding XIM_UNSET_IC_FOCUS\n");
-			err = decode_XIM_UNSET_IC_FOCUS(&msg, (struct XIM_UNSET_IC_FOCUS*)(hdr + 1),
-			                                src_len - sizeof(*hdr));
-			break;
-
-		case XIM_DESTROY_IC:
-			fprintf(stderr, "Decoding XIM_DESTROY_IC\n");
-			err = decode_XIM_DESTROY_IC(&msg, (struct XIM_DESTROY_IC*)(hdr + 1),
-			                            src_len - sizeof(*hdr));
-			break;
-
-		case XIM_SYNC:
-		case XIM_SYNC_REPLY:
-			fprintf(stderr, "Decoding XIM_SYNC%s\n",
-			        hdr->opcode_major == XIM_SYNC_REPLY ? "_REPLY" : "");
-			err = decode_XIM_SYNC(&msg, (struct XIM_SYNC*)(hdr + 1),
-			                      src_len - sizeof(*hdr));
-			break;
-
-		case XIM_RESET_IC:
-			fprintf(stderr, "Decoding XIM_RESET_IC\n");
-			err = decode_XIM_RESET_IC(&msg, (struct XIM_RESET_IC*)(hdr + 1),
-			                          src_len - sizeof(*hdr));
-			break;
-
-		case XIM_FORWARD_EVENT:
-			fprintf(stderr, "Decoding XIM_FORWARD_EVENT\n");
-			err = decode_XIM_FORWARD_EVENT(&msg, (struct XIM_FORWARD_EVENT*)(hdr + 1),
-			                               src_len - sizeof(*hdr));
-			break;
-
-		default:
-			fprintf(stderr, "Decoding of %hhu type message not implemented\n",
-			        hdr->opcode_major);
-			err = -ENOSYS;
-			break;
-		}
-
-		if (err >= 0) {
-			msg->type = hdr->opcode_major;
-			msg->subtype = hdr->opcode_minor;
-			msg->length = hdr->length * 4;
-
-			err += sizeof(*hdr);
-			*dst = msg;
-		}
-	}
-
-	return err;
-}
-
-int xim_msg_new(xim_msg_t **msg, const xim_msg_type_t type)
-{
-	xim_msg_t *m;
-
-	if (!msg) {
-		return -EINVAL;
-	}
-
-	if (!(m = calloc(1, _msg_info[type].size))) {
-		return -ENOMEM;
-	}
-
-	m->type = type;
-	m->subtype = 0;
-
-	*msg = m;
-	return 0;
-}
-
-static int encode_XIM_ERROR(xim_msg_error_t *src, uint8_t *dst, const size_t dst_size)
-{
-	struct XIM_ERROR *raw;
-	int data_len;
-	int padded_len;
-	int padding_len;
-
-	if (!src || !dst) {
-		return -EINVAL;
-	}
-
-	data_len = sizeof(*raw) + src->detail_len;
-	padding_len = PAD(data_len);
-	padded_len = data_len + padding_len;
-
-	if (dst_size < padded_len) {
-		return -EMSGSIZE;
-	}
-
-	raw = (struct XIM_ERROR*)dst;
-	raw->im = src->im;
-	raw->ic = src->ic;
-	raw->flag = src->flags;
-	raw->error_code = src->error;
-	raw->detail_len = src->detail_len;
-	raw->detail_type = src->detail_type;
-	memmove(raw->detail, src->detail, src->detail_len);
-	memset(raw->detail + src->detail_len, 0, padding_len);
-
-	return padded_len;
-}
-
-static int encode_XIM_CONNECT_REPLY(xim_msg_connect_reply_t *src, uint8_t *dst, const size_t dst_size)
-{
-	struct XIM_CONNECT_REPLY *raw;
-
-	if (!src || !dst) {
-		return -EINVAL;
-	}
-
-	if (dst_size < sizeof(*raw)) {
-		return -EMSGSIZE;
-	}
-
-	raw = (struct XIM_CONNECT_REPLY*)dst;
-	raw->server_ver.major = src->server_ver.major;
-	raw->server_ver.minor = src->server_ver.minor;
-
-	return sizeof(*raw);
-}
-
-static int encode_XIM_OPEN_REPLY(xim_msg_open_reply_t *src, uint8_t *dst, const size_t dst_size)
-{
-	struct XIM_OPEN_REPLY *raw;
-	size_t required_size;
-	uint16_t num_imattrs;
-	uint16_t len_imattrs;
-	uint16_t num_icattrs;
-	uint16_t len_icattrs;
-	int encoded_len;
-	int i;
-
-	if (!src || !dst) {
-		return -EINVAL;
-	}
-
-	required_size = 4 * sizeof(uint16_t);
-	num_imattrs = num_icattrs = 0;
-	len_imattrs = len_icattrs = 0;
-
-	if (src->im_attrs) {
-		for (i = 0; src->im_attrs[i]; i++) {
-			size_t attr_len;
-
-			fprintf(stderr, "XIMATTR: %s\n", src->im_attrs[i]->name);
-			attr_len = 6 + strlen(src->im_attrs[i]->name);
-			required_size += attr_len + PAD(attr_len);
-			num_imattrs++;
-			len_imattrs += attr_len + PAD(attr_len);
-		}
-	}
-
-	if (src->ic_attrs) {
-		for (i = 0; src->ic_attrs[i]; i++) {
-			size_t attr_len;
-
-			fprintf(stderr, "XICATTR: %s\n", src->ic_attrs[i]->name);
-			attr_len = 6 + strlen(src->ic_attrs[i]->name);
-			required_size += attr_len + PAD(attr_len);
-			num_icattrs++;
-			len_icattrs += attr_len + PAD(attr_len);
-		}
-	}
-
-	if (dst_size < required_size) {
-		return -EMSGSIZE;
-	}
-
-	raw = (struct XIM_OPEN_REPLY*)dst;
-	raw->im_id = src->id;
-	*(uint16_t*)(raw + 1) = len_imattrs;
-	encoded_len = sizeof(*raw) + sizeof(uint16_t);
-
-	for (i = 0; i < num_imattrs; i++) {
-		int len;
-
-		if ((len = encode_ATTR(src->im_attrs[i],
-		                       dst + encoded_len,
-		                       dst_size - encoded_len)) < 0) {
-			return len;
-		}
-		encoded_len += len;
-	}
-
-	*(uint16_t*)(dst + encoded_len + 0) = len_icattrs;
-	*(uint16_t*)(dst + encoded_len + 2) = 0;
-	encoded_len += 4;
-
-	for (i = 0; i < num_icattrs; i++) {
-		int len;
-
-		if ((len = encode_ATTR(src->ic_attrs[i],
-		                       dst + encoded_len,
-		                       dst_size - encoded_len)) < 0) {
-			return len;
+	case FIELD_ATTRIBUTES:
+		if ((parsed = decode_LISTofATTRIBUTE((attr_value_t***)list, src, c->list_len,
+		                                     c->arena)) < 0) {
+			return parsed;
 		}
-		encoded_len += len;
-	}
-
-	return encoded_len;
-}
-
-static int encode_XIM_CLOSE_REPLY(xim_msg_close_reply_t *src, uint8_t *dst, const size_t dst_size)
-{
-	struct XIM_CLOSE_REPLY *raw;
-
-	if (!src || !dst) {
-		return -EINVAL;
-	}
-
-	if (dst_size < sizeof(*raw)) {
-		return -ENOMEM;
-	}
-
-	raw = (struct XIM_CLOSE_REPLY*)dst;
-	raw->im = src->im;
-
-	return sizeof(*raw);
-}
-
-static int encode_XIM_QUERY_EXTENSION_REPLY(xim_msg_query_extension_reply_t *src,
-                                            uint8_t *dst, const size_t dst_size)
-{
-	struct XIM_QUERY_EXTENSION_REPLY *raw;
-	int len_exts;
-	int i;
-
-	if (!src || !dst) {
-		return -EINVAL;
-	}
-
-	if (dst_size < sizeof(*raw)) {
-		return -ENOMEM;
-	}
-
-	raw = (struct XIM_QUERY_EXTENSION_REPLY*)dst;
-	raw->im = src->im;
-	len_exts = 0;
-
-	if (src->exts) {
-		for (i = 0; src->exts[i].name; i++) {
-			int ext_len;
-
-			if ((ext_len = encode_EXT(&src->exts[i], raw->exts + len_exts,
-			                          dst_size - sizeof(*raw) - len_exts)) < 0) {
-				return ext_len;
-			}
-
-			len_exts += ext_len;
-		}
-	}
-	raw->exts_len = len_exts;
-
-	return len_exts + sizeof(*raw);
-}
-
-static int encode_XIM_ENCODING_NEGOTIATION_REPLY(xim_msg_encoding_negotiation_reply_t *src,
-                                                 uint8_t *dst, const size_t dst_size)
-{
-	struct XIM_ENCODING_NEGOTIATION_REPLY *raw;
-
-	if (!src || !dst) {
-		return -EINVAL;
-	}
-
-	if (dst_size < sizeof(*raw)) {
-		return -ENOMEM;
-	}
-
-	raw = (struct XIM_ENCODING_NEGOTIATION_REPLY*)dst;
-	raw->im = src->im;
-	raw->category = src->category;
-	raw->encoding = src->encoding;
-	raw->unused = 0;
-
-	return sizeof(*raw);
-}
-
-static int encode_XIM_GET_IM_VALUES_REPLY(xim_msg_get_im_values_reply_t *src,
-                                          uint8_t *dst, const size_t dst_size)
-{
-	struct XIM_GET_IM_VALUES_REPLY *raw;
-	int required_size;
-	int encoded_len;
-	int i;
-
-	if (!src || !dst) {
-		return -EINVAL;
-	}
 
-	if (!src->values && src->num_values > 0) {
-		return -EBADMSG;
-	}
+		while (((attr_value_t**)*list)[count]) {
+			count++;
+		}
 
-	required_size = sizeof(*raw);
-	for (i = 0; i < src->num_values; i++) {
-		int value_len;
+		parsed = c->list_len;
+		break;
 
-		value_len = sizeof(uint16_t) + sizeof(uint16_t) + src->values[i]->len;
-		required_size += value_len + PAD(value_len);
+	default:
+		return -ENOSYS;
 	}
 
-	if (dst_size < required_size) {
-		return -EMSGSIZE;
+	if (aux >= 0 && type != FIELD_DATA && type != FIELD_CTEXT) {
+		*(int*)(msg + aux) = count;
 	}
 
-	raw = (struct XIM_GET_IM_VALUES_REPLY*)dst;
-	raw->im = src->im;
-	encoded_len = sizeof(*raw);
-	for (i = 0; i < src->num_values; i++) {
-		int value_len;
+	c->offset += parsed;
+	return 0;
+}
 
-		value_len = encode_ATTRIBUTE(src->values[i], dst + encoded_len,
-		                             dst_size - encoded_len);
+/*
+ * Decodes one field. This is called with a constant type and sizes from
+ * the generated functions, so that each call is reduced to the code for
+ * that one field.
+ */
+static inline __attribute__((always_inline))
+int _decode_field(struct codec *c, const field_type_t type, uint8_t *msg,
+                  const size_t offset, const size_t size, const int aux)
+{
+	size_t wire_size;
+	int parsed;
+
+	switch (type) {
+	case FIELD_CARD8:
+	case FIELD_CARD16:
+	case FIELD_CARD32:
+	case FIELD_LEN16:
+	case FIELD_LEN32:
+		wire_size = type == FIELD_CARD8 ? 1 :
+		            type == FIELD_CARD32 || type == FIELD_LEN32 ? 4 : 2;
+
+		if (c->size - c->offset < wire_size) {
+			return -EBADMSG;
+		}
 
-		if (value_len < 0) {
-			return value_len;
+		if (type == FIELD_LEN16 || type == FIELD_LEN32) {
+			c->list_len = _wire_get(c->data + c->offset, wire_size);
+		} else {
+			_member_set(msg + offset, size, _wire_get(c->data + c->offset, wire_size));
 		}
 
-		encoded_len += value_len;
-	}
+		c->offset += wire_size;
+		return 0;
 
-	raw->len_values = encoded_len - sizeof(*raw);
+	case FIELD_UNUSED:
+	case FIELD_ALIGN:
+	case FIELD_BYTES:
+		wire_size = type == FIELD_UNUSED ? aux :
+		            type == FIELD_ALIGN ? PAD(c->offset) : size;
 
-	return encoded_len;
-}
+		if (c->size - c->offset < wire_size) {
+			return -EBADMSG;
+		}
 
-static int encode_XIM_SET_IM_VALUES_REPLY(xim_msg_set_im_values_reply_t *src,
-                                          uint8_t *dst, const size_t dst_size)
-{
-	struct XIM_SET_IM_VALUES_REPLY *raw;
+		if (type == FIELD_BYTES) {
+			memcpy(msg + offset, c->data + c->offset, size);
+		}
 
-	if (!src || !dst) {
-		return -EINVAL;
-	}
+		c->offset += wire_size;
+		return 0;
 
-	if (dst_size < sizeof(*raw)) {
-		return -EMSGSIZE;
-	}
+	case FIELD_STR:
+		if ((parsed = decode_STR((char**)(msg + offset), c->data + c->offset,
+		                         c->size - c->offset, c->arena)) < 0) {
+			return parsed;
+		}
 
-	raw = (struct XIM_SET_IM_VALUES_REPLY*)dst;
-	raw->im = src->im;
-	raw->unused = 0;
+		c->offset += parsed;
+		return 0;
 
-	return sizeof(*raw);
+	default:
+		return _decode_list(c, type, msg, offset, aux);
+	}
 }
 
-static int encode_XIM_GET_IC_VALUES_REPLY(xim_msg_get_ic_values_reply_t *src,
-                                          uint8_t *dst, const size_t dst_size)
+static int _encode_list(struct codec *c, const field_type_t type, const uint8_t *msg,
+                        const size_t offset, const int aux)
 {
-	struct XIM_GET_IC_VALUES_REPLY *raw;
-	int required_size;
-	int encoded_len;
+	const void *list;
+	uint8_t *dst;
+	size_t dst_size;
+	int encoded;
+	int count;
 	int i;
 
-	if (!src || !dst) {
-		return -EINVAL;
-	}
-
-	if (!src->values && src->num_values > 0) {
-		return -EBADMSG;
-	}
+	list = *(const void* const*)(msg + offset);
+	count = aux >= 0 ? *(const int*)(msg + aux) : INT_MAX;
+	dst = c->data + c->offset;
+	dst_size = c->size - c->offset;
+	encoded = 0;
 
-	required_size = sizeof(*raw);
-	for (i = 0; i < src->num_values; i++) {
-		int value_len;
+	switch (type) {
+	case FIELD_SKIP:
+		return 0;
 
-		value_len = sizeof(uint16_t) + sizeof(uint16_t) + src->values[i]->len;
-		required_size += value_len + PAD(value_len);
-	}
+	case FIELD_DATA:
+		encoded = *(const size_t*)(msg + aux);
 
-	if (dst_size < required_size) {
-		return -EMSGSIZE;
-	}
+		if (dst_size < encoded) {
+			return -EMSGSIZE;
+		}
 
-	raw = (struct XIM_GET_IC_VALUES_REPLY*)dst;
-	raw->im = src->im;
-	raw->ic = src->ic;
-	encoded_len = sizeof(*raw);
-	for (i = 0; i < src->num_values; i++) {
-		int value_len;
+		memcpy(dst, list, encoded);
+		return encoded;
 
-		value_len = encode_ATTRIBUTE(src->values[i], dst + encoded_len,
-		                             dst_size - encoded_len);
+	case FIELD_CTEXT:
+		/* an empty string is sent without header and trailer */
+		if ((encoded = *(const size_t*)(msg + aux)) == 0) {
+			return 0;
+		}
 
-		if (value_len < 0) {
-			return value_len;
+		if (dst_size < sizeof(_ct_header) + encoded + CT_TRAILER_LEN) {
+			return -EMSGSIZE;
 		}
 
-		encoded_len += value_len;
-	}
+		memcpy(dst, _ct_header, sizeof(_ct_header));
+		memcpy(dst + sizeof(_ct_header), list, encoded);
+		memcpy(dst + sizeof(_ct_header) + encoded, _ct_trailer, CT_TRAILER_LEN);
+		return sizeof(_ct_header) + encoded + CT_TRAILER_LEN;
 
-	raw->len_values = encoded_len - sizeof(*raw);
+	case FIELD_CARD16S:
+	case FIELD_CARD32S:
+		encoded = type == FIELD_CARD16S ? sizeof(uint16_t) : sizeof(uint32_t);
 
-	return encoded_len;
-}
+		if (count < 0 || dst_size / encoded < count) {
+			return -EMSGSIZE;
+		}
 
-static int encode_XIM_SET_IC_VALUES_REPLY(xim_msg_set_ic_values_reply_t *src,
-                                          uint8_t *dst, const size_t dst_size)
-{
-	struct XIM_SET_IC_VALUES_REPLY *raw;
+		for (i = 0; i < count; i++) {
+			_wire_put(dst + i * encoded, encoded,
+			          type == FIELD_CARD16S ?
+			          (uint32_t)((const int*)list)[i] : ((const uint32_t*)list)[i]);
+		}
 
-	if (!src || !dst) {
-		return -EINVAL;
-	}
+		return count * encoded;
 
-	if (dst_size < sizeof(*raw)) {
-		return -EMSGSIZE;
+	case FIELD_ATTRS:
+	case FIELD_ATTRIBUTES:
+	case FIELD_EXTS:
+	case FIELD_TRIGGERKEYS:
+		break;
+
+	default:
+		return -ENOSYS;
 	}
 
-	raw = (struct XIM_SET_IC_VALUES_REPLY*)dst;
-	raw->im = src->im;
-	raw->ic = src->ic;
+	for (i = 0; list && i < count; i++) {
+		int item_len;
 
-	return sizeof(*raw);
-}
+		switch (type) {
+		case FIELD_ATTRS:
+			if (!((attr_t* const*)list)[i]) {
+				return encoded;
+			}
 
-static int encode_XIM_CREATE_IC_REPLY(xim_msg_create_ic_reply_t *src, uint8_t *dst, const size_t dst_size)
-{
-	struct XIM_CREATE_IC_REPLY *raw;
+			item_len = encode_ATTR(((attr_t* const*)list)[i],
+			                       dst + encoded, dst_size - encoded);
+			break;
 
-	if (!src || !dst) {
-		return -EINVAL;
-	}
+		case FIELD_ATTRIBUTES:
+			if (!((attr_value_t* const*)list)[i]) {
+				return encoded;
+			}
 
-	if (dst_size < sizeof(*raw)) {
-		return -ENOMEM;
-	}
+			item_len = encode_ATTRIBUTE(((attr_value_t* const*)list)[i],
+			                            dst + encoded, dst_size - encoded);
+			break;
 
-	raw = (struct XIM_CREATE_IC_REPLY*)dst;
-	raw->im = src->im;
-	raw->ic = src->ic;
+		case FIELD_EXTS:
+			if (!((const ext_t*)list)[i].name) {
+				return encoded;
+			}
 
-	return sizeof(*raw);
-}
+			item_len = encode_EXT(&((const ext_t*)list)[i],
+			                      dst + encoded, dst_size - encoded);
+			break;
 
-static int encode_XIM_DESTROY_IC_REPLY(xim_msg_destroy_ic_reply_t *src, uint8_t *dst, const size_t dst_size)
-{
-	struct XIM_DESTROY_IC_REPLY *raw;
+		default:
+			item_len = encode_TRIGGERKEY(&((const trigger_key_t*)list)[i],
+			                             dst + encoded, dst_size - encoded);
+			break;
+		}
 
-	if (!src || !dst) {
-		return -EINVAL;
-	}
+		if (item_len < 0) {
+			return item_len;
+		}
 
-	if (dst_size < sizeof(*raw)) {
-		return -ENOMEM;
+		encoded += item_len;
 	}
 
-	raw = (struct XIM_DESTROY_IC_REPLY*)dst;
-	raw->im = src->im;
-	raw->ic = src->ic;
-
-	return sizeof(*raw);
+	return encoded;
 }
 
-static int encode_XIM_SYNC_REPLY(xim_msg_sync_reply_t *src, uint8_t *dst, const size_t dst_size)
+/* Encodes one field, the counterpart of _decode_field() */
+static inline __attribute__((always_inline))
+int _encode_field(struct codec *c, const field_type_t type, const uint8_t *msg,
+                  const size_t offset, const size_t size, const int aux)
 {
-	struct XIM_SYNC_REPLY *raw;
+	const char *str;
+	size_t wire_size;
+	int encoded;
+
+	switch (type) {
+	case FIELD_CARD8:
+	case FIELD_CARD16:
+	case FIELD_CARD32:
+	case FIELD_LEN16:
+	case FIELD_LEN32:
+		wire_size = type == FIELD_CARD8 ? 1 :
+		            type == FIELD_CARD32 || type == FIELD_LEN32 ? 4 : 2;
+
+		if (c->size - c->offset < wire_size) {
+			return -EMSGSIZE;
+		}
 
-	if (!src || !dst) {
-		return -EINVAL;
-	}
+		if (type == FIELD_LEN16 || type == FIELD_LEN32) {
+			/* filled in after the list was encoded */
+			c->len_offset = c->offset;
+			c->len_size = wire_size;
+		} else {
+			_wire_put(c->data + c->offset, wire_size, _member_get(msg + offset, size));
+		}
 
-	if (dst_size < sizeof(*raw)) {
-		return -EMSGSIZE;
-	}
+		c->offset += wire_size;
+		return 0;
 
-	raw = (struct XIM_SYNC_REPLY*)dst;
-	raw->im = src->im;
-	raw->ic = src->ic;
+	case FIELD_UNUSED:
+	case FIELD_ALIGN:
+	case FIELD_BYTES:
+		wire_size = type == FIELD_UNUSED ? aux :
+		            type == FIELD_ALIGN ? PAD(c->offset) : size;
 
-	return sizeof(*raw);
-}
+		if (c->size - c->offset < wire_size) {
+			return -EMSGSIZE;
+		}
 
-static int encode_XIM_RESET_IC_REPLY(xim_msg_reset_ic_reply_t *src, uint8_t *dst, const size_t dst_size)
-{
-	struct XIM_RESET_IC_REPLY *raw;
-	int encoded_len;
-	int padding_len;
-	int padded_len;
+		if (type == FIELD_BYTES) {
+			memcpy(c->data + c->offset, msg + offset, size);
+		} else {
+			memset(c->data + c->offset, 0, wire_size);
+		}
 
-	if (!src || !dst) {
-		return -EINVAL;
-	}
+		c->offset += wire_size;
+		return 0;
 
-	encoded_len = sizeof(*raw) + src->preedit.len;
-	padding_len = PAD(encoded_len);
-	padded_len = encoded_len + padding_len;
+	case FIELD_STR:
+		str = *(const char* const*)(msg + offset);
+		wire_size = strlen(str);
 
-	if (dst_size < padded_len) {
-		return -EMSGSIZE;
-	}
+		if (wire_size > UINT8_MAX || c->size - c->offset < wire_size + 1) {
+			return -EMSGSIZE;
+		}
 
-	raw = (struct XIM_RESET_IC_REPLY*)dst;
-	raw->im = src->im;
-	raw->ic = src->ic;
-	raw->len_preedit = src->preedit.len;
-	memmove(raw->preedit, src->preedit.data, src->preedit.len);
-	memset(raw->preedit + src->preedit.len, 0, padding_len);
+		c->data[c->offset] = wire_size;
+		memcpy(c->data + c->offset + 1, str, wire_size);
+		c->offset += wire_size + 1;
+		return 0;
 
-	return padded_len;
-}
+	default:
+		if ((encoded = _encode_list(c, type, msg, offset, aux)) < 0) {
+			return encoded;
+		}
 
-static int encode_COMPOUND_TEXT(char **dst, const char *utf8, const size_t utf8_len)
-{
-	static const uint8_t ct_header[]  = { 0x1B, 0x25, 0x47 };
-	static const uint8_t ct_trailer[] = { 0x1B, 0x25, 0x40 };
-	char *ct;
-	size_t ct_len;
+		if (c->len_size > 0) {
+			if (c->len_size == sizeof(uint16_t) && encoded > UINT16_MAX) {
+				return -EMSGSIZE;
+			}
+
+			_wire_put(c->data + c->len_offset, c->len_size, encoded);
+			c->len_size = 0;
+		}
 
-	if (SIZE_MAX - sizeof(ct_header) - sizeof(ct_trailer) < utf8_len ||
-	    utf8_len + sizeof(ct_header) + sizeof(ct_trailer) > INT_MAX) {
-		return -EOVERFLOW;
+		c->offset += encoded;
+		return 0;
 	}
+}
 
-	ct_len = sizeof(ct_header) + utf8_len + sizeof(ct_trailer);
+#define MEMBER_SIZE(t, m) sizeof(((t*)0)->m)
+
+#define DECODE_FIELD(t, kind, member, aux)                                       \
+	if ((err = _decode_field(&c, FIELD_##kind, (uint8_t*)msg, offsetof(t, member), \
+	                         MEMBER_SIZE(t, member), (aux))) < 0) {          \
+		return err;                                                      \
+	}
+
+#define ENCODE_FIELD(t, kind, member, aux)                                       \
+	if ((err = _encode_field(&c, FIELD_##kind, (const uint8_t*)msg,         \
+	                         offsetof(t, member), MEMBER_SIZE(t, member),    \
+	                         (aux))) < 0) {                                  \
+		return err;                                                      \
+	}
+
+/* Generates the decoder and the encoder of a message from its layout */
+#define CODEC(type, t)                                                           \
+	static int decode_##type(xim_msg_t *msg, const uint8_t *src,            \
+	                         const size_t src_len, arena_t *arena)          \
+	{                                                                        \
+		struct codec c = {                                               \
+			.data = (uint8_t*)src,                                   \
+			.size = src_len,                                         \
+			.arena = arena                                           \
+		};                                                               \
+		int err;                                                         \
+                                                                                 \
+		type##_LAYOUT(DECODE_FIELD, t)                                   \
+		return c.offset;                                                 \
+	}                                                                        \
+                                                                                 \
+	static int encode_##type(const xim_msg_t *msg, uint8_t *dst,            \
+	                         const size_t dst_size)                         \
+	{                                                                        \
+		struct codec c = {                                               \
+			.data = dst,                                             \
+			.size = dst_size                                         \
+		};                                                               \
+		int err;                                                         \
+                                                                                 \
+		type##_LAYOUT(ENCODE_FIELD, t)                                   \
+		return c.offset;                                                 \
+	}
+
+CODEC(XIM_ERROR, xim_msg_error_t)
+CODEC(XIM_CONNECT, xim_msg_connect_t)
+CODEC(XIM_CONNECT_REPLY, xim_msg_connect_reply_t)
+CODEC(XIM_OPEN, xim_msg_open_t)
+CODEC(XIM_OPEN_REPLY, xim_msg_open_reply_t)
+CODEC(XIM_CLOSE, xim_msg_close_t)
+CODEC(XIM_CLOSE_REPLY, xim_msg_close_reply_t)
+CODEC(XIM_REGISTER_TRIGGERKEYS, xim_msg_register_triggerkeys_t)
+CODEC(XIM_TRIGGER_NOTIFY, xim_msg_trigger_notify_t)
+CODEC(XIM_TRIGGER_NOTIFY_REPLY, xim_msg_trigger_notify_reply_t)
+CODEC(XIM_SET_EVENT_MASK, xim_msg_set_event_mask_t)
+CODEC(XIM_ENCODING_NEGOTIATION, xim_msg_encoding_negotiation_t)
+CODEC(XIM_ENCODING_NEGOTIATION_REPLY, xim_msg_encoding_negotiation_reply_t)
+CODEC(XIM_QUERY_EXTENSION, xim_msg_query_extension_t)
+CODEC(XIM_QUERY_EXTENSION_REPLY, xim_msg_query_extension_reply_t)
+CODEC(XIM_SET_IM_VALUES, xim_msg_set_im_values_t)
+CODEC(XIM_SET_IM_VALUES_REPLY, xim_msg_set_im_values_reply_t)
+CODEC(XIM_GET_IM_VALUES, xim_msg_get_im_values_t)
+CODEC(XIM_GET_IM_VALUES_REPLY, xim_msg_get_im_values_reply_t)
+CODEC(XIM_CREATE_IC, xim_msg_create_ic_t)
+CODEC(XIM_CREATE_IC_REPLY, xim_msg_create_ic_reply_t)
+CODEC(XIM_DESTROY_IC, xim_msg_destroy_ic_t)
+CODEC(XIM_DESTROY_IC_REPLY, xim_msg_destroy_ic_reply_t)
+CODEC(XIM_SET_IC_VALUES, xim_msg_set_ic_values_t)
+CODEC(XIM_SET_IC_VALUES_REPLY, xim_msg_set_ic_values_reply_t)
+CODEC(XIM_GET_IC_VALUES, xim_msg_get_ic_values_t)
+CODEC(XIM_GET_IC_VALUES_REPLY, xim_msg_get_ic_values_reply_t)
+CODEC(XIM_SET_IC_FOCUS, xim_msg_set_ic_focus_t)
+CODEC(XIM_UNSET_IC_FOCUS, xim_msg_unset_ic_focus_t)
+CODEC(XIM_FORWARD_EVENT, xim_msg_forward_event_t)
+CODEC(XIM_SYNC, xim_msg_sync_t)
+CODEC(XIM_SYNC_REPLY, xim_msg_sync_reply_t)
+CODEC(XIM_RESET_IC, xim_msg_reset_ic_t)
+CODEC(XIM_RESET_IC_REPLY, xim_msg_reset_ic_reply_t)
+CODEC(XIM_PREEDIT_START, xim_msg_preedit_start_t)
+CODEC(XIM_PREEDIT_START_REPLY, xim_msg_preedit_start_reply_t)
+CODEC(XIM_PREEDIT_DRAW, xim_msg_preedit_draw_t)
+CODEC(XIM_PREEDIT_CARET, xim_msg_preedit_caret_t)
+CODEC(XIM_PREEDIT_CARET_REPLY, xim_msg_preedit_caret_reply_t)
+CODEC(XIM_PREEDIT_DONE, xim_msg_preedit_done_t)
+
+static ssize_t iov_len(const struct iovec *iov, const int iovcnt)
+{
+	ssize_t len;
+	int i;
 
-	if (!(ct = malloc(ct_len))) {
-		return -ENOMEM;
-	}
+	for (len = i = 0; i < iovcnt; i++) {
+		if (iov[i].iov_len > SSIZE_MAX - len) {
+			return -EOVERFLOW;
+		}
 
-	memcpy(ct, ct_header, sizeof(ct_header));
-	memcpy(ct + sizeof(ct_header), utf8, utf8_len);
-	memcpy(ct + sizeof(ct_header) + utf8_len, ct_trailer, sizeof(ct_trailer));
+		len += iov[i].iov_len;
+	}
 
-	*dst = ct;
-	return (int)ct_len;
+	return len;
 }
 
-static int encode_XIM_COMMIT(xim_msg_commit_t *src, uint8_t *dst, const size_t dst_size)
+/*
+ * Encodes the XIM_COMMIT message up to and including the compound text
+ * header. The length of the string and the padding are returned through
+ * string_len and padding_len.
+ */
+static int encode_XIM_COMMIT_head(xim_msg_commit_t *src, uint8_t *dst, const size_t dst_size,
+                                  size_t *string_len, int *padding_len)
 {
 	struct XIM_COMMIT *raw;
+	ssize_t utf8_len;
+	size_t ct_len;
+	int head_len;
 	int encoded_len;
-	int padding_len;
-	int padded_len;
-	int ct_len;
-	char *ct;
-
-	if (!src || !dst) {
-		return -EINVAL;
-	}
 
-	ct = NULL;
-	if ((ct_len = encode_COMPOUND_TEXT(&ct, src->string.data, src->string.len)) < 0) {
-		return ct_len;
-	}
+	ct_len = 0;
+	*string_len = 0;
 
 	raw = (struct XIM_COMMIT*)dst;
-	encoded_len = sizeof(uint16_t) * 3;
+	head_len = sizeof(uint16_t) * 3;
 
 	if (src->flags & XIM_COMMIT_FLAG_KEYSYM) {
-		encoded_len += sizeof(raw->data.keysym);
+		head_len += sizeof(raw->data.keysym);
 	}
 	if (src->flags & XIM_COMMIT_FLAG_CHARS) {
-		encoded_len += sizeof(raw->data.chars) + ct_len;
+		if ((utf8_len = iov_len(src->string.iov, src->string.iovcnt)) < 0) {
+			return utf8_len;
+		}
+
+		ct_len = sizeof(_ct_header) + utf8_len + CT_TRAILER_LEN;
+
+		/* the length of the string and that of the message are 16 bits */
+		if (ct_len > UINT16_MAX || ct_len > XIM_MSG_MAX_SIZE - 4 - 16) {
+			return -EMSGSIZE;
+		}
+
+		head_len += sizeof(raw->data.chars) + sizeof(_ct_header);
+		*string_len = utf8_len;
 	}
-	padding_len = PAD(encoded_len);
-	padded_len = encoded_len + padding_len;
 
-	if (dst_size < padded_len) {
-		free(ct);
+	if (dst_size < head_len) {
 		return -EMSGSIZE;
 	}
 
+	encoded_len = head_len + *string_len + (ct_len ? CT_TRAILER_LEN : 0);
+	*padding_len = PAD(encoded_len);
+
 	raw->im = src->im;
 	raw->ic = src->ic;
 	raw->flag = src->flags;
@@ -1681,201 +953,287 @@ static int encode_XIM_COMMIT(xim_msg_commit_t *src, uint8_t *dst, const size_t d
 		if (src->flags & XIM_COMMIT_FLAG_KEYSYM) {
 			/* have KeySym *AND* Chars */
 			raw->data.both.len_string = ct_len;
-			memmove(raw->data.both.string, ct, ct_len);
-			memset(raw->data.both.string + ct_len, 0, padding_len);
+			memcpy(raw->data.both.string, _ct_header, sizeof(_ct_header));
 		} else {
 			raw->data.chars.len_string = ct_len;
-			memmove(raw->data.chars.string, ct, ct_len);
-			memset(raw->data.chars.string + ct_len, 0, padding_len);
+			memcpy(raw->data.chars.string, _ct_header, sizeof(_ct_header));
 		}
 	}
 
-	free(ct);
-
-	return padded_len;
+	return head_len;
 }
 
-static int encode_XIM_FORWARD_EVENT(xim_msg_forward_event_t *src, uint8_t *dst, const size_t dst_size)
+static int encode_XIM_COMMIT(const xim_msg_t *msg, uint8_t *dst, const size_t dst_size)
 {
-	struct XIM_FORWARD_EVENT *raw;
+	xim_msg_commit_t *src;
+	size_t string_len;
+	int padding_len;
+	int head_len;
+	int offset;
+	int i;
 
-	if (!src || !dst) {
+	if (!msg || !dst) {
 		return -EINVAL;
 	}
 
-	if (dst_size < sizeof(*raw)) {
+	src = (xim_msg_commit_t*)msg;
+
+	if ((head_len = encode_XIM_COMMIT_head(src, dst, dst_size,
+	                                       &string_len, &padding_len)) < 0) {
+		return head_len;
+	}
+
+	if (!(src->flags & XIM_COMMIT_FLAG_CHARS)) {
+		if (dst_size < head_len + padding_len) {
+			return -EMSGSIZE;
+		}
+
+		memset(dst + head_len, 0, padding_len);
+		return head_len + padding_len;
+	}
+
+	if (dst_size < head_len + string_len + CT_TRAILER_LEN + padding_len) {
 		return -EMSGSIZE;
 	}
 
-	raw = (struct XIM_FORWARD_EVENT*)dst;
-	raw->im = src->im;
-	raw->ic = src->ic;
-	raw->flag = src->flags;
-	raw->serial = src->serial;
-	memmove(&raw->event, &src->event, sizeof(raw->event));
+	for (offset = head_len, i = 0; i < src->string.iovcnt; i++) {
+		memcpy(dst + offset, src->string.iov[i].iov_base, src->string.iov[i].iov_len);
+		offset += src->string.iov[i].iov_len;
+	}
+
+	memcpy(dst + offset, _ct_trailer, CT_TRAILER_LEN + padding_len);
+	return offset + CT_TRAILER_LEN + padding_len;
+}
+
+#define MSG(type, t)        [type] = { #type, sizeof(t), decode_##type, encode_##type }
+#define MSG_EMPTY(type, t)  [type] = { #type, sizeof(t), NULL, NULL }
 
-	return sizeof(*raw);
+static const struct {
+	const char *name;
+	size_t size;
+	/* both are NULL for messages without payload */
+	int (*decode)(xim_msg_t *dst, const uint8_t *src, const size_t src_len, arena_t *arena);
+	int (*encode)(const xim_msg_t *src, uint8_t *dst, const size_t dst_size);
+} _msg_info[] = {
+	MSG(XIM_CONNECT, xim_msg_connect_t),
+	MSG(XIM_CONNECT_REPLY, xim_msg_connect_reply_t),
+	MSG_EMPTY(XIM_DISCONNECT, xim_msg_disconnect_t),
+	MSG_EMPTY(XIM_DISCONNECT_REPLY, xim_msg_disconnect_reply_t),
+	MSG(XIM_ERROR, xim_msg_error_t),
+	MSG(XIM_OPEN, xim_msg_open_t),
+	MSG(XIM_OPEN_REPLY, xim_msg_open_reply_t),
+	MSG(XIM_CLOSE, xim_msg_close_t),
+	MSG(XIM_CLOSE_REPLY, xim_msg_close_reply_t),
+	MSG(XIM_REGISTER_TRIGGERKEYS, xim_msg_register_triggerkeys_t),
+	MSG(XIM_TRIGGER_NOTIFY, xim_msg_trigger_notify_t),
+	MSG(XIM_TRIGGER_NOTIFY_REPLY, xim_msg_trigger_notify_reply_t),
+	MSG(XIM_SET_EVENT_MASK, xim_msg_set_event_mask_t),
+	MSG(XIM_ENCODING_NEGOTIATION, xim_msg_encoding_negotiation_t),
+	MSG(XIM_ENCODING_NEGOTIATION_REPLY, xim_msg_encoding_negotiation_reply_t),
+	MSG(XIM_QUERY_EXTENSION, xim_msg_query_extension_t),
+	MSG(XIM_QUERY_EXTENSION_REPLY, xim_msg_query_extension_reply_t),
+	MSG(XIM_SET_IM_VALUES, xim_msg_set_im_values_t),
+	MSG(XIM_SET_IM_VALUES_REPLY, xim_msg_set_im_values_reply_t),
+	MSG(XIM_GET_IM_VALUES, xim_msg_get_im_values_t),
+	MSG(XIM_GET_IM_VALUES_REPLY, xim_msg_get_im_values_reply_t),
+	MSG(XIM_CREATE_IC, xim_msg_create_ic_t),
+	MSG(XIM_CREATE_IC_REPLY, xim_msg_create_ic_reply_t),
+	MSG(XIM_DESTROY_IC, xim_msg_destroy_ic_t),
+	MSG(XIM_DESTROY_IC_REPLY, xim_msg_destroy_ic_reply_t),
+	MSG(XIM_SET_IC_VALUES, xim_msg_set_ic_values_t),
+	MSG(XIM_SET_IC_VALUES_REPLY, xim_msg_set_ic_values_reply_t),
+	MSG(XIM_GET_IC_VALUES, xim_msg_get_ic_values_t),
+	MSG(XIM_GET_IC_VALUES_REPLY, xim_msg_get_ic_values_reply_t),
+	MSG(XIM_SET_IC_FOCUS, xim_msg_set_ic_focus_t),
+	MSG(XIM_UNSET_IC_FOCUS, xim_msg_unset_ic_focus_t),
+	MSG(XIM_FORWARD_EVENT, xim_msg_forward_event_t),
+	MSG(XIM_SYNC, xim_msg_sync_t),
+	MSG(XIM_SYNC_REPLY, xim_msg_sync_reply_t),
+	/* the string of XIM_COMMIT doesn't fit into a layout */
+	[XIM_COMMIT] = { "XIM_COMMIT", sizeof(xim_msg_commit_t), NULL, encode_XIM_COMMIT },
+	MSG(XIM_RESET_IC, xim_msg_reset_ic_t),
+	MSG(XIM_RESET_IC_REPLY, xim_msg_reset_ic_reply_t),
+	MSG(XIM_PREEDIT_START, xim_msg_preedit_start_t),
+	MSG(XIM_PREEDIT_START_REPLY, xim_msg_preedit_start_reply_t),
+	MSG(XIM_PREEDIT_DRAW, xim_msg_preedit_draw_t),
+	MSG(XIM_PREEDIT_CARET, xim_msg_preedit_caret_t),
+	MSG(XIM_PREEDIT_CARET_REPLY, xim_msg_preedit_caret_reply_t),
+	MSG(XIM_PREEDIT_DONE, xim_msg_preedit_done_t)
+};
+
+#define NUM_MSG_TYPES (sizeof(_msg_info) / sizeof(_msg_info[0]))
+#define MSG_IS_KNOWN(type) ((type) < NUM_MSG_TYPES && _msg_info[(type)].name)
+
+static int need_more_data(struct XIM_PACKET *src, const size_t src_len)
+{
+	return (src_len < sizeof(*src) || /* check if header is there */
+	        src_len < (sizeof(*src) + src->length * 4)); /* check if payload is there */
 }
 
-static int encode_XIM_SET_EVENT_MASK(xim_msg_set_event_mask_t *src, uint8_t *dst, const size_t dst_size)
+int xim_msg_get_size(const uint8_t *src, const size_t src_len)
 {
-	struct XIM_SET_EVENT_MASK *raw;
+	const struct XIM_PACKET *hdr;
 
-	if (!src || !dst) {
+	if (!src) {
 		return -EINVAL;
 	}
 
-	if (dst_size < sizeof(*raw)) {
-		return -EMSGSIZE;
+	if (src_len < sizeof(*hdr)) {
+		return -EAGAIN;
 	}
 
-	raw = (struct XIM_SET_EVENT_MASK*)dst;
-	raw->im = src->im;
-	raw->ic = src->ic;
-	raw->masks.forward = src->masks.forward;
-	raw->masks.sync = src->masks.sync;
-
-	return sizeof(*raw);
+	hdr = (const struct XIM_PACKET*)src;
+	return sizeof(*hdr) + hdr->length * 4;
 }
 
-int xim_msg_encode(xim_msg_t *src, uint8_t *dst, const size_t dst_size)
+int xim_msg_decode(xim_msg_t **dst, const uint8_t *src, const size_t src_len, arena_t *arena)
 {
 	struct XIM_PACKET *hdr;
-	int payload_len;
-	int ret_val;
+	xim_msg_t *msg;
+	int type;
+	int err;
 
-	if (!src || !dst) {
-		return -EINVAL;
+	hdr = (struct XIM_PACKET*)src;
+	type = hdr->opcode_major;
+
+	if (need_more_data(hdr, src_len)) {
+		return -EAGAIN;
 	}
 
-	if (dst_size < sizeof(struct XIM_PACKET)) {
+	if (!MSG_IS_KNOWN(type) ||
+	    (!_msg_info[type].decode && (_msg_info[type].encode || hdr->length > 0))) {
+		log_warn("Decoding of %hhu type message not implemented",
+		         hdr->opcode_major);
+		return -ENOSYS;
+	}
+
+	log_debug("Decoding %s", _msg_info[type].name);
+
+	if (!(msg = arena_calloc(arena, 1, _msg_info[type].size))) {
 		return -ENOMEM;
 	}
 
-	hdr = (struct XIM_PACKET*)dst;
-	ret_val = -EFAULT;
-	payload_len = -1;
-
-	switch (src->type) {
-	case XIM_ERROR:
-		payload_len = encode_XIM_ERROR((xim_msg_error_t*)src,
-		                               (uint8_t*)(hdr + 1),
-		                               dst_size - sizeof(*hdr));
-		break;
+	if (_msg_info[type].decode &&
+	    (err = _msg_info[type].decode(msg, (const uint8_t*)(hdr + 1),
+	                                  hdr->length * 4, arena)) < 0) {
+		return err;
+	}
 
-	case XIM_CONNECT_REPLY:
-		payload_len = encode_XIM_CONNECT_REPLY((xim_msg_connect_reply_t*)src,
-		                                       (uint8_t*)(hdr + 1),
-		                                       dst_size - sizeof(*hdr));
-		break;
+	msg->type = hdr->opcode_major;
+	msg->subtype = hdr->opcode_minor;
+	msg->length = hdr->length * 4;
 
-	case XIM_DISCONNECT_REPLY:
-		payload_len = 0;
-		break;
+	*dst = msg;
+	return sizeof(*hdr) + hdr->length * 4;
+}
 
-	case XIM_OPEN_REPLY:
-		payload_len = encode_XIM_OPEN_REPLY((xim_msg_open_reply_t*)src,
-		                                    (uint8_t*)(hdr + 1),
-		                                    dst_size - sizeof(*hdr));
-		break;
+int xim_msg_new(xim_msg_t **msg, const xim_msg_type_t type)
+{
+	xim_msg_t *m;
 
-	case XIM_CLOSE_REPLY:
-		payload_len = encode_XIM_CLOSE_REPLY((xim_msg_close_reply_t*)src,
-		                                     (uint8_t*)(hdr + 1),
-		                                     dst_size - sizeof(*hdr));
-		break;
+	if (!msg) {
+		return -EINVAL;
+	}
 
-	case XIM_QUERY_EXTENSION_REPLY:
-		payload_len = encode_XIM_QUERY_EXTENSION_REPLY((xim_msg_query_extension_reply_t*)src,
-		                                               (uint8_t*)(hdr + 1),
-		                                               dst_size - sizeof(*hdr));
-		break;
+	if (!MSG_IS_KNOWN(type)) {
+		return -ENOSYS;
+	}
 
-	case XIM_ENCODING_NEGOTIATION_REPLY:
-		payload_len = encode_XIM_ENCODING_NEGOTIATION_REPLY((xim_msg_encoding_negotiation_reply_t*)src,
-		                                                    (uint8_t*)(hdr + 1),
-		                                                    dst_size - sizeof(*hdr));
-		break;
+	if (!(m = calloc(1, _msg_info[type].size))) {
+		return -ENOMEM;
+	}
 
-	case XIM_GET_IM_VALUES_REPLY:
-		payload_len = encode_XIM_GET_IM_VALUES_REPLY((xim_msg_get_im_values_reply_t*)src,
-		                                             (uint8_t*)(hdr + 1),
-		                                             dst_size - sizeof(*hdr));
-		break;
+	m->type = type;
+	m->subtype = 0;
 
-	case XIM_SET_IM_VALUES_REPLY:
-		payload_len = encode_XIM_SET_IM_VALUES_REPLY((xim_msg_set_im_values_reply_t*)src,
-		                                             (uint8_t*)(hdr + 1),
-		                                             dst_size - sizeof(*hdr));
-		break;
+	*msg = m;
+	return 0;
+}
 
-	case XIM_GET_IC_VALUES_REPLY:
-		payload_len = encode_XIM_GET_IC_VALUES_REPLY((xim_msg_get_ic_values_reply_t*)src,
-		                                             (uint8_t*)(hdr + 1),
-		                                             dst_size - sizeof(*hdr));
-		break;
+int xim_msg_encode(xim_msg_t *src, uint8_t *dst, const size_t dst_size)
+{
+	struct XIM_PACKET *hdr;
+	int payload_len;
 
-	case XIM_SET_IC_VALUES_REPLY:
-		payload_len = encode_XIM_SET_IC_VALUES_REPLY((xim_msg_set_ic_values_reply_t*)src,
-		                                             (uint8_t*)(hdr + 1),
-		                                             dst_size - sizeof(*hdr));
-		break;
+	if (!src || !dst) {
+		return -EINVAL;
+	}
 
-	case XIM_CREATE_IC_REPLY:
-		payload_len = encode_XIM_CREATE_IC_REPLY((xim_msg_create_ic_reply_t*)src,
-		                                         (uint8_t*)(hdr + 1),
-		                                         dst_size - sizeof(*hdr));
-		break;
+	if (dst_size < sizeof(struct XIM_PACKET)) {
+		return -ENOMEM;
+	}
 
-	case XIM_DESTROY_IC_REPLY:
-		payload_len = encode_XIM_DESTROY_IC_REPLY((xim_msg_destroy_ic_reply_t*)src,
-		                                          (uint8_t*)(hdr + 1),
-		                                          dst_size - sizeof(*hdr));
-		break;
+	if (!MSG_IS_KNOWN(src->type) ||
+	    (!_msg_info[src->type].encode && _msg_info[src->type].decode)) {
+		return -ENOSYS;
+	}
 
-	case XIM_SYNC:
-	case XIM_SYNC_REPLY:
-		payload_len = encode_XIM_SYNC_REPLY((xim_msg_sync_reply_t*)src,
-		                                    (uint8_t*)(hdr + 1),
-		                                    dst_size - sizeof(*hdr));
-		break;
+	hdr = (struct XIM_PACKET*)dst;
+	payload_len = 0;
 
-	case XIM_RESET_IC_REPLY:
-		payload_len = encode_XIM_RESET_IC_REPLY((xim_msg_reset_ic_reply_t*)src,
-		                                        (uint8_t*)(hdr + 1),
-		                                        dst_size - sizeof(*hdr));
-		break;
+	if (_msg_info[src->type].encode &&
+	    (payload_len = _msg_info[src->type].encode(src, (uint8_t*)(hdr + 1),
+	                                               dst_size - sizeof(*hdr))) < 0) {
+		return payload_len;
+	}
 
-	case XIM_COMMIT:
-		payload_len = encode_XIM_COMMIT((xim_msg_commit_t*)src,
-		                                (uint8_t*)(hdr + 1),
-		                                dst_size - sizeof(*hdr));
-		break;
+	hdr->opcode_major = src->type;
+	hdr->opcode_minor = src->subtype;
+	hdr->length = payload_len / 4;
 
-	case XIM_FORWARD_EVENT:
-		payload_len = encode_XIM_FORWARD_EVENT((xim_msg_forward_event_t*)src,
-		                                       (uint8_t*)(hdr + 1),
-		                                       dst_size - sizeof(*hdr));
-		break;
+	return sizeof(*hdr) + payload_len;
+}
 
-	case XIM_SET_EVENT_MASK:
-		payload_len = encode_XIM_SET_EVENT_MASK((xim_msg_set_event_mask_t*)src,
-		                                        (uint8_t*)(hdr + 1),
-		                                        dst_size - sizeof(*hdr));
-		break;
+int xim_msg_encode_commit(xim_msg_commit_t *src, uint8_t *dst, const size_t dst_size,
+                          struct iovec *iov, const int max_iov)
+{
+	struct XIM_PACKET *hdr;
+	size_t string_len;
+	int padding_len;
+	int head_len;
+	int num_iov;
+	int i;
 
-	default:
-		ret_val = -ENOSYS;
-		break;
+	if (!src || !dst || !iov || dst_size < sizeof(*hdr)) {
+		return -EINVAL;
+	}
+
+	if (max_iov < src->string.iovcnt + XIM_MSG_COMMIT_IOV_EXTRA) {
+		return -ENOBUFS;
+	}
+
+	hdr = (struct XIM_PACKET*)dst;
+
+	if ((head_len = encode_XIM_COMMIT_head(src, (uint8_t*)(hdr + 1), dst_size - sizeof(*hdr),
+	                                       &string_len, &padding_len)) < 0) {
+		return head_len;
 	}
 
-	if (payload_len >= 0) {
-		hdr->opcode_major = src->type;
-		hdr->opcode_minor = src->subtype;
-		hdr->length = payload_len / 4;
+	hdr->opcode_major = XIM_COMMIT;
+	hdr->opcode_minor = 0;
+	hdr->length = (head_len + string_len + padding_len +
+	               (src->flags & XIM_COMMIT_FLAG_CHARS ? CT_TRAILER_LEN : 0)) / 4;
+
+	/* the headers are followed by the string, which is sent from where it is */
+	iov[0].iov_base = dst;
+	iov[0].iov_len = sizeof(*hdr) + head_len;
+	num_iov = 1;
+
+	if (src->flags & XIM_COMMIT_FLAG_CHARS) {
+		for (i = 0; i < src->string.iovcnt; i++) {
+			if (src->string.iov[i].iov_len > 0) {
+				iov[num_iov++] = src->string.iov[i];
+			}
+		}
 
-		ret_val = sizeof(*hdr) + payload_len;
+		iov[num_iov].iov_base = (void*)_ct_trailer;
+		iov[num_iov].iov_len = CT_TRAILER_LEN + padding_len;
+		num_iov++;
+	} else if (padding_len > 0) {
+		iov[num_iov].iov_base = (void*)(_ct_trailer + CT_TRAILER_LEN);
+		iov[num_iov].iov_len = padding_len;
+		num_iov++;
 	}
 
-	return ret_val;
+	return num_iov;
 }
@@ -24,8 +24,12 @@
 #include "ximtypes.h"
 #include <stdint.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <X11/Xlib.h>
 
+/* 4 bytes of header plus a payload of up to 65535 words */
+#define XIM_MSG_MAX_SIZE (4 + 0xffff * 4)
+
 typedef enum {
 	XIM_CONNECT                    =  1,
 	XIM_CONNECT_REPLY              =  2,
@@ -115,12 +119,22 @@ typedef enum {
 	XIM_COMMIT_FLAG_KEYSYM = 4
 } xim_commit_flags_t;
 
+typedef enum {
+	XIM_TRIGGER_NOTIFY_FLAG_ON  = 0,
+	XIM_TRIGGER_NOTIFY_FLAG_OFF = 1
+} xim_trigger_notify_flags_t;
+
 typedef enum {
 	XIM_FORWARD_EVENT_FLAG_SYNC   = 1,
 	XIM_FORWARD_EVENT_FLAG_FILTER = 2,
 	XIM_FORWARD_EVENT_FLAG_LOOKUP = 4
 } xim_forward_event_flags_t;
 
+typedef enum {
+	XIM_PREEDIT_DRAW_NO_STRING   = 1,
+	XIM_PREEDIT_DRAW_NO_FEEDBACK = 2
+} xim_preedit_draw_status_t;
+
 typedef struct {
 	xim_msg_type_t type;
 	uint8_t subtype;
@@ -186,6 +200,33 @@ typedef struct {
 	int im;
 } xim_msg_close_reply_t;
 
+typedef struct {
+	xim_msg_t hdr;
+
+	int im;
+	int num_on_keys;
+	const trigger_key_t *on_keys;
+	int num_off_keys;
+	const trigger_key_t *off_keys;
+} xim_msg_register_triggerkeys_t;
+
+typedef struct {
+	xim_msg_t hdr;
+
+	int im;
+	int ic;
+	xim_trigger_notify_flags_t flag;
+	uint32_t index;
+	uint32_t mask;
+} xim_msg_trigger_notify_t;
+
+typedef struct {
+	xim_msg_t hdr;
+
+	int im;
+	int ic;
+} xim_msg_trigger_notify_reply_t;
+
 typedef struct {
 	xim_msg_t hdr;
 
@@ -348,9 +389,10 @@ typedef struct {
 
 	int im;
 	int ic;
+	/* UTF-8, sent as compound text, not copied */
 	struct {
 		size_t len;
-		void *data;
+		const void *data;
 	} preedit;
 } xim_msg_reset_ic_reply_t;
 
@@ -362,9 +404,11 @@ typedef struct {
 	xim_commit_flags_t flags;
 
 	uint32_t sym;
+
+	/* UTF-8 string, scattered over any number of vectors */
 	struct {
-		size_t len;
-		void *data;
+		const struct iovec *iov;
+		int iovcnt;
 	} string;
 } xim_msg_commit_t;
 
@@ -418,8 +462,83 @@ typedef struct {
 	void *detail;
 } xim_msg_error_t;
 
+typedef struct {
+	xim_msg_t hdr;
+
+	int im;
+	int ic;
+} xim_msg_preedit_start_t;
+
+typedef struct {
+	xim_msg_t hdr;
+
+	int im;
+	int ic;
+	int32_t max_len;
+} xim_msg_preedit_start_reply_t;
+
+typedef struct {
+	xim_msg_t hdr;
+
+	int im;
+	int ic;
+	int32_t caret;
+	int32_t chg_first;
+	int32_t chg_length;
+	xim_preedit_draw_status_t status;
+
+	/* UTF-8, sent as compound text, not copied */
+	struct {
+		size_t len;
+		const void *data;
+	} string;
+
+	struct {
+		int num;
+		const uint32_t *list;
+	} feedback;
+} xim_msg_preedit_draw_t;
+
+typedef struct {
+	xim_msg_t hdr;
+
+	int im;
+	int ic;
+	int32_t position;
+	uint32_t direction;
+	uint32_t style;
+} xim_msg_preedit_caret_t;
+
+typedef struct {
+	xim_msg_t hdr;
+
+	int im;
+	int ic;
+	int32_t position;
+} xim_msg_preedit_caret_reply_t;
+
+typedef struct {
+	xim_msg_t hdr;
+
+	int im;
+	int ic;
+} xim_msg_preedit_done_t;
+
+/* Size of the header that precedes the payload of every message */
+#define XIM_MSG_HDR_SIZE 4
+
 int xim_msg_new(xim_msg_t **dst, xim_msg_type_t type);
-int xim_msg_decode(xim_msg_t **dst, const uint8_t *src, const size_t src_len);
+int xim_msg_get_size(const uint8_t *src, const size_t src_len);
+/* Decoded messages are allocated from the arena, see decode_STRING() */
+int xim_msg_decode(xim_msg_t **dst, const uint8_t *src, const size_t src_len, arena_t *arena);
 int xim_msg_encode(xim_msg_t *src, uint8_t *dst, const size_t dst_size);
 
+/* Vectors that xim_msg_encode_commit() needs in addition to the string's */
+#define XIM_MSG_COMMIT_IOV_EXTRA 2
+/* Size of the buffer that xim_msg_encode_commit() needs for the headers */
+#define XIM_MSG_COMMIT_HDR_SIZE  32
+
+int xim_msg_encode_commit(xim_msg_commit_t *src, uint8_t *dst, const size_t dst_size,
+                          struct iovec *iov, const int max_iov);
+
 #endif /* XIMPROTO_H */
@@ -19,10 +19,15 @@
  */
 
 #include "fd.h"
+#include "inputcontext.h"
+#include "log.h"
 #include "thread.h"
+#include "uring.h"
 #include "ximserver.h"
 #include "ximclient.h"
 #include <errno.h>
+#include <poll.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
@@ -32,19 +37,90 @@
 #include <arpa/inet.h>
 #include <unistd.h>
 
-struct xim_server {
-	fd_t *fd;
-	thread_t *thread;
+#define XIM_SERVER_LISTEN_MAX 4
+
+/* Other fds that a reactor watches, see xim_server_watch() */
+#define XIM_SERVER_WATCH_MAX 4
+
+/* Clients are edge-triggered, so they must read and write until EAGAIN */
+#define XIM_SERVER_CLIENT_EVENTS (EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET)
+
+/* Size of the submission queue of a reactor's io_uring */
+#define XIM_SERVER_URING_ENTRIES  256
+
+/* Buffers that the kernel receives client data into */
+#define XIM_SERVER_URING_BUFS     128
+#define XIM_SERVER_URING_BUF_SIZE 2048
+#define XIM_SERVER_URING_BGID     0
+
+/* Requests that are kept in flight for a watched fd */
+#define WATCH_RECV     0
+#define WATCH_POLLOUT  1
+#define WATCH_POLLIN   2
+#define WATCH_TAG_MASK 3
+
+struct reactor;
+
+/*
+ * An fd that is watched through an io_uring. The pointer to the watch is
+ * the user data of its requests, with the request in the lower bits.
+ */
+struct watch {
+	struct reactor *reactor;
+	fd_t *fd;            /* NULL once the fd has been closed */
+	unsigned int armed;  /* requests in flight, (1 << WATCH_*) */
+	int busy;            /* set while a completion is dispatched */
+
+	/* requests that couldn't be cancelled yet for lack of an sqe */
+	unsigned int cancel;
+	struct watch *next_cancel;
+};
 
+/*
+ * An event loop thread. It either uses an io_uring or, if the kernel
+ * doesn't support io_uring, an epoll set.
+ */
+struct reactor {
+	thread_t *thread;    /* NULL if the reactor runs in the caller's thread */
+	int stop;            /* set by xim_server_stop() */
 	int epfd;
+	uring_t *ring;
+
+	/* written by other threads to make the reactor run a pass */
+	fd_t *wakeup;
+
+	/* watches with cancel requests that are retried in the next pass */
+	struct watch *cancels;
+
+	struct watch listeners[XIM_SERVER_LISTEN_MAX];
+
+	/* fds that are told when a pass of the event loop is done */
+	fd_t *watched[XIM_SERVER_WATCH_MAX];
+	int num_watched;
 };
 
-static int _watch_fd(int epfd, fd_t *fd)
+struct xim_server {
+	fd_t *fds[XIM_SERVER_LISTEN_MAX];
+	int num_fds;
+
+	/*
+	 * With epoll, the listening sockets are watched by the first reactor,
+	 * which hands new clients to the reactors in turn. With io_uring, all
+	 * reactors watch the listening sockets and keep the clients that they
+	 * accepted. A client stays with its reactor for its lifetime, so client
+	 * state is never shared between threads.
+	 */
+	struct reactor *reactors;
+	int num_reactors;
+	unsigned int next_reactor;
+};
+
+static int _watch_fd(int epfd, fd_t *fd, const uint32_t events)
 {
 	struct epoll_event ev;
 	int err;
 
-	ev.events = EPOLLIN;
+	ev.events = events;
 	ev.data.ptr = fd;
 	err = 0;
 
@@ -55,62 +131,478 @@ static int _watch_fd(int epfd, fd_t *fd)
 	return err;
 }
 
-static void _xim_server_in(fd_t *fd, fd_event_t event, xim_server_t *server, void *data)
+/* The reactor that the calling thread runs */
+static __thread struct reactor *_current_reactor;
+
+static int _reactor_arm(struct reactor *reactor, struct watch *watch, const int tag)
 {
-	xim_client_t *ximclient;
-	fd_t *client;
-	int err;
+	struct io_uring_sqe *sqe;
+
+	if (!(sqe = uring_get_sqe(reactor->ring))) {
+		return -EBUSY;
+	}
+
+	sqe->fd = watch->fd->fd;
+	sqe->user_data = (uint64_t)(uintptr_t)watch | tag;
+
+	if (tag == WATCH_RECV) {
+		/* received data ends up in one of the provided buffers */
+		sqe->opcode = IORING_OP_RECV;
+		sqe->ioprio = IORING_RECV_MULTISHOT;
+		sqe->flags = IOSQE_BUFFER_SELECT;
+		sqe->buf_group = XIM_SERVER_URING_BGID;
+	} else if (tag == WATCH_POLLOUT) {
+		/* only armed while the owner of the fd has output queued */
+		sqe->opcode = IORING_OP_POLL_ADD;
+		sqe->poll32_events = POLLOUT;
+	} else {
+		/*
+		 * Listening sockets are polled one-shot. The handler accepts
+		 * until the queue is empty, and a new poll completes right away
+		 * if another reactor was faster at accepting.
+		 */
+		sqe->opcode = IORING_OP_POLL_ADD;
+		sqe->poll32_events = POLLIN;
+	}
+
+	watch->armed |= 1U << tag;
+	return 0;
+}
+
+static void _reactor_cancel(struct reactor *reactor, struct watch *watch, const int tag)
+{
+	struct io_uring_sqe *sqe;
+
+	if (!(sqe = uring_get_sqe(reactor->ring))) {
+		/*
+		 * The kernel didn't take any of the queued requests, most likely
+		 * because the completion queue is full. The request would keep the
+		 * watch and the socket alive, so the cancel is tried again.
+		 */
+		if (!watch->cancel) {
+			watch->next_cancel = reactor->cancels;
+			reactor->cancels = watch;
+		}
+
+		watch->cancel |= 1U << tag;
+		return;
+	}
+
+	/* the completion of the cancel request itself is ignored */
+	sqe->opcode = IORING_OP_ASYNC_CANCEL;
+	sqe->addr = (uint64_t)(uintptr_t)watch | tag;
+	sqe->user_data = 0;
+}
+
+/* Frees a watch whose fd was closed, once nothing refers to it anymore */
+static void _watch_put(struct watch *watch)
+{
+	if (!watch->fd && !watch->armed && !watch->busy && !watch->cancel) {
+		free(watch);
+	}
+}
 
-	if ((err = fd_accept(fd, &client)) < 0) {
-		fprintf(stderr, "fd_accept: %s\n", strerror(-err));
+static void _reactor_retry_cancels(struct reactor *reactor)
+{
+	struct watch *watch;
+	int tag;
+
+	while ((watch = reactor->cancels)) {
+		reactor->cancels = watch->next_cancel;
+
+		for (tag = 0; tag <= WATCH_TAG_MASK; tag++) {
+			if (watch->cancel & (1U << tag)) {
+				watch->cancel &= ~(1U << tag);
+
+				/* requests that ended by themselves don't need cancelling */
+				if (watch->armed & (1U << tag)) {
+					_reactor_cancel(reactor, watch, tag);
+				}
+			}
+		}
+
+		if (reactor->cancels == watch) {
+			/* still no room, try again in the next pass */
+			break;
+		}
+
+		_watch_put(watch);
+	}
+}
+
+static void _watch_close(fd_t *fd, fd_event_t event, struct watch *watch, void *data)
+{
+	int tag;
+
+	watch->fd = NULL;
+
+	for (tag = 0; tag <= WATCH_TAG_MASK; tag++) {
+		if (watch->armed & (1U << tag)) {
+			_reactor_cancel(watch->reactor, watch, tag);
+		}
+	}
+
+	/* otherwise freed when the last request has completed */
+	_watch_put(watch);
+}
+
+/* The owner of the fd has output queued, tell it when the fd is writable */
+static void _watch_want_out(fd_t *fd, fd_event_t event, struct watch *watch, void *data)
+{
+	if (!(watch->armed & (1U << WATCH_POLLOUT)) &&
+	    _reactor_arm(watch->reactor, watch, WATCH_POLLOUT) < 0) {
+		log_error("Could not poll fd %d for writability", fd->fd);
+	}
+}
+
+static int _reactor_watch_client(struct reactor *reactor, fd_t *fd)
+{
+	struct watch *watch;
+
+	if (!(watch = calloc(1, sizeof(*watch)))) {
+		return -ENOMEM;
+	}
+
+	watch->reactor = reactor;
+	watch->fd = fd;
+
+	/* requests that were armed are cancelled when the fd is closed */
+	fd_set_callback(fd, FD_EVENT_CLOSE, (fd_callback_t*)_watch_close, watch);
+	fd_set_callback(fd, FD_EVENT_WANT_OUT, (fd_callback_t*)_watch_want_out, watch);
+
+	return _reactor_arm(reactor, watch, WATCH_RECV);
+}
+
+static void _reactor_complete(struct reactor *reactor, const struct io_uring_cqe *cqe)
+{
+	struct watch *watch;
+	struct fd_data in;
+	uint16_t bid;
+	int has_buf;
+	int more;
+	int tag;
+
+	if (!cqe->user_data) {
 		return;
 	}
 
+	watch = (struct watch*)(uintptr_t)(cqe->user_data & ~(uint64_t)WATCH_TAG_MASK);
+	tag = cqe->user_data & WATCH_TAG_MASK;
+	more = cqe->flags & IORING_CQE_F_MORE;
+	has_buf = cqe->flags & IORING_CQE_F_BUFFER;
+	bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+
+	if (!more) {
+		watch->armed &= ~(1U << tag);
+	}
+
+	/* the handlers may close the fd, but must not free the watch */
+	watch->busy = 1;
+
+	if (watch->fd) {
+		switch (tag) {
+		case WATCH_RECV:
+			/* running out of buffers or being cancelled isn't an error */
+			if (cqe->res != -ENOBUFS && cqe->res != -ECANCELED) {
+				in.data = has_buf ? uring_get_buffer(reactor->ring, bid) : NULL;
+				in.len = cqe->res;
+				fd_notify(watch->fd, FD_EVENT_IN, &in);
+			}
+			break;
+
+		case WATCH_POLLOUT:
+			if (cqe->res > 0 && (cqe->res & POLLOUT)) {
+				fd_notify(watch->fd, FD_EVENT_OUT, NULL);
+			}
+			break;
+
+		case WATCH_POLLIN:
+			if (cqe->res > 0) {
+				fd_notify(watch->fd, FD_EVENT_IN, NULL);
+			}
+			break;
+		}
+	}
+
+	watch->busy = 0;
+
+	if (has_buf) {
+		uring_recycle_buffer(reactor->ring, bid);
+	}
+
+	if (!watch->fd) {
+		_watch_put(watch);
+	} else if (!more && tag != WATCH_POLLOUT && (cqe->res >= 0 || cqe->res == -ENOBUFS)) {
+		/* the kernel ended the multishot request, start a new one */
+		if (_reactor_arm(reactor, watch, tag) < 0) {
+			log_error("Could not re-arm request for fd %d", watch->fd->fd);
+		}
+	}
+}
+
+static int _xim_server_add_client(xim_server_t *server, fd_t *client)
+{
+	struct reactor *reactor;
+	xim_client_t *ximclient;
+	int err;
+
 	if ((err = xim_client_new(&ximclient, client)) < 0) {
-		fprintf(stderr, "xim_client_new: %s\n", strerror(-err));
 		fd_free(&client);
-		return;
+		return err;
 	}
 
-	if ((err = _watch_fd(server->epfd, client)) < 0) {
-		fprintf(stderr, "_watch_fd: %s\n", strerror(-err));
+	if ((reactor = _current_reactor) && reactor->ring) {
+		err = _reactor_watch_client(reactor, client);
+	} else {
+		reactor = &server->reactors[server->next_reactor++ % server->num_reactors];
+		err = _watch_fd(reactor->epfd, client, XIM_SERVER_CLIENT_EVENTS);
+	}
+
+	if (err < 0) {
 		xim_client_free(&ximclient);
 	}
 
+	return err;
+}
+
+static void _xim_server_in(fd_t *fd, fd_event_t event, xim_server_t *server, void *data)
+{
+	fd_t *client;
+	int err;
+
+	/* listeners are edge-triggered, so take everything that is queued */
+	while ((err = fd_accept(fd, &client)) != -EAGAIN && err != -EWOULDBLOCK) {
+		if (err < 0) {
+			if (err == -EINTR || err == -ECONNABORTED) {
+				continue;
+			}
+
+			log_error("fd_accept: %s", strerror(-err));
+			break;
+		}
+
+		if ((err = _xim_server_add_client(server, client)) < 0) {
+			log_warn("Could not add client: %s", strerror(-err));
+		}
+	}
+
 	return;
 }
 
-int xim_server_init(xim_server_t **server, const char *addr, unsigned short port)
+static void _reactor_unwatch(fd_t *fd, fd_event_t event, struct reactor *reactor, void *data)
 {
-	xim_server_t *srv;
+	int i;
+
+	/* other fds may refer to the same file, so closing it isn't enough */
+	if (reactor->epfd >= 0) {
+		epoll_ctl(reactor->epfd, EPOLL_CTL_DEL, fd->fd, NULL);
+	}
+
+	for (i = 0; i < reactor->num_watched; i++) {
+		if (reactor->watched[i] == fd) {
+			reactor->watched[i] = reactor->watched[--reactor->num_watched];
+			break;
+		}
+	}
+}
+
+static void _reactor_unwatch_uring(fd_t *fd, fd_event_t event, struct watch *watch, void *data)
+{
+	_reactor_unwatch(fd, event, watch->reactor, data);
+	_watch_close(fd, event, watch, data);
+}
+
+static int _reactor_watch(struct reactor *reactor, fd_t *fd)
+{
+	struct watch *watch;
 	int err;
 
-	if (!(srv = calloc(1, sizeof(*srv)))) {
-		err = -ENOMEM;
-		goto cleanup;
+	if (reactor->num_watched >= XIM_SERVER_WATCH_MAX) {
+		return -EMFILE;
 	}
 
-	if ((err = thread_new(&srv->thread)) < 0) {
-		fprintf(stderr, "thread_new: %s\n", strerror(-err));
-		goto cleanup;
+	if (!reactor->ring) {
+		/* level-triggered, the fd may not be read until it is empty */
+		if ((err = _watch_fd(reactor->epfd, fd, EPOLLIN)) < 0) {
+			return err;
+		}
+
+		fd_set_callback(fd, FD_EVENT_CLOSE, (fd_callback_t*)_reactor_unwatch, reactor);
+	} else {
+		if (!(watch = calloc(1, sizeof(*watch)))) {
+			return -ENOMEM;
+		}
+
+		watch->reactor = reactor;
+		watch->fd = fd;
+
+		if ((err = _reactor_arm(reactor, watch, WATCH_POLLIN)) < 0) {
+			free(watch);
+			return err;
+		}
+
+		fd_set_callback(fd, FD_EVENT_CLOSE, (fd_callback_t*)_reactor_unwatch_uring, watch);
+	}
+
+	reactor->watched[reactor->num_watched++] = fd;
+	return 0;
+}
+
+static void _reactor_woken(fd_t *fd, fd_event_t event, struct reactor *reactor, void *data)
+{
+	uint64_t count;
+
+	/* the pass that this is part of is all that was asked for */
+	fd_read(fd, &count, sizeof(count));
+}
+
+static int _reactor_init_wakeup(struct reactor *reactor)
+{
+	int err;
+
+	if ((err = fd_open(&reactor->wakeup, FD_DOM_EVENT)) < 0) {
+		return err;
+	}
+
+	fd_set_callback(reactor->wakeup, FD_EVENT_IN, (fd_callback_t*)_reactor_woken, reactor);
+
+	if ((err = _reactor_watch(reactor, reactor->wakeup)) < 0) {
+		fd_free(&reactor->wakeup);
+	}
+
+	return err;
+}
+
+/*
+ * Provided buffer rings came with Linux 5.19, but multishot receives only
+ * with 6.0. Older kernels fail the receive with -EINVAL, so it is tried on
+ * a socketpair before any client depends on it.
+ */
+static int _reactor_probe_recv(struct reactor *reactor)
+{
+	struct io_uring_sqe *sqe;
+	struct io_uring_cqe *cqe;
+	int done;
+	int err;
+	int sv[2];
+
+	if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) < 0) {
+		return -errno;
+	}
+
+	/* the request ends at the end of the stream, after the first byte */
+	err = write(sv[1], "", 1) == 1 ? 0 : -EIO;
+	close(sv[1]);
+
+	if (err < 0 || !(sqe = uring_get_sqe(reactor->ring))) {
+		close(sv[0]);
+		return err < 0 ? err : -EBUSY;
+	}
+
+	sqe->opcode = IORING_OP_RECV;
+	sqe->fd = sv[0];
+	sqe->ioprio = IORING_RECV_MULTISHOT;
+	sqe->flags = IOSQE_BUFFER_SELECT;
+	sqe->buf_group = XIM_SERVER_URING_BGID;
+
+	for (done = 0; !done; ) {
+		if ((err = uring_submit(reactor->ring, 1)) < 0 && err != -EINTR) {
+			break;
+		}
+
+		err = 0;
+
+		while (!done && uring_peek_cqe(reactor->ring, &cqe) == 0) {
+			if (cqe->flags & IORING_CQE_F_BUFFER) {
+				uring_recycle_buffer(reactor->ring, cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+			}
+
+			if (cqe->res < 0) {
+				err = cqe->res == -EINVAL ? -EOPNOTSUPP : cqe->res;
+			}
+
+			done = !(cqe->flags & IORING_CQE_F_MORE);
+			uring_cqe_seen(reactor->ring);
+		}
+	}
+
+	close(sv[0]);
+	return err;
+}
+
+static int _reactor_init_uring(struct reactor *reactor)
+{
+	int err;
+
+	if ((err = uring_new(&reactor->ring, XIM_SERVER_URING_ENTRIES)) < 0) {
+		return err;
 	}
 
-	if ((srv->epfd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+	if ((err = uring_provide_buffers(reactor->ring, XIM_SERVER_URING_BGID,
+	                                 XIM_SERVER_URING_BUFS,
+	                                 XIM_SERVER_URING_BUF_SIZE)) < 0 ||
+	    (err = _reactor_probe_recv(reactor)) < 0) {
+		uring_free(&reactor->ring);
+	}
+
+	return err;
+}
+
+static int _reactor_init_epoll(struct reactor *reactor)
+{
+	int err;
+
+	err = 0;
+
+	if ((reactor->epfd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
 		err = -errno;
-		perror("epoll_create1");
-		goto cleanup;
+		log_error("epoll_create1: %s", strerror(-err));
 	}
 
-	if ((err = fd_open(&srv->fd, FD_DOM_IN4, addr, port)) < 0) {
-		goto cleanup;
+	return err;
+}
+
+int xim_server_init(xim_server_t **server, const int num_reactors)
+{
+	xim_server_t *srv;
+	int err;
+	int i;
+
+	if (!server || num_reactors < 1 || num_reactors > XIM_SERVER_REACTOR_MAX) {
+		return -EINVAL;
 	}
 
-	if ((err = _watch_fd(srv->epfd, srv->fd)) < 0) {
+	if (!(srv = calloc(1, sizeof(*srv))) ||
+	    !(srv->reactors = calloc(num_reactors, sizeof(*srv->reactors)))) {
+		err = -ENOMEM;
 		goto cleanup;
 	}
 
-	srv->fd->userdata = srv;
-	fd_set_callback(srv->fd, FD_EVENT_IN, (fd_callback_t*)_xim_server_in, srv);
+	for (i = 0; i < num_reactors; i++) {
+		srv->reactors[i].epfd = -1;
+	}
+	srv->num_reactors = num_reactors;
+
+	/* all reactors use io_uring, or none of them does */
+	for (err = i = 0; !err && i < num_reactors; i++) {
+		err = _reactor_init_uring(&srv->reactors[i]);
+	}
+
+	if (err < 0) {
+		log_info("io_uring not available, using epoll: %s", strerror(-err));
+
+		for (err = i = 0; !err && i < num_reactors; i++) {
+			if (srv->reactors[i].ring) {
+				uring_free(&srv->reactors[i].ring);
+			}
+
+			err = _reactor_init_epoll(&srv->reactors[i]);
+		}
+	}
+
+	for (i = 0; !err && i < num_reactors; i++) {
+		err = _reactor_init_wakeup(&srv->reactors[i]);
+	}
 
 cleanup:
 	if (!err) {
@@ -122,77 +614,350 @@ cleanup:
 	return err;
 }
 
+static int _xim_server_listen(xim_server_t *server, fd_t *fd)
+{
+	int err;
+	int i;
+
+	if (server->num_fds >= XIM_SERVER_LISTEN_MAX) {
+		fd_free(&fd);
+		return -EMFILE;
+	}
+
+	/* several reactors may race for a new connection, the losers mustn't block */
+	if ((err = fd_set_nonblock(fd)) < 0) {
+		fd_free(&fd);
+		return err;
+	}
+
+	if (!server->reactors[0].ring &&
+	    (err = _watch_fd(server->reactors[0].epfd, fd, EPOLLIN | EPOLLET)) < 0) {
+		fd_free(&fd);
+		return err;
+	}
+
+	fd->userdata = server;
+	fd_set_callback(fd, FD_EVENT_IN, (fd_callback_t*)_xim_server_in, server);
+
+	for (i = 0; server->reactors[0].ring && i < server->num_reactors; i++) {
+		struct reactor *reactor;
+		struct watch *watch;
+
+		reactor = &server->reactors[i];
+		watch = &reactor->listeners[server->num_fds];
+		watch->reactor = reactor;
+		watch->fd = fd;
+
+		if ((err = _reactor_arm(reactor, watch, WATCH_POLLIN)) < 0) {
+			/* the fd is freed with the server, after the rings are gone */
+			break;
+		}
+	}
+
+	server->fds[server->num_fds++] = fd;
+
+	return err;
+}
+
+/*
+ * Makes the first reactor watch an fd that isn't a client, such as the
+ * connection to the X server. The fd gets FD_EVENT_IN when it becomes
+ * readable and FD_EVENT_FLUSH at the end of every pass of the event loop.
+ */
+int xim_server_watch(xim_server_t *server, fd_t *fd)
+{
+	if (!server || !fd) {
+		return -EINVAL;
+	}
+
+	return _reactor_watch(&server->reactors[0], fd);
+}
+
+/* The reactor that runs in the calling thread, or NULL */
+xim_reactor_t *xim_server_get_reactor(void)
+{
+	return _current_reactor;
+}
+
+/* Makes a reactor run a pass of its event loop. May be called from any thread. */
+int xim_server_wake(xim_reactor_t *reactor)
+{
+	static const uint64_t one = 1;
+	ssize_t err;
+
+	if (!reactor) {
+		return -EINVAL;
+	}
+
+	err = fd_write(reactor->wakeup, &one, sizeof(one));
+	return err < 0 && err != -EAGAIN ? (int)err : 0;
+}
+
+int xim_server_listen_tcp(xim_server_t *server, const char *addr, unsigned short port,
+                          const int backlog)
+{
+	fd_t *fd;
+	int err;
+
+	if (!server || !addr) {
+		return -EINVAL;
+	}
+
+	if ((err = fd_open(&fd, FD_DOM_IN4, addr, (int)port, backlog)) < 0) {
+		return err;
+	}
+
+	return _xim_server_listen(server, fd);
+}
+
+int xim_server_listen_local(xim_server_t *server, const char *path, const int backlog)
+{
+	fd_t *fd;
+	int err;
+
+	if (!server || !path) {
+		return -EINVAL;
+	}
+
+	if ((err = fd_open(&fd, FD_DOM_UNIX, path, backlog)) < 0) {
+		return err;
+	}
+
+	return _xim_server_listen(server, fd);
+}
+
 int xim_server_free(xim_server_t **server)
 {
+	int i;
+
 	if (!server || !*server) {
 		return -EINVAL;
 	}
 
-	if ((*server)->thread) {
-		thread_free(&(*server)->thread);
-	}
+	for (i = 0; (*server)->reactors && i < (*server)->num_reactors; i++) {
+		struct reactor *reactor;
+
+		reactor = &(*server)->reactors[i];
+
+		if (reactor->thread) {
+			thread_free(&reactor->thread);
+		}
+
+		/* the reactor must still be there when the fd is closed */
+		if (reactor->wakeup) {
+			fd_free(&reactor->wakeup);
+		}
 
-	if ((*server)->epfd >= 0) {
-		close((*server)->epfd);
-		(*server)->epfd = -1;
+		if (reactor->ring) {
+			uring_free(&reactor->ring);
+		}
+
+		if (reactor->epfd >= 0) {
+			close(reactor->epfd);
+			reactor->epfd = -1;
+		}
 	}
-	if ((*server)->fd >= 0) {
-		fd_free(&(*server)->fd);
+
+	while ((*server)->num_fds > 0) {
+		fd_free(&(*server)->fds[--(*server)->num_fds]);
 	}
 
+	free((*server)->reactors);
 	free(*server);
 	*server = NULL;
 
 	return 0;
 }
 
-static void* _xim_server_run(xim_server_t *server)
+static void _reactor_flush(struct reactor *reactor)
+{
+	int i;
+
+	/* changes of all ICs in this pass are drawn in one go */
+	input_context_draw_pending();
+
+	for (i = 0; i < reactor->num_watched; i++) {
+		fd_notify(reactor->watched[i], FD_EVENT_FLUSH, NULL);
+	}
+}
+
+static void _reactor_run_uring(struct reactor *reactor)
+{
+	while (!__atomic_load_n(&reactor->stop, __ATOMIC_ACQUIRE)) {
+		struct io_uring_cqe *cqe;
+		int err;
+
+		_reactor_retry_cancels(reactor);
+
+		/* submit new requests and wait for completions in one go */
+		if ((err = uring_submit(reactor->ring, 1)) < 0 &&
+		    err != -EINTR && err != -EAGAIN && err != -EBUSY) {
+			log_error("uring_submit: %s", strerror(-err));
+			break;
+		}
+
+		while (uring_peek_cqe(reactor->ring, &cqe) == 0) {
+			struct io_uring_cqe completion;
+
+			/* free the slot right away, handlers may submit new requests */
+			completion = *cqe;
+			uring_cqe_seen(reactor->ring);
+
+			_reactor_complete(reactor, &completion);
+		}
+
+		_reactor_flush(reactor);
+	}
+}
+
+static void _reactor_run_epoll(struct reactor *reactor)
 {
 	int nev;
 
-	while (!thread_is_stopping(server->thread)) {
+	while (!__atomic_load_n(&reactor->stop, __ATOMIC_ACQUIRE)) {
 		struct epoll_event events[8];
 
-		nev = epoll_wait(server->epfd, events, sizeof(events) / sizeof(events[0]), -1);
+		nev = epoll_wait(reactor->epfd, events, sizeof(events) / sizeof(events[0]), -1);
 
 		while (--nev >= 0) {
 			fd_t *fd;
 
 			fd = events[nev].data.ptr;
 
-			if (events[nev].events & EPOLLIN) {
-				fd_notify(fd, FD_EVENT_IN, NULL);
+			if (events[nev].events & EPOLLOUT) {
+				fd_notify(fd, FD_EVENT_OUT, NULL);
 			}
 			if (events[nev].events & EPOLLERR) {
 				fd_notify(fd, FD_EVENT_ERR, NULL);
 			}
-			if (events[nev].events & EPOLLHUP) {
+			if (events[nev].events & (EPOLLHUP | EPOLLRDHUP)) {
 				fd_notify(fd, FD_EVENT_HUP, NULL);
 			}
+
+			/*
+			 * The input handler must come last because it may free the fd.
+			 * It also gets to see errors and hangups, since a read is how
+			 * a client notices that its peer went away.
+			 */
+			if (events[nev].events & (EPOLLIN | EPOLLERR | EPOLLHUP | EPOLLRDHUP)) {
+				fd_notify(fd, FD_EVENT_IN, NULL);
+			}
 		}
+
+		_reactor_flush(reactor);
+	}
+}
+
+static void* _xim_server_run(struct reactor *reactor)
+{
+	_current_reactor = reactor;
+
+	if (reactor->ring) {
+		_reactor_run_uring(reactor);
+	} else {
+		_reactor_run_epoll(reactor);
 	}
 
 	return NULL;
 }
 
+/* Runs a reactor in a thread of its own */
+static int _reactor_start(struct reactor *reactor)
+{
+	int err;
+
+	if ((err = thread_new(&reactor->thread)) < 0) {
+		log_error("thread_new: %s", strerror(-err));
+		return err;
+	}
+
+	if ((err = thread_start(reactor->thread, (void*(*)(void*))_xim_server_run, reactor)) < 0) {
+		log_error("thread_start: %s", strerror(-err));
+		thread_free(&reactor->thread);
+	}
+
+	return err;
+}
+
 int xim_server_start(xim_server_t *server)
 {
+	int err;
+	int i;
+
+	if (!server) {
+		return -EINVAL;
+	}
+
+	for (err = i = 0; !err && i < server->num_reactors; i++) {
+		err = _reactor_start(&server->reactors[i]);
+	}
+
+	return err;
+}
+
+/*
+ * Like xim_server_start(), but the first reactor runs in the calling thread.
+ * Returns when the server was stopped.
+ */
+int xim_server_run(xim_server_t *server)
+{
+	int err;
+	int i;
+
 	if (!server) {
 		return -EINVAL;
 	}
 
-	return thread_start(server->thread, (void*(*)(void*))_xim_server_run, server);
+	for (err = 0, i = 1; !err && i < server->num_reactors; i++) {
+		err = _reactor_start(&server->reactors[i]);
+	}
+
+	if (!err) {
+		_xim_server_run(&server->reactors[0]);
+	}
+
+	return err;
 }
 
+/*
+ * Makes all reactors leave their event loops and waits for their threads.
+ * May be called from a reactor, which then returns after the current pass.
+ */
 int xim_server_stop(xim_server_t *server)
 {
+	int err;
+	int i;
+
 	if (!server) {
 		return -EINVAL;
 	}
 
-	if (!server->thread) {
-		return -EBADFD;
+	for (err = i = 0; i < server->num_reactors; i++) {
+		int wake_err;
+
+		__atomic_store_n(&server->reactors[i].stop, 1, __ATOMIC_RELEASE);
+
+		if ((wake_err = xim_server_wake(&server->reactors[i])) < 0 && !err) {
+			err = wake_err;
+		}
 	}
 
-	return thread_stop(server->thread);
+	for (i = 0; i < server->num_reactors; i++) {
+		struct reactor *reactor;
+		thread_t *thread;
+
+		reactor = &server->reactors[i];
+
+		/* a reactor can't wait for itself, its thread is joined when it's freed */
+		if (reactor == _current_reactor) {
+			continue;
+		}
+
+		/* each thread is joined by only one of the threads that stop the server */
+		if ((thread = __atomic_exchange_n(&reactor->thread, NULL, __ATOMIC_ACQ_REL))) {
+			thread_free(&thread);
+		}
+	}
+
+	return err;
 }
@@ -21,12 +21,30 @@
 #ifndef XIMSERVER_H
 #define XIMSERVER_H
 
+#include "fd.h"
+
 typedef struct xim_server xim_server_t;
+typedef struct reactor xim_reactor_t;
+
+/* Upper limit for the number of event loop threads */
+#define XIM_SERVER_REACTOR_MAX 64
 
-int xim_server_init(xim_server_t **server, const char *address, unsigned short port);
+int xim_server_init(xim_server_t **server, const int num_reactors);
 int xim_server_free(xim_server_t **server);
 
+/* A backlog of 0 or less selects the system default */
+int xim_server_listen_tcp(xim_server_t *server, const char *address, unsigned short port,
+                          const int backlog);
+int xim_server_listen_local(xim_server_t *server, const char *path, const int backlog);
+
+/* Watches an fd that isn't a client, see ximserver.c */
+int xim_server_watch(xim_server_t *server, fd_t *fd);
+
+xim_reactor_t *xim_server_get_reactor(void);
+int xim_server_wake(xim_reactor_t *reactor);
+
 int xim_server_start(xim_server_t *server);
+int xim_server_run(xim_server_t *server);
 int xim_server_stop(xim_server_t *server);
 
 #endif /* XIMSERVER_H */
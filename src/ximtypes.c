@@ -18,6 +18,7 @@
  * Boston, MA 02111-1307, USA.
  */
 
+#include "arena.h"
 #include "ximtypes.h"
 #include <errno.h>
 #include <stdio.h>
@@ -48,44 +49,46 @@ struct XIMEXT {
 	uint8_t name[];
 } __attribute__((packed));
 
-int decode_STRING(char **dst, const uint8_t *src, const size_t src_len)
+struct XIMTRIGGERKEY {
+	uint32_t keysym;
+	uint32_t modifier;
+	uint32_t modifier_mask;
+} __attribute__((packed));
+
+int decode_STRING(char **dst, const uint8_t *src, const size_t src_len, arena_t *arena)
 {
 	struct XIMSTRING *raw;
-        char *parsed;
-        size_t len;
-        int parsed_len;
-        int padded_len;
-
-        if (src_len < sizeof(*raw)) {
-                return -ENOMSG;
-        }
-        raw = (struct XIMSTRING*)src;
-
-        if (src_len < (sizeof(*raw) + raw->len)) {
-	        return -EBADMSG;
-        }
-        len = raw->len + 1;
-
-        if (!(parsed = malloc(len))) {
-                return -ENOMEM;
-        }
-
-        snprintf(parsed, len, "%s", raw->data);
-        parsed_len = sizeof(*raw) + raw->len;
-        padded_len = parsed_len + PAD(parsed_len);
-
-        *dst = parsed;
-        return padded_len;
+	char *parsed;
+	int parsed_len;
+	int padded_len;
+
+	if (src_len < sizeof(*raw)) {
+		return -ENOMSG;
+	}
+	raw = (struct XIMSTRING*)src;
+
+	if (src_len < (sizeof(*raw) + raw->len)) {
+		return -EBADMSG;
+	}
+
+	if (!(parsed = arena_strndup(arena, raw->data, raw->len))) {
+		return -ENOMEM;
+	}
+
+	parsed_len = sizeof(*raw) + raw->len;
+	padded_len = parsed_len + PAD(parsed_len);
+
+	*dst = parsed;
+	return padded_len;
 }
 
-int decode_STR(char **dst, const uint8_t *src, const size_t src_len)
+int decode_STR(char **dst, const uint8_t *src, const size_t src_len, arena_t *arena)
 {
 	struct {
 		uint8_t len;
 		char data[];
 	} __attribute__((packed)) *raw;
 	char *parsed;
-	size_t len;
 	int parsed_len;
 
 	if (src_len < sizeof(*raw)) {
@@ -96,20 +99,18 @@ int decode_STR(char **dst, const uint8_t *src, const size_t src_len)
 	if (src_len < (sizeof(*raw) + raw->len)) {
 		return -EBADMSG;
 	}
-	len = raw->len + 1;
 
-	if (!(parsed = malloc(len))) {
+	if (!(parsed = arena_strndup(arena, raw->data, raw->len))) {
 		return -ENOMEM;
 	}
 
-	snprintf(parsed, len, "%s", raw->data);
 	parsed_len = sizeof(*raw) + raw->len;
 
 	*dst = parsed;
 	return parsed_len;
 }
 
-int decode_ATTR(attr_t **dst, const uint8_t *src, const size_t src_len)
+int decode_ATTR(attr_t **dst, const uint8_t *src, const size_t src_len, arena_t *arena)
 {
 	struct XIMATTR *raw;
 	attr_t *attr;
@@ -123,16 +124,16 @@ int decode_ATTR(attr_t **dst, const uint8_t *src, const size_t src_len)
 
 	raw = (struct XIMATTR*)src;
 
-	if (!(attr = calloc(1, sizeof(*attr)))) {
+	if (!(attr = arena_calloc(arena, 1, sizeof(*attr)))) {
 		return -ENOMEM;
 	}
 
 	attr->id = raw->id;
 	attr->type = raw->type;
-	string_len = decode_STRING(&attr->name, (uint8_t*)&raw->string, src_len - sizeof(*raw));
+	string_len = decode_STRING(&attr->name, (uint8_t*)&raw->string,
+	                           src_len - sizeof(*raw), arena);
 
 	if (string_len < 0) {
-		free(attr);
 		return -ENOMSG;
 	}
 
@@ -143,7 +144,7 @@ int decode_ATTR(attr_t **dst, const uint8_t *src, const size_t src_len)
 	return padded_len;
 }
 
-int decode_ATTRIBUTE(attr_value_t **dst, const uint8_t *src, const size_t src_len)
+int decode_ATTRIBUTE(attr_value_t **dst, const uint8_t *src, const size_t src_len, arena_t *arena)
 {
 	struct XIMATTRIBUTE *raw;
 	attr_value_t *attr;
@@ -160,19 +161,15 @@ int decode_ATTRIBUTE(attr_value_t **dst, const uint8_t *src, const size_t src_le
 		return -EBADMSG;
 	}
 
-	if (!(attr = calloc(1, sizeof(*attr)))) {
+	if (!(attr = arena_calloc(arena, 1, sizeof(*attr)))) {
 		return -ENOMEM;
 	}
 
+	/* the value is not copied, it points into the received message */
 	attr->id = raw->id;
 	attr->len = raw->data_len;
+	attr->data = raw->data;
 
-	if (!(attr->data = malloc(raw->data_len))) {
-		free(attr);
-		return -ENOMEM;
-	}
-
-	memcpy(attr->data, raw->data, attr->len);
 	decoded_len = sizeof(*raw) + attr->len;
 	padded_len = decoded_len + PAD(decoded_len);
 
@@ -228,7 +225,7 @@ int encode_ATTR(const attr_t *src, uint8_t *dst, const size_t dst_size)
 	raw->id = src->id;
 	raw->type = src->type;
 	encode_STRING(src->name, (uint8_t*)(raw + 1), dst_size - sizeof(*raw));
-	memset(raw + raw_len, 0, padding_len);
+	memset(dst + raw_len, 0, padding_len);
 
 	return (int)padded_len;
 }
@@ -284,6 +281,22 @@ int encode_EXT(const ext_t *src, uint8_t *dst, const size_t dst_size)
 	return sizeof(*raw) + name_len;
 }
 
+int encode_TRIGGERKEY(const trigger_key_t *src, uint8_t *dst, const size_t dst_size)
+{
+	struct XIMTRIGGERKEY *raw;
+
+	if (dst_size < sizeof(*raw)) {
+		return -ENOMEM;
+	}
+
+	raw = (struct XIMTRIGGERKEY*)dst;
+	raw->keysym = src->keysym;
+	raw->modifier = src->modifier;
+	raw->modifier_mask = src->modifier_mask;
+
+	return sizeof(*raw);
+}
+
 static int _count_attributes(const uint8_t *list, const size_t list_len)
 {
 	struct XIMATTRIBUTE *attribute;
@@ -294,15 +307,23 @@ static int _count_attributes(const uint8_t *list, const size_t list_len)
 	num_attributes = 0;
 
 	while (offset < list_len) {
+		size_t attribute_len;
+
+		if (list_len - offset < sizeof(*attribute)) {
+			return -EBADMSG;
+		}
+
 		attribute = (struct XIMATTRIBUTE*)(list + offset);
 		num_attributes++;
-		offset += sizeof(*attribute) + attribute->data_len;
+		attribute_len = sizeof(*attribute) + attribute->data_len;
+		offset += attribute_len + PAD(attribute_len);
 	}
 
 	return num_attributes;
 }
 
-int decode_LISTofATTRIBUTE(attr_value_t ***dst, const void *src, const size_t src_len)
+int decode_LISTofATTRIBUTE(attr_value_t ***dst, const void *src, const size_t src_len,
+                           arena_t *arena)
 {
 	attr_value_t **attributes;
 	int num_attributes;
@@ -313,7 +334,7 @@ int decode_LISTofATTRIBUTE(attr_value_t ***dst, const void *src, const size_t sr
 		return num_attributes;
 	}
 
-	if (!(attributes = calloc(num_attributes + 1, sizeof(attr_value_t*)))) {
+	if (!(attributes = arena_calloc(arena, num_attributes + 1, sizeof(attr_value_t*)))) {
 		return -ENOMEM;
 	}
 
@@ -322,24 +343,15 @@ int decode_LISTofATTRIBUTE(attr_value_t ***dst, const void *src, const size_t sr
 
 		if ((attribute_len = decode_ATTRIBUTE(&attributes[i],
 		                                      src + parsed_len,
-		                                      src_len - parsed_len)) < 0) {
-			break;
+		                                      src_len - parsed_len,
+		                                      arena)) < 0) {
+			/* did not decode all attributes */
+			return -EBADMSG;
 		}
 
 		parsed_len += attribute_len;
 	}
 
-	if (i != num_attributes) {
-		/* did not decode all attributes */
-
-		while (i >= 0) {
-			free(attributes[i--]);
-		}
-		free(attributes);
-
-		return -EBADMSG;
-	}
-
 	*dst = attributes;
 	return parsed_len;
 }
@@ -21,6 +21,7 @@
 #ifndef XIMTYPES_H
 #define XIMTYPES_H
 
+#include "arena.h"
 #include <stdint.h>
 #include <sys/types.h>
 
@@ -51,16 +52,29 @@ typedef struct {
 	char *name;
 } ext_t;
 
-int decode_STRING(char **dst, const uint8_t *src, const size_t src_len);
-int decode_STR(char **dst, const uint8_t *src, const size_t src_len);
-int decode_ATTR(attr_t **attr, const uint8_t *src, const size_t src_len);
-int decode_ATTRIBUTE(attr_value_t **val, const uint8_t *src, const size_t src_len);
-int decode_LISTofATTRIBUTE(attr_value_t ***dst, const void *src, const size_t src_len);
+typedef struct {
+	uint32_t keysym;
+	uint32_t modifier;
+	uint32_t modifier_mask;
+} trigger_key_t;
+
+/*
+ * Decoded data is allocated from the arena and is only valid until the
+ * arena is reset. Attribute values point into the source buffer.
+ */
+int decode_STRING(char **dst, const uint8_t *src, const size_t src_len, arena_t *arena);
+int decode_STR(char **dst, const uint8_t *src, const size_t src_len, arena_t *arena);
+int decode_ATTR(attr_t **attr, const uint8_t *src, const size_t src_len, arena_t *arena);
+int decode_ATTRIBUTE(attr_value_t **val, const uint8_t *src, const size_t src_len,
+                     arena_t *arena);
+int decode_LISTofATTRIBUTE(attr_value_t ***dst, const void *src, const size_t src_len,
+                           arena_t *arena);
 
 int encode_STRING(const char *src, uint8_t *dst, const size_t dst_size);
 int encode_ATTR(const attr_t *src, uint8_t *dst, const size_t dst_size);
 int encode_ATTRIBUTE(const attr_value_t *src, uint8_t *dst, const size_t dst_size);
 int encode_EXT(const ext_t *src, uint8_t *dst, const size_t dst_size);
+int encode_TRIGGERKEY(const trigger_key_t *src, uint8_t *dst, const size_t dst_size);
 
 #define decode_ENCODINGINFO decode_STRING
 